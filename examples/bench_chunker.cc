@@ -0,0 +1,191 @@
+// 内容定义分块(FastCDC)吞吐量与去重率基准测试
+// 生成随机数据作为"旧版本"，再在随机位置插入、删除、覆盖若干小段得到"新版本"，
+// 测试 Util::GearChunker 的切块速度(GB/s)、平均分块长度，以及新版本相对旧版本可复用的数据比例，
+// 结果为JSON，便于做回归对比
+//
+// 编译: cd src && make bench_chunker
+// 用法: ./bench_chunker [-s 256M] [-a 1M] [-e 16] [-r 3] [-o result.json]
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <string>
+#include <unordered_set>
+#include <unistd.h>
+#include "util.hpp"
+#include "chunker.hpp"
+
+struct Options
+{
+    size_t size = 256 << 20; // 语料大小
+    size_t avg = 1 << 20;    // 平均分块长度
+    int edits = 16;          // 新版本相对旧版本的修改次数
+    int repeat = 3;
+    std::string output; // 为空则输出到标准输出
+};
+
+void usage()
+{
+    std::cout << "-------- USAGE --------" << std::endl;
+    std::cout << "./bench_chunker [-s size] [-a avg_chunk] [-e edits] [-r repeat] [-o result.json]" << std::endl;
+}
+
+size_t parseSize(const std::string &str)
+{
+    size_t n = std::stoul(str);
+    switch (str.back())
+    {
+    case 'K': case 'k': return n << 10;
+    case 'M': case 'm': return n << 20;
+    case 'G': case 'g': return n << 30;
+    default: return n;
+    }
+}
+
+bool parseOptions(int argc, char *argv[], Options *opt)
+{
+    int c;
+    while ((c = getopt(argc, argv, "s:a:e:r:o:h")) != -1)
+    {
+        switch (c)
+        {
+        case 's':
+            opt->size = parseSize(optarg);
+            break;
+        case 'a':
+            opt->avg = parseSize(optarg);
+            break;
+        case 'e':
+            opt->edits = std::max(0, atoi(optarg));
+            break;
+        case 'r':
+            opt->repeat = std::max(1, atoi(optarg));
+            break;
+        case 'o':
+            opt->output = optarg;
+            break;
+        default:
+            return false;
+        }
+    }
+    return opt->avg >= 256;
+}
+
+std::string genRandom(size_t size, std::mt19937_64 &rng)
+{
+    std::string out(size, '\0');
+    for (size_t i = 0; i < size; i += 8)
+    {
+        uint64_t v = rng();
+        memcpy(&out[i], &v, std::min<size_t>(8, size - i));
+    }
+    return out;
+}
+
+// 在随机位置插入、删除或覆盖一小段数据
+std::string genModified(const std::string &input, int edits, std::mt19937_64 &rng)
+{
+    std::string out = input;
+    for (int i = 0; i < edits; i++)
+    {
+        size_t pos = rng() % out.size();
+        size_t len = 1 + rng() % 4096;
+        switch (rng() % 3)
+        {
+        case 0:
+            out.insert(pos, genRandom(len, rng));
+            break;
+        case 1:
+            out.erase(pos, len);
+            break;
+        default:
+        {
+            std::string patch = genRandom(len, rng);
+            out.replace(pos, std::min(len, out.size() - pos), patch);
+            break;
+        }
+        }
+    }
+    return out;
+}
+
+template <typename F>
+double timeit(F &&f)
+{
+    auto begin = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - begin).count();
+}
+
+// 切块，返回各分块的 (起始偏移, 长度)
+std::vector<std::pair<size_t, size_t>> chunkAll(const Util::GearChunker &chunker, const std::string &data)
+{
+    std::vector<std::pair<size_t, size_t>> chunks;
+    const uint8_t *p = (const uint8_t *)data.data();
+    for (size_t off = 0; off < data.size();)
+    {
+        size_t n = chunker.cut(p + off, data.size() - off);
+        chunks.emplace_back(off, n);
+        off += n;
+    }
+    return chunks;
+}
+
+std::string chunkHash(const std::string &data, size_t off, size_t len)
+{
+    Util::Hasher hasher;
+    hasher.update(data.data() + off, len);
+    return hasher.hexdigest();
+}
+
+int main(int argc, char *argv[])
+{
+    Options opt;
+    if (!parseOptions(argc, argv, &opt))
+    {
+        usage();
+        return -1;
+    }
+
+    std::mt19937_64 rng(42); // 固定种子，保证每次运行语料一致
+    std::string base = genRandom(opt.size, rng);
+    std::string modified = genModified(base, opt.edits, rng);
+    Util::GearChunker chunker(opt.avg / 4, opt.avg, opt.avg * 4);
+
+    // 1.切块吞吐量：取多次运行中最快的一次
+    std::vector<std::pair<size_t, size_t>> chunks;
+    double sec = 1e30;
+    for (int i = 0; i < opt.repeat; i++)
+        sec = std::min(sec, timeit([&] { chunks = chunkAll(chunker, base); }));
+
+    // 2.去重率：新版本的分块中，内容已在旧版本中出现过的数据量占比
+    std::unordered_set<std::string> known;
+    for (auto &[off, len] : chunks)
+        known.insert(chunkHash(base, off, len));
+    size_t reused = 0;
+    auto newChunks = chunkAll(chunker, modified);
+    for (auto &[off, len] : newChunks)
+    {
+        if (known.count(chunkHash(modified, off, len)))
+            reused += len;
+    }
+
+    Json::Value root;
+    root["size"] = (Json::UInt64)opt.size;
+    root["avg_chunk"] = (Json::UInt64)opt.avg;
+    root["edits"] = opt.edits;
+    root["repeat"] = opt.repeat;
+    root["chunk_gbps"] = sec > 0 ? opt.size / (1024.0 * 1024.0 * 1024.0) / sec : 0;
+    root["chunks"] = (Json::UInt64)chunks.size();
+    root["mean_chunk"] = chunks.empty() ? 0 : (double)opt.size / chunks.size();
+    root["modified_chunks"] = (Json::UInt64)newChunks.size();
+    root["reused_ratio"] = modified.empty() ? 0 : (double)reused / modified.size();
+
+    std::string str;
+    Util::JsonUtil::serialize(root, &str);
+    if (opt.output.empty())
+        std::cout << str << std::endl;
+    else
+        Util::FileUtil(opt.output).setContent(str);
+    return 0;
+}
@@ -0,0 +1,342 @@
+// 压缩/解压吞吐量基准测试
+// 生成不同类型(文本、日志、二进制、随机、类媒体)与不同大小的语料，
+// 分别测试 bundle 各压缩算法以及 Util::FileUtil::compress/uncompress 整条链路，
+// 输出每个组合的 压缩/解压速度(MB/s)、压缩率、峰值内存，结果为JSON，便于做回归对比
+//
+// 编译: cd src && make bench
+// 用法: ./bench [-s 64K,1M,16M] [-c LZ4F,MINIZ,LZIP,ZSTD] [-r 3] [-o result.json]
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "util.hpp"
+#include "bundle.h"
+
+struct Options
+{
+    std::vector<size_t> sizes = {64 << 10, 1 << 20, 16 << 20};
+    std::vector<unsigned> codecs = {bundle::LZ4F, bundle::MINIZ, bundle::LZIP, bundle::ZSTD, bundle::BROTLI9, bundle::LZMA20};
+    int repeat = 3;
+    std::string output; // 为空则输出到标准输出
+};
+
+void usage()
+{
+    std::cout << "-------- USAGE --------" << std::endl;
+    std::cout << "./bench [-s 64K,1M,16M] [-c LZ4F,MINIZ,LZIP,ZSTD] [-r repeat] [-o result.json]" << std::endl;
+}
+
+std::vector<std::string> split(const std::string &str, char sep)
+{
+    std::vector<std::string> array;
+    std::istringstream iss(str);
+    std::string item;
+    while (std::getline(iss, item, sep))
+    {
+        if (!item.empty())
+            array.push_back(item);
+    }
+    return array;
+}
+
+size_t parseSize(const std::string &str)
+{
+    size_t n = std::stoul(str);
+    switch (str.back())
+    {
+    case 'K': case 'k': return n << 10;
+    case 'M': case 'm': return n << 20;
+    case 'G': case 'g': return n << 30;
+    default: return n;
+    }
+}
+
+bool parseCodec(const std::string &name, unsigned *q)
+{
+    for (unsigned i = 0; i <= bundle::BZIP2; i++)
+    {
+        if (name == bundle::name_of(i))
+        {
+            *q = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parseOptions(int argc, char *argv[], Options *opt)
+{
+    int c;
+    while ((c = getopt(argc, argv, "s:c:r:o:h")) != -1)
+    {
+        switch (c)
+        {
+        case 's':
+            opt->sizes.clear();
+            for (auto &s : split(optarg, ','))
+                opt->sizes.push_back(parseSize(s));
+            break;
+        case 'c':
+            opt->codecs.clear();
+            for (auto &s : split(optarg, ','))
+            {
+                unsigned q;
+                if (!parseCodec(s, &q))
+                {
+                    std::cerr << "未知的压缩算法: " << s << std::endl;
+                    return false;
+                }
+                opt->codecs.push_back(q);
+            }
+            break;
+        case 'r':
+            opt->repeat = std::max(1, atoi(optarg));
+            break;
+        case 'o':
+            opt->output = optarg;
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+// ---------------- 语料生成 ----------------
+
+std::string genText(size_t size, std::mt19937_64 &rng)
+{
+    // 词频近似Zipf分布的英文文本
+    static const std::vector<std::string> words = {
+        "the", "of", "and", "to", "in", "a", "is", "that", "for", "it", "as", "was", "with", "be", "by",
+        "on", "not", "he", "this", "are", "or", "his", "from", "at", "which", "but", "have", "an", "had",
+        "they", "you", "were", "their", "one", "all", "we", "can", "her", "has", "there", "been", "if",
+        "more", "when", "will", "would", "who", "so", "no", "backup", "server", "file", "compress", "cloud"};
+    std::string out;
+    out.reserve(size + 64);
+    size_t sentence = 0;
+    while (out.size() < size)
+    {
+        double r = std::uniform_real_distribution<double>(0, 1)(rng);
+        size_t idx = (size_t)(words.size() * r * r * r);
+        out += words[std::min(idx, words.size() - 1)];
+        if (++sentence % 12 == 0)
+            out += ".\n";
+        else
+            out += ' ';
+    }
+    out.resize(size);
+    return out;
+}
+
+std::string genLogs(size_t size, std::mt19937_64 &rng)
+{
+    static const char *levels[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+    static const char *paths[] = {"/download/a.txt", "/upload", "/file-list", "/list", "/download/report.pdf"};
+    std::string out;
+    out.reserve(size + 256);
+    time_t ts = 1700000000;
+    char line[256];
+    while (out.size() < size)
+    {
+        ts += rng() % 3;
+        int n = snprintf(line, sizeof(line), "[%ld][%s][service.hpp:%u] 192.168.%u.%u GET %s %u %lu us\n",
+                         (long)ts, levels[rng() % 4], (unsigned)(rng() % 300),
+                         (unsigned)(rng() % 256), (unsigned)(rng() % 256),
+                         paths[rng() % 5], rng() % 2 ? 200u : 404u, (unsigned long)(rng() % 100000));
+        out.append(line, n);
+    }
+    out.resize(size);
+    return out;
+}
+
+std::string genBinary(size_t size, std::mt19937_64 &rng)
+{
+    // 类似可执行文件/数据库页：定长结构体，小整数、指针、填充0较多
+    std::string out(size, '\0');
+    uint64_t base = 0x400000;
+    for (size_t i = 0; i + 32 <= size; i += 32)
+    {
+        uint32_t id = (uint32_t)(i / 32);
+        uint32_t flag = rng() % 4;
+        uint64_t ptr = base + (rng() % 4096) * 16;
+        uint64_t val = rng() % 1000;
+        memcpy(&out[i], &id, 4);
+        memcpy(&out[i + 4], &flag, 4);
+        memcpy(&out[i + 8], &ptr, 8);
+        memcpy(&out[i + 16], &val, 8);
+    }
+    return out;
+}
+
+std::string genRandom(size_t size, std::mt19937_64 &rng)
+{
+    std::string out(size, '\0');
+    for (size_t i = 0; i < size; i += 8)
+    {
+        uint64_t v = rng();
+        memcpy(&out[i], &v, std::min<size_t>(8, size - i));
+    }
+    return out;
+}
+
+std::string genMedia(size_t size, std::mt19937_64 &rng)
+{
+    // 类媒体文件：已压缩的高熵帧数据，每4K带一个固定格式的帧头
+    std::string out = genRandom(size, rng);
+    for (size_t i = 0, frame = 0; i + 16 <= size; i += 4096, frame++)
+    {
+        memcpy(&out[i], "\x00\x00\x01\xb3" "FRAM", 8);
+        memcpy(&out[i + 8], &frame, 8);
+    }
+    return out;
+}
+
+// ---------------- 测量 ----------------
+
+// 将进程的峰值内存(VmHWM)重置为当前内存
+void resetPeakRSS()
+{
+    std::ofstream ofs("/proc/self/clear_refs");
+    ofs << "5";
+}
+
+// 读取进程的峰值内存(KB)
+long peakRSS()
+{
+    std::ifstream ifs("/proc/self/status");
+    std::string line;
+    while (std::getline(ifs, line))
+    {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+            return atol(line.c_str() + 6);
+    }
+    return -1;
+}
+
+template <typename F>
+double timeit(F &&f)
+{
+    auto begin = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - begin).count();
+}
+
+double mbps(size_t bytes, double sec)
+{
+    return sec > 0 ? bytes / (1024.0 * 1024.0) / sec : 0;
+}
+
+Json::Value benchCodec(unsigned q, const std::string &input, int repeat)
+{
+    std::string packed, unpacked;
+    double packSec = 1e30, unpackSec = 1e30;
+
+    resetPeakRSS();
+    for (int i = 0; i < repeat; i++)
+        packSec = std::min(packSec, timeit([&] { packed = bundle::pack(q, input); }));
+    long packRSS = peakRSS();
+
+    resetPeakRSS();
+    for (int i = 0; i < repeat; i++)
+        unpackSec = std::min(unpackSec, timeit([&] { unpacked = bundle::unpack(packed); }));
+    long unpackRSS = peakRSS();
+
+    Json::Value item;
+    item["codec"] = bundle::name_of(q);
+    item["compress_mbps"] = mbps(input.size(), packSec);
+    item["uncompress_mbps"] = mbps(input.size(), unpackSec);
+    item["ratio"] = input.empty() ? 0 : (double)packed.size() / input.size();
+    item["packed_size"] = (Json::UInt64)packed.size();
+    item["compress_peak_rss_kb"] = (Json::Int64)packRSS;
+    item["uncompress_peak_rss_kb"] = (Json::Int64)unpackRSS;
+    item["roundtrip_ok"] = (unpacked == input);
+    return item;
+}
+
+// 测试服务端实际使用的 FileUtil::compress/uncompress（含文件读写与落盘）
+Json::Value benchFileUtil(const std::string &input, int repeat)
+{
+    std::string dir = "./bench_tmp/";
+    Util::FileUtil(dir).createDirectory();
+    std::string src = dir + "corpus", pack = dir + "corpus.lz", out = dir + "corpus.out";
+    Util::FileUtil(src).setContent(input);
+
+    double packSec = 1e30, unpackSec = 1e30;
+    resetPeakRSS();
+    for (int i = 0; i < repeat; i++)
+        packSec = std::min(packSec, timeit([&] { Util::FileUtil(src).compress(pack); }));
+    long packRSS = peakRSS();
+
+    resetPeakRSS();
+    for (int i = 0; i < repeat; i++)
+        unpackSec = std::min(unpackSec, timeit([&] { Util::FileUtil(pack).uncompress(out); }));
+    long unpackRSS = peakRSS();
+
+    std::string result;
+    Util::FileUtil(out).getContent(result);
+
+    Json::Value item;
+    item["codec"] = "FileUtil(LZIP)";
+    item["compress_mbps"] = mbps(input.size(), packSec);
+    item["uncompress_mbps"] = mbps(input.size(), unpackSec);
+    item["ratio"] = input.empty() ? 0 : (double)Util::FileUtil(pack).fileSize() / input.size();
+    item["packed_size"] = (Json::UInt64)Util::FileUtil(pack).fileSize();
+    item["compress_peak_rss_kb"] = (Json::Int64)packRSS;
+    item["uncompress_peak_rss_kb"] = (Json::Int64)unpackRSS;
+    item["roundtrip_ok"] = (result == input);
+
+    Util::fs::remove_all(dir);
+    return item;
+}
+
+int main(int argc, char *argv[])
+{
+    Options opt;
+    if (!parseOptions(argc, argv, &opt))
+    {
+        usage();
+        return -1;
+    }
+
+    using Generator = std::string (*)(size_t, std::mt19937_64 &);
+    std::vector<std::pair<std::string, Generator>> corpora = {
+        {"text", genText}, {"logs", genLogs}, {"binary", genBinary}, {"random", genRandom}, {"media", genMedia}};
+
+    Json::Value root;
+    root["repeat"] = opt.repeat;
+    for (auto &[name, gen] : corpora)
+    {
+        for (size_t size : opt.sizes)
+        {
+            std::mt19937_64 rng(42); // 固定种子，保证每次运行语料一致
+            std::string input = gen(size, rng);
+            std::cerr << "corpus=" << name << " size=" << size << std::endl;
+
+            for (unsigned q : opt.codecs)
+            {
+                Json::Value item = benchCodec(q, input, opt.repeat);
+                item["corpus"] = name;
+                item["size"] = (Json::UInt64)size;
+                root["results"].append(item);
+            }
+            Json::Value item = benchFileUtil(input, opt.repeat);
+            item["corpus"] = name;
+            item["size"] = (Json::UInt64)size;
+            root["results"].append(item);
+        }
+    }
+
+    std::string str;
+    Util::JsonUtil::serialize(root, &str);
+    if (opt.output.empty())
+        std::cout << str << std::endl;
+    else
+        Util::FileUtil(opt.output).setContent(str);
+    return 0;
+}
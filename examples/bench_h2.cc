@@ -0,0 +1,560 @@
+// 大量小文件传输基准测试：HTTP/1.1 与 HTTP/2(h2c) 对比
+// 对运行中的服务端(server_mode 为 epoll，h2c 开启)：
+//   1.准备：经 /upload-batch 分批上传 n 个小文件作为语料(内容由序号确定，可重复生成校验)
+//   2.上传：u 个小文件分别以三种方式经 /upload 上传
+//   3.下载：n 个语料文件分别以三种方式经 /download 下载并校验内容
+// 三种方式：http1: 一个keep-alive连接逐个请求；http1_conns: c 个keep-alive连接并发；
+//           h2: 一个HTTP/2连接上同时 k 个流
+// 输出各方式的耗时(ms)、每秒文件数与吞吐量(MB/s)，结果为JSON。测试时应关闭服务端的带宽整形
+//
+// 编译: cd src && make bench_h2
+// 用法: ./bench_h2 [-a 127.0.0.1:9090] [-n 100000] [-s 1024] [-u 1000] [-c 8] [-k 100] [-b 1000] [-S] [-o result.json]
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <unordered_map>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include "httplib.h"
+#include "h2.hpp"
+#include "util.hpp"
+
+ckflogs::Logger::Ptr _logger;
+
+struct Options
+{
+    std::string host = "127.0.0.1";
+    int port = 9090;
+    size_t count = 100000;  // 语料文件个数
+    size_t size = 1024;     // 每个文件的长度
+    size_t uploads = 1000;  // 上传阶段的文件个数(每次上传都会持久化备份信息表，语料大时上传较慢)
+    size_t conns = 8;       // http1_conns 的连接个数
+    size_t streams = 100;   // h2 同时进行的流个数
+    size_t batch = 1000;    // 准备语料时每批上传的文件个数
+    bool skip_setup = false; // 语料已存在时跳过准备
+    std::string output;     // 为空则输出到标准输出
+};
+
+void usage()
+{
+    std::cout << "-------- USAGE --------" << std::endl;
+    std::cout << "./bench_h2 [-a host:port] [-n count] [-s size] [-u uploads] [-c conns] [-k streams] [-b batch] [-S] [-o result.json]" << std::endl;
+}
+
+bool parseOptions(int argc, char *argv[], Options *opt)
+{
+    int c;
+    while ((c = getopt(argc, argv, "a:n:s:u:c:k:b:So:h")) != -1)
+    {
+        switch (c)
+        {
+        case 'a':
+        {
+            std::string addr = optarg;
+            size_t pos = addr.rfind(':');
+            if (pos == std::string::npos)
+                return false;
+            opt->host = addr.substr(0, pos);
+            opt->port = atoi(addr.c_str() + pos + 1);
+            break;
+        }
+        case 'n':
+            opt->count = std::stoul(optarg);
+            break;
+        case 's':
+            opt->size = std::stoul(optarg);
+            break;
+        case 'u':
+            opt->uploads = std::stoul(optarg);
+            break;
+        case 'c':
+            opt->conns = std::max(1ul, std::stoul(optarg));
+            break;
+        case 'k':
+            opt->streams = std::max(1ul, std::stoul(optarg));
+            break;
+        case 'b':
+            opt->batch = std::max(1ul, std::stoul(optarg));
+            break;
+        case 'S':
+            opt->skip_setup = true;
+            break;
+        case 'o':
+            opt->output = optarg;
+            break;
+        default:
+            return false;
+        }
+    }
+    return opt->count > 0 && opt->size > 0;
+}
+
+// 文件内容由名称确定，下载时重新生成以校验
+std::string contentOf(const std::string &name, size_t size)
+{
+    std::mt19937_64 rng(std::hash<std::string>()(name));
+    std::string data(size, '\0');
+    for (auto &c : data)
+        c = 'a' + rng() % 26;
+    return data;
+}
+
+std::string corpusName(size_t i) { return "h2bench_" + std::to_string(i) + ".txt"; }
+
+struct Request
+{
+    std::string method;
+    std::string path;
+    std::string body;
+};
+using Callback = std::function<void(size_t index, int status, const std::string &body)>;
+
+// 阻塞套接字上的最小HTTP/2客户端：同时保持最多 k 个流，响应到达后立即发起下一个请求
+class H2Client
+{
+public:
+    ~H2Client()
+    {
+        if (_fd >= 0)
+            close(_fd);
+    }
+    bool connect(const std::string &host, int port);
+    bool run(const std::vector<Request> &requests, size_t streams, const Callback &cb); // 返回false表示连接出错
+
+private:
+    struct Stream
+    {
+        size_t index;
+        int status = 0;
+        std::string body;
+        size_t unacked = 0;
+        std::string pending; // 受流量控制未能发送的请求体
+        int64_t window;
+    };
+    void submit(size_t index, const Request &req);
+    void sendPending();
+    bool flush();
+    bool readFrame(Cloud::H2::FrameHeader *fh, std::string *payload);
+
+private:
+    static const uint32_t recv_window = 16 << 20;
+    int _fd = -1;
+    std::string _host;
+    std::string _out;
+    Cloud::HpackEncoder _encoder;
+    Cloud::HpackDecoder _decoder;
+    uint32_t _next_id = 1;
+    std::unordered_map<uint32_t, Stream> _streams;
+    std::vector<uint32_t> _blocked; // 请求体未发送完的流
+    int64_t _send_window = Cloud::H2::default_window;
+    int64_t _peer_window = Cloud::H2::default_window;
+    size_t _peer_frame = Cloud::H2::default_frame_size;
+    size_t _unacked = 0;
+    std::string _buf;
+};
+
+bool H2Client::connect(const std::string &host, int port)
+{
+    addrinfo hints{}, *res = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0)
+        return false;
+    _fd = socket(AF_INET, SOCK_STREAM, 0);
+    bool ok = ::connect(_fd, res->ai_addr, res->ai_addrlen) == 0;
+    freeaddrinfo(res);
+    if (!ok)
+        return false;
+    int on = 1;
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    _host = host + ":" + std::to_string(port);
+    _out.assign(Cloud::H2::preface, Cloud::H2::preface_len);
+    Cloud::H2::appendSettings(&_out, {{Cloud::H2::SETTINGS_ENABLE_PUSH, 0},
+                                      {Cloud::H2::SETTINGS_INITIAL_WINDOW_SIZE, (uint32_t)recv_window}});
+    Cloud::H2::appendWindowUpdate(&_out, 0, recv_window - Cloud::H2::default_window);
+    return flush();
+}
+
+void H2Client::submit(size_t index, const Request &req)
+{
+    uint32_t id = _next_id;
+    _next_id += 2;
+    Cloud::HeaderList headers = {{":method", req.method}, {":scheme", "http"}, {":authority", _host}, {":path", req.path}};
+    if (!req.body.empty())
+        headers.emplace_back("content-length", std::to_string(req.body.size()));
+    std::string block;
+    _encoder.encode(headers, &block);
+    Cloud::H2::appendHeaders(&_out, id, block, req.body.empty(), _peer_frame);
+    Stream &s = _streams[id];
+    s.index = index;
+    s.window = _peer_window;
+    if (!req.body.empty())
+    {
+        s.pending = req.body;
+        _blocked.push_back(id);
+    }
+}
+
+void H2Client::sendPending()
+{
+    for (auto it = _blocked.begin(); it != _blocked.end();)
+    {
+        Stream &s = _streams[*it];
+        while (!s.pending.empty() && _send_window > 0 && s.window > 0)
+        {
+            size_t n = std::min({s.pending.size(), (size_t)_send_window, (size_t)s.window, _peer_frame});
+            bool end = n == s.pending.size();
+            Cloud::H2::appendFrame(&_out, Cloud::H2::DATA, end ? Cloud::H2::FLAG_END_STREAM : 0, *it, s.pending.data(), n);
+            s.pending.erase(0, n);
+            _send_window -= n;
+            s.window -= n;
+        }
+        it = s.pending.empty() ? _blocked.erase(it) : std::next(it);
+    }
+}
+
+bool H2Client::flush()
+{
+    size_t pos = 0;
+    while (pos < _out.size())
+    {
+        ssize_t n = send(_fd, _out.data() + pos, _out.size() - pos, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        pos += n;
+    }
+    _out.clear();
+    return true;
+}
+
+bool H2Client::readFrame(Cloud::H2::FrameHeader *fh, std::string *payload)
+{
+    char tmp[64 * 1024];
+    while (true)
+    {
+        if (_buf.size() >= Cloud::H2::frame_header_len)
+        {
+            *fh = Cloud::H2::parseFrameHeader(_buf.data());
+            if (_buf.size() >= Cloud::H2::frame_header_len + fh->length)
+            {
+                payload->assign(_buf, Cloud::H2::frame_header_len, fh->length);
+                _buf.erase(0, Cloud::H2::frame_header_len + fh->length);
+                return true;
+            }
+        }
+        ssize_t n = recv(_fd, tmp, sizeof(tmp), 0);
+        if (n <= 0)
+            return false;
+        _buf.append(tmp, n);
+    }
+}
+
+bool H2Client::run(const std::vector<Request> &requests, size_t streams, const Callback &cb)
+{
+    using namespace Cloud;
+    size_t next = 0, done = 0;
+    std::string payload, block;
+    uint32_t block_stream = 0;
+    while (done < requests.size())
+    {
+        while (next < requests.size() && _streams.size() < streams)
+        {
+            submit(next, requests[next]);
+            next++;
+        }
+        sendPending();
+        if (!flush())
+            return false;
+
+        H2::FrameHeader fh;
+        if (!readFrame(&fh, &payload))
+            return false;
+        auto it = _streams.find(fh.stream);
+        bool end = false;
+        switch (fh.type)
+        {
+        case H2::SETTINGS:
+            if (fh.flags & H2::FLAG_ACK)
+                break;
+            for (size_t i = 0; i + 6 <= payload.size(); i += 6)
+            {
+                uint16_t id = (uint8_t)payload[i] << 8 | (uint8_t)payload[i + 1];
+                uint32_t val = H2::readU32(payload.data() + i + 2);
+                if (id == H2::SETTINGS_INITIAL_WINDOW_SIZE)
+                {
+                    for (auto &[sid, s] : _streams)
+                        s.window += (int64_t)val - _peer_window;
+                    _peer_window = val;
+                }
+                else if (id == H2::SETTINGS_MAX_FRAME_SIZE)
+                    _peer_frame = val;
+                else if (id == H2::SETTINGS_MAX_CONCURRENT_STREAMS)
+                    streams = std::min<size_t>(streams, val);
+            }
+            H2::appendFrame(&_out, H2::SETTINGS, H2::FLAG_ACK, 0, nullptr, 0);
+            break;
+        case H2::PING:
+            if (!(fh.flags & H2::FLAG_ACK))
+                H2::appendFrame(&_out, H2::PING, H2::FLAG_ACK, 0, payload.data(), payload.size());
+            break;
+        case H2::WINDOW_UPDATE:
+            if (fh.stream == 0)
+                _send_window += H2::readU32(payload.data()) & 0x7fffffff;
+            else if (it != _streams.end())
+                it->second.window += H2::readU32(payload.data()) & 0x7fffffff;
+            break;
+        case H2::GOAWAY:
+            std::cerr << "GOAWAY error=" << H2::readU32(payload.data() + 4) << std::endl;
+            return false;
+        case H2::RST_STREAM:
+            if (it != _streams.end())
+            {
+                uint32_t err = H2::readU32(payload.data());
+                if (err == H2::ERR_NO_ERROR && it->second.status != 0)
+                    break; // 响应已完整，服务端不再接收请求体
+                cb(it->second.index, -(int)err, "");
+                _blocked.erase(std::remove(_blocked.begin(), _blocked.end(), fh.stream), _blocked.end());
+                _streams.erase(it);
+                done++;
+            }
+            break;
+        case H2::HEADERS:
+        case H2::CONTINUATION:
+        {
+            // 服务端不发送填充与优先级
+            if (fh.type == H2::HEADERS)
+            {
+                block.clear();
+                block_stream = fh.stream;
+            }
+            block += payload;
+            if (!(fh.flags & H2::FLAG_END_HEADERS))
+                break;
+            HeaderList headers;
+            if (!_decoder.decode(block.data(), block.size(), &headers))
+                return false;
+            it = _streams.find(block_stream);
+            if (it != _streams.end())
+            {
+                for (auto &[name, value] : headers)
+                {
+                    if (name == ":status")
+                        it->second.status = std::stoi(value);
+                }
+                end = fh.type == H2::HEADERS && (fh.flags & H2::FLAG_END_STREAM);
+            }
+            break;
+        }
+        case H2::DATA:
+            _unacked += fh.length;
+            if (_unacked >= recv_window / 2)
+            {
+                H2::appendWindowUpdate(&_out, 0, _unacked);
+                _unacked = 0;
+            }
+            if (it != _streams.end())
+            {
+                it->second.body += payload;
+                it->second.unacked += fh.length;
+                end = fh.flags & H2::FLAG_END_STREAM;
+                if (!end && it->second.unacked >= recv_window / 2)
+                {
+                    H2::appendWindowUpdate(&_out, fh.stream, it->second.unacked);
+                    it->second.unacked = 0;
+                }
+            }
+            break;
+        default:
+            break;
+        }
+        if (end && it != _streams.end())
+        {
+            cb(it->second.index, it->second.status, it->second.body);
+            _blocked.erase(std::remove(_blocked.begin(), _blocked.end(), it->first), _blocked.end());
+            _streams.erase(it);
+            done++;
+        }
+    }
+    return true;
+}
+
+struct Result
+{
+    double ms = 0;
+    size_t files = 0;
+    size_t bytes = 0;
+    size_t errors = 0; // 状态码不对或内容不一致的请求
+};
+
+template <typename F>
+double timeit(F &&f)
+{
+    auto begin = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - begin).count() * 1000;
+}
+
+// HTTP/1.1：conns 个keep-alive连接，各自逐个发送请求
+Result runHttp1(const Options &opt, const std::vector<Request> &requests, size_t conns,
+                const std::function<bool(size_t, int, const std::string &)> &check)
+{
+    Result r;
+    std::atomic<size_t> next(0), errors(0), bytes(0);
+    r.ms = timeit([&]
+                  {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < conns; t++)
+        {
+            threads.emplace_back([&]
+                                 {
+                httplib::Client cli(opt.host, opt.port);
+                cli.set_keep_alive(true);
+                size_t i;
+                while ((i = next++) < requests.size())
+                {
+                    auto &req = requests[i];
+                    auto res = req.method == "GET" ? cli.Get(req.path)
+                                                   : cli.Post(req.path, req.body, "application/octet-stream");
+                    if (!res || !check(i, res->status, res->body))
+                        errors++;
+                    else
+                        bytes += req.method == "GET" ? res->body.size() : req.body.size();
+                } });
+        }
+        for (auto &th : threads)
+            th.join(); });
+    r.files = requests.size();
+    r.errors = errors;
+    r.bytes = bytes;
+    return r;
+}
+
+// HTTP/2：一个连接上同时 streams 个流
+Result runH2(const Options &opt, const std::vector<Request> &requests,
+             const std::function<bool(size_t, int, const std::string &)> &check)
+{
+    Result r;
+    H2Client cli;
+    if (!cli.connect(opt.host, opt.port))
+    {
+        r.errors = requests.size();
+        return r;
+    }
+    size_t finished = 0;
+    r.ms = timeit([&]
+                  { cli.run(requests, opt.streams, [&](size_t i, int status, const std::string &body)
+                            {
+        finished++;
+        if (!check(i, status, body))
+            r.errors++;
+        else
+            r.bytes += requests[i].method == "GET" ? body.size() : requests[i].body.size(); }); });
+    r.files = requests.size();
+    r.errors += requests.size() - finished; // 连接出错时未完成的请求
+    return r;
+}
+
+bool setupCorpus(const Options &opt)
+{
+    httplib::Client cli(opt.host, opt.port);
+    cli.set_keep_alive(true);
+    cli.set_read_timeout(300, 0);
+    for (size_t begin = 0; begin < opt.count; begin += opt.batch)
+    {
+        httplib::MultipartFormDataItems items;
+        for (size_t i = begin; i < std::min(opt.count, begin + opt.batch); i++)
+            items.push_back({"file", contentOf(corpusName(i), opt.size), corpusName(i), "application/octet-stream"});
+        auto res = cli.Post("/upload-batch", items);
+        if (!res || res->status != 200)
+        {
+            std::cerr << "准备语料失败: " << (res ? std::to_string(res->status) : httplib::to_string(res.error())) << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+Json::Value toJson(const Result &r)
+{
+    Json::Value v;
+    v["ms"] = r.ms;
+    v["files"] = (Json::UInt64)r.files;
+    v["errors"] = (Json::UInt64)r.errors;
+    v["files_per_sec"] = r.ms > 0 ? r.files / (r.ms / 1000) : 0;
+    v["mbps"] = r.ms > 0 ? r.bytes / (1024.0 * 1024.0) / (r.ms / 1000) : 0;
+    return v;
+}
+
+int main(int argc, char *argv[])
+{
+    Options opt;
+    if (!parseOptions(argc, argv, &opt))
+    {
+        usage();
+        return -1;
+    }
+    double setup_ms = 0;
+    if (!opt.skip_setup)
+    {
+        bool ok = false;
+        setup_ms = timeit([&]
+                          { ok = setupCorpus(opt); });
+        if (!ok)
+            return 1;
+    }
+
+    Json::Value root;
+    root["count"] = (Json::UInt64)opt.count;
+    root["size"] = (Json::UInt64)opt.size;
+    root["conns"] = (Json::UInt64)opt.conns;
+    root["streams"] = (Json::UInt64)opt.streams;
+    root["setup_ms"] = setup_ms;
+
+    // 上传：每种方式使用不同的文件名
+    const char *modes[] = {"http1", "http1_conns", "h2"};
+    for (auto mode : modes)
+    {
+        std::vector<Request> requests(opt.uploads);
+        for (size_t i = 0; i < opt.uploads; i++)
+        {
+            std::string name = std::string("h2bench_up_") + mode + "_" + std::to_string(i) + ".txt";
+            requests[i] = Request{"POST", "/upload?filename=" + name, contentOf(name, opt.size)};
+        }
+        auto check = [](size_t, int status, const std::string &)
+        { return status == 200; };
+        Result r = mode == std::string("h2") ? runH2(opt, requests, check)
+                                             : runHttp1(opt, requests, mode == std::string("http1") ? 1 : opt.conns, check);
+        root["upload"][mode] = toJson(r);
+    }
+
+    // 下载并校验内容
+    std::vector<Request> requests(opt.count);
+    for (size_t i = 0; i < opt.count; i++)
+        requests[i] = Request{"GET", "/download/" + corpusName(i), ""};
+    auto check = [&](size_t i, int status, const std::string &body)
+    { return status == 200 && body == contentOf(corpusName(i), opt.size); };
+    root["download"]["http1"] = toJson(runHttp1(opt, requests, 1, check));
+    root["download"]["http1_conns"] = toJson(runHttp1(opt, requests, opt.conns, check));
+    root["download"]["h2"] = toJson(runH2(opt, requests, check));
+
+    bool ok = true;
+    for (auto phase : {"upload", "download"})
+    {
+        for (auto mode : modes)
+            ok = ok && root[phase][mode]["errors"].asUInt64() == 0;
+    }
+    root["verified"] = ok;
+
+    std::string str;
+    Util::JsonUtil::serialize(root, &str);
+    if (opt.output.empty())
+        std::cout << str << std::endl;
+    else
+        Util::FileUtil(opt.output).setContent(str);
+    return ok ? 0 : 1;
+}
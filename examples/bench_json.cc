@@ -0,0 +1,235 @@
+// 备份信息JSON编解码基准测试
+// 生成n条备份信息(部分带分块列表，文件名含中文与需要转义的字符)，对比两种实现：
+//   jsoncpp: 旧实现，构造 Json::Value 树后经 JsonUtil::serialize / unserialize
+//   fast: 新实现，FastJson 按编译期字段表直接写出/解析，不构造DOM
+// 输出两种方式编码、解码的耗时(ms)与吞吐量(MB/s)，并交叉校验两者结果一致，结果为JSON
+//
+// 编译: cd src && make bench_json
+// 用法: ./bench_json [-n 100000] [-r 5] [-o result.json]
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <unistd.h>
+#include "util.hpp"
+#include "fastjson.hpp"
+#include "data.hpp"
+
+ckflogs::Logger::Ptr _logger;
+
+struct Options
+{
+    size_t count = 100000; // 备份信息条数
+    int repeat = 5;
+    std::string output; // 为空则输出到标准输出
+};
+
+void usage()
+{
+    std::cout << "-------- USAGE --------" << std::endl;
+    std::cout << "./bench_json [-n count] [-r repeat] [-o result.json]" << std::endl;
+}
+
+bool parseOptions(int argc, char *argv[], Options *opt)
+{
+    int c;
+    while ((c = getopt(argc, argv, "n:r:o:h")) != -1)
+    {
+        switch (c)
+        {
+        case 'n':
+            opt->count = std::stoul(optarg);
+            break;
+        case 'r':
+            opt->repeat = std::max(1, atoi(optarg));
+            break;
+        case 'o':
+            opt->output = optarg;
+            break;
+        default:
+            return false;
+        }
+    }
+    return opt->count > 0;
+}
+
+std::string hashOf(const std::string &data)
+{
+    Util::Hasher hasher;
+    hasher.update(data.data(), data.size());
+    return hasher.hexdigest();
+}
+
+std::vector<Cloud::BackupInfo> genInfos(size_t n, std::mt19937_64 &rng)
+{
+    static const char *names[] = {"report", "照片", "backup \"v2\"", "a\\b", "数据库-导出"};
+    std::vector<Cloud::BackupInfo> array(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        auto &bi = array[i];
+        std::string name = std::string(names[i % 5]) + "_" + std::to_string(i) + ".dat";
+        bi.pack_flag = rng() % 2;
+        bi.is_packing = false;
+        bi.fsize = rng() % (1ull << 34);
+        bi.atime = 1700000000 + rng() % 10000000;
+        bi.mtime = 1700000000 + rng() % 10000000;
+        bi.real_path = "./backup_dir/" + name;
+        bi.pack_path = "./pack_dir/" + name + ".lz";
+        bi.url = "/download/" + name;
+        bi.content_hash = hashOf(std::to_string(rng()));
+        if (i % 4 == 0)
+        {
+            for (int c = 0; c < 16; c++)
+                bi.chunks.push_back(Cloud::ChunkRef{hashOf(std::to_string(rng())), (size_t)(rng() % (1 << 20))});
+        }
+    }
+    return array;
+}
+
+// 旧实现：与改动前 BackupInfoManager::storage / initLoad 相同
+std::string legacyEncode(const std::vector<Cloud::BackupInfo> &array)
+{
+    Json::Value root;
+    for (auto &v : array)
+    {
+        Json::Value item;
+        item["pack_flag"] = v.pack_flag;
+        item["is_packing"] = v.is_packing;
+        item["fsize"] = (Json::UInt64)v.fsize;
+        item["atime"] = (Json::Int64)v.atime;
+        item["mtime"] = (Json::Int64)v.mtime;
+        item["real_path"] = v.real_path;
+        item["pack_path"] = v.pack_path;
+        item["url"] = v.url;
+        item["content_hash"] = v.content_hash;
+        for (auto &chunk : v.chunks)
+        {
+            Json::Value c;
+            c.append(chunk.hash);
+            c.append((Json::UInt64)chunk.size);
+            item["chunks"].append(c);
+        }
+        root.append(item);
+    }
+    std::string str;
+    Util::JsonUtil::serialize(root, &str);
+    return str;
+}
+
+bool legacyDecode(const std::string &str, std::vector<Cloud::BackupInfo> *array)
+{
+    Json::Value root;
+    if (!Util::JsonUtil::unserialize(str, &root))
+        return false;
+    array->clear();
+    for (auto &item : root)
+    {
+        Cloud::BackupInfo bi;
+        bi.atime = item["atime"].asInt64();
+        bi.mtime = item["mtime"].asInt64();
+        bi.fsize = item["fsize"].asUInt64();
+        bi.pack_flag = item["pack_flag"].asBool();
+        bi.is_packing = item["is_packing"].asBool();
+        bi.pack_path = item["pack_path"].asString();
+        bi.real_path = item["real_path"].asString();
+        bi.url = item["url"].asString();
+        bi.content_hash = item["content_hash"].asString();
+        for (auto &chunk : item["chunks"])
+            bi.chunks.push_back(Cloud::ChunkRef{chunk[0].asString(), chunk[1].asUInt64()});
+        array->push_back(std::move(bi));
+    }
+    return true;
+}
+
+bool sameInfos(const std::vector<Cloud::BackupInfo> &a, const std::vector<Cloud::BackupInfo> &b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        auto &x = a[i];
+        auto &y = b[i];
+        if (x.pack_flag != y.pack_flag || x.is_packing != y.is_packing || x.fsize != y.fsize ||
+            x.atime != y.atime || x.mtime != y.mtime || x.real_path != y.real_path ||
+            x.pack_path != y.pack_path || x.url != y.url || x.content_hash != y.content_hash ||
+            x.chunks.size() != y.chunks.size())
+            return false;
+        for (size_t c = 0; c < x.chunks.size(); c++)
+        {
+            if (x.chunks[c].hash != y.chunks[c].hash || x.chunks[c].size != y.chunks[c].size)
+                return false;
+        }
+    }
+    return true;
+}
+
+template <typename F>
+double timeit(F &&f)
+{
+    auto begin = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - begin).count();
+}
+
+// 取多次运行中最快的一次(毫秒)
+template <typename F>
+double best(int repeat, F &&f)
+{
+    double sec = 1e30;
+    for (int i = 0; i < repeat; i++)
+        sec = std::min(sec, timeit(f));
+    return sec * 1000;
+}
+
+int main(int argc, char *argv[])
+{
+    Options opt;
+    if (!parseOptions(argc, argv, &opt))
+    {
+        usage();
+        return -1;
+    }
+
+    std::mt19937_64 rng(42); // 固定种子，保证每次运行数据一致
+    auto infos = genInfos(opt.count, rng);
+
+    std::string legacy_str, fast_str;
+    std::vector<Cloud::BackupInfo> legacy_out, fast_out;
+    double legacy_enc = best(opt.repeat, [&] { legacy_str = legacyEncode(infos); });
+    double fast_enc = best(opt.repeat, [&] { fast_str = Util::FastJson::serialize(infos); });
+    double legacy_dec = best(opt.repeat, [&] { legacyDecode(legacy_str, &legacy_out); });
+    double fast_dec = best(opt.repeat, [&] { Util::FastJson::unserialize(legacy_str, &fast_out); });
+
+    // 交叉校验：新解析器读旧格式、旧解析器读新格式，结果都应与原始数据一致
+    std::vector<Cloud::BackupInfo> cross;
+    bool ok = sameInfos(infos, legacy_out) && sameInfos(infos, fast_out) &&
+              legacyDecode(fast_str, &cross) && sameInfos(infos, cross);
+
+    auto mbps = [](size_t bytes, double ms)
+    { return ms > 0 ? bytes / (1024.0 * 1024.0) / (ms / 1000) : 0; };
+
+    Json::Value root;
+    root["count"] = (Json::UInt64)opt.count;
+    root["repeat"] = opt.repeat;
+    root["verified"] = ok;
+    root["jsoncpp"]["bytes"] = (Json::UInt64)legacy_str.size();
+    root["jsoncpp"]["encode_ms"] = legacy_enc;
+    root["jsoncpp"]["decode_ms"] = legacy_dec;
+    root["jsoncpp"]["encode_mbps"] = mbps(legacy_str.size(), legacy_enc);
+    root["jsoncpp"]["decode_mbps"] = mbps(legacy_str.size(), legacy_dec);
+    root["fast"]["bytes"] = (Json::UInt64)fast_str.size();
+    root["fast"]["encode_ms"] = fast_enc;
+    root["fast"]["decode_ms"] = fast_dec;
+    root["fast"]["encode_mbps"] = mbps(fast_str.size(), fast_enc);
+    root["fast"]["decode_mbps"] = mbps(legacy_str.size(), fast_dec);
+    root["encode_speedup"] = fast_enc > 0 ? legacy_enc / fast_enc : 0;
+    root["decode_speedup"] = fast_dec > 0 ? legacy_dec / fast_dec : 0;
+
+    std::string str;
+    Util::JsonUtil::serialize(root, &str);
+    if (opt.output.empty())
+        std::cout << str << std::endl;
+    else
+        Util::FileUtil(opt.output).setContent(str);
+    return ok ? 0 : 1;
+}
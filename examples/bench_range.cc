@@ -0,0 +1,179 @@
+// 断点续传下载延迟基准测试
+// 进程内启动一个 httplib 服务端，对同一个文件提供两种下载方式：
+//   whole: 旧实现，FileUtil::getContent 读入整个文件后由 httplib 截取区间
+//   range: 新实现，内容提供者 + DataSink::write_file，只发送请求的区间
+// 对不同大小的文件请求最后 tail 字节(模拟断点续传)，输出两种方式的平均延迟(ms)，结果为JSON
+//
+// 编译: cd src && make bench_range
+// 用法: ./bench_range [-s 16M,256M,1G] [-t 1M] [-r 5] [-o result.json]
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <unistd.h>
+#include "httplib.h"
+#include "util.hpp"
+
+struct Options
+{
+    std::vector<size_t> sizes = {16 << 20, 256 << 20, 1 << 30};
+    size_t tail = 1 << 20; // 续传的字节数
+    int repeat = 5;
+    std::string output; // 为空则输出到标准输出
+};
+
+void usage()
+{
+    std::cout << "-------- USAGE --------" << std::endl;
+    std::cout << "./bench_range [-s 16M,256M,1G] [-t tail] [-r repeat] [-o result.json]" << std::endl;
+}
+
+std::vector<std::string> split(const std::string &str, char sep)
+{
+    std::vector<std::string> array;
+    std::istringstream iss(str);
+    std::string item;
+    while (std::getline(iss, item, sep))
+    {
+        if (!item.empty())
+            array.push_back(item);
+    }
+    return array;
+}
+
+size_t parseSize(const std::string &str)
+{
+    size_t n = std::stoul(str);
+    switch (str.back())
+    {
+    case 'K': case 'k': return n << 10;
+    case 'M': case 'm': return n << 20;
+    case 'G': case 'g': return n << 30;
+    default: return n;
+    }
+}
+
+bool parseOptions(int argc, char *argv[], Options *opt)
+{
+    int c;
+    while ((c = getopt(argc, argv, "s:t:r:o:h")) != -1)
+    {
+        switch (c)
+        {
+        case 's':
+            opt->sizes.clear();
+            for (auto &s : split(optarg, ','))
+                opt->sizes.push_back(parseSize(s));
+            break;
+        case 't':
+            opt->tail = parseSize(optarg);
+            break;
+        case 'r':
+            opt->repeat = std::max(1, atoi(optarg));
+            break;
+        case 'o':
+            opt->output = optarg;
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+// 生成指定大小的文件，分块写入，内存占用与文件大小无关
+bool genFile(const std::string &path, size_t size)
+{
+    Util::FileWriter writer;
+    if (!writer.open(path))
+        return false;
+    std::string block(1 << 20, '\0');
+    for (size_t i = 0; i < block.size(); i++)
+        block[i] = (char)(i * 131 + 7);
+    for (size_t done = 0; done < size; done += block.size())
+    {
+        if (!writer.write(block.data(), std::min(block.size(), size - done)))
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    Options opt;
+    if (!parseOptions(argc, argv, &opt))
+    {
+        usage();
+        return -1;
+    }
+
+    std::string path = "./bench_range.tmp";
+    httplib::Server svr;
+    svr.Get("/whole", [&](const httplib::Request &req, httplib::Response &resp)
+            {
+        Util::FileUtil(path).getContent(resp.body);
+        resp.status = 206; });
+    svr.Get("/range", [&](const httplib::Request &req, httplib::Response &resp)
+            {
+        auto file = std::make_shared<Util::FileReader>();
+        if (!file->open(path))
+        {
+            resp.status = 404;
+            return;
+        }
+        resp.set_content_provider(file->size(), "application/octet-stream",
+                                  [file](size_t offset, size_t length, httplib::DataSink &sink)
+                                  { return sink.write_file(file->fd(), offset, std::min<size_t>(length, 4 << 20)); }); });
+
+    int port = svr.bind_to_any_port("127.0.0.1");
+    std::thread th([&]
+                   { svr.listen_after_bind(); });
+    svr.wait_until_ready();
+
+    httplib::Client cli("127.0.0.1", port);
+    httplib::Headers headers = {{"Range", "bytes=-" + std::to_string(opt.tail)}};
+
+    Json::Value root;
+    root["tail"] = (Json::UInt64)opt.tail;
+    root["repeat"] = opt.repeat;
+    for (size_t size : opt.sizes)
+    {
+        if (!genFile(path, size))
+        {
+            std::cerr << "生成文件失败: " << path << std::endl;
+            break;
+        }
+        std::cerr << "size=" << size << std::endl;
+
+        Json::Value item;
+        item["size"] = (Json::UInt64)size;
+        for (std::string mode : {"whole", "range"})
+        {
+            double total = 0;
+            bool ok = true;
+            for (int i = 0; i < opt.repeat; i++)
+            {
+                auto begin = std::chrono::steady_clock::now();
+                auto res = cli.Get("/" + mode, headers);
+                auto end = std::chrono::steady_clock::now();
+                ok = ok && res && res->status == 206 && res->body.size() == std::min(opt.tail, size);
+                total += std::chrono::duration<double, std::milli>(end - begin).count();
+            }
+            item[mode + "_ms"] = total / opt.repeat;
+            item[mode + "_ok"] = ok;
+        }
+        root["results"].append(item);
+    }
+
+    svr.stop();
+    th.join();
+    Util::FileUtil(path).remove();
+
+    std::string str;
+    Util::JsonUtil::serialize(root, &str);
+    if (opt.output.empty())
+        std::cout << str << std::endl;
+    else
+        Util::FileUtil(opt.output).setContent(str);
+    return 0;
+}
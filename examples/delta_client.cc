@@ -0,0 +1,56 @@
+// 增量上传客户端示例
+// 1.GET /signature/<文件名> 获取服务端已存储版本的块签名
+// 2.用 Util::Delta::encode 在本地新版本上匹配签名，生成增量
+// 3.POST /delta/<文件名> 上传增量；服务端还没有该文件时退化为整文件上传
+//
+// 编译: g++ -std=c++17 -o delta_client delta_client.cc -I../include -lpthread -lstdc++fs -ljsoncpp -lcrypto -L../libs/ -lbundle
+// 用法: ./delta_client ip port file
+#include <iostream>
+#include "httplib.h"
+#include "util.hpp"
+#include "delta.hpp"
+
+int main(int argc, char *argv[])
+{
+    if (argc != 4)
+    {
+        std::cout << "-------- USAGE --------" << std::endl;
+        std::cout << "./delta_client ip port file" << std::endl;
+        return -1;
+    }
+    httplib::Client cli(argv[1], atoi(argv[2]));
+    std::string content;
+    if (!Util::FileUtil(argv[3]).getContent(content))
+        return -1;
+    std::string filename = Util::FileUtil(argv[3]).fileName();
+
+    Util::Hasher hasher;
+    hasher.update(content.data(), content.size());
+    std::string hash = hasher.hexdigest();
+
+    auto sig = cli.Get("/signature/" + filename);
+    if (!sig || sig->status != 200)
+    {
+        // 服务端没有旧版本：整文件上传
+        auto ret = cli.Post("/upload?filename=" + filename, content, "application/octet-stream");
+        std::cout << "full upload: " << (ret ? ret->status : -1) << std::endl;
+        return 0;
+    }
+
+    Json::Value root;
+    Util::JsonUtil::unserialize(sig->body, &root);
+    size_t block_size = root["block_size"].asUInt64();
+    std::vector<Util::Delta::Block> blocks;
+    for (auto &block : root["blocks"])
+        blocks.push_back({block[0].asUInt(), block[1].asString()});
+
+    std::string delta = Util::Delta::encode(blocks, block_size, content);
+    std::string path = "/delta/" + filename + "?block_size=" + std::to_string(block_size) +
+                       "&base=" + root["content_hash"].asString() + "&hash=" + hash;
+    auto ret = cli.Post(path, delta, "application/octet-stream");
+    std::cout << "file " << content.size() << " bytes, delta " << delta.size() << " bytes, status "
+              << (ret ? ret->status : -1) << std::endl;
+    if (ret)
+        std::cout << ret->body << std::endl;
+    return 0;
+}
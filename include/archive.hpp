@@ -0,0 +1,287 @@
+#pragma once
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "httplib.h"
+#include "util.hpp"
+#include "data.hpp"
+#include "pack.hpp"
+#include "chunkstore.hpp"
+#include "log/ckflog.hpp"
+
+extern Cloud::BackupInfoManager *_biManager;
+extern ckflogs::Logger::Ptr _logger;
+
+namespace Cloud
+{
+    // 批量归档下载：把一批备份文件边读边生成tar流(ustar格式，长文件名与超过8GB的文件使用pax扩展头)
+    // 每个文件按存储形态读取：热点文件直接读；分块存储按分块读；分块压缩包逐块解压，brotli压缩包按块流式解压，
+    // 只有分块格式之前写出的其他算法压缩包需要整个解压到内存。压缩包不解压回热点文件，不改变文件状态
+    class ArchiveStream
+    {
+    public:
+        static constexpr size_t block_size = 64 << 10; // 每次生成的数据长度(文件头除外)
+
+        ArchiveStream(const std::vector<std::string> &urls) : _urls(urls) {}
+        bool read(std::string *out); // 生成下一段数据，out为空表示归档结束；返回false表示读取出错
+        size_t entries() const { return _entries; } // 已写入的文件个数
+
+    private:
+        bool open(const std::string &url, std::string *out); // 打开文件并写出文件头，文件已删除或打不开返回false
+        bool readEntry(size_t len, std::string *out);       // 追加当前文件的下一段数据
+        bool inflate();                                     // 压缩包：再解压一段数据追加到_data，已无数据或出错返回false
+        void reset();                                       // 关闭当前文件
+
+        static void tarHeader(const std::string &name, size_t size, time_t mtime, char type, std::string *out);
+        static void paxRecord(const std::string &key, const std::string &val, std::string *out);
+        static void pad(size_t size, std::string *out); // 数据补齐到512字节边界
+
+    private:
+        std::vector<std::string> _urls;
+        size_t _index = 0;
+        size_t _entries = 0;
+        bool _finished = false;
+
+        // 当前文件
+        bool _open = false;
+        size_t _size = 0; // 原始长度
+        size_t _sent = 0;
+        std::shared_ptr<Util::FileReader> _file; // 热点文件或压缩包
+        std::shared_ptr<ChunkReader> _chunks;
+        std::unique_ptr<Util::PackReader> _pack;                  // 分块压缩包
+        std::unique_ptr<httplib::detail::decompressor> _decoder; // 流式解压，与_pack都为空且_file为空时_data是整个文件
+        size_t _zoff = 0; // 压缩数据的读取进度
+        size_t _zend = 0;
+        std::string _data; // 已解压未输出的数据
+        size_t _data_pos = 0;
+        std::string _buf;
+    };
+}
+
+bool Cloud::ArchiveStream::read(std::string *out)
+{
+    out->clear();
+    while (out->size() < block_size && !_finished)
+    {
+        if (!_open)
+        {
+            if (_index == _urls.size())
+            {
+                // 归档结束：两个全零块
+                out->append(1024, '\0');
+                _finished = true;
+                break;
+            }
+            const std::string &url = _urls[_index++];
+            if (!open(url, out))
+            {
+                _logger->_warn("归档跳过 %s: 文件不存在或打开失败", url.c_str());
+                reset();
+                continue;
+            }
+            _open = true;
+            _entries++;
+            continue;
+        }
+        if (!readEntry(block_size - out->size(), out))
+        {
+            _logger->_error("归档读取 %s 失败", _urls[_index - 1].c_str());
+            return false;
+        }
+        if (_sent == _size)
+        {
+            pad(_size, out);
+            reset();
+        }
+    }
+    return true;
+}
+
+bool Cloud::ArchiveStream::open(const std::string &url, std::string *out)
+{
+    BackupInfo bi;
+    unsigned codec = 0;
+    size_t offset = 0, zlen = 0;
+    {
+        // 与 openStored 相同，加锁确定存储形态并打开，之后文件被压缩/解压也不影响已打开的描述符
+        std::unique_lock<std::mutex> lck(Packer::mutexOf(url));
+        if (!_biManager->getOneByURL(url, &bi))
+            return false;
+        if (!bi.chunks.empty())
+        {
+            _chunks = std::make_shared<ChunkReader>(bi.chunks);
+            _size = _chunks->size();
+        }
+        else
+        {
+            _file = std::make_shared<Util::FileReader>();
+            if (!_file->open(bi.pack_flag ? bi.pack_path : bi.real_path))
+                return false;
+            _size = _file->size();
+            if (bi.pack_flag)
+            {
+                _pack.reset(new Util::PackReader);
+                if (_pack->open(_file))
+                {
+                    _size = _pack->size();
+                }
+                else
+                {
+                    _pack.reset();
+                    if (!Util::FileUtil(bi.pack_path).packInfo(&codec, &offset, &zlen, &_size))
+                        return false;
+                }
+            }
+        }
+    }
+
+    if (_file && bi.pack_flag && !_pack)
+    {
+        bool stream = false;
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+        if (codec == bundle::BROTLI9 || codec == bundle::BROTLI11)
+        {
+            _decoder.reset(new httplib::detail::brotli_decompressor);
+            _zoff = offset;
+            _zend = offset + zlen;
+            stream = _decoder->is_valid();
+        }
+#endif
+        if (!stream)
+        {
+            _decoder.reset();
+            std::string packed;
+            if (!_file->pread(0, _file->size(), &packed))
+                return false;
+            _data = bundle::unpack(packed);
+            _file.reset();
+            if (_data.size() != _size)
+                return false;
+        }
+    }
+
+    std::string name = Util::FileUtil(bi.real_path).fileName();
+    std::string pax;
+    if (name.size() > 100)
+        paxRecord("path", name, &pax);
+    if (_size > 077777777777ull) // 超出ustar长度字段(11位八进制)
+        paxRecord("size", std::to_string(_size), &pax);
+    if (!pax.empty())
+    {
+        tarHeader("PaxHeaders/" + std::to_string(_entries), pax.size(), bi.mtime, 'x', out);
+        out->append(pax);
+        pad(pax.size(), out);
+    }
+    tarHeader(name, _size, bi.mtime, '0', out);
+    return true;
+}
+
+bool Cloud::ArchiveStream::readEntry(size_t len, std::string *out)
+{
+    size_t want = std::min(len, _size - _sent);
+    size_t before = out->size();
+    if (_chunks)
+    {
+        if (!_chunks->read(_sent, want, &_buf))
+            return false;
+        out->append(_buf);
+    }
+    else if (_file && !_decoder && !_pack) // 热点文件
+    {
+        if (!_file->pread(_sent, want, &_buf))
+            return false;
+        out->append(_buf);
+    }
+    else
+    {
+        // 压缩包：逐段解压，直到够本次输出
+        while (_data.size() - _data_pos < want)
+        {
+            _data.erase(0, _data_pos);
+            _data_pos = 0;
+            if (!inflate())
+                return false;
+        }
+        size_t n = std::min(want, _data.size() - _data_pos);
+        out->append(_data, _data_pos, n);
+        _data_pos += n;
+    }
+    // 实际长度比文件头中的短，归档已无法继续
+    if (out->size() - before != want)
+        return false;
+    _sent += want;
+    return true;
+}
+
+bool Cloud::ArchiveStream::inflate()
+{
+    if (_pack)
+    {
+        if (!_pack->next(&_buf) || _buf.empty())
+            return false;
+        _data.append(_buf);
+        return true;
+    }
+    if (!_decoder || _zoff >= _zend)
+        return false;
+    if (!_file->pread(_zoff, std::min(block_size, _zend - _zoff), &_buf) || _buf.empty())
+        return false;
+    _zoff += _buf.size();
+    return _decoder->decompress(_buf.data(), _buf.size(), [this](const char *data, size_t n)
+                                {
+        _data.append(data, n);
+        return true; });
+}
+
+void Cloud::ArchiveStream::reset()
+{
+    _open = false;
+    _size = _sent = 0;
+    _file.reset();
+    _chunks.reset();
+    _pack.reset();
+    _decoder.reset();
+    _zoff = _zend = 0;
+    std::string().swap(_data);
+    _data_pos = 0;
+}
+
+void Cloud::ArchiveStream::tarHeader(const std::string &name, size_t size, time_t mtime, char type, std::string *out)
+{
+    char h[512];
+    memset(h, 0, sizeof(h));
+    memcpy(h, name.data(), std::min<size_t>(name.size(), 100)); // 更长的文件名在pax头中
+    memcpy(h + 100, "0000644", 7);
+    memcpy(h + 108, "0000000", 7);
+    memcpy(h + 116, "0000000", 7);
+    snprintf(h + 124, 12, "%011llo", (unsigned long long)(size > 077777777777ull ? 0 : size));
+    snprintf(h + 136, 12, "%011llo", (unsigned long long)std::max<time_t>(mtime, 0));
+    h[156] = type;
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+
+    // 校验和：校验和字段按8个空格计算
+    memset(h + 148, ' ', 8);
+    unsigned sum = 0;
+    for (unsigned char c : h)
+        sum += c;
+    snprintf(h + 148, 8, "%06o", sum);
+    out->append(h, sizeof(h));
+}
+
+void Cloud::ArchiveStream::paxRecord(const std::string &key, const std::string &val, std::string *out)
+{
+    // 记录格式 "<长度> key=value\n"，长度包括长度字段本身
+    size_t body = key.size() + val.size() + 3; // 空格、'='、'\n'
+    size_t len = body + 1;
+    while (std::to_string(len).size() + body != len)
+        len = std::to_string(len).size() + body;
+    *out += std::to_string(len) + " " + key + "=" + val + "\n";
+}
+
+void Cloud::ArchiveStream::pad(size_t size, std::string *out)
+{
+    if (size % 512)
+        out->append(512 - size % 512, '\0');
+}
@@ -0,0 +1,169 @@
+#pragma once
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <sys/inotify.h>
+#include "httplib.h"
+#include "util.hpp"
+#include "config.hpp"
+#include "log/ckflog.hpp"
+
+extern ckflogs::Logger::Ptr _logger;
+
+namespace Cloud
+{
+    // 前端静态页面缓存
+    // 启动时把 www_dir 下的文件全部读入内存，并预先生成 gzip / br 压缩版本(最高压缩级别，只压缩一次)，
+    // 请求页面时不再访问文件系统，也不再实时压缩；开启 www_watch 时用 inotify 监视目录，文件修改后重新加载
+    class AssetCache
+    {
+    public:
+        struct Asset
+        {
+            std::string content_type;
+            std::string hash; // 原始内容的SHA-256前16位，用于ETag
+            std::string raw;
+            std::string gzip; // 为空表示不压缩(压缩后不比原文件小)
+            std::string br;
+        };
+        using AssetPtr = std::shared_ptr<const Asset>;
+
+        static AssetCache &getInstance();
+        AssetPtr get(const std::string &name); // 不存在返回nullptr
+
+    private:
+        AssetCache();
+        AssetCache(const AssetCache &other) = delete;
+        AssetCache &operator=(const AssetCache &other) = delete;
+
+        void load(const std::string &name); // 读取一个文件并生成压缩版本
+        void watchLoop();                   // 监视线程：文件修改后重新加载
+
+    private:
+        std::string _dir;
+        std::unordered_map<std::string, AssetPtr> _assets; // 文件名 -> 页面
+        std::mutex _mutex;
+        int _inotify_fd;
+    };
+}
+
+Cloud::AssetCache &Cloud::AssetCache::getInstance()
+{
+    static AssetCache inst;
+    return inst;
+}
+
+Cloud::AssetCache::AssetCache()
+    : _dir(Config::getInstance()->getWwwDir()), _inotify_fd(-1)
+{
+    std::vector<std::string> files;
+    if (Util::FileUtil(_dir).isExists())
+        Util::FileUtil(_dir).scanDirectory(files);
+    for (auto &path : files)
+    {
+        if (Util::FileUtil(path).isRegularFile())
+            load(Util::FileUtil(path).fileName());
+    }
+    _logger->_debug("静态页面缓存-页面个数 %d", _assets.size());
+
+    if (Config::getInstance()->getWwwWatch())
+    {
+        _inotify_fd = inotify_init1(IN_CLOEXEC);
+        if (_inotify_fd < 0 || inotify_add_watch(_inotify_fd, _dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM) < 0)
+        {
+            _logger->_warn("监视页面目录失败 %s: %s", _dir.c_str(), strerror(errno));
+            return;
+        }
+        std::thread(&AssetCache::watchLoop, this).detach();
+    }
+}
+
+Cloud::AssetCache::AssetPtr Cloud::AssetCache::get(const std::string &name)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    auto it = _assets.find(name);
+    return it == _assets.end() ? nullptr : it->second;
+}
+
+void Cloud::AssetCache::load(const std::string &name)
+{
+    auto asset = std::make_shared<Asset>();
+    std::string path = _dir + name;
+    if (!Util::FileUtil(path).getContent(asset->raw))
+    {
+        // 文件已删除
+        std::unique_lock<std::mutex> lck(_mutex);
+        _assets.erase(name);
+        return;
+    }
+    asset->content_type = httplib::detail::find_content_type(path, {}, "application/octet-stream");
+    Util::Hasher hasher;
+    hasher.update(asset->raw.data(), asset->raw.size());
+    asset->hash = hasher.hexdigest().substr(0, 16);
+
+    if (httplib::detail::can_compress_content_type(asset->content_type))
+    {
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+        z_stream strm;
+        memset(&strm, 0, sizeof(strm));
+        if (deflateInit2(&strm, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) == Z_OK)
+        {
+            asset->gzip.resize(deflateBound(&strm, asset->raw.size()));
+            strm.next_in = (Bytef *)asset->raw.data();
+            strm.avail_in = asset->raw.size();
+            strm.next_out = (Bytef *)&asset->gzip[0];
+            strm.avail_out = asset->gzip.size();
+            bool ok = deflate(&strm, Z_FINISH) == Z_STREAM_END;
+            asset->gzip.resize(ok ? strm.total_out : 0);
+            deflateEnd(&strm);
+        }
+#endif
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+        size_t len = BrotliEncoderMaxCompressedSize(asset->raw.size());
+        asset->br.resize(len);
+        if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, asset->raw.size(),
+                                   (const uint8_t *)asset->raw.data(), &len, (uint8_t *)&asset->br[0]))
+            len = 0;
+        asset->br.resize(len);
+#endif
+        if (asset->gzip.size() >= asset->raw.size())
+            asset->gzip.clear();
+        if (asset->br.size() >= asset->raw.size())
+            asset->br.clear();
+    }
+
+    _logger->_debug("加载页面 %s: %lu 字节, gzip %lu 字节, br %lu 字节", name.c_str(), asset->raw.size(),
+                    asset->gzip.size(), asset->br.size());
+    std::unique_lock<std::mutex> lck(_mutex);
+    _assets[name] = asset;
+}
+
+void Cloud::AssetCache::watchLoop()
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true)
+    {
+        ssize_t n = read(_inotify_fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            _logger->_warn("页面目录监视结束 %s", strerror(errno));
+            return;
+        }
+        for (char *p = buf; p < buf + n;)
+        {
+            auto *ev = (struct inotify_event *)p;
+            std::string name = ev->len > 0 ? ev->name : "";
+            // 编辑器保存时产生的临时文件不加载
+            if (!name.empty() && name[0] != '.' && !Util::FileUtil(name).isTempFile())
+            {
+                _logger->_info("页面 %s 已修改，重新加载", name.c_str());
+                load(name);
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <iostream>
+#include "util.hpp"
+#include "config.hpp"
+#include "data.hpp"
+#include "log/ckflog.hpp"
+
+extern Cloud::BackupInfoManager *_biManager;
+extern ckflogs::Logger::Ptr _logger;
+
+namespace Cloud
+{
+    // 内容寻址存储
+    // 备份信息按 content_hash 建立索引(BackupInfoManager::getByHash)，内容相同的文件共用磁盘上的同一份数据：
+    // 原文件、压缩包都以硬链接的方式共享inode，引用计数即引用该内容的备份信息个数，
+    // 删除一个文件只删除它自己的链接，最后一个引用删除时inode由文件系统回收
+    // 前提：备份目录与压缩目录中的文件只会整体替换(临时文件+rename)，从不原地修改，因此共享inode是安全的
+    class BlobStore
+    {
+    public:
+        // 上传的内容已存在：把已有的原文件(或压缩包)链接到该url的路径上，填充备份信息
+        static bool dedupUpload(const std::string &hash, const std::string &real_path, BackupInfo *bi);
+        static bool linkPack(const BackupInfo &bi); // 压缩时：同内容已有压缩包，直接链接
+        static bool linkReal(const BackupInfo &bi); // 解压时：同内容已有原文件，直接链接
+        static size_t refcount(const std::string &hash); // 引用该内容的文件个数
+
+    private:
+        static std::vector<BackupInfo> others(const std::string &hash, const std::string &url); // 内容相同的其他文件
+    };
+}
+
+std::vector<Cloud::BackupInfo> Cloud::BlobStore::others(const std::string &hash, const std::string &url)
+{
+    std::vector<BackupInfo> refs, array;
+    _biManager->getByHash(hash, &refs);
+    for (auto &bi : refs)
+    {
+        if (bi.url != url)
+            array.push_back(bi);
+    }
+    return array;
+}
+
+size_t Cloud::BlobStore::refcount(const std::string &hash)
+{
+    std::vector<BackupInfo> refs;
+    _biManager->getByHash(hash, &refs);
+    return refs.size();
+}
+
+bool Cloud::BlobStore::dedupUpload(const std::string &hash, const std::string &real_path, BackupInfo *bi)
+{
+    if (hash.empty())
+        return false;
+
+    Config *conf = Config::getInstance();
+    std::string filename = Util::FileUtil(real_path).fileName();
+    std::string url = conf->getUrlPrefix() + filename;
+
+    for (auto &ref : others(hash, url))
+    {
+        // 1.已有热点文件：链接原文件
+        if (Util::FileUtil(ref.real_path).isExists() && Util::FileUtil(ref.real_path).link(real_path))
+        {
+            // 共享inode的时间属于已有文件，新上传的文件以上传时间为准
+            *bi = BackupInfo(real_path);
+            bi->atime = bi->mtime = time(nullptr);
+            bi->content_hash = hash;
+            _logger->_debug("%s 内容已存在(%s)，链接原文件", url.c_str(), ref.url.c_str());
+            return true;
+        }
+
+        // 2.已有压缩包：直接链接压缩包，新文件一上传就是压缩状态，不需要再压缩
+        std::string pack_path = conf->getPackDir() + filename + conf->getArcSuffix();
+        if (Util::FileUtil(ref.pack_path).isExists() && Util::FileUtil(ref.pack_path).link(pack_path))
+        {
+            Util::FileUtil(real_path).remove(); // 覆盖上传时的旧版本原文件
+            bi->pack_flag = true;
+            bi->is_packing = false;
+            bi->fsize = ref.fsize;
+            bi->atime = bi->mtime = time(nullptr);
+            bi->real_path = real_path;
+            bi->pack_path = pack_path;
+            bi->url = url;
+            bi->content_hash = hash;
+            _logger->_debug("%s 内容已存在(%s)，链接压缩包", url.c_str(), ref.url.c_str());
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Cloud::BlobStore::linkPack(const BackupInfo &bi)
+{
+    if (bi.content_hash.empty())
+        return false;
+    for (auto &ref : others(bi.content_hash, bi.url))
+    {
+        if (ref.pack_flag && Util::FileUtil(ref.pack_path).isExists() && Util::FileUtil(ref.pack_path).link(bi.pack_path))
+            return true;
+    }
+    return false;
+}
+
+bool Cloud::BlobStore::linkReal(const BackupInfo &bi)
+{
+    if (bi.content_hash.empty())
+        return false;
+    for (auto &ref : others(bi.content_hash, bi.url))
+    {
+        if (!ref.pack_flag && Util::FileUtil(ref.real_path).isExists() && Util::FileUtil(ref.real_path).link(bi.real_path))
+            return true;
+    }
+    return false;
+}
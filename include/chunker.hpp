@@ -0,0 +1,123 @@
+#pragma once
+#include <iostream>
+#include <cstdint>
+#include <array>
+
+namespace Util
+{
+    // 基于 Gear 滚动哈希的内容定义分块 (FastCDC)
+    // fp = (fp << 1) + GEAR[byte]，fp 的第 i 位只与最近 i+1 个字节有关，因此用高位做掩码判断，
+    // 相当于一个64字节的滑动窗口；同样的内容无论出现在文件的什么位置，切出来的分块边界都相同
+    //
+    // 1.跳过最小分块长度：前 min_size 个字节不可能成为切点，直接跳过，只需从 min_size-64 处开始计算哈希
+    // 2.归一化分块：未达到平均长度时用更严格的掩码(多2位)，超过后用更宽松的掩码(少2位)，分块长度更集中
+    // 3.内循环每次处理4个字节，哈希更新只有移位、加法与查表，判断切点只有一次与运算和比较
+    class GearChunker
+    {
+    public:
+        GearChunker(size_t min_size, size_t avg_size, size_t max_size);
+        size_t cut(const uint8_t *data, size_t len) const; // 返回从data开始的第一个分块长度
+        size_t minSize() const { return _min_size; }
+        size_t maxSize() const { return _max_size; }
+
+    private:
+        static const std::array<uint64_t, 256> &gear(); // Gear 表，固定种子生成，保证各进程分块结果一致
+        static uint64_t highMask(unsigned bits);        // 高 bits 位为1的掩码
+
+    private:
+        size_t _min_size;
+        size_t _avg_size;
+        size_t _max_size;
+        uint64_t _mask_s; // 未达到平均长度时使用的严格掩码
+        uint64_t _mask_l; // 超过平均长度后使用的宽松掩码
+    };
+}
+
+Util::GearChunker::GearChunker(size_t min_size, size_t avg_size, size_t max_size)
+    : _min_size(min_size), _avg_size(avg_size), _max_size(max_size)
+{
+    unsigned bits = 0;
+    while (((size_t)1 << (bits + 1)) <= avg_size)
+        bits++;
+    _mask_s = highMask(bits + 2);
+    _mask_l = highMask(bits >= 2 ? bits - 2 : 1);
+}
+
+uint64_t Util::GearChunker::highMask(unsigned bits)
+{
+    return bits >= 64 ? ~0ULL : ~0ULL << (64 - bits);
+}
+
+const std::array<uint64_t, 256> &Util::GearChunker::gear()
+{
+    // splitmix64 生成的伪随机表，种子固定
+    static const std::array<uint64_t, 256> table = []
+    {
+        std::array<uint64_t, 256> t{};
+        uint64_t x = 0x636c6f75642d6364ULL; // "cloud-cd"
+        for (auto &v : t)
+        {
+            uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            v = z ^ (z >> 31);
+        }
+        return t;
+    }();
+    return table;
+}
+
+size_t Util::GearChunker::cut(const uint8_t *data, size_t len) const
+{
+    if (len <= _min_size)
+        return len;
+
+    const uint64_t *G = gear().data();
+    size_t end = len < _max_size ? len : _max_size;
+    size_t normal = _avg_size < end ? _avg_size : end;
+
+    // 切点之前的64个字节决定了fp的全部位，更早的字节不需要计算
+    size_t i = _min_size >= 64 ? _min_size - 64 : 0;
+    uint64_t fp = 0;
+    for (; i < _min_size; i++)
+        fp = (fp << 1) + G[data[i]];
+
+    // 未达到平均长度：严格掩码
+    for (; i + 4 <= normal; i += 4)
+    {
+        fp = (fp << 1) + G[data[i]];
+        if (!(fp & _mask_s)) return i + 1;
+        fp = (fp << 1) + G[data[i + 1]];
+        if (!(fp & _mask_s)) return i + 2;
+        fp = (fp << 1) + G[data[i + 2]];
+        if (!(fp & _mask_s)) return i + 3;
+        fp = (fp << 1) + G[data[i + 3]];
+        if (!(fp & _mask_s)) return i + 4;
+    }
+    for (; i < normal; i++)
+    {
+        fp = (fp << 1) + G[data[i]];
+        if (!(fp & _mask_s))
+            return i + 1;
+    }
+
+    // 超过平均长度：宽松掩码
+    for (; i + 4 <= end; i += 4)
+    {
+        fp = (fp << 1) + G[data[i]];
+        if (!(fp & _mask_l)) return i + 1;
+        fp = (fp << 1) + G[data[i + 1]];
+        if (!(fp & _mask_l)) return i + 2;
+        fp = (fp << 1) + G[data[i + 2]];
+        if (!(fp & _mask_l)) return i + 3;
+        fp = (fp << 1) + G[data[i + 3]];
+        if (!(fp & _mask_l)) return i + 4;
+    }
+    for (; i < end; i++)
+    {
+        fp = (fp << 1) + G[data[i]];
+        if (!(fp & _mask_l))
+            return i + 1;
+    }
+    return end;
+}
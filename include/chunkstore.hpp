@@ -0,0 +1,272 @@
+#pragma once
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include "util.hpp"
+#include "config.hpp"
+#include "data.hpp"
+#include "chunker.hpp"
+#include "bundle.h"
+#include "log/ckflog.hpp"
+
+extern Cloud::BackupInfoManager *_biManager;
+extern ckflogs::Logger::Ptr _logger;
+
+namespace Cloud
+{
+    // 内容分块存储
+    // 大文件上传后用 GearChunker 按内容切成分块，每个分块以 SHA-256 命名、单独压缩后存放在 chunk_dir/<前2位>/<哈希>，
+    // 相同的分块只存一份；文件的备份信息只保存分块列表，下载时按顺序解压分块拼接出原文件
+    // 分块的引用计数在启动时由所有备份信息的分块列表重建，计数归零的分块被删除；
+    // 正在读取的 ChunkReader 也持有引用，覆盖上传或删除后旧版本的分块等下载结束才删除
+    class ChunkStore
+    {
+    public:
+        static ChunkStore &getInstance();
+        bool enabled(size_t fsize);                                        // 该大小的文件是否按分块存储
+        bool storeFile(const std::string &path, std::vector<ChunkRef> *chunks); // 将文件切块存入，得到分块列表
+        bool get(const std::string &hash, std::string *data);              // 读取并解压一个分块
+        void retain(const std::vector<ChunkRef> &chunks);                  // 增加引用(读取期间保留分块)
+        void release(const std::vector<ChunkRef> &chunks);                 // 释放一个文件对分块的引用
+
+    private:
+        ChunkStore();
+        ChunkStore(const ChunkStore &other) = delete;
+        ChunkStore &operator=(const ChunkStore &other) = delete;
+
+        bool put(const char *data, size_t len, std::string *hash); // 存入一个分块(已存在则只增加引用)
+        std::string pathOf(const std::string &hash);
+
+    private:
+        static const unsigned codec = bundle::LZ4; // 分块压缩算法：下载时需要逐块解压，选用解压最快的
+        std::string _dir;
+        size_t _threshold;
+        Util::GearChunker _chunker;
+        std::unordered_map<std::string, size_t> _refs; // 分块哈希 -> 引用计数
+        std::unordered_set<std::string> _writing;      // 正在写入的新分块，同内容的其他写入等它完成
+        std::mutex _mutex;
+        std::condition_variable _cond;
+    };
+
+    // 按偏移读取分块存储的文件：二分查找偏移所在的分块，缓存最近解压的一个分块，顺序读取时每个分块只解压一次
+    class ChunkReader
+    {
+    public:
+        ChunkReader(const std::vector<ChunkRef> &chunks); // 需在文件锁内构造，保证分块仍被备份信息引用
+        ~ChunkReader();
+        ChunkReader(const ChunkReader &other) = delete;
+        ChunkReader &operator=(const ChunkReader &other) = delete;
+        size_t size() const { return _size; }
+        bool read(size_t offset, size_t len, std::string *out); // 读取[offset, offset+len)，越界部分截断
+
+    private:
+        std::vector<ChunkRef> _chunks;
+        std::vector<size_t> _offsets; // 各分块在文件中的起始偏移
+        size_t _size;
+        size_t _index; // 缓存的分块序号
+        std::string _data;
+    };
+}
+
+Cloud::ChunkStore &Cloud::ChunkStore::getInstance()
+{
+    static ChunkStore inst;
+    return inst;
+}
+
+Cloud::ChunkStore::ChunkStore()
+    : _dir(Config::getInstance()->getChunkDir()),
+      _threshold(Config::getInstance()->getChunkThreshold()),
+      _chunker(Config::getInstance()->getChunkAvgSize() / 4,
+               Config::getInstance()->getChunkAvgSize(),
+               Config::getInstance()->getChunkAvgSize() * 4)
+{
+    Util::FileUtil(_dir).createDirectory();
+
+    // 由备份信息重建引用计数
+    std::vector<BackupInfo> array;
+    _biManager->getAll(&array);
+    for (auto &bi : array)
+    {
+        for (auto &chunk : bi.chunks)
+            _refs[chunk.hash]++;
+    }
+
+    // 清理未被引用的分块(上传中途崩溃留下的)与未完成的临时文件
+    std::error_code ec;
+    std::vector<std::string> orphans;
+    for (auto &entry : Util::fs::recursive_directory_iterator(_dir, ec))
+    {
+        if (!Util::fs::is_regular_file(entry.path()))
+            continue;
+        std::string name = entry.path().filename().string();
+        if (Util::FileUtil(entry.path().string()).isTempFile() || _refs.find(name) == _refs.end())
+            orphans.push_back(entry.path().string());
+    }
+    for (auto &path : orphans)
+    {
+        _logger->_debug("清理未引用的分块 %s", path.c_str());
+        Util::FileUtil(path).remove();
+    }
+    _logger->_debug("分块存储模块-分块个数 %d", _refs.size());
+}
+
+bool Cloud::ChunkStore::enabled(size_t fsize)
+{
+    return _threshold > 0 && fsize >= _threshold;
+}
+
+std::string Cloud::ChunkStore::pathOf(const std::string &hash)
+{
+    return _dir + hash.substr(0, 2) + "/" + hash;
+}
+
+bool Cloud::ChunkStore::put(const char *data, size_t len, std::string *hash)
+{
+    Util::Hasher hasher;
+    hasher.update(data, len);
+    *hash = hasher.hexdigest();
+
+    std::unique_lock<std::mutex> lck(_mutex);
+    _cond.wait(lck, [&]
+               { return _writing.count(*hash) == 0; });
+    if (_refs[*hash]++ > 0) // 已存在的分块
+        return true;
+
+    // 新分块：压缩后原子写入，压缩与写盘不持有全局锁
+    _writing.insert(*hash);
+    lck.unlock();
+    std::string path = pathOf(*hash);
+    Util::FileUtil(_dir + hash->substr(0, 2)).createDirectory();
+    std::string packed = bundle::pack(codec, std::string(data, len));
+    bool ok = Util::FileUtil(path).setContentAtomic(packed);
+    lck.lock();
+    _writing.erase(*hash);
+    if (!ok && --_refs[*hash] == 0)
+        _refs.erase(*hash);
+    _cond.notify_all();
+    return ok;
+}
+
+bool Cloud::ChunkStore::storeFile(const std::string &path, std::vector<ChunkRef> *chunks)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs.is_open())
+    {
+        _logger->_warn("%s: File open fail", path.c_str());
+        return false;
+    }
+
+    // 缓冲区保持至少一个最大分块的数据，每次从头部切下一个分块
+    std::vector<char> buf(_chunker.maxSize() * 2);
+    size_t begin = 0, end = 0;
+    bool eof = false;
+    while (true)
+    {
+        if (!eof && end - begin < _chunker.maxSize())
+        {
+            memmove(buf.data(), buf.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+            ifs.read(buf.data() + end, buf.size() - end);
+            end += ifs.gcount();
+            eof = !ifs;
+        }
+        if (begin == end)
+            break;
+
+        size_t n = _chunker.cut((const uint8_t *)buf.data() + begin, end - begin);
+        ChunkRef ref;
+        ref.size = n;
+        if (!put(buf.data() + begin, n, &ref.hash))
+        {
+            release(*chunks);
+            chunks->clear();
+            return false;
+        }
+        chunks->push_back(ref);
+        begin += n;
+    }
+    return true;
+}
+
+bool Cloud::ChunkStore::get(const std::string &hash, std::string *data)
+{
+    std::string packed;
+    if (!Util::FileUtil(pathOf(hash)).getContent(packed))
+        return false;
+    *data = bundle::unpack(packed);
+    return true;
+}
+
+void Cloud::ChunkStore::retain(const std::vector<ChunkRef> &chunks)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    for (auto &chunk : chunks)
+    {
+        auto it = _refs.find(chunk.hash);
+        if (it != _refs.end())
+            it->second++;
+    }
+}
+
+void Cloud::ChunkStore::release(const std::vector<ChunkRef> &chunks)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    for (auto &chunk : chunks)
+    {
+        auto it = _refs.find(chunk.hash);
+        if (it == _refs.end())
+            continue;
+        if (--it->second == 0)
+        {
+            Util::FileUtil(pathOf(chunk.hash)).remove();
+            _refs.erase(it);
+        }
+    }
+}
+
+Cloud::ChunkReader::ChunkReader(const std::vector<ChunkRef> &chunks)
+    : _chunks(chunks), _size(0), _index(SIZE_MAX)
+{
+    for (auto &chunk : _chunks)
+    {
+        _offsets.push_back(_size);
+        _size += chunk.size;
+    }
+    ChunkStore::getInstance().retain(_chunks);
+}
+
+Cloud::ChunkReader::~ChunkReader()
+{
+    ChunkStore::getInstance().release(_chunks);
+}
+
+bool Cloud::ChunkReader::read(size_t offset, size_t len, std::string *out)
+{
+    out->clear();
+    len = offset < _size ? std::min(len, _size - offset) : 0;
+    while (len > 0)
+    {
+        size_t index = std::upper_bound(_offsets.begin(), _offsets.end(), offset) - _offsets.begin() - 1;
+        if (index != _index)
+        {
+            if (!ChunkStore::getInstance().get(_chunks[index].hash, &_data))
+            {
+                _logger->_error("分块 %s 读取失败", _chunks[index].hash.c_str());
+                return false;
+            }
+            _index = index;
+        }
+        size_t pos = offset - _offsets[index];
+        size_t n = std::min(len, _data.size() - pos);
+        out->append(_data, pos, n);
+        offset += n;
+        len -= n;
+    }
+    return true;
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include <iostream>
 #include <mutex>
+#include <map>
 #include "util.hpp"
 #include "log/ckflog.hpp"
 
@@ -25,6 +26,46 @@ namespace Cloud
         std::string _svr_ip;       // 服务端ip地址
         unsigned _svr_port;        // 服务端端口号
         std::string _manager_file; // 备份信息
+        std::string _journal_file; // 压缩/解压状态转换日志
+        std::string _queue_file;   // 压缩任务队列
+        std::string _session_dir;  // 分块上传会话目录(需与backup_dir在同一文件系统)
+        time_t _session_ttl;       // 分块上传会话无活动多久后过期
+        std::string _chunk_dir;    // 内容分块存储目录
+        size_t _chunk_threshold;   // 不小于该大小的上传文件按内容分块存储，0表示关闭
+        size_t _chunk_avg_size;    // 平均分块大小(最小为其1/4，最大为其4倍)
+        size_t _delta_block_size;  // 增量上传签名的默认块大小
+        unsigned _pack_codec;      // 压缩包使用的压缩算法(bundle算法名)
+        double _compress_cpu_budget; // 后台压缩可占用的CPU比例(单核)
+        size_t _compress_disk_bw;    // 后台压缩的磁盘带宽上限(字节/秒)，0表示不限
+        double _compress_busy_qps;   // 前台请求速率超过该值时暂停后台压缩
+        size_t _prefetch_depth;      // 预测下载时最多提前解压的文件个数，0表示关闭
+        time_t _prefetch_window;     // 修改时间相差在该秒数内的文件视为同一批上传
+        size_t _http_threads;        // HTTP工作线程个数(每个线程同一时刻服务一个连接)
+        size_t _http_queue;          // 等待工作线程的连接个数上限，超过则直接返回503
+        size_t _bulk_slots;          // 同时进行的大文件传输(上传/下载)请求个数
+        size_t _bulk_queue;          // 等待传输名额的请求个数上限，超过则返回503
+        size_t _bulk_min_size;       // 请求体或下载文件不小于该大小的请求视为大文件传输
+        time_t _retry_after;         // 503响应中建议客户端重试的秒数
+        std::string _server_mode;    // 服务端模型：thread(每连接一线程) / epoll(事件驱动)
+        size_t _event_loops;         // epoll模式的事件循环线程个数
+        size_t _event_workers;       // epoll模式执行请求处理函数的线程个数
+        size_t _keep_alive_max;      // 一个连接上最多处理的请求个数，0表示不限
+        time_t _keep_alive_timeout;  // keep-alive连接两次请求之间最长的空闲时间(秒)
+        time_t _read_timeout;        // 接收请求(请求头、请求体)时等待数据的超时时间(秒)
+        time_t _write_timeout;       // 发送响应时等待套接字可写的超时时间(秒)
+        bool _tcp_nodelay;           // 是否关闭Nagle算法
+        bool _tcp_cork;              // 是否在发送每个响应期间开启TCP_CORK，把响应头与响应体合并成满报文段
+        bool _h2c;                   // epoll模式是否接受明文HTTP/2(先验知识方式)
+        size_t _h2_max_streams;      // 一个HTTP/2连接上同时处理的请求(流)个数上限
+        size_t _shape_client_rate;   // 每个客户端(IP)单方向的传输速率上限(字节/秒)，0表示不限
+        size_t _shape_download_rate; // 下载总带宽(字节/秒)，按差额轮询分给各下载，0表示不限
+        size_t _shape_upload_rate;   // 上传总带宽(字节/秒)，0表示不限
+        size_t _shape_quantum;       // 差额轮询每轮分给一个传输的字节数
+        std::map<std::string, size_t> _shape_route_rates; // 按路径前缀限速(字节/秒)，上传与下载分别计，最长的前缀生效
+        std::string _io_engine;      // 文件I/O引擎：uring / blocking
+        std::string _www_dir;        // 前端页面目录
+        time_t _www_max_age;         // 前端页面的浏览器缓存时间(秒)
+        bool _www_watch;             // 是否监视前端页面目录，文件修改后自动重新加载
 
     public:
         time_t getHotTime() const;
@@ -35,6 +76,46 @@ namespace Cloud
         std::string getSvrIP() const;
         unsigned getSvrPort() const;
         std::string getManagerFile() const;
+        std::string getJournalFile() const;
+        std::string getQueueFile() const;
+        std::string getSessionDir() const;
+        time_t getSessionTTL() const;
+        std::string getChunkDir() const;
+        size_t getChunkThreshold() const;
+        size_t getChunkAvgSize() const;
+        size_t getDeltaBlockSize() const;
+        unsigned getPackCodec() const;
+        double getCompressCpuBudget() const;
+        size_t getCompressDiskBW() const;
+        double getCompressBusyQps() const;
+        size_t getPrefetchDepth() const;
+        time_t getPrefetchWindow() const;
+        size_t getHttpThreads() const;
+        size_t getHttpQueue() const;
+        size_t getBulkSlots() const;
+        size_t getBulkQueue() const;
+        size_t getBulkMinSize() const;
+        time_t getRetryAfter() const;
+        std::string getServerMode() const;
+        size_t getEventLoops() const;
+        size_t getEventWorkers() const;
+        size_t getKeepAliveMax() const;
+        time_t getKeepAliveTimeout() const;
+        time_t getReadTimeout() const;
+        time_t getWriteTimeout() const;
+        bool getTcpNodelay() const;
+        bool getTcpCork() const;
+        bool getH2c() const;
+        size_t getH2MaxStreams() const;
+        size_t getShapeClientRate() const;
+        size_t getShapeDownloadRate() const;
+        size_t getShapeUploadRate() const;
+        size_t getShapeQuantum() const;
+        const std::map<std::string, size_t> &getShapeRouteRates() const;
+        std::string getIOEngine() const;
+        std::string getWwwDir() const;
+        time_t getWwwMaxAge() const;
+        bool getWwwWatch() const;
 
     public:
         static Config *getInstance();
@@ -81,6 +162,69 @@ bool Cloud::Config::readConfigFile()
     _svr_ip = conf["svr_ip"].asString();
     _svr_port = conf["svr_port"].asUInt();
     _manager_file = conf["manager_file"].asString();
+    _journal_file = conf.get("journal_file", "./pack.journal").asString();
+    _queue_file = conf.get("queue_file", "./compress_queue.log").asString();
+    _session_dir = conf.get("session_dir", "./session_dir/").asString();
+    _session_ttl = (time_t)conf.get("session_ttl", 86400).asUInt();
+    _chunk_dir = conf.get("chunk_dir", "./chunk_dir/").asString();
+    _chunk_threshold = conf.get("chunk_threshold", 0).asUInt64();
+    _chunk_avg_size = conf.get("chunk_avg_size", 1 << 20).asUInt64();
+    _delta_block_size = conf.get("delta_block_size", 8192).asUInt64();
+    std::string codec = conf.get("pack_codec", "LZIP").asString();
+    _pack_codec = bundle::LZIP;
+    for (unsigned q = 0; q <= bundle::BZIP2; q++)
+    {
+        if (codec == bundle::name_of(q))
+            _pack_codec = q;
+    }
+    _compress_cpu_budget = conf.get("compress_cpu_budget", 0.5).asDouble();
+    _compress_disk_bw = conf.get("compress_disk_bw", 0).asUInt64();
+    _compress_busy_qps = conf.get("compress_busy_qps", 50).asDouble();
+    _prefetch_depth = conf.get("prefetch_depth", 4).asUInt();
+    _prefetch_window = (time_t)conf.get("prefetch_window", 60).asUInt();
+    _http_threads = std::max(2u, conf.get("http_threads", 16).asUInt());
+    _http_queue = conf.get("http_queue", 256).asUInt();
+    _bulk_slots = std::max(1u, conf.get("bulk_slots", 4).asUInt());
+    _bulk_queue = conf.get("bulk_queue", 8).asUInt();
+    // 线程模式下排队的传输请求也占着工作线程等待名额，传输通道(名额+排队)至多占用3/4的工作线程，
+    // 其余线程始终留给元数据请求
+    size_t bulk_max = _http_threads - std::max<size_t>(1, _http_threads / 4);
+    if (_bulk_slots + _bulk_queue > bulk_max)
+    {
+        DF_WARN("bulk_slots(%lu) + bulk_queue(%lu) 超过工作线程数的3/4(%lu)，已调低", _bulk_slots, _bulk_queue, bulk_max);
+        _bulk_slots = std::min(_bulk_slots, bulk_max);
+        _bulk_queue = bulk_max - _bulk_slots;
+    }
+    _bulk_min_size = conf.get("bulk_min_size", 1048576).asUInt64();
+    _retry_after = (time_t)conf.get("retry_after", 5).asUInt();
+    _server_mode = conf.get("server_mode", "thread").asString();
+    _event_loops = std::max(1u, conf.get("event_loops", 2).asUInt());
+    _event_workers = std::max(1u, conf.get("event_workers", 4).asUInt());
+    _keep_alive_max = conf.get("keep_alive_max", 10000).asUInt64();
+    _keep_alive_timeout = (time_t)std::max(1u, conf.get("keep_alive_timeout", 15).asUInt());
+    _read_timeout = (time_t)std::max(1u, conf.get("read_timeout", 30).asUInt());
+    _write_timeout = (time_t)std::max(1u, conf.get("write_timeout", 30).asUInt());
+    _tcp_nodelay = conf.get("tcp_nodelay", true).asBool();
+    _tcp_cork = conf.get("tcp_cork", false).asBool();
+    _h2c = conf.get("h2c", true).asBool();
+    _h2_max_streams = std::max<size_t>(1, conf.get("h2_max_streams", 128).asUInt64());
+    _shape_client_rate = conf.get("shape_client_rate", 0).asUInt64();
+    _shape_download_rate = conf.get("shape_download_rate", 0).asUInt64();
+    _shape_upload_rate = conf.get("shape_upload_rate", 0).asUInt64();
+    _shape_quantum = std::max<size_t>(4096, conf.get("shape_quantum", 65536).asUInt64());
+    const Json::Value &routes = conf["shape_route_rates"];
+    if (routes.isObject())
+    {
+        for (auto &prefix : routes.getMemberNames())
+        {
+            if (routes[prefix].asUInt64() > 0)
+                _shape_route_rates[prefix] = routes[prefix].asUInt64();
+        }
+    }
+    _io_engine = conf.get("io_engine", "uring").asString();
+    _www_dir = conf.get("www_dir", "../www/").asString();
+    _www_max_age = (time_t)conf.get("www_max_age", 86400).asUInt();
+    _www_watch = conf.get("www_watch", false).asBool();
     return true;
 }
 
@@ -134,4 +278,204 @@ unsigned Cloud::Config::getSvrPort() const
 std::string Cloud::Config::getManagerFile() const
 {
     return _manager_file;
-}
\ No newline at end of file
+}
+
+std::string Cloud::Config::getJournalFile() const
+{
+    return _journal_file;
+}
+
+std::string Cloud::Config::getQueueFile() const
+{
+    return _queue_file;
+}
+
+std::string Cloud::Config::getSessionDir() const
+{
+    return _session_dir;
+}
+
+time_t Cloud::Config::getSessionTTL() const
+{
+    return _session_ttl;
+}
+
+std::string Cloud::Config::getChunkDir() const
+{
+    return _chunk_dir;
+}
+
+size_t Cloud::Config::getChunkThreshold() const
+{
+    return _chunk_threshold;
+}
+
+size_t Cloud::Config::getChunkAvgSize() const
+{
+    return _chunk_avg_size;
+}
+
+size_t Cloud::Config::getDeltaBlockSize() const
+{
+    return _delta_block_size;
+}
+
+unsigned Cloud::Config::getPackCodec() const
+{
+    return _pack_codec;
+}
+
+double Cloud::Config::getCompressCpuBudget() const
+{
+    return _compress_cpu_budget;
+}
+
+size_t Cloud::Config::getCompressDiskBW() const
+{
+    return _compress_disk_bw;
+}
+
+double Cloud::Config::getCompressBusyQps() const
+{
+    return _compress_busy_qps;
+}
+
+size_t Cloud::Config::getPrefetchDepth() const
+{
+    return _prefetch_depth;
+}
+
+time_t Cloud::Config::getPrefetchWindow() const
+{
+    return _prefetch_window;
+}
+
+size_t Cloud::Config::getHttpThreads() const
+{
+    return _http_threads;
+}
+
+size_t Cloud::Config::getHttpQueue() const
+{
+    return _http_queue;
+}
+
+size_t Cloud::Config::getBulkSlots() const
+{
+    return _bulk_slots;
+}
+
+size_t Cloud::Config::getBulkQueue() const
+{
+    return _bulk_queue;
+}
+
+size_t Cloud::Config::getBulkMinSize() const
+{
+    return _bulk_min_size;
+}
+
+time_t Cloud::Config::getRetryAfter() const
+{
+    return _retry_after;
+}
+
+std::string Cloud::Config::getServerMode() const
+{
+    return _server_mode;
+}
+
+size_t Cloud::Config::getEventLoops() const
+{
+    return _event_loops;
+}
+
+size_t Cloud::Config::getEventWorkers() const
+{
+    return _event_workers;
+}
+
+size_t Cloud::Config::getKeepAliveMax() const
+{
+    return _keep_alive_max;
+}
+
+time_t Cloud::Config::getKeepAliveTimeout() const
+{
+    return _keep_alive_timeout;
+}
+
+time_t Cloud::Config::getReadTimeout() const
+{
+    return _read_timeout;
+}
+
+time_t Cloud::Config::getWriteTimeout() const
+{
+    return _write_timeout;
+}
+
+bool Cloud::Config::getTcpNodelay() const
+{
+    return _tcp_nodelay;
+}
+
+bool Cloud::Config::getTcpCork() const
+{
+    return _tcp_cork;
+}
+
+bool Cloud::Config::getH2c() const
+{
+    return _h2c;
+}
+
+size_t Cloud::Config::getH2MaxStreams() const
+{
+    return _h2_max_streams;
+}
+
+size_t Cloud::Config::getShapeClientRate() const
+{
+    return _shape_client_rate;
+}
+
+size_t Cloud::Config::getShapeDownloadRate() const
+{
+    return _shape_download_rate;
+}
+
+size_t Cloud::Config::getShapeUploadRate() const
+{
+    return _shape_upload_rate;
+}
+
+size_t Cloud::Config::getShapeQuantum() const
+{
+    return _shape_quantum;
+}
+
+const std::map<std::string, size_t> &Cloud::Config::getShapeRouteRates() const
+{
+    return _shape_route_rates;
+}
+
+std::string Cloud::Config::getIOEngine() const
+{
+    return _io_engine;
+}
+
+std::string Cloud::Config::getWwwDir() const
+{
+    return _www_dir;
+}
+
+time_t Cloud::Config::getWwwMaxAge() const
+{
+    return _www_max_age;
+}
+
+bool Cloud::Config::getWwwWatch() const
+{
+    return _www_watch;
+}
@@ -1,16 +1,27 @@
 #pragma once
 #include <iostream>
 #include <unordered_map>
+#include <unordered_set>
+#include <set>
 #include <memory>
+#include <functional>
 #include <pthread.h>
 #include "util.hpp"
+#include "fastjson.hpp"
 #include "config.hpp"
+#include "journal.hpp"
 #include "log/ckflog.hpp"
 
 extern ckflogs::Logger::Ptr _logger;
 
 namespace Cloud
 {
+    struct ChunkRef // 内容分块引用
+    {
+        std::string hash; // 分块内容的SHA-256
+        size_t size;      // 分块原始大小
+    };
+
     typedef struct BackupInfo // 备份文件数据
     {
         bool pack_flag;        // 文件是否已压缩的标志
@@ -21,12 +32,46 @@ namespace Cloud
         std::string real_path; // 文件实际存储路径
         std::string pack_path; // 文件压缩包存储路径
         std::string url;       // 文件url
+        std::string content_hash; // 文件内容的SHA-256(十六进制)，用于去重，为空表示未知
+        std::vector<ChunkRef> chunks; // 按内容分块存储时的分块列表，为空表示整文件存储
 
         BackupInfo();
         BackupInfo(const std::string &realPath);
 
     } BackupInfo;
     BackupInfo *createBackupInfo(const std::string &realPath);
+}
+
+namespace Util
+{
+    // 备份信息持久化格式，字段名与旧版(jsoncpp)一致；分块引用编码为 [hash, size]
+    template <>
+    struct JsonFields<Cloud::ChunkRef>
+    {
+        static constexpr bool as_array = true;
+        static constexpr auto fields = std::make_tuple(jsonField("hash", &Cloud::ChunkRef::hash),
+                                                       jsonField("size", &Cloud::ChunkRef::size));
+    };
+
+    template <>
+    struct JsonFields<Cloud::BackupInfo>
+    {
+        static constexpr bool as_array = false;
+        static constexpr auto fields = std::make_tuple(jsonField("pack_flag", &Cloud::BackupInfo::pack_flag),
+                                                       jsonField("is_packing", &Cloud::BackupInfo::is_packing),
+                                                       jsonField("fsize", &Cloud::BackupInfo::fsize),
+                                                       jsonField("atime", &Cloud::BackupInfo::atime),
+                                                       jsonField("mtime", &Cloud::BackupInfo::mtime),
+                                                       jsonField("real_path", &Cloud::BackupInfo::real_path),
+                                                       jsonField("pack_path", &Cloud::BackupInfo::pack_path),
+                                                       jsonField("url", &Cloud::BackupInfo::url),
+                                                       jsonField("content_hash", &Cloud::BackupInfo::content_hash),
+                                                       jsonField("chunks", &Cloud::BackupInfo::chunks));
+    };
+}
+
+namespace Cloud
+{
 
     class BackupInfoManager // 文件数据管理器
     {
@@ -34,21 +79,36 @@ namespace Cloud
         std::unordered_map<std::string, std::unique_ptr<BackupInfo>> _table; // url映射文件数据的表
         Util::FileUtil _manager_file;                                        // 持久化备份文件数据
         pthread_rwlock_t _rwlock;                                            // 读写锁
+        std::unordered_map<std::string, std::unordered_set<std::string>> _hash_index; // 内容哈希 -> 引用该内容的url
+        std::set<std::string> _urls;                                                  // 按url排序的索引，供scan按键续扫
+
+        void indexHash(const std::string &url, const std::string &oldHash, const std::string &newHash); // 维护内容哈希索引
 
     public:
         BackupInfoManager();
         ~BackupInfoManager();
         bool initLoad();                                            // 初始化文件数据（从备份文件中读取）
-        bool storage();                                             // 保持文件数据到本地（持久化）
+        bool recover();                                             // 启动时以磁盘为准修正备份信息（崩溃恢复）
+        bool storage();                                             // 保持文件数据到本地（持久化），调用方已加写锁
         bool insert(const std::string &key, const BackupInfo &val); // 插入一个文件数据
         bool update(const std::string &key, const BackupInfo &val); // 修改一个文件数据
+        bool updateBatch(const std::vector<BackupInfo> &vals);      // 修改一批文件数据，只持久化一次
         bool getOneByURL(const std::string &url, BackupInfo *val);
+        bool getSizeByURL(const std::string &url, size_t *fsize); // 只取文件大小，不复制整个文件数据(请求预分类用)
+        bool setPacking(const std::string &url, bool packing);    // 只改内存中的压缩中标记，不持久化(压缩任务以压缩调度器的队列为准)
         bool getOneByRealPath(const std::string &realPath, BackupInfo *val);
         bool getAll(std::vector<BackupInfo> *array);
+        size_t getIf(const std::function<bool(const BackupInfo &)> &pred, std::vector<BackupInfo> *array); // 只复制满足条件的文件数据
+        // 按游标分批获取：按url顺序取出排在*cursor之后的至多count个文件数据，*cursor更新为本批最后一个url(初始为空)，
+        // 返回是否还有后续；游标是url而不是位置，遍历期间一直存在的文件恰好返回一次，期间增删的文件可能有也可能没有
+        bool scan(std::string *cursor, size_t count, std::vector<BackupInfo> *array);
+        bool getByHash(const std::string &hash, std::vector<BackupInfo> *array); // 获取内容相同的所有文件数据
+        bool remove(const std::string &key);                                     // 删除一个文件数据
     };
 }
 
-Cloud::BackupInfo::BackupInfo() : is_packing(false)
+Cloud::BackupInfo::BackupInfo()
+    : pack_flag(false), is_packing(false), fsize(0), atime(0), mtime(0)
 {
 }
 
@@ -88,6 +148,11 @@ Cloud::BackupInfoManager::BackupInfoManager()
         _logger->_error("备份信息初始化失败");
         exit(-1);
     }
+    if (!recover())
+    {
+        _logger->_error("备份信息恢复失败");
+        exit(-1);
+    }
     _logger->_debug("数据管理模块-备份信息初始化成功, 当前文件个数 %d", _table.size());
 }
 
@@ -113,72 +178,125 @@ bool Cloud::BackupInfoManager::initLoad()
     if(backup.empty())//备份信息为空
         return true;
 
-    // 2.反序列为Json
-    Json::Value root;
-    if (!Util::JsonUtil::unserialize(backup, &root))
+    // 2.按字段表直接解析为文件数据数组
+    std::vector<BackupInfo> array;
+    if (!Util::FastJson::unserialize(backup, &array))
     {
         DF_ERROR("Json unserialize failed");
         return false;
     }
 
-    // 3.初始化
-    for (int i = 0; i < root.size(); i++)
+    // 3.初始化(刚从文件读出，不需要逐个持久化)
+    //   压缩中标记不以文件为准：上次进程的压缩任务由热点管理器按压缩调度器的队列重新提交
+    for (auto &bi : array)
     {
-        Json::Value item = root[i];
-
-        BackupInfo bi;
-        bi.atime = item["atime"].asUInt();
-        bi.mtime = item["mtime"].asUInt();
-        bi.fsize = item["fsize"].asUInt();
-        bi.pack_flag = item["pack_flag"].asBool();
-        bi.pack_path = item["pack_path"].asString();
-        bi.real_path = item["real_path"].asString();
-        bi.url = item["url"].asString();
-        insert(bi.url, bi);
+        if (_table.count(bi.url) != 0)
+            continue;
+        bi.is_packing = false;
+        std::string url = bi.url;
+        indexHash(url, "", bi.content_hash);
+        _urls.insert(url);
+        _table[url] = std::unique_ptr<BackupInfo>(new BackupInfo(std::move(bi)));
     }
 
     return true;
 }
 
-bool Cloud::BackupInfoManager::storage()
+bool Cloud::BackupInfoManager::recover()
 {
-    if (_table.empty())
+    Config *conf = Config::getInstance();
+
+    // 1.清理崩溃遗留的临时文件（未rename的临时文件一定是不完整的），以及没有任何备份信息引用的孤儿压缩包
+    std::unordered_set<std::string> packs;
+    for (auto &[k, v] : _table)
+        packs.insert(Util::FileUtil(v->pack_path).fileName());
+
+    for (const std::string &dir : {conf->getBackupDir(), conf->getPackDir()})
     {
-        DF_WARN("No BackupInfo need to storage");
-        return false;
+        Util::FileUtil dirfu(dir);
+        if (!dirfu.isExists())
+            continue;
+        std::vector<std::string> files;
+        dirfu.scanDirectory(files);
+        for (const std::string &file : files)
+        {
+            Util::FileUtil fu(file);
+            if (fu.isTempFile())
+            {
+                _logger->_warn("清理未完成的临时文件: %s", file.c_str());
+                fu.remove();
+            }
+            else if (dir == conf->getPackDir() && fu.isRegularFile() && packs.count(fu.fileName()) == 0)
+            {
+                _logger->_warn("清理孤儿压缩包: %s", file.c_str());
+                fu.remove();
+            }
+        }
     }
-    // 1.获取所有文件数据
-    std::vector<BackupInfo> array;
-    getAll(&array);
-
-    // 2.将文件数据转化为json对象（root视为Json数组）
-    Json::Value root;
 
-    Util::RDLockGuard(&this->_rwlock);
-    for (auto v : array)
+    // 2.只有日志中未完成的状态转换可能让备份信息与磁盘不一致：以磁盘上的实际文件为准修正这些url
+    //   目标文件都是原子写入的，因此存在即完整：原文件优先，其次压缩包
+    PackJournal &journal = PackJournal::getInstance();
+    std::vector<PackJournal::Entry> pending;
+    if (!journal.pending(&pending))
+        return false;
+    bool changed = false;
+    for (auto &e : pending)
     {
-        Json::Value item;
-        item["pack_flag"] = v.pack_flag;
-        item["fsize"] = v.fsize;
-        item["atime"] = v.atime;
-        item["mtime"] = v.mtime;
-        item["real_path"] = v.real_path;
-        item["pack_path"] = v.pack_path;
-        item["url"] = v.url;
-
-        root.append(item);
+        _logger->_warn("未完成的状态转换 %s: %s", PackJournal::opName(e.op).c_str(), e.url.c_str());
+        auto it = _table.find(e.url);
+        if (it == _table.end()) // 新文件的上传未登记，或删除已完成
+            continue;
+        BackupInfo &bi = *it->second;
+        if (!bi.chunks.empty()) // 分块存储的文件没有原文件与压缩包，由分块存储自行校验
+            continue;
+        bool hasReal = Util::FileUtil(bi.real_path).isExists();
+        bool hasPack = Util::FileUtil(bi.pack_path).isExists();
+
+        if (hasReal)
+        {
+            if (hasPack) // 转换未完成，删除多余的压缩包
+                Util::FileUtil(bi.pack_path).remove();
+            bi.pack_flag = false;
+        }
+        else if (hasPack)
+        {
+            bi.pack_flag = true;
+            bi.is_packing = false;
+        }
+        else
+        {
+            _logger->_error("%s: 原文件与压缩包均不存在，移除备份信息", bi.url.c_str());
+            indexHash(bi.url, bi.content_hash, "");
+            _urls.erase(bi.url);
+            _table.erase(it);
+        }
+        changed = true;
     }
 
-    // 3.序列化json
-    std::string str;
-    if (!Util::JsonUtil::serialize(root, &str))
+    // 3.修正后的状态落盘(表已清空时写出空数组)，清空日志
+    if (changed && !(_table.empty() ? _manager_file.setContentAtomic("[]") : storage()))
+        return false;
+    return journal.reset();
+}
+
+bool Cloud::BackupInfoManager::storage()
+{
+    if (_table.empty())
     {
-        DF_ERROR("Json serialize failed");
+        DF_WARN("No BackupInfo need to storage");
         return false;
     }
+    // 1.按字段表把所有文件数据直接编码为JSON数组(不复制文件数据，不构造Json::Value)
+    Util::JsonWriter writer;
+    writer.beginArray();
+    for (auto &[k, v] : _table)
+        Util::FastJson::write(writer, *v);
+    writer.endArray();
+    const std::string &str = writer.buffer();
 
-    // 4.持久化存储
-    if (!_manager_file.setContent(str))
+    // 2.持久化存储（原子替换，崩溃时不会留下写了一半的备份信息）
+    if (!_manager_file.setContentAtomic(str))
     {
         DF_ERROR("Set backup file failed");
         return false;
@@ -189,7 +307,7 @@ bool Cloud::BackupInfoManager::storage()
 
 bool Cloud::BackupInfoManager::insert(const std::string &key, const BackupInfo &val)
 {
-    Util::WRLockGuard(&this->_rwlock);
+    Util::WRLockGuard guard(&this->_rwlock);
     if (_table.count(key) != 0) // 已存在
     {
         DF_WARN("BackupInfo exists")
@@ -197,6 +315,8 @@ bool Cloud::BackupInfoManager::insert(const std::string &key, const BackupInfo &
     }
     BackupInfo *newbi = new BackupInfo(val);
     _table[key] = std::unique_ptr<BackupInfo>(newbi);
+    indexHash(key, "", val.content_hash);
+    _urls.insert(key);
     storage();
     return true;
 }
@@ -204,22 +324,67 @@ bool Cloud::BackupInfoManager::insert(const std::string &key, const BackupInfo &
 //有则替换，无则插入
 bool Cloud::BackupInfoManager::update(const std::string &key, const BackupInfo &val)
 {
-    Util::WRLockGuard(&this->_rwlock);
+    Util::WRLockGuard guard(&this->_rwlock);
     if (_table.count(key) == 0) // 不存在
     {
         _table[key] = std::unique_ptr<BackupInfo>(new BackupInfo(val));
+        indexHash(key, "", val.content_hash);
+        _urls.insert(key);
     }
     else//存在
     {
+        indexHash(key, _table[key]->content_hash, val.content_hash);
         *_table[key] = val;
     }
     storage();
     return true;
 }
 
+bool Cloud::BackupInfoManager::updateBatch(const std::vector<BackupInfo> &vals)
+{
+    Util::WRLockGuard guard(&this->_rwlock);
+    std::vector<std::unique_ptr<BackupInfo>> prev; // 修改前的备份信息(原本不存在则为空)，持久化失败时恢复
+    for (auto &val : vals)
+    {
+        if (_table.count(val.url) == 0) // 不存在
+        {
+            prev.emplace_back();
+            _table[val.url] = std::unique_ptr<BackupInfo>(new BackupInfo(val));
+            indexHash(val.url, "", val.content_hash);
+            _urls.insert(val.url);
+        }
+        else // 存在
+        {
+            prev.emplace_back(new BackupInfo(*_table[val.url]));
+            indexHash(val.url, _table[val.url]->content_hash, val.content_hash);
+            *_table[val.url] = val;
+        }
+    }
+    if (storage())
+        return true;
+
+    // 持久化失败：整批撤销，内存中的表与磁盘保持一致
+    for (size_t i = vals.size(); i-- > 0;)
+    {
+        const std::string &url = vals[i].url;
+        if (prev[i])
+        {
+            indexHash(url, _table[url]->content_hash, prev[i]->content_hash);
+            *_table[url] = *prev[i];
+        }
+        else
+        {
+            indexHash(url, _table[url]->content_hash, "");
+            _urls.erase(url);
+            _table.erase(url);
+        }
+    }
+    return false;
+}
+
 bool Cloud::BackupInfoManager::getOneByURL(const std::string &url, BackupInfo *val)
 {
-    Util::RDLockGuard(&this->_rwlock);
+    Util::RDLockGuard guard(&this->_rwlock);
 
     if (_table.count(url) == 0) // 不存在
     {
@@ -231,9 +396,29 @@ bool Cloud::BackupInfoManager::getOneByURL(const std::string &url, BackupInfo *v
     return true;
 }
 
+bool Cloud::BackupInfoManager::getSizeByURL(const std::string &url, size_t *fsize)
+{
+    Util::RDLockGuard guard(&this->_rwlock);
+    auto it = _table.find(url);
+    if (it == _table.end())
+        return false;
+    *fsize = it->second->fsize;
+    return true;
+}
+
+bool Cloud::BackupInfoManager::setPacking(const std::string &url, bool packing)
+{
+    Util::WRLockGuard guard(&this->_rwlock);
+    auto it = _table.find(url);
+    if (it == _table.end())
+        return false;
+    it->second->is_packing = packing;
+    return true;
+}
+
 bool Cloud::BackupInfoManager::getOneByRealPath(const std::string &realPath, BackupInfo *val)
 {
-    Util::RDLockGuard(&this->_rwlock);
+    Util::RDLockGuard guard(&this->_rwlock);
 
     for (auto &[k, v] : _table)
     {
@@ -248,7 +433,7 @@ bool Cloud::BackupInfoManager::getOneByRealPath(const std::string &realPath, Bac
 
 bool Cloud::BackupInfoManager::getAll(std::vector<BackupInfo> *array)
 {
-    Util::RDLockGuard(&this->_rwlock);
+    Util::RDLockGuard guard(&this->_rwlock);
 
     for (auto &[k, v] : _table)
     {
@@ -256,3 +441,86 @@ bool Cloud::BackupInfoManager::getAll(std::vector<BackupInfo> *array)
     }
     return true;
 }
+
+size_t Cloud::BackupInfoManager::getIf(const std::function<bool(const BackupInfo &)> &pred, std::vector<BackupInfo> *array)
+{
+    Util::RDLockGuard guard(&this->_rwlock);
+
+    size_t n = 0;
+    for (auto &[k, v] : _table)
+    {
+        if (pred(*v))
+        {
+            array->push_back(*v);
+            n++;
+        }
+    }
+    return n;
+}
+
+bool Cloud::BackupInfoManager::scan(std::string *cursor, size_t count, std::vector<BackupInfo> *array)
+{
+    Util::RDLockGuard guard(&this->_rwlock);
+
+    auto it = cursor->empty() ? _urls.begin() : _urls.upper_bound(*cursor);
+    for (size_t got = 0; it != _urls.end() && got < count; ++it, got++)
+    {
+        array->push_back(*_table.find(*it)->second);
+        *cursor = *it;
+    }
+    return it != _urls.end();
+}
+
+bool Cloud::BackupInfoManager::getByHash(const std::string &hash, std::vector<BackupInfo> *array)
+{
+    Util::RDLockGuard guard(&this->_rwlock);
+
+    auto it = _hash_index.find(hash);
+    if (hash.empty() || it == _hash_index.end())
+        return false;
+    for (auto &url : it->second)
+    {
+        auto bi = _table.find(url);
+        if (bi != _table.end())
+            array->push_back(*bi->second);
+    }
+    return true;
+}
+
+bool Cloud::BackupInfoManager::remove(const std::string &key)
+{
+    Util::WRLockGuard guard(&this->_rwlock);
+
+    auto it = _table.find(key);
+    if (it == _table.end()) // 不存在
+    {
+        DF_WARN("BackupInfo not exists")
+        return false;
+    }
+    indexHash(key, it->second->content_hash, "");
+    _urls.erase(key);
+    _table.erase(it);
+
+    // storage() 在表为空时不写文件，这里直接写出空数组
+    if (_table.empty())
+        return _manager_file.setContentAtomic("[]");
+    return storage();
+}
+
+void Cloud::BackupInfoManager::indexHash(const std::string &url, const std::string &oldHash, const std::string &newHash)
+{
+    if (oldHash == newHash)
+        return;
+    if (!oldHash.empty())
+    {
+        auto it = _hash_index.find(oldHash);
+        if (it != _hash_index.end())
+        {
+            it->second.erase(url);
+            if (it->second.empty())
+                _hash_index.erase(it);
+        }
+    }
+    if (!newHash.empty())
+        _hash_index[newHash].insert(url);
+}
\ No newline at end of file
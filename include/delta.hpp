@@ -0,0 +1,275 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+#include "util.hpp"
+
+namespace Util
+{
+    // rsync 式增量传输
+    // 1.服务端把已存储的版本按固定块大小切分，返回每块的 弱校验和(可滚动) + 强校验和 —— 签名
+    // 2.客户端在新版本上滚动计算弱校验和，命中后再比对强校验和，相同的块只发送块号，其余发送原始数据 —— 增量
+    // 3.服务端按增量从旧版本复制块、写入原始数据，重建出新版本
+    //
+    // 增量格式(小端)：
+    //   'C' u32 起始块号 u32 块数   复制旧版本中连续的若干块
+    //   'L' u32 长度 数据          原始数据
+    class Delta
+    {
+    public:
+        struct Block
+        {
+            uint32_t weak;      // 弱校验和
+            std::string strong; // 强校验和：SHA-256 前16字节(十六进制)
+        };
+        static const char OP_COPY = 'C';
+        static const char OP_LITERAL = 'L';
+
+        static uint32_t weakSum(const char *data, size_t len);
+        static uint32_t rollSum(uint32_t sum, size_t len, uint8_t out, uint8_t in); // 窗口右移一个字节
+        static std::string strongSum(const char *data, size_t len);
+
+        // 客户端：根据旧版本签名生成新版本的增量
+        static std::string encode(const std::vector<Block> &sig, size_t block_size, const std::string &data);
+    };
+
+    // 流式应用增量：增量数据可以任意切分后依次传入
+    class DeltaApplier
+    {
+    public:
+        using BaseReader = std::function<bool(size_t offset, size_t len, std::string *out)>; // 读取旧版本
+        using Sink = std::function<bool(const char *data, size_t len)>;                      // 写出新版本
+
+        DeltaApplier(size_t block_size, size_t block_num, BaseReader reader, Sink sink);
+        bool feed(const char *data, size_t len);
+        bool finish(); // 增量是否完整结束
+        const std::string &error() const { return _error; }
+
+    private:
+        bool fail(const std::string &msg);
+        bool copy(uint32_t index, uint32_t count);
+
+    private:
+        size_t _block_size;
+        size_t _block_num;
+        BaseReader _reader;
+        Sink _sink;
+        std::string _header;    // 未接收完整的操作头
+        size_t _literal_remain; // 当前原始数据还剩多少字节
+        std::string _buf;
+        std::string _error;
+    };
+}
+
+uint32_t Util::Delta::weakSum(const char *data, size_t len)
+{
+    // a = Σx_i, b = Σ(len-i)·x_i，各取低16位
+    uint32_t a = 0, b = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        a += (uint8_t)data[i];
+        b += a;
+    }
+    return (a & 0xffff) | (b << 16);
+}
+
+uint32_t Util::Delta::rollSum(uint32_t sum, size_t len, uint8_t out, uint8_t in)
+{
+    uint32_t a = sum & 0xffff, b = sum >> 16;
+    a = (a - out + in) & 0xffff;
+    b = (b - (uint32_t)len * out + a) & 0xffff;
+    return a | (b << 16);
+}
+
+std::string Util::Delta::strongSum(const char *data, size_t len)
+{
+    Util::Hasher hasher;
+    hasher.update(data, len);
+    return hasher.hexdigest().substr(0, 32);
+}
+
+std::string Util::Delta::encode(const std::vector<Block> &sig, size_t block_size, const std::string &data)
+{
+    std::unordered_multimap<uint32_t, uint32_t> index; // 弱校验和 -> 块号
+    for (uint32_t i = 0; i < sig.size(); i++)
+        index.emplace(sig[i].weak, i);
+
+    std::string out, literal;
+    int64_t copy_begin = -1; // 待输出的连续复制
+    uint32_t copy_count = 0;
+
+    auto putU32 = [&out](uint32_t v)
+    {
+        char b[4] = {(char)v, (char)(v >> 8), (char)(v >> 16), (char)(v >> 24)};
+        out.append(b, 4);
+    };
+    auto flushLiteral = [&]()
+    {
+        if (literal.empty())
+            return;
+        out += OP_LITERAL;
+        putU32(literal.size());
+        out += literal;
+        literal.clear();
+    };
+    auto flushCopy = [&]()
+    {
+        if (copy_begin < 0)
+            return;
+        out += OP_COPY;
+        putU32(copy_begin);
+        putU32(copy_count);
+        copy_begin = -1;
+        copy_count = 0;
+    };
+
+    size_t pos = 0;
+    size_t win = std::min(block_size, data.size());
+    uint32_t sum = weakSum(data.data(), win);
+    while (pos < data.size())
+    {
+        // 窗口为一个块长(到达末尾时更短，可与旧版本末尾的短块匹配)
+        int64_t match = -1;
+        auto range = index.equal_range(sum);
+        if (range.first != range.second)
+        {
+            std::string strong = strongSum(data.data() + pos, win);
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                if (sig[it->second].strong == strong)
+                {
+                    match = it->second;
+                    break;
+                }
+            }
+        }
+
+        if (match >= 0)
+        {
+            flushLiteral();
+            if (copy_begin >= 0 && copy_begin + copy_count == (uint32_t)match)
+            {
+                copy_count++;
+            }
+            else
+            {
+                flushCopy();
+                copy_begin = match;
+                copy_count = 1;
+            }
+            pos += win;
+            win = std::min(block_size, data.size() - pos);
+            sum = weakSum(data.data() + pos, win);
+            continue;
+        }
+
+        // 未命中：输出一个字节的原始数据，窗口右移
+        flushCopy();
+        literal += data[pos];
+        if (pos + win < data.size())
+        {
+            sum = rollSum(sum, win, data[pos], data[pos + win]);
+        }
+        else
+        {
+            win--; // 已到末尾，窗口缩短
+            sum = weakSum(data.data() + pos + 1, win);
+        }
+        pos++;
+        if (literal.size() >= block_size * 16)
+            flushLiteral();
+    }
+    flushCopy();
+    flushLiteral();
+    return out;
+}
+
+Util::DeltaApplier::DeltaApplier(size_t block_size, size_t block_num, BaseReader reader, Sink sink)
+    : _block_size(block_size), _block_num(block_num), _reader(reader), _sink(sink), _literal_remain(0)
+{
+}
+
+bool Util::DeltaApplier::fail(const std::string &msg)
+{
+    if (_error.empty())
+        _error = msg;
+    return false;
+}
+
+bool Util::DeltaApplier::copy(uint32_t index, uint32_t count)
+{
+    if ((size_t)index + count > _block_num)
+        return fail("copy out of range");
+    // 连续的块合并读取，单次最多读取16块
+    for (uint32_t i = 0; i < count; i += 16)
+    {
+        uint32_t n = std::min<uint32_t>(16, count - i);
+        if (!_reader((size_t)(index + i) * _block_size, (size_t)n * _block_size, &_buf))
+            return fail("read base failed");
+        if (!_sink(_buf.data(), _buf.size()))
+            return fail("write failed");
+    }
+    return true;
+}
+
+bool Util::DeltaApplier::feed(const char *data, size_t len)
+{
+    if (!_error.empty())
+        return false;
+
+    while (len > 0)
+    {
+        // 1.原始数据直接写出
+        if (_literal_remain > 0)
+        {
+            size_t n = std::min(len, _literal_remain);
+            if (!_sink(data, n))
+                return fail("write failed");
+            _literal_remain -= n;
+            data += n;
+            len -= n;
+            continue;
+        }
+
+        // 2.接收操作头
+        if (_header.empty() && *data != Delta::OP_COPY && *data != Delta::OP_LITERAL)
+            return fail("bad opcode");
+        size_t full = (_header.empty() ? *data : _header[0]) == Delta::OP_COPY ? 9 : 5;
+        size_t n = std::min(len, full - _header.size());
+        _header.append(data, n);
+        data += n;
+        len -= n;
+        if (_header.size() < full)
+            continue;
+
+        auto getU32 = [this](size_t pos)
+        {
+            const uint8_t *p = (const uint8_t *)_header.data() + pos;
+            return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+        };
+        if (_header[0] == Delta::OP_COPY)
+        {
+            if (!copy(getU32(1), getU32(5)))
+                return false;
+        }
+        else
+        {
+            _literal_remain = getU32(1);
+        }
+        _header.clear();
+    }
+    return true;
+}
+
+bool Util::DeltaApplier::finish()
+{
+    if (!_error.empty())
+        return false;
+    if (!_header.empty() || _literal_remain > 0)
+        return fail("truncated delta");
+    return true;
+}
@@ -0,0 +1,1958 @@
+#pragma once
+#include <iostream>
+#include <memory>
+#include <regex>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <unordered_map>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include "httplib.h"
+#include "util.hpp"
+#include "workerpool.hpp"
+#include "h2.hpp"
+#include "log/ckflog.hpp"
+
+extern ckflogs::Logger::Ptr _logger;
+
+namespace Cloud
+{
+    // 路由表项：两种服务端模型共用同一张路由表
+    struct Route
+    {
+        std::string method;
+        std::string pattern;
+        httplib::Server::Handler handler;                 // 请求体已读入 req.body
+        httplib::Server::HandlerWithContentReader reader; // 由处理函数流式读取请求体
+    };
+
+    // 连接层参数：keep-alive、超时与TCP选项
+    struct ConnOptions
+    {
+        size_t keep_alive_max = 10000;  // 一个连接上最多处理的请求个数，0表示不限
+        time_t keep_alive_timeout = 15; // 两次请求之间的空闲超时
+        time_t read_timeout = 30;       // 请求未接收完整时的超时
+        time_t write_timeout = 30;      // 响应发送停滞的超时
+        bool tcp_nodelay = true;
+        bool tcp_cork = false; // 发送每个响应期间开启TCP_CORK
+        bool h2c = true;              // 是否接受明文HTTP/2(先验知识，连接以HTTP/2前言开头)
+        size_t h2_max_streams = 128;  // HTTP/2连接上同时处理的流个数上限
+    };
+
+    // 事件驱动的HTTP服务端(epoll，非阻塞套接字，边缘触发，支持keep-alive)
+    // 每个事件循环线程持有一个 SO_REUSEPORT 监听套接字，由内核在各循环间分配连接；
+    // 读请求、写响应都在事件循环中完成，处理函数(可能读写磁盘)交给工作线程执行，
+    // 因此大量慢速连接只占用连接状态，不占用线程
+    // 连接以HTTP/2前言开头时切换为h2c：一个连接上的多个请求(流)并发交给工作线程处理，
+    // 响应按流轮流分帧发送，大量小文件的请求/上传共用一个连接，请求头经HPACK压缩
+    // 请求体在事件循环中接收并限速(setBodyGate)：HTTP/1.x被限速时停止读取该连接，HTTP/2暂缓归还该流的接收窗口
+    // HTTP/1.x的分块编码请求体边接收边解码；多区间Range请求以 multipart/byteranges 逐个区间读取内容提供者
+    // 限制：h2c不支持Upgrade方式与服务端推送
+    class EventServer
+    {
+    public:
+        // 请求体限速：接收请求体前在事件循环中调用，参数为剩余长度，返回本次允许接收的字节数，0表示被限速、稍后重试
+        using BodyGate = std::function<size_t(size_t want)>;
+
+        EventServer(const std::vector<Route> &routes, size_t loops, size_t workers, const ConnOptions &opts);
+        ~EventServer();
+        void setRequestHook(std::function<void(const httplib::Request &)> hook) { _hook = hook; }
+        void setBodyGate(std::function<BodyGate(const httplib::Request &)> factory) { _gate = factory; } // 为每个有请求体的请求创建
+        bool listen(const std::string &host, int port); // 阻塞直到 stop
+        void stop();
+        static bool inLoop() { return _in_loop; } // 当前线程是否不能阻塞(事件循环线程，或正在为其读取内容提供者的工作线程)
+
+    private:
+        struct Conn;
+        using ConnPtr = std::shared_ptr<Conn>;
+        struct H2Session;
+        class Loop;
+
+        bool route(Conn *conn);                      // 查找路由，设置 req.matches
+        void handle(Conn *conn);                     // 工作线程中执行处理函数
+        static bool readBody(Conn *conn, const httplib::ContentReceiver &receiver); // 依次交出请求体
+
+    private:
+        std::vector<std::pair<std::regex, Route>> _routes;
+        size_t _loop_num;
+        ConnOptions _opts;
+        std::function<void(const httplib::Request &)> _hook;
+        std::function<BodyGate(const httplib::Request &)> _gate;
+        std::unique_ptr<WorkerPool> _workers;
+        std::vector<std::unique_ptr<Loop>> _loops;
+        std::atomic<bool> _running;
+        static inline thread_local bool _in_loop = false;
+    };
+}
+
+// HTTP/2连接状态，只在事件循环线程中访问
+struct Cloud::EventServer::H2Session
+{
+    static const uint32_t stream_window = 1 << 20; // 本端每个流的接收窗口
+    static const uint32_t conn_window = 16 << 20;  // 本端连接级接收窗口
+    static const size_t send_buffer = 256 * 1024;  // 套接字发送缓冲中最多积压的帧数据，其余留在各流中
+
+    HpackDecoder decoder;
+    HpackEncoder encoder;
+    std::unordered_map<uint32_t, ConnPtr> streams; // 未结束的流
+    std::deque<uint32_t> ready;                    // 有响应数据待发送的流，轮流各发一帧
+    uint32_t last_stream = 0;                      // 已接收的最大流ID
+    int64_t send_window = H2::default_window;      // 连接级发送窗口
+    int64_t peer_window = H2::default_window;      // 对端 SETTINGS_INITIAL_WINDOW_SIZE
+    size_t peer_frame = H2::default_frame_size;    // 对端 SETTINGS_MAX_FRAME_SIZE
+    size_t recv_unacked = 0;                       // 已接收、尚未以WINDOW_UPDATE归还的字节数
+    std::string header_block;                      // 等待CONTINUATION的头部块
+    uint32_t header_stream = 0;                    // 头部块所属的流，0表示没有
+    bool header_end_stream = false;
+    bool goaway = false; // 已收到或发送GOAWAY，不再接受新的流
+};
+
+struct Cloud::EventServer::Conn
+{
+    enum State
+    {
+        READ_HEAD, // 等待请求头
+        READ_BODY, // 接收请求体
+        HANDLING,  // 处理函数执行中(仅工作线程访问请求与响应)
+        WRITE      // 发送响应
+    };
+    static const size_t spool_threshold = 1 << 20; // 请求体超过该大小则暂存到临时文件
+    static const size_t reuse_limit = 256 * 1024;  // 请求之间保留的缓冲区容量上限
+
+    int fd = -1;
+    State state = READ_HEAD;
+    bool peer_closed = false; // 对端已关闭或出错
+    time_t last_active = 0;
+    std::string remote_addr;
+    int remote_port = 0;
+    std::string in; // 已接收未解析的数据
+
+    // 当前请求
+    httplib::Request req;
+    httplib::Response res;
+    const Route *route = nullptr;
+    size_t body_len = 0;
+    size_t body_recv = 0;
+    FILE *spool = nullptr;   // 请求体临时文件，为空则请求体在 req.body
+    BodyGate gate;               // 请求体限速，为空表示不限
+    bool chunked = false;        // 请求体为分块编码(长度未知)
+    enum
+    {
+        CHUNK_SIZE,   // 等待分块长度行
+        CHUNK_DATA,   // 分块数据
+        CHUNK_CRLF,   // 分块数据之后的空行
+        CHUNK_TRAILER // 最后一块之后的trailer，空行结束
+    } chunk_state = CHUNK_SIZE;
+    size_t chunk_left = 0; // 当前分块未接收的长度
+    size_t body_credit = 0;      // 已获许可、尚未接收(HTTP/2：尚未归还窗口)的字节数
+    bool body_throttled = false; // 请求体被限速，已在 _throttled 中等待重试
+    bool keep_alive = true;
+    size_t requests = 0; // 该连接上已接收的请求个数
+    bool corked = false;
+
+    // 当前响应
+    std::string out; // 待发送的数据
+    size_t out_pos = 0;
+    int file_fd = -1; // 待 sendfile 的文件区间
+    off_t file_off = 0;
+    size_t file_len = 0;
+    size_t prov_off = 0; // 内容提供者的读取进度
+    size_t prov_end = 0;
+    bool prov_done = true;
+    struct Part
+    {
+        std::string head; // 区间之前的分隔行与头部
+        size_t off = 0;
+        size_t len = 0;
+    };
+    std::vector<Part> parts; // 多区间响应：依次发送的区间，最后一项只有结束分隔行
+    size_t part = 0;         // 下一个要发送的区间
+    std::unique_ptr<httplib::detail::compressor> compressor; // 分块响应的压缩器
+    bool pulling = false;        // 工作线程正在读取内容提供者，期间事件循环不访问响应与发送缓冲区，也不释放连接
+    bool pull_ok = true;         // 最近一次读取的结果
+    bool pull_throttled = false; // 最近一次读取被限速，未给出数据
+
+    // HTTP/2：连接持有会话状态；每个流也是一个Conn(没有套接字)，复用请求、响应与内容提供者的处理
+    std::unique_ptr<H2Session> h2;
+    struct
+    {
+        uint32_t id = 0; // 非0表示这是一个HTTP/2流
+        std::weak_ptr<Conn> conn;
+        int64_t send_window = 0;
+        size_t recv_unacked = 0;
+        bool queued = false;     // 是否在 H2Session::ready 中
+        bool end_stream = false; // 对端已结束发送(请求完整或流已被对端重置)
+    } stream;
+
+    ~Conn()
+    {
+        if (spool)
+            fclose(spool);
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    // 缓冲区清空后留给下一个请求使用，过大的释放
+    static void recycle(std::string &buf)
+    {
+        if (buf.capacity() > reuse_limit)
+            std::string().swap(buf);
+        else
+            buf.clear();
+    }
+
+    void reset()
+    {
+        if (res.content_provider_resource_releaser_)
+            res.content_provider_resource_releaser_(res.content_provider_success_);
+        // 同一连接上连续的小请求复用请求体、响应体与发送缓冲区，不再逐个请求重新分配
+        std::string req_body, res_body;
+        req_body.swap(req.body);
+        res_body.swap(res.body);
+        req = httplib::Request();
+        res = httplib::Response();
+        recycle(req_body);
+        recycle(res_body);
+        req.body.swap(req_body);
+        res.body.swap(res_body);
+        route = nullptr;
+        body_len = body_recv = 0;
+        gate = nullptr;
+        body_credit = 0;
+        body_throttled = false;
+        chunked = false;
+        chunk_state = CHUNK_SIZE;
+        chunk_left = 0;
+        if (spool)
+            fclose(spool);
+        spool = nullptr;
+        recycle(out);
+        out_pos = 0;
+        file_fd = -1;
+        file_len = 0;
+        prov_off = prov_end = 0;
+        prov_done = true;
+        parts.clear();
+        part = 0;
+        compressor.reset();
+        state = READ_HEAD;
+    }
+};
+
+// 事件循环：一个epoll实例 + 一个监听套接字 + 一个用于接收处理完成通知的eventfd
+class Cloud::EventServer::Loop
+{
+public:
+    Loop(EventServer *server) : _server(server) {}
+    ~Loop();
+    bool open(const std::string &host, int port);
+    void run();
+    void post(const ConnPtr &conn); // 工作线程：处理函数执行完毕
+
+private:
+    void accept();
+    void onEvent(const ConnPtr &conn, uint32_t events);
+    void onReadable(const ConnPtr &conn);
+    void process(const ConnPtr &conn);   // 解析已接收的数据，推进状态
+    bool parseHead(const ConnPtr &conn); // 解析请求头，返回false表示数据不完整
+    bool readChunked(const ConnPtr &conn); // 解码分块编码的请求体，返回true表示请求体已完整
+    bool credit(const ConnPtr &conn, size_t want, size_t *n); // 请求体限速：本次最多接收*n字节，被限速返回false
+    void appendBody(const ConnPtr &conn, const char *data, size_t len); // 保存一段请求体(超过阈值转存临时文件)，出错时已回复
+    int setupRequest(Conn *conn);        // 解析请求目标并查找路由，返回0或错误状态码(HTTP/1.x与HTTP/2共用)
+    void dispatch(const ConnPtr &conn);
+    void respond(const ConnPtr &conn);   // 处理函数返回后：确定状态码、区间、编码，生成响应头
+    void prepare(Conn *conn, bool *chunked, size_t *length); // 确定响应的实体内容与长度
+    void error(const ConnPtr &conn, int status);
+    bool pull(Conn *conn, bool *throttled); // 从内容提供者取下一段数据，提供者本次未给出数据(被限速)时置throttled
+    void fetch(const ConnPtr &conn);        // 在工作线程中执行 pull(解压、压缩、读盘)，完成后经eventfd通知事件循环
+    void resume(const ConnPtr &conn);       // 事件循环：内容读取完成，继续发送
+    void flush(const ConnPtr &conn);
+    void finish(const ConnPtr &conn);    // 响应发送完毕
+    void close(const ConnPtr &conn);
+    void sweep();                        // 关闭空闲超时的连接
+
+    // HTTP/2
+    void h2Start(const ConnPtr &conn);
+    void h2Process(const ConnPtr &conn);                                                 // 解析已接收的帧
+    uint32_t h2Frame(const ConnPtr &conn, const H2::FrameHeader &fh, const char *payload); // 返回0或连接错误码
+    uint32_t h2Request(const ConnPtr &conn);                                             // 头部块接收完整：创建流
+    void h2Credit(const ConnPtr &conn, const ConnPtr &stream); // 归还流的接收窗口，请求体被限速时暂缓
+    void h2Respond(const ConnPtr &stream);
+    bool h2Fill(const ConnPtr &conn);                         // 各流轮流分帧写入发送缓冲，返回是否写入了数据
+    void h2Queue(const ConnPtr &conn, const ConnPtr &stream); // 流有数据待发送
+    void h2Close(const ConnPtr &conn, const ConnPtr &stream, bool success);
+    void h2Goaway(const ConnPtr &conn, uint32_t error);      // 连接错误：发送GOAWAY并关闭
+
+private:
+    EventServer *_server;
+    int _epfd = -1;
+    int _listen_fd = -1;
+    int _event_fd = -1;
+    std::unordered_map<int, ConnPtr> _conns;
+    std::mutex _mutex;
+    std::vector<ConnPtr> _done; // 处理完成待发送响应的连接
+    std::vector<ConnPtr> _pulled; // 内容读取完成待继续发送的连接(或HTTP/2流)
+    std::vector<ConnPtr> _throttled; // 被限速、稍后重试的连接：重新读取内容提供者，或继续接收请求体
+};
+
+Cloud::EventServer::EventServer(const std::vector<Route> &routes, size_t loops, size_t workers, const ConnOptions &opts)
+    : _loop_num(loops), _opts(opts), _running(false)
+{
+    for (auto &r : routes)
+        _routes.emplace_back(std::regex(r.pattern), r);
+    // 工作线程复用连接线程池的实现，排队不设上限(连接数已由事件循环承载)
+    _workers.reset(new WorkerPool(workers, SIZE_MAX, 0));
+}
+
+Cloud::EventServer::~EventServer()
+{
+    stop();
+    _workers->shutdown();
+}
+
+bool Cloud::EventServer::listen(const std::string &host, int port)
+{
+    for (size_t i = 0; i < _loop_num; i++)
+    {
+        _loops.emplace_back(new Loop(this));
+        if (!_loops.back()->open(host, port))
+            return false;
+    }
+    _running = true;
+    std::vector<std::thread> threads;
+    for (auto &loop : _loops)
+        threads.emplace_back(&Loop::run, loop.get());
+    for (auto &thr : threads)
+        thr.join();
+    return true;
+}
+
+void Cloud::EventServer::stop()
+{
+    _running = false;
+}
+
+bool Cloud::EventServer::route(Conn *conn)
+{
+    auto &req = conn->req;
+    std::string method = req.method == "HEAD" ? "GET" : req.method;
+    for (auto &[regex, r] : _routes)
+    {
+        if (r.method == method && std::regex_match(req.path, req.matches, regex))
+        {
+            conn->route = &r;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Cloud::EventServer::readBody(Conn *conn, const httplib::ContentReceiver &receiver)
+{
+    if (conn->spool == nullptr)
+        return conn->req.body.empty() || receiver(conn->req.body.data(), conn->req.body.size());
+    rewind(conn->spool);
+    std::vector<char> buf(64 * 1024);
+    size_t n;
+    while ((n = fread(buf.data(), 1, buf.size(), conn->spool)) > 0)
+    {
+        if (!receiver(buf.data(), n))
+            return false;
+    }
+    return !ferror(conn->spool);
+}
+
+void Cloud::EventServer::handle(Conn *conn)
+{
+    auto &req = conn->req;
+    auto &res = conn->res;
+    try
+    {
+        if (conn->route->reader)
+        {
+            httplib::ContentReader reader(
+                [conn](httplib::ContentReceiver receiver)
+                { return readBody(conn, receiver); },
+                [conn](httplib::MultipartContentHeader header, httplib::ContentReceiver receiver)
+                {
+                    std::string boundary;
+                    if (!httplib::detail::parse_multipart_boundary(conn->req.get_header_value("Content-Type"), boundary))
+                        return false;
+                    httplib::detail::MultipartFormDataParser parser;
+                    parser.set_boundary(std::move(boundary));
+                    return readBody(conn, [&](const char *data, size_t len)
+                                    { return parser.parse(data, len, receiver, header); }) &&
+                           parser.is_valid();
+                });
+            conn->route->reader(req, res, reader);
+        }
+        else
+        {
+            conn->route->handler(req, res);
+        }
+    }
+    catch (std::exception &e)
+    {
+        _logger->_error("请求处理异常 %s: %s", req.path.c_str(), e.what());
+        res = httplib::Response();
+        res.status = 500;
+    }
+}
+
+Cloud::EventServer::Loop::~Loop()
+{
+    for (int fd : {_epfd, _listen_fd, _event_fd})
+    {
+        if (fd >= 0)
+            ::close(fd);
+    }
+}
+
+bool Cloud::EventServer::Loop::open(const std::string &host, int port)
+{
+    _listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int on = 1;
+    setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1 ||
+        bind(_listen_fd, (sockaddr *)&addr, sizeof(addr)) < 0 || ::listen(_listen_fd, 1024) < 0)
+    {
+        _logger->_error("监听失败 %s:%d %s", host.c_str(), port, strerror(errno));
+        return false;
+    }
+
+    _epfd = epoll_create1(EPOLL_CLOEXEC);
+    _event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = _listen_fd;
+    epoll_ctl(_epfd, EPOLL_CTL_ADD, _listen_fd, &ev);
+    ev.data.fd = _event_fd;
+    epoll_ctl(_epfd, EPOLL_CTL_ADD, _event_fd, &ev);
+    return _epfd >= 0 && _event_fd >= 0;
+}
+
+void Cloud::EventServer::Loop::run()
+{
+    std::vector<epoll_event> events(1024);
+    time_t last_sweep = time(nullptr);
+    _in_loop = true;
+    while (_server->_running)
+    {
+        // 有被限速的连接时缩短等待，及时重试
+        int n = epoll_wait(_epfd, events.data(), events.size(), _throttled.empty() ? 1000 : 5);
+        for (int i = 0; i < n; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == _listen_fd)
+            {
+                accept();
+            }
+            else if (fd == _event_fd)
+            {
+                uint64_t v;
+                while (read(_event_fd, &v, sizeof(v)) > 0)
+                    ;
+                std::vector<ConnPtr> done, pulled;
+                {
+                    std::unique_lock<std::mutex> lck(_mutex);
+                    done.swap(_done);
+                    pulled.swap(_pulled);
+                }
+                for (auto &conn : done)
+                    respond(conn);
+                for (auto &conn : pulled)
+                    resume(conn);
+            }
+            else
+            {
+                auto it = _conns.find(fd);
+                if (it == _conns.end())
+                    continue;
+                ConnPtr conn = it->second; // 处理过程中连接可能从表中移除
+                onEvent(conn, events[i].events);
+            }
+        }
+        if (!_throttled.empty())
+        {
+            std::vector<ConnPtr> throttled;
+            throttled.swap(_throttled);
+            for (auto &conn : throttled)
+            {
+                if (conn->peer_closed)
+                    continue;
+                if (conn->body_throttled && conn->state == Conn::READ_BODY)
+                {
+                    conn->body_throttled = false;
+                    if (conn->stream.id)
+                    {
+                        ConnPtr parent = conn->stream.conn.lock();
+                        if (parent && !parent->peer_closed)
+                        {
+                            h2Credit(parent, conn);
+                            flush(parent);
+                        }
+                        continue;
+                    }
+                    process(conn);
+                    if (!conn->body_throttled)
+                        onReadable(conn); // 边缘触发：内核缓冲区中积压的数据不会再有事件通知
+                }
+                else if (conn->stream.id)
+                {
+                    // HTTP/2流：重新排队，由连接的 h2Fill 再次读取
+                    ConnPtr parent = conn->stream.conn.lock();
+                    if (parent && !parent->peer_closed)
+                    {
+                        h2Queue(parent, conn);
+                        flush(parent);
+                    }
+                }
+                else if (conn->state == Conn::WRITE)
+                {
+                    flush(conn);
+                }
+            }
+        }
+        if (time(nullptr) != last_sweep)
+        {
+            last_sweep = time(nullptr);
+            sweep();
+        }
+    }
+}
+
+void Cloud::EventServer::Loop::accept()
+{
+    while (true)
+    {
+        sockaddr_in addr{};
+        socklen_t len = sizeof(addr);
+        int fd = accept4(_listen_fd, (sockaddr *)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                _logger->_warn("accept失败 %s", strerror(errno));
+            return;
+        }
+        int on = 1;
+        if (_server->_opts.tcp_nodelay)
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        auto conn = std::make_shared<Conn>();
+        conn->fd = fd;
+        conn->last_active = time(nullptr);
+        char ip[INET_ADDRSTRLEN] = {0};
+        inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+        conn->remote_addr = ip;
+        conn->remote_port = ntohs(addr.sin_port);
+        _conns[fd] = conn;
+
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fd;
+        epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+void Cloud::EventServer::Loop::onEvent(const ConnPtr &conn, uint32_t events)
+{
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        onReadable(conn);
+    if (!conn->peer_closed && (events & EPOLLOUT))
+        flush(conn);
+}
+
+void Cloud::EventServer::Loop::onReadable(const ConnPtr &conn)
+{
+    char buf[64 * 1024];
+    while (!conn->peer_closed)
+    {
+        // 响应尚未完成时最多预读1MB(流水线请求)，其余留在内核缓冲区
+        if (conn->state != Conn::READ_HEAD && conn->state != Conn::READ_BODY && conn->in.size() >= (1 << 20))
+            break;
+        // 请求体被限速：停止读取，数据留在内核缓冲区，由TCP流量控制使客户端减速
+        if (conn->body_throttled)
+            break;
+        ssize_t n = recv(conn->fd, buf, sizeof(buf), 0);
+        if (n > 0)
+        {
+            conn->in.append(buf, n);
+            conn->last_active = time(nullptr);
+            if (conn->state == Conn::READ_HEAD || conn->state == Conn::READ_BODY || conn->h2)
+                process(conn); // 及时解析请求头、转存请求体，避免缓冲区膨胀
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n < 0 && errno == EINTR)
+            continue;
+        conn->peer_closed = true;
+    }
+
+    if (conn->peer_closed)
+    {
+        // 处理函数执行中或内容读取中不能释放连接，等其返回后再关闭
+        if (conn->state != Conn::HANDLING && !conn->pulling)
+            close(conn);
+        return;
+    }
+    process(conn);
+}
+
+void Cloud::EventServer::Loop::process(const ConnPtr &conn)
+{
+    // 新连接以HTTP/2前言开头：切换为h2c
+    if (!conn->h2 && _server->_opts.h2c && conn->state == Conn::READ_HEAD && conn->requests == 0)
+    {
+        size_t n = std::min(conn->in.size(), H2::preface_len);
+        if (n > 0 && conn->in.compare(0, n, H2::preface, n) == 0)
+        {
+            if (n < H2::preface_len)
+                return; // 前言不完整
+            h2Start(conn);
+        }
+    }
+    if (conn->h2)
+    {
+        h2Process(conn);
+        return;
+    }
+
+    while (!conn->peer_closed)
+    {
+        if (conn->state == Conn::READ_HEAD)
+        {
+            if (!parseHead(conn))
+                return;
+            continue;
+        }
+        if (conn->state != Conn::READ_BODY || conn->body_throttled)
+            return;
+        if (conn->chunked)
+        {
+            if (readChunked(conn))
+                dispatch(conn);
+            return;
+        }
+
+        size_t n = std::min(conn->in.size(), conn->body_len - conn->body_recv);
+        if (n > 0 && !credit(conn, conn->body_len - conn->body_recv, &n))
+            return;
+        if (n > 0)
+        {
+            appendBody(conn, conn->in.data(), n);
+            if (conn->state != Conn::READ_BODY)
+                return;
+            conn->in.erase(0, n);
+        }
+        if (conn->body_recv < conn->body_len)
+        {
+            if (conn->in.empty())
+                return;
+            continue; // 限速时一次只接收许可的部分
+        }
+        dispatch(conn);
+        return;
+    }
+}
+
+bool Cloud::EventServer::Loop::parseHead(const ConnPtr &conn)
+{
+    size_t end = conn->in.find("\r\n\r\n");
+    if (end == std::string::npos)
+    {
+        if (conn->in.size() > CPPHTTPLIB_HEADER_MAX_LENGTH)
+            error(conn, 431);
+        return false;
+    }
+
+    auto &req = conn->req;
+    req.remote_addr = conn->remote_addr;
+    req.remote_port = conn->remote_port;
+    size_t line_end = conn->in.find("\r\n");
+    std::string line = conn->in.substr(0, line_end);
+    size_t count = 0;
+    httplib::detail::split(line.data(), line.data() + line.size(), ' ', [&](const char *b, const char *e)
+                           {
+        switch (count++)
+        {
+        case 0: req.method = std::string(b, e); break;
+        case 1: req.target = std::string(b, e); break;
+        case 2: req.version = std::string(b, e); break;
+        default: break;
+        } });
+    bool ok = count == 3 && (req.version == "HTTP/1.1" || req.version == "HTTP/1.0");
+    for (size_t pos = line_end + 2; ok && pos < end;)
+    {
+        size_t eol = conn->in.find("\r\n", pos);
+        ok = httplib::detail::parse_header(conn->in.data() + pos, conn->in.data() + eol,
+                                           [&](const std::string &key, const std::string &val)
+                                           { req.headers.emplace(key, val); });
+        pos = eol + 2;
+    }
+    conn->in.erase(0, end + 4);
+    if (!ok)
+    {
+        error(conn, 400);
+        return false;
+    }
+
+    conn->keep_alive = req.version == "HTTP/1.1" ? req.get_header_value("Connection") != "close"
+                                                 : req.get_header_value("Connection") == "Keep-Alive";
+    conn->requests++;
+    if (_server->_opts.keep_alive_max > 0 && conn->requests >= _server->_opts.keep_alive_max)
+        conn->keep_alive = false; // 达到单连接请求数上限，本次响应后关闭
+    if (int status = setupRequest(conn.get()))
+    {
+        error(conn, status);
+        return false;
+    }
+
+    // 分块编码的请求体长度未知，与HTTP/2相同，在接收过程中转存临时文件或判断上限
+    conn->chunked = httplib::detail::is_chunked_transfer_encoding(req.headers);
+    conn->body_len = conn->chunked ? 0 : req.get_header_value_u64("Content-Length");
+    if (conn->route->reader && conn->body_len > Conn::spool_threshold)
+    {
+        conn->spool = tmpfile();
+        if (conn->spool == nullptr)
+        {
+            error(conn, 500);
+            return false;
+        }
+    }
+    else if (!conn->route->reader && conn->body_len > CPPHTTPLIB_PAYLOAD_MAX_LENGTH)
+    {
+        error(conn, 413);
+        return false;
+    }
+    bool has_body = conn->body_len > 0 || conn->chunked;
+    if (has_body && _server->_gate)
+        conn->gate = _server->_gate(req);
+    if (has_body && req.get_header_value("Expect") == "100-continue")
+    {
+        conn->out += "HTTP/1.1 100 Continue\r\n\r\n";
+        flush(conn);
+    }
+    conn->state = Conn::READ_BODY;
+    return true;
+}
+
+bool Cloud::EventServer::Loop::readChunked(const ConnPtr &conn)
+{
+    std::string &in = conn->in;
+    size_t pos = 0;
+    bool done = false;
+    while (!done && conn->state == Conn::READ_BODY)
+    {
+        if (conn->chunk_state == Conn::CHUNK_DATA)
+        {
+            size_t n = std::min(in.size() - pos, conn->chunk_left);
+            if (n == 0 || !credit(conn, conn->chunk_left, &n))
+                break;
+            appendBody(conn, in.data() + pos, n);
+            pos += n;
+            conn->chunk_left -= n;
+            if (conn->chunk_left == 0)
+                conn->chunk_state = Conn::CHUNK_CRLF;
+            continue;
+        }
+
+        size_t eol = in.find("\r\n", pos);
+        if (eol == std::string::npos)
+        {
+            if (in.size() - pos > CPPHTTPLIB_HEADER_MAX_LENGTH)
+                error(conn, 400);
+            break;
+        }
+        std::string line = in.substr(pos, eol - pos);
+        pos = eol + 2;
+        if (conn->chunk_state == Conn::CHUNK_SIZE)
+        {
+            // 长度行：十六进制长度，可带 ";扩展"
+            char *end = nullptr;
+            errno = 0;
+            unsigned long long len = strtoull(line.c_str(), &end, 16);
+            if (end == line.c_str() || errno == ERANGE || (*end != '\0' && *end != ';' && *end != ' ' && *end != '\t'))
+            {
+                error(conn, 400);
+                break;
+            }
+            conn->chunk_left = len;
+            conn->chunk_state = len == 0 ? Conn::CHUNK_TRAILER : Conn::CHUNK_DATA;
+        }
+        else if (conn->chunk_state == Conn::CHUNK_CRLF)
+        {
+            if (!line.empty())
+            {
+                error(conn, 400);
+                break;
+            }
+            conn->chunk_state = Conn::CHUNK_SIZE;
+        }
+        else
+        {
+            done = line.empty(); // trailer字段不使用
+        }
+    }
+    if (conn->state != Conn::READ_BODY)
+        return false; // 已回复错误
+    in.erase(0, pos);
+    return done;
+}
+
+bool Cloud::EventServer::Loop::credit(const ConnPtr &conn, size_t want, size_t *n)
+{
+    if (!conn->gate)
+        return true;
+    if (conn->body_credit == 0)
+        conn->body_credit = conn->gate(want);
+    if (conn->body_credit == 0)
+    {
+        conn->body_throttled = true;
+        _throttled.push_back(conn);
+        return false;
+    }
+    *n = std::min(*n, conn->body_credit);
+    conn->body_credit -= *n;
+    conn->last_active = time(nullptr); // 限速等待不算读取超时
+    return true;
+}
+
+int Cloud::EventServer::Loop::setupRequest(Conn *conn)
+{
+    auto &req = conn->req;
+    size_t frag = req.target.find('#');
+    if (frag != std::string::npos)
+        req.target.erase(frag);
+    httplib::detail::divide(req.target, '?', [&](const char *lhs, size_t lhs_size, const char *rhs, size_t rhs_size)
+                            {
+        req.path = httplib::detail::decode_url(std::string(lhs, lhs_size), false);
+        httplib::detail::parse_query_text(rhs, rhs_size, req.params); });
+    req.set_header("REMOTE_ADDR", req.remote_addr);
+    req.set_header("REMOTE_PORT", std::to_string(req.remote_port));
+
+    if (req.has_header("Range") && !httplib::detail::parse_range_header(req.get_header_value("Range"), req.ranges))
+        return 416;
+    if (!_server->route(conn))
+        return 404;
+    if (_server->_hook)
+        _server->_hook(req);
+    return 0;
+}
+
+void Cloud::EventServer::Loop::dispatch(const ConnPtr &conn)
+{
+    conn->state = Conn::HANDLING;
+    ConnPtr self = conn;
+    _server->_workers->enqueue([this, self]
+                               {
+        _server->handle(self.get());
+        post(self); });
+}
+
+void Cloud::EventServer::Loop::post(const ConnPtr &conn)
+{
+    {
+        std::unique_lock<std::mutex> lck(_mutex);
+        _done.push_back(conn);
+    }
+    uint64_t one = 1;
+    write(_event_fd, &one, sizeof(one));
+}
+
+void Cloud::EventServer::Loop::error(const ConnPtr &conn, int status)
+{
+    // 请求没有被完整读取，回复后关闭连接
+    conn->keep_alive = false;
+    conn->res = httplib::Response();
+    conn->res.status = status;
+    respond(conn);
+}
+
+void Cloud::EventServer::Loop::respond(const ConnPtr &conn)
+{
+    if (conn->stream.id)
+    {
+        h2Respond(conn);
+        return;
+    }
+    if (conn->peer_closed)
+    {
+        close(conn);
+        return;
+    }
+    auto &req = conn->req;
+    auto &res = conn->res;
+    conn->state = Conn::WRITE;
+    conn->last_active = time(nullptr);
+    bool chunked = false;
+    size_t length = 0;
+    prepare(conn.get(), &chunked, &length);
+
+    // 响应行与响应头
+    std::string &out = conn->out;
+    out += "HTTP/1.1 " + std::to_string(res.status) + " " + httplib::status_message(res.status) + "\r\n";
+    if (res.get_header_value("Connection") == "close")
+        conn->keep_alive = false;
+    if (!res.has_header("Connection"))
+        res.set_header("Connection", conn->keep_alive ? "keep-alive" : "close");
+    if (conn->keep_alive)
+    {
+        const ConnOptions &opts = _server->_opts;
+        std::string keep = "timeout=" + std::to_string(opts.keep_alive_timeout);
+        if (opts.keep_alive_max > 0)
+            keep += ", max=" + std::to_string(opts.keep_alive_max - conn->requests);
+        res.set_header("Keep-Alive", keep);
+    }
+    if (chunked)
+        res.set_header("Transfer-Encoding", "chunked");
+    else
+        res.set_header("Content-Length", std::to_string(length));
+    if (length > 0 && !res.has_header("Content-Type"))
+        res.set_header("Content-Type", "text/plain");
+    for (auto &[key, val] : res.headers)
+        out += key + ": " + val + "\r\n";
+    out += "\r\n";
+    if (req.method != "HEAD")
+        out += res.body;
+    if (_server->_opts.tcp_cork && !conn->corked)
+    {
+        // 响应发送完毕(finish)时解除，剩余不足一个报文段的数据随之发出
+        int on = 1;
+        setsockopt(conn->fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+        conn->corked = true;
+    }
+    flush(conn);
+}
+
+void Cloud::EventServer::Loop::prepare(Conn *conn, bool *chunked, size_t *length)
+{
+    auto &req = conn->req;
+    auto &res = conn->res;
+    if (res.status == -1)
+        res.status = req.ranges.empty() ? 200 : 206;
+    // 静态页面：以文件内容提供者发送
+    if (!res.file_content_path_.empty())
+    {
+        auto file = std::make_shared<Util::FileReader>();
+        if (!file->open(res.file_content_path_))
+        {
+            res = httplib::Response();
+            res.status = 404;
+        }
+        else
+        {
+            std::string type = res.file_content_content_type_;
+            if (type.empty())
+                type = httplib::detail::find_content_type(res.file_content_path_, {}, "application/octet-stream");
+            res.set_content_provider(file->size(), type, [file](size_t offset, size_t length, httplib::DataSink &sink)
+                                     { return sink.write_file(file->fd(), offset, length); });
+        }
+    }
+    if (httplib::detail::range_error(req, res))
+    {
+        res = httplib::Response();
+        res.status = 416;
+    }
+
+    // 确定实体内容与长度
+    *chunked = false;
+    *length = 0;
+    size_t total = res.content_provider_ ? res.content_length_ : res.body.size();
+    std::pair<size_t, size_t> range(0, total);
+    bool encoded = res.has_header("Content-Encoding"); // 已编码(预压缩)的内容原样发送
+    bool multi = res.status == 206 && req.ranges.size() > 1;
+    std::string boundary, content_type;
+    if (multi)
+    {
+        // 多区间：multipart/byteranges，每个区间带自己的Content-Type与Content-Range
+        content_type = res.get_header_value("Content-Type");
+        res.headers.erase("Content-Type");
+        boundary = httplib::detail::make_multipart_data_boundary();
+        res.set_header("Content-Type", "multipart/byteranges; boundary=" + boundary);
+    }
+    else if (res.status == 206)
+    {
+        range = httplib::detail::get_range_offset_and_length(req.ranges[0], total);
+        res.set_header("Content-Range", httplib::detail::make_content_range_header_field(range, total));
+    }
+    if (res.content_provider_ && res.is_chunked_content_provider_)
+    {
+        *chunked = true;
+        switch (encoded ? httplib::detail::EncodingType::None : httplib::detail::encoding_type(req, res))
+        {
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+        case httplib::detail::EncodingType::Gzip:
+            conn->compressor.reset(new httplib::detail::gzip_compressor);
+            res.set_header("Content-Encoding", "gzip");
+            break;
+#endif
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+        case httplib::detail::EncodingType::Brotli:
+            conn->compressor.reset(new httplib::detail::brotli_compressor);
+            res.set_header("Content-Encoding", "br");
+            break;
+#endif
+        default:
+            break;
+        }
+        conn->prov_off = 0;
+        conn->prov_done = false;
+    }
+    else if (res.content_provider_ && multi)
+    {
+        // 分隔行与头部随区间数据依次写出(pull)，区间数据仍按段读取内容提供者
+        std::string head;
+        httplib::detail::process_multipart_ranges_data(
+            req, boundary, content_type, total,
+            [&](const std::string &token)
+            { head += token; },
+            [&](const std::string &token)
+            { head += token; },
+            [&](size_t offset, size_t len)
+            {
+                conn->parts.push_back({std::move(head), offset, len});
+                head.clear();
+                return true;
+            });
+        conn->parts.push_back({std::move(head), 0, 0});
+        *length = httplib::detail::get_multipart_ranges_data_length(req, boundary, content_type, total);
+        conn->prov_off = conn->prov_end = 0;
+        conn->part = 0;
+        conn->prov_done = false;
+    }
+    else if (res.content_provider_)
+    {
+        *length = range.second;
+        conn->prov_off = range.first;
+        conn->prov_end = range.first + range.second;
+        conn->prov_done = *length == 0;
+    }
+    else
+    {
+        if (multi)
+        {
+            std::string data;
+            httplib::detail::make_multipart_ranges_data(req, res, boundary, content_type, total, data);
+            res.body.swap(data);
+        }
+        else if (res.status == 206)
+        {
+            res.body = res.body.substr(range.first, range.second);
+        }
+        else if (!res.body.empty())
+        {
+            // 与 httplib 一致：文本类型的整体响应按 Accept-Encoding 压缩
+            std::unique_ptr<httplib::detail::compressor> comp;
+            std::string coding;
+            switch (encoded ? httplib::detail::EncodingType::None : httplib::detail::encoding_type(req, res))
+            {
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+            case httplib::detail::EncodingType::Gzip:
+                comp.reset(new httplib::detail::gzip_compressor);
+                coding = "gzip";
+                break;
+#endif
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+            case httplib::detail::EncodingType::Brotli:
+                comp.reset(new httplib::detail::brotli_compressor);
+                coding = "br";
+                break;
+#endif
+            default:
+                break;
+            }
+            std::string compressed;
+            if (comp && comp->compress(res.body.data(), res.body.size(), true, [&](const char *data, size_t n)
+                                       { compressed.append(data, n); return true; }))
+            {
+                res.body.swap(compressed);
+                res.set_header("Content-Encoding", coding);
+            }
+        }
+        *length = res.body.size();
+    }
+    if (req.method == "HEAD")
+        conn->prov_done = true;
+}
+
+bool Cloud::EventServer::Loop::pull(Conn *conn, bool *throttled)
+{
+    auto &res = conn->res;
+    bool chunked = res.is_chunked_content_provider_;
+    bool stream = conn->stream.id != 0; // HTTP/2流：数据由 h2Fill 分帧，这里不加分块编码
+    bool produced = false;
+    auto emit = [conn, chunked, stream](const char *data, size_t len)
+    {
+        if (len == 0)
+            return true;
+        if (!chunked)
+        {
+            conn->out.append(data, len);
+            return true;
+        }
+        // 分块编码：可能经过压缩器
+        auto frame = [conn, stream](const char *d, size_t n)
+        {
+            if (n == 0)
+                return true;
+            if (stream)
+            {
+                conn->out.append(d, n);
+                return true;
+            }
+            conn->out += httplib::detail::from_i_to_hex(n) + "\r\n";
+            conn->out.append(d, n);
+            conn->out += "\r\n";
+            return true;
+        };
+        return conn->compressor ? conn->compressor->compress(data, len, false, frame) : frame(data, len);
+    };
+
+    httplib::DataSink sink;
+    bool ok = true;
+    sink.write = [&](const char *data, size_t len)
+    {
+        produced = true;
+        conn->prov_off += len;
+        return ok = ok && emit(data, len);
+    };
+    sink.write_file = [&](int fd, size_t offset, size_t len)
+    {
+        produced = true;
+        if (chunked || stream)
+        {
+            std::string buf(len, '\0');
+            ssize_t n = pread(fd, &buf[0], len, offset);
+            if (n <= 0)
+                return ok = false;
+            conn->prov_off += n;
+            return ok = ok && emit(buf.data(), n);
+        }
+        // 文件区间在发送时用 sendfile 直接写入套接字
+        conn->file_fd = fd;
+        conn->file_off = offset;
+        conn->file_len = len;
+        conn->prov_off += len;
+        return true;
+    };
+    sink.is_writable = []
+    { return true; };
+    sink.done = [&]
+    {
+        produced = true;
+        conn->prov_done = true;
+        std::string tail;
+        if (conn->compressor)
+        {
+            ok = ok && conn->compressor->compress(nullptr, 0, true, [&](const char *d, size_t n)
+                                                  {
+                tail.append(d, n);
+                return true; });
+            if (stream)
+                conn->out += tail;
+            else if (!tail.empty())
+                conn->out += httplib::detail::from_i_to_hex(tail.size()) + "\r\n" + tail + "\r\n";
+        }
+        if (!stream)
+            conn->out += "0\r\n\r\n";
+    };
+
+    if (chunked)
+    {
+        if (!res.content_provider_(conn->prov_off, 0, sink))
+            return false;
+    }
+    else
+    {
+        // 多区间：上一个区间已发送完(sendfile的区间在此之前已写入套接字)，写出下一个区间的分隔头
+        while (conn->prov_off >= conn->prov_end && conn->part < conn->parts.size())
+        {
+            auto &part = conn->parts[conn->part++];
+            conn->out += part.head;
+            conn->prov_off = part.off;
+            conn->prov_end = part.off + part.len;
+            produced = true;
+        }
+        // HTTP/2流的数据先读入内存再分帧，每次少取一些
+        size_t len = std::min<size_t>(conn->prov_end - conn->prov_off, stream ? 64 << 10 : 4 << 20);
+        if (len > 0 && !res.content_provider_(conn->prov_off, len, sink))
+            return false;
+        if (conn->prov_off >= conn->prov_end && conn->part == conn->parts.size())
+            conn->prov_done = true;
+    }
+    *throttled = ok && !produced;
+    return ok;
+}
+
+void Cloud::EventServer::Loop::fetch(const ConnPtr &conn)
+{
+    conn->pulling = true;
+    ConnPtr self = conn;
+    _server->_workers->enqueue([this, self]
+                               {
+        // 限速未放行时不占用工作线程等待，交回事件循环稍后重试
+        _in_loop = true;
+        try
+        {
+            self->pull_ok = pull(self.get(), &self->pull_throttled);
+        }
+        catch (std::exception &e)
+        {
+            _logger->_error("响应内容读取异常 %s: %s", self->req.path.c_str(), e.what());
+            self->pull_ok = false;
+        }
+        _in_loop = false;
+        {
+            std::unique_lock<std::mutex> lck(_mutex);
+            _pulled.push_back(self);
+        }
+        uint64_t one = 1;
+        write(_event_fd, &one, sizeof(one)); });
+}
+
+void Cloud::EventServer::Loop::resume(const ConnPtr &conn)
+{
+    conn->pulling = false;
+    if (conn->stream.id)
+    {
+        ConnPtr parent = conn->stream.conn.lock();
+        if (!parent || parent->peer_closed || conn->peer_closed)
+        {
+            // 读取期间连接已关闭或流已被重置：只释放资源
+            conn->reset();
+            return;
+        }
+        if (!conn->pull_ok)
+        {
+            _logger->_warn("响应内容读取失败 %s", conn->req.path.c_str());
+            H2::appendRstStream(&parent->out, conn->stream.id, H2::ERR_INTERNAL);
+            conn->stream.end_stream = true;
+            h2Close(parent, conn, false);
+        }
+        else if (conn->pull_throttled)
+        {
+            parent->last_active = time(nullptr);
+            _throttled.push_back(conn);
+        }
+        else
+        {
+            h2Queue(parent, conn);
+        }
+        flush(parent);
+        return;
+    }
+    if (conn->peer_closed)
+    {
+        close(conn);
+        return;
+    }
+    if (!conn->pull_ok)
+    {
+        _logger->_warn("响应内容读取失败 %s", conn->req.path.c_str());
+        conn->peer_closed = true;
+        close(conn);
+        return;
+    }
+    if (conn->pull_throttled)
+    {
+        // 对端在正常接收，等待限速期间不算发送停滞
+        conn->last_active = time(nullptr);
+        _throttled.push_back(conn);
+        return;
+    }
+    flush(conn);
+}
+
+void Cloud::EventServer::Loop::flush(const ConnPtr &conn)
+{
+    if (conn->pulling)
+        return; // 等待工作线程读取完成(resume)
+    while (!conn->peer_closed)
+    {
+        if (conn->out_pos < conn->out.size())
+        {
+            ssize_t n = send(conn->fd, conn->out.data() + conn->out_pos, conn->out.size() - conn->out_pos, MSG_NOSIGNAL);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return; // 等待 EPOLLOUT
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            conn->out_pos += n;
+            conn->last_active = time(nullptr);
+            continue;
+        }
+        conn->out.clear();
+        conn->out_pos = 0;
+
+        if (conn->file_len > 0)
+        {
+            ssize_t n = sendfile(conn->fd, conn->file_fd, &conn->file_off, conn->file_len);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return;
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            conn->file_len -= n;
+            conn->last_active = time(nullptr);
+            continue;
+        }
+
+        if (conn->h2)
+        {
+            if (h2Fill(conn))
+                continue;
+            if (conn->h2->goaway && conn->h2->streams.empty())
+                break; // 对端已发送GOAWAY，所有流都已结束
+            return;
+        }
+        if (conn->state != Conn::WRITE)
+            return;
+        if (conn->prov_done)
+        {
+            finish(conn);
+            return;
+        }
+        fetch(conn);
+        return;
+    }
+    conn->peer_closed = true;
+    close(conn);
+}
+
+void Cloud::EventServer::Loop::finish(const ConnPtr &conn)
+{
+    conn->res.content_provider_success_ = true;
+    if (conn->corked)
+    {
+        int off = 0;
+        setsockopt(conn->fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+        conn->corked = false;
+    }
+    if (!conn->keep_alive)
+    {
+        close(conn);
+        return;
+    }
+    conn->reset();
+    // 继续处理已预读的流水线请求，以及预读上限时留在内核中的数据
+    onReadable(conn);
+}
+
+void Cloud::EventServer::Loop::close(const ConnPtr &conn)
+{
+    auto it = _conns.find(conn->fd);
+    if (it == _conns.end() || it->second != conn)
+        return;
+    epoll_ctl(_epfd, EPOLL_CTL_DEL, conn->fd, nullptr);
+    _conns.erase(it);
+    conn->peer_closed = true;
+    if (conn->res.content_provider_resource_releaser_)
+        conn->res.content_provider_resource_releaser_(conn->res.content_provider_success_);
+    conn->res.content_provider_resource_releaser_ = nullptr;
+    if (conn->h2)
+    {
+        // 处理函数执行中的流等其返回(h2Respond)时释放，读取内容中的流等读取完成(resume)时释放
+        auto streams = std::move(conn->h2->streams);
+        conn->h2->streams.clear();
+        conn->h2->ready.clear();
+        for (auto &[id, stream] : streams)
+        {
+            stream->peer_closed = true;
+            if (stream->state != Conn::HANDLING && !stream->pulling)
+                stream->reset();
+        }
+    }
+}
+
+void Cloud::EventServer::Loop::sweep()
+{
+    time_t now = time(nullptr);
+    const ConnOptions &opts = _server->_opts;
+    std::vector<ConnPtr> expired;
+    for (auto &[fd, conn] : _conns)
+    {
+        time_t timeout;
+        if (conn->h2)
+        {
+            // HTTP/2连接：有流在发送响应按发送超时，有流在接收请求体按读取超时，流都在处理中则不限制
+            bool writing = conn->out_pos < conn->out.size(), reading = false, pulling = false;
+            for (auto &[id, stream] : conn->h2->streams)
+            {
+                writing = writing || stream->state == Conn::WRITE;
+                reading = reading || stream->state == Conn::READ_BODY;
+                pulling = pulling || stream->pulling;
+            }
+            if (pulling) // 读取内容(如解压冷文件)的时间不算发送停滞
+                continue;
+            else if (writing)
+                timeout = opts.write_timeout;
+            else if (reading)
+                timeout = opts.read_timeout;
+            else if (!conn->h2->streams.empty())
+                continue;
+            else
+                timeout = opts.keep_alive_timeout;
+        }
+        else if (conn->state == Conn::HANDLING || conn->pulling) // 处理函数执行与内容读取的时间不受限制
+            continue;
+        else if (conn->state == Conn::WRITE)
+            timeout = opts.write_timeout;
+        else if (conn->state == Conn::READ_HEAD && conn->in.empty())
+            timeout = opts.keep_alive_timeout; // 等待下一个请求
+        else
+            timeout = opts.read_timeout;
+        if (now - conn->last_active > timeout)
+            expired.push_back(conn);
+    }
+    for (auto &conn : expired)
+        close(conn);
+}
+
+void Cloud::EventServer::Loop::h2Start(const ConnPtr &conn)
+{
+    conn->in.erase(0, H2::preface_len);
+    conn->h2.reset(new H2Session);
+    H2::appendSettings(&conn->out, {{H2::SETTINGS_MAX_CONCURRENT_STREAMS, (uint32_t)_server->_opts.h2_max_streams},
+                                    {H2::SETTINGS_INITIAL_WINDOW_SIZE, (uint32_t)H2Session::stream_window},
+                                    {H2::SETTINGS_ENABLE_PUSH, 0}});
+    H2::appendWindowUpdate(&conn->out, 0, H2Session::conn_window - H2::default_window);
+}
+
+void Cloud::EventServer::Loop::h2Process(const ConnPtr &conn)
+{
+    H2Session &h2 = *conn->h2;
+    size_t pos = 0;
+    uint32_t err = H2::ERR_NO_ERROR;
+    while (!conn->peer_closed && conn->in.size() - pos >= H2::frame_header_len)
+    {
+        H2::FrameHeader fh = H2::parseFrameHeader(conn->in.data() + pos);
+        if (fh.length > H2::default_frame_size) // 本端未修改 SETTINGS_MAX_FRAME_SIZE
+        {
+            err = H2::ERR_FRAME_SIZE;
+            break;
+        }
+        if (conn->in.size() - pos - H2::frame_header_len < fh.length)
+            break; // 帧不完整
+        // 头部块必须由同一个流的CONTINUATION连续发送完
+        if (h2.header_stream != 0 && (fh.type != H2::CONTINUATION || fh.stream != h2.header_stream))
+        {
+            err = H2::ERR_PROTOCOL;
+            break;
+        }
+        err = h2Frame(conn, fh, conn->in.data() + pos + H2::frame_header_len);
+        pos += H2::frame_header_len + fh.length;
+        if (err != H2::ERR_NO_ERROR)
+            break;
+    }
+    if (conn->peer_closed)
+        return;
+    if (err != H2::ERR_NO_ERROR)
+    {
+        h2Goaway(conn, err);
+        return;
+    }
+    conn->in.erase(0, pos);
+    flush(conn);
+}
+
+uint32_t Cloud::EventServer::Loop::h2Frame(const ConnPtr &conn, const H2::FrameHeader &fh, const char *payload)
+{
+    H2Session &h2 = *conn->h2;
+    const char *data = payload;
+    size_t len = fh.length;
+    // 去掉填充
+    if ((fh.type == H2::DATA || fh.type == H2::HEADERS) && (fh.flags & H2::FLAG_PADDED))
+    {
+        if (len < 1 || (uint8_t)data[0] >= len)
+            return H2::ERR_PROTOCOL;
+        len -= 1 + (uint8_t)data[0];
+        data++;
+    }
+
+    switch (fh.type)
+    {
+    case H2::DATA:
+    {
+        if (fh.stream == 0)
+            return H2::ERR_PROTOCOL;
+        // 连接级窗口按整个帧(含填充)计算，无论流是否还存在
+        h2.recv_unacked += fh.length;
+        if (h2.recv_unacked >= H2Session::conn_window / 2)
+        {
+            H2::appendWindowUpdate(&conn->out, 0, h2.recv_unacked);
+            h2.recv_unacked = 0;
+        }
+        auto it = h2.streams.find(fh.stream);
+        if (it == h2.streams.end() || it->second->state != Conn::READ_BODY)
+            return fh.stream > h2.last_stream ? H2::ERR_PROTOCOL : H2::ERR_NO_ERROR; // 已结束或已拒绝的流：丢弃
+        ConnPtr stream = it->second;
+        stream->stream.recv_unacked += fh.length;
+        stream->last_active = time(nullptr);
+        appendBody(stream, data, len);
+        if (stream->state != Conn::READ_BODY)
+            return H2::ERR_NO_ERROR; // 已回复错误
+        if (fh.flags & H2::FLAG_END_STREAM)
+        {
+            stream->stream.end_stream = true;
+            dispatch(stream);
+        }
+        else if (stream->stream.recv_unacked >= H2Session::stream_window / 2)
+        {
+            h2Credit(conn, stream);
+        }
+        return H2::ERR_NO_ERROR;
+    }
+    case H2::HEADERS:
+        if (fh.stream == 0)
+            return H2::ERR_PROTOCOL;
+        if (fh.flags & H2::FLAG_PRIORITY)
+        {
+            if (len < 5)
+                return H2::ERR_PROTOCOL;
+            data += 5; // 不支持优先级
+            len -= 5;
+        }
+        h2.header_block.assign(data, len);
+        h2.header_stream = fh.stream;
+        h2.header_end_stream = fh.flags & H2::FLAG_END_STREAM;
+        return (fh.flags & H2::FLAG_END_HEADERS) ? h2Request(conn) : H2::ERR_NO_ERROR;
+    case H2::CONTINUATION:
+        if (h2.header_stream == 0)
+            return H2::ERR_PROTOCOL;
+        h2.header_block.append(data, len);
+        if (h2.header_block.size() > CPPHTTPLIB_HEADER_MAX_LENGTH)
+            return H2::ERR_PROTOCOL;
+        return (fh.flags & H2::FLAG_END_HEADERS) ? h2Request(conn) : H2::ERR_NO_ERROR;
+    case H2::PRIORITY:
+        return len == 5 ? H2::ERR_NO_ERROR : H2::ERR_FRAME_SIZE;
+    case H2::RST_STREAM:
+    {
+        if (fh.stream == 0)
+            return H2::ERR_PROTOCOL;
+        if (len != 4)
+            return H2::ERR_FRAME_SIZE;
+        auto it = h2.streams.find(fh.stream);
+        if (it != h2.streams.end())
+        {
+            ConnPtr stream = it->second;
+            stream->stream.end_stream = true;
+            h2Close(conn, stream, false);
+        }
+        return H2::ERR_NO_ERROR;
+    }
+    case H2::SETTINGS:
+        if (fh.stream != 0)
+            return H2::ERR_PROTOCOL;
+        if (fh.flags & H2::FLAG_ACK)
+            return len == 0 ? H2::ERR_NO_ERROR : H2::ERR_FRAME_SIZE;
+        if (len % 6)
+            return H2::ERR_FRAME_SIZE;
+        for (size_t i = 0; i < len; i += 6)
+        {
+            uint16_t id = (uint8_t)data[i] << 8 | (uint8_t)data[i + 1];
+            uint32_t val = H2::readU32(data + i + 2);
+            switch (id)
+            {
+            case H2::SETTINGS_HEADER_TABLE_SIZE:
+                h2.encoder.setMaxSize(val);
+                break;
+            case H2::SETTINGS_ENABLE_PUSH:
+                if (val > 1)
+                    return H2::ERR_PROTOCOL;
+                break;
+            case H2::SETTINGS_INITIAL_WINDOW_SIZE:
+            {
+                if (val > H2::max_window)
+                    return H2::ERR_FLOW_CONTROL;
+                // 调整所有流的发送窗口
+                int64_t delta = (int64_t)val - h2.peer_window;
+                h2.peer_window = val;
+                for (auto &[sid, stream] : h2.streams)
+                {
+                    stream->stream.send_window += delta;
+                    if (stream->state == Conn::WRITE)
+                        h2Queue(conn, stream);
+                }
+                break;
+            }
+            case H2::SETTINGS_MAX_FRAME_SIZE:
+                if (val < H2::default_frame_size || val > 0xffffff)
+                    return H2::ERR_PROTOCOL;
+                h2.peer_frame = val;
+                break;
+            default:
+                break;
+            }
+        }
+        H2::appendFrame(&conn->out, H2::SETTINGS, H2::FLAG_ACK, 0, nullptr, 0);
+        return H2::ERR_NO_ERROR;
+    case H2::PUSH_PROMISE:
+        return H2::ERR_PROTOCOL; // 客户端不能推送
+    case H2::PING:
+        if (fh.stream != 0)
+            return H2::ERR_PROTOCOL;
+        if (len != 8)
+            return H2::ERR_FRAME_SIZE;
+        if (!(fh.flags & H2::FLAG_ACK))
+            H2::appendFrame(&conn->out, H2::PING, H2::FLAG_ACK, 0, data, len);
+        return H2::ERR_NO_ERROR;
+    case H2::GOAWAY:
+        h2.goaway = true; // 已接收的流继续处理完
+        return H2::ERR_NO_ERROR;
+    case H2::WINDOW_UPDATE:
+    {
+        if (len != 4)
+            return H2::ERR_FRAME_SIZE;
+        uint32_t inc = H2::readU32(data) & 0x7fffffff;
+        if (inc == 0)
+            return H2::ERR_PROTOCOL;
+        if (fh.stream == 0)
+        {
+            h2.send_window += inc;
+            return h2.send_window > H2::max_window ? H2::ERR_FLOW_CONTROL : H2::ERR_NO_ERROR;
+        }
+        auto it = h2.streams.find(fh.stream);
+        if (it == h2.streams.end())
+            return H2::ERR_NO_ERROR;
+        ConnPtr stream = it->second;
+        stream->stream.send_window += inc;
+        if (stream->stream.send_window > H2::max_window)
+        {
+            H2::appendRstStream(&conn->out, fh.stream, H2::ERR_FLOW_CONTROL);
+            stream->stream.end_stream = true;
+            h2Close(conn, stream, false);
+        }
+        else if (stream->state == Conn::WRITE)
+        {
+            h2Queue(conn, stream);
+        }
+        return H2::ERR_NO_ERROR;
+    }
+    default:
+        return H2::ERR_NO_ERROR; // 忽略未知类型的帧
+    }
+}
+
+uint32_t Cloud::EventServer::Loop::h2Request(const ConnPtr &conn)
+{
+    H2Session &h2 = *conn->h2;
+    uint32_t id = h2.header_stream;
+    bool end_stream = h2.header_end_stream;
+    h2.header_stream = 0;
+    HeaderList headers;
+    bool ok = h2.decoder.decode(h2.header_block.data(), h2.header_block.size(), &headers);
+    h2.header_block.clear();
+    if (!ok)
+        return H2::ERR_COMPRESSION; // 解码表已不一致，只能关闭连接
+
+    auto it = h2.streams.find(id);
+    if (it != h2.streams.end())
+    {
+        // 请求体之后的尾部字段(忽略)，必须结束流
+        ConnPtr stream = it->second;
+        if (!end_stream)
+            return H2::ERR_PROTOCOL;
+        if (stream->state == Conn::READ_BODY)
+        {
+            stream->stream.end_stream = true;
+            dispatch(stream);
+        }
+        return H2::ERR_NO_ERROR;
+    }
+    if (id % 2 == 0)
+        return H2::ERR_PROTOCOL;
+    if (id <= h2.last_stream)
+        return H2::ERR_STREAM_CLOSED;
+    h2.last_stream = id;
+    if (h2.goaway)
+        return H2::ERR_NO_ERROR;
+    if (h2.streams.size() >= _server->_opts.h2_max_streams)
+    {
+        H2::appendRstStream(&conn->out, id, H2::ERR_REFUSED_STREAM);
+        return H2::ERR_NO_ERROR;
+    }
+
+    auto stream = std::make_shared<Conn>();
+    stream->stream.id = id;
+    stream->stream.conn = conn;
+    stream->stream.send_window = h2.peer_window;
+    stream->stream.end_stream = end_stream;
+    stream->last_active = time(nullptr);
+    stream->remote_addr = conn->remote_addr;
+    stream->remote_port = conn->remote_port;
+    stream->requests = 1;
+    h2.streams[id] = stream;
+
+    auto &req = stream->req;
+    req.version = "HTTP/2";
+    req.remote_addr = conn->remote_addr;
+    req.remote_port = conn->remote_port;
+    std::string authority;
+    for (auto &[name, value] : headers)
+    {
+        if (name == ":method")
+            req.method = value;
+        else if (name == ":path")
+            req.target = value;
+        else if (name == ":authority")
+            authority = value;
+        else if (name.empty() || name[0] != ':')
+            req.headers.emplace(name, value);
+    }
+    if (!authority.empty() && !req.has_header("Host"))
+        req.headers.emplace("Host", authority);
+    if (req.method.empty() || req.target.empty())
+    {
+        error(stream, 400);
+        return H2::ERR_NO_ERROR;
+    }
+    if (int status = setupRequest(stream.get()))
+    {
+        error(stream, status);
+        return H2::ERR_NO_ERROR;
+    }
+
+    // 与HTTP/1.x相同：大请求体暂存到临时文件，超过上限直接拒绝；没有Content-Length时在接收过程中判断
+    stream->body_len = req.get_header_value_u64("Content-Length");
+    if (stream->route->reader && stream->body_len > Conn::spool_threshold)
+    {
+        stream->spool = tmpfile();
+        if (stream->spool == nullptr)
+        {
+            error(stream, 500);
+            return H2::ERR_NO_ERROR;
+        }
+    }
+    else if (!stream->route->reader && stream->body_len > CPPHTTPLIB_PAYLOAD_MAX_LENGTH)
+    {
+        error(stream, 413);
+        return H2::ERR_NO_ERROR;
+    }
+    stream->state = Conn::READ_BODY;
+    if (end_stream)
+        dispatch(stream);
+    else if (_server->_gate)
+        stream->gate = _server->_gate(req);
+    return H2::ERR_NO_ERROR;
+}
+
+void Cloud::EventServer::Loop::h2Credit(const ConnPtr &conn, const ConnPtr &stream)
+{
+    // 连接上的其他流仍要接收，不能停止读取套接字；被限速时暂不归还该流的窗口，对端用完窗口后停止发送这个流
+    if (stream->body_throttled || stream->stream.recv_unacked == 0)
+        return;
+    while (stream->gate && stream->body_credit < stream->stream.recv_unacked)
+    {
+        size_t n = stream->gate(stream->stream.recv_unacked - stream->body_credit);
+        if (n == 0)
+        {
+            stream->body_throttled = true;
+            _throttled.push_back(stream);
+            return;
+        }
+        stream->body_credit += n;
+        stream->last_active = time(nullptr);
+    }
+    if (stream->gate)
+        stream->body_credit -= stream->stream.recv_unacked;
+    H2::appendWindowUpdate(&conn->out, stream->stream.id, stream->stream.recv_unacked);
+    stream->stream.recv_unacked = 0;
+}
+
+void Cloud::EventServer::Loop::appendBody(const ConnPtr &stream, const char *data, size_t len)
+{
+    if (len == 0)
+        return;
+    auto &body = stream->req.body;
+    if (stream->spool == nullptr && stream->route->reader && body.size() + len > Conn::spool_threshold)
+    {
+        // 请求体超过阈值，已接收的部分一并转存
+        stream->spool = tmpfile();
+        if (stream->spool == nullptr || fwrite(body.data(), 1, body.size(), stream->spool) != body.size())
+        {
+            error(stream, 500);
+            return;
+        }
+        std::string().swap(body);
+    }
+    if (stream->spool)
+    {
+        if (fwrite(data, 1, len, stream->spool) != len)
+        {
+            error(stream, 500);
+            return;
+        }
+    }
+    else if (body.size() + len > CPPHTTPLIB_PAYLOAD_MAX_LENGTH)
+    {
+        error(stream, 413);
+        return;
+    }
+    else
+    {
+        body.append(data, len);
+    }
+    stream->body_recv += len;
+}
+
+void Cloud::EventServer::Loop::h2Respond(const ConnPtr &stream)
+{
+    ConnPtr conn = stream->stream.conn.lock();
+    if (!conn || conn->peer_closed || stream->peer_closed)
+    {
+        // 连接已关闭或流已被重置：只释放资源
+        stream->reset();
+        return;
+    }
+    H2Session &h2 = *conn->h2;
+    auto &res = stream->res;
+    stream->state = Conn::WRITE;
+    stream->last_active = time(nullptr);
+    bool chunked = false;
+    size_t length = 0;
+    prepare(stream.get(), &chunked, &length);
+
+    HeaderList headers;
+    headers.emplace_back(":status", std::to_string(res.status));
+    if (!chunked)
+        res.set_header("Content-Length", std::to_string(length));
+    if (length > 0 && !res.has_header("Content-Type"))
+        res.set_header("Content-Type", "text/plain");
+    for (auto &[key, val] : res.headers)
+    {
+        // 字段名小写，去掉HTTP/2中禁止的连接级字段
+        std::string name = key;
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        if (name == "connection" || name == "keep-alive" || name == "transfer-encoding" ||
+            name == "upgrade" || name == "proxy-connection")
+            continue;
+        headers.emplace_back(std::move(name), val);
+    }
+    std::string block;
+    h2.encoder.encode(headers, &block);
+
+    if (stream->req.method == "HEAD")
+        res.body.clear();
+    stream->out.swap(res.body);
+    stream->out_pos = 0;
+    bool empty = stream->out.empty() && stream->prov_done;
+    H2::appendHeaders(&conn->out, stream->stream.id, block, empty, h2.peer_frame);
+    if (empty)
+        h2Close(conn, stream, true);
+    else
+        h2Queue(conn, stream);
+    flush(conn);
+}
+
+bool Cloud::EventServer::Loop::h2Fill(const ConnPtr &conn)
+{
+    H2Session &h2 = *conn->h2;
+    size_t before = conn->out.size();
+    while (!h2.ready.empty() && conn->out.size() - conn->out_pos < H2Session::send_buffer)
+    {
+        uint32_t id = h2.ready.front();
+        h2.ready.pop_front();
+        auto it = h2.streams.find(id);
+        if (it == h2.streams.end())
+            continue;
+        ConnPtr stream = it->second;
+        stream->stream.queued = false;
+        if (stream->state != Conn::WRITE)
+            continue;
+
+        if (stream->pulling)
+            continue; // 读取完成后(resume)重新排队
+        if (stream->out_pos == stream->out.size() && !stream->prov_done)
+        {
+            Conn::recycle(stream->out);
+            stream->out_pos = 0;
+            fetch(stream);
+            continue;
+        }
+
+        size_t avail = stream->out.size() - stream->out_pos;
+        if (avail > 0)
+        {
+            if (h2.send_window <= 0)
+            {
+                // 连接窗口用尽：保持在队首，等待连接级WINDOW_UPDATE
+                h2.ready.push_front(id);
+                stream->stream.queued = true;
+                break;
+            }
+            if (stream->stream.send_window <= 0)
+                continue; // 等待该流的WINDOW_UPDATE重新入队
+            size_t n = std::min({avail, (size_t)h2.send_window, (size_t)stream->stream.send_window, h2.peer_frame});
+            bool end = n == avail && stream->prov_done;
+            H2::appendFrame(&conn->out, H2::DATA, end ? H2::FLAG_END_STREAM : 0, id, stream->out.data() + stream->out_pos, n);
+            stream->out_pos += n;
+            h2.send_window -= n;
+            stream->stream.send_window -= n;
+            stream->last_active = time(nullptr);
+            if (end)
+            {
+                h2Close(conn, stream, true);
+                continue;
+            }
+        }
+        else if (stream->prov_done)
+        {
+            H2::appendFrame(&conn->out, H2::DATA, H2::FLAG_END_STREAM, id, nullptr, 0);
+            h2Close(conn, stream, true);
+            continue;
+        }
+        h2Queue(conn, stream); // 轮到下一个流
+    }
+    return conn->out.size() > before;
+}
+
+void Cloud::EventServer::Loop::h2Queue(const ConnPtr &conn, const ConnPtr &stream)
+{
+    if (stream->stream.queued)
+        return;
+    conn->h2->ready.push_back(stream->stream.id);
+    stream->stream.queued = true;
+}
+
+void Cloud::EventServer::Loop::h2Close(const ConnPtr &conn, const ConnPtr &stream, bool success)
+{
+    ConnPtr self = stream; // stream 可能引用流表中的元素
+    if (!self->stream.end_stream)
+    {
+        // 响应已完整但请求体尚未接收完：通知对端不必再发送
+        H2::appendRstStream(&conn->out, self->stream.id, H2::ERR_NO_ERROR);
+        self->stream.end_stream = true;
+    }
+    conn->h2->streams.erase(self->stream.id);
+    self->peer_closed = true;
+    if (self->state != Conn::HANDLING && !self->pulling)
+    {
+        self->res.content_provider_success_ = success;
+        self->reset();
+    }
+}
+
+void Cloud::EventServer::Loop::h2Goaway(const ConnPtr &conn, uint32_t error)
+{
+    _logger->_warn("HTTP/2连接错误 %s:%d code=%u", conn->remote_addr.c_str(), conn->remote_port, error);
+    H2::appendGoaway(&conn->out, conn->h2->last_stream, error);
+    conn->h2->goaway = true;
+    // 尽力发出GOAWAY后关闭，不再等待其余数据
+    send(conn->fd, conn->out.data() + conn->out_pos, conn->out.size() - conn->out_pos, MSG_NOSIGNAL);
+    close(conn);
+}
@@ -0,0 +1,436 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <tuple>
+#include <type_traits>
+#include <cstring>
+#include "util.hpp"
+
+namespace Util
+{
+    // 字段表：把JSON键名与结构体成员指针绑定，编译期确定，不需要运行时反射
+    template <class T, class M>
+    struct JsonField
+    {
+        const char *name;
+        M T::*member;
+    };
+
+    template <class T, class M>
+    constexpr JsonField<T, M> jsonField(const char *name, M T::*member)
+    {
+        return {name, member};
+    }
+
+    // 为类型T特化 JsonFields<T>：
+    //   static constexpr bool as_array = false;                      // true表示按字段顺序编码为数组
+    //   static constexpr auto fields = std::make_tuple(jsonField("key", &T::member), ...);
+    template <class T>
+    struct JsonFields;
+
+    // 拉取式JSON解析器：直接在输入文本上按需读取，不构造 Json::Value 树
+    // 出错后所有读取都返回false，最后由 ok() 判断整体是否成功
+    class JsonReader
+    {
+    public:
+        JsonReader(const char *begin, const char *end) : _p(begin), _end(end) {}
+
+        bool ok() const { return _ok; }
+        bool consume(char c); // 跳过空白后读取字符c
+        bool next(char close, bool *first); // 数组/对象中是否还有下一个元素，遇到close时读取它并返回false
+        bool readString(std::string *str);
+        bool readInt(int64_t *v); // 带小数或指数的数字截断为整数
+        bool readBool(bool *v);
+        bool skipValue(); // 跳过一个任意类型的值(未知字段)
+        bool atEnd();     // 剩余内容只有空白
+
+    private:
+        void skipSpace();
+        bool fail() { return _ok = false; }
+        void appendUtf8(uint32_t cp, std::string *str);
+        bool readHex4(uint32_t *cp);
+
+    private:
+        const char *_p;
+        const char *_end;
+        bool _ok = true;
+    };
+
+    // 按字段表编码/解码，用于备份信息、文件列表等热点路径
+    class FastJson
+    {
+    public:
+        template <class T>
+        static void write(JsonWriter &writer, const T &val);
+        template <class T>
+        static bool read(JsonReader &reader, T *val);
+
+        template <class T>
+        static std::string serialize(const T &val)
+        {
+            JsonWriter writer;
+            write(writer, val);
+            return std::move(writer.buffer());
+        }
+        template <class T>
+        static bool unserialize(const std::string &str, T *val)
+        {
+            JsonReader reader(str.data(), str.data() + str.size());
+            return read(reader, val) && reader.atEnd();
+        }
+
+    private:
+        template <class T>
+        struct IsVector : std::false_type
+        {
+        };
+        template <class E>
+        struct IsVector<std::vector<E>> : std::true_type
+        {
+        };
+    };
+}
+
+template <class T>
+void Util::FastJson::write(JsonWriter &writer, const T &val)
+{
+    if constexpr (std::is_same_v<T, bool>)
+    {
+        writer.value(val);
+    }
+    else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+    {
+        writer.value((int64_t)val);
+    }
+    else if constexpr (std::is_integral_v<T>)
+    {
+        writer.value((uint64_t)val);
+    }
+    else if constexpr (std::is_same_v<T, std::string>)
+    {
+        writer.value(val);
+    }
+    else if constexpr (IsVector<T>::value)
+    {
+        writer.beginArray();
+        for (auto &item : val)
+            write(writer, item);
+        writer.endArray();
+    }
+    else if constexpr (JsonFields<T>::as_array)
+    {
+        writer.beginArray();
+        std::apply([&](auto &...field)
+                   { (write(writer, val.*(field.member)), ...); },
+                   JsonFields<T>::fields);
+        writer.endArray();
+    }
+    else
+    {
+        writer.beginObject();
+        std::apply([&](auto &...field)
+                   { ((writer.key(field.name), write(writer, val.*(field.member))), ...); },
+                   JsonFields<T>::fields);
+        writer.endObject();
+    }
+}
+
+template <class T>
+bool Util::FastJson::read(JsonReader &reader, T *val)
+{
+    if constexpr (std::is_same_v<T, bool>)
+    {
+        return reader.readBool(val);
+    }
+    else if constexpr (std::is_integral_v<T>)
+    {
+        int64_t v;
+        if (!reader.readInt(&v))
+            return false;
+        *val = (T)v;
+        return true;
+    }
+    else if constexpr (std::is_same_v<T, std::string>)
+    {
+        return reader.readString(val);
+    }
+    else if constexpr (IsVector<T>::value)
+    {
+        if (!reader.consume('['))
+            return false;
+        val->clear();
+        bool first = true;
+        while (reader.next(']', &first))
+        {
+            val->emplace_back();
+            if (!read(reader, &val->back()))
+                return false;
+        }
+        return reader.ok();
+    }
+    else if constexpr (JsonFields<T>::as_array)
+    {
+        // 按顺序读取，多余的元素跳过
+        if (!reader.consume('['))
+            return false;
+        bool first = true;
+        bool ok = true;
+        std::apply([&](auto &...field)
+                   { ((ok = ok && reader.next(']', &first) && read(reader, &(val->*(field.member)))), ...); },
+                   JsonFields<T>::fields);
+        if (!ok)
+            return false;
+        while (reader.next(']', &first))
+        {
+            if (!reader.skipValue())
+                return false;
+        }
+        return reader.ok();
+    }
+    else
+    {
+        // 缺少的字段保持原值，未知字段跳过
+        if (!reader.consume('{'))
+            return false;
+        bool first = true;
+        std::string key;
+        while (reader.next('}', &first))
+        {
+            if (!reader.readString(&key) || !reader.consume(':'))
+                return false;
+            bool matched = false;
+            bool ok = true;
+            std::apply([&](auto &...field)
+                       { ((!matched && key == field.name ? (matched = true, ok = read(reader, &(val->*(field.member)))) : false), ...); },
+                       JsonFields<T>::fields);
+            if (!matched)
+                ok = reader.skipValue();
+            if (!ok)
+                return false;
+        }
+        return reader.ok();
+    }
+}
+
+void Util::JsonReader::skipSpace()
+{
+    while (_p < _end && (*_p == ' ' || *_p == '\t' || *_p == '\n' || *_p == '\r'))
+        _p++;
+}
+
+bool Util::JsonReader::atEnd()
+{
+    skipSpace();
+    return _ok && _p == _end;
+}
+
+bool Util::JsonReader::consume(char c)
+{
+    skipSpace();
+    if (!_ok || _p == _end || *_p != c)
+        return fail();
+    _p++;
+    return true;
+}
+
+bool Util::JsonReader::next(char close, bool *first)
+{
+    skipSpace();
+    if (!_ok || _p == _end)
+        return fail();
+    if (*_p == close)
+    {
+        _p++;
+        return false;
+    }
+    if (!*first && !consume(','))
+        return false;
+    *first = false;
+    return true;
+}
+
+bool Util::JsonReader::readHex4(uint32_t *cp)
+{
+    if (_end - _p < 4)
+        return fail();
+    *cp = 0;
+    for (int i = 0; i < 4; i++, _p++)
+    {
+        char c = *_p;
+        *cp <<= 4;
+        if (c >= '0' && c <= '9')
+            *cp |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            *cp |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            *cp |= c - 'A' + 10;
+        else
+            return fail();
+    }
+    return true;
+}
+
+void Util::JsonReader::appendUtf8(uint32_t cp, std::string *str)
+{
+    if (cp < 0x80)
+    {
+        *str += (char)cp;
+    }
+    else if (cp < 0x800)
+    {
+        *str += (char)(0xC0 | (cp >> 6));
+        *str += (char)(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000)
+    {
+        *str += (char)(0xE0 | (cp >> 12));
+        *str += (char)(0x80 | ((cp >> 6) & 0x3F));
+        *str += (char)(0x80 | (cp & 0x3F));
+    }
+    else
+    {
+        *str += (char)(0xF0 | (cp >> 18));
+        *str += (char)(0x80 | ((cp >> 12) & 0x3F));
+        *str += (char)(0x80 | ((cp >> 6) & 0x3F));
+        *str += (char)(0x80 | (cp & 0x3F));
+    }
+}
+
+bool Util::JsonReader::readString(std::string *str)
+{
+    if (!consume('"'))
+        return false;
+    str->clear();
+    while (true)
+    {
+        // 没有转义的一段整体追加
+        const char *begin = _p;
+        while (_p < _end && *_p != '"' && *_p != '\\')
+            _p++;
+        str->append(begin, _p - begin);
+        if (_p == _end)
+            return fail();
+        if (*_p++ == '"')
+            return true;
+
+        if (_p == _end)
+            return fail();
+        char c = *_p++;
+        switch (c)
+        {
+        case '"': *str += '"'; break;
+        case '\\': *str += '\\'; break;
+        case '/': *str += '/'; break;
+        case 'b': *str += '\b'; break;
+        case 'f': *str += '\f'; break;
+        case 'n': *str += '\n'; break;
+        case 'r': *str += '\r'; break;
+        case 't': *str += '\t'; break;
+        case 'u':
+        {
+            // jsoncpp 默认把非ASCII字符写成\uXXXX，需要还原为UTF-8(含代理对)
+            uint32_t cp;
+            if (!readHex4(&cp))
+                return false;
+            if (cp >= 0xD800 && cp <= 0xDBFF && _end - _p >= 6 && _p[0] == '\\' && _p[1] == 'u')
+            {
+                _p += 2;
+                uint32_t low;
+                if (!readHex4(&low))
+                    return false;
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            }
+            appendUtf8(cp, str);
+            break;
+        }
+        default:
+            return fail();
+        }
+    }
+}
+
+bool Util::JsonReader::readInt(int64_t *v)
+{
+    skipSpace();
+    if (!_ok || _p == _end)
+        return fail();
+    const char *begin = _p;
+    auto res = std::from_chars(_p, _end, *v);
+    if (res.ec != std::errc())
+        return fail();
+    _p = res.ptr;
+    // 带小数或指数部分(如 1e+10)时按浮点解析后截断
+    if (_p < _end && (*_p == '.' || *_p == 'e' || *_p == 'E'))
+    {
+        while (_p < _end && (isdigit(*_p) || *_p == '.' || *_p == 'e' || *_p == 'E' || *_p == '+' || *_p == '-'))
+            _p++;
+        *v = (int64_t)strtod(std::string(begin, _p).c_str(), nullptr);
+    }
+    return true;
+}
+
+bool Util::JsonReader::readBool(bool *v)
+{
+    skipSpace();
+    if (_end - _p >= 4 && memcmp(_p, "true", 4) == 0)
+    {
+        _p += 4;
+        *v = true;
+        return true;
+    }
+    if (_end - _p >= 5 && memcmp(_p, "false", 5) == 0)
+    {
+        _p += 5;
+        *v = false;
+        return true;
+    }
+    return fail();
+}
+
+bool Util::JsonReader::skipValue()
+{
+    skipSpace();
+    if (!_ok || _p == _end)
+        return fail();
+    std::string tmp;
+    bool first = true;
+    switch (*_p)
+    {
+    case '"':
+        return readString(&tmp);
+    case '[':
+        _p++;
+        while (next(']', &first))
+        {
+            if (!skipValue())
+                return false;
+        }
+        return _ok;
+    case '{':
+        _p++;
+        while (next('}', &first))
+        {
+            if (!readString(&tmp) || !consume(':') || !skipValue())
+                return false;
+        }
+        return _ok;
+    case 't':
+    case 'f':
+    {
+        bool b;
+        return readBool(&b);
+    }
+    case 'n':
+        if (_end - _p >= 4 && memcmp(_p, "null", 4) == 0)
+        {
+            _p += 4;
+            return true;
+        }
+        return fail();
+    default:
+        while (_p < _end && (isdigit(*_p) || *_p == '.' || *_p == 'e' || *_p == 'E' || *_p == '+' || *_p == '-'))
+            _p++;
+        return true;
+    }
+}
@@ -0,0 +1,564 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace Cloud
+{
+    using HeaderList = std::vector<std::pair<std::string, std::string>>;
+
+    // HTTP/2 (RFC 7540) 帧格式，事件驱动服务端的 h2c 与基准测试客户端共用
+    namespace H2
+    {
+        static const char preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"; // 客户端连接前言
+        static const size_t preface_len = 24;
+        static const size_t frame_header_len = 9;
+        static const size_t default_frame_size = 16384; // 帧长度上限的默认值
+        static const int64_t default_window = 65535;    // 流量控制窗口的初始值
+        static const int64_t max_window = 0x7fffffff;
+
+        enum FrameType
+        {
+            DATA = 0,
+            HEADERS = 1,
+            PRIORITY = 2,
+            RST_STREAM = 3,
+            SETTINGS = 4,
+            PUSH_PROMISE = 5,
+            PING = 6,
+            GOAWAY = 7,
+            WINDOW_UPDATE = 8,
+            CONTINUATION = 9
+        };
+        enum Flag
+        {
+            FLAG_END_STREAM = 0x1,
+            FLAG_ACK = 0x1,
+            FLAG_END_HEADERS = 0x4,
+            FLAG_PADDED = 0x8,
+            FLAG_PRIORITY = 0x20
+        };
+        enum Setting
+        {
+            SETTINGS_HEADER_TABLE_SIZE = 1,
+            SETTINGS_ENABLE_PUSH = 2,
+            SETTINGS_MAX_CONCURRENT_STREAMS = 3,
+            SETTINGS_INITIAL_WINDOW_SIZE = 4,
+            SETTINGS_MAX_FRAME_SIZE = 5,
+            SETTINGS_MAX_HEADER_LIST_SIZE = 6
+        };
+        enum ErrorCode
+        {
+            ERR_NO_ERROR = 0,
+            ERR_PROTOCOL = 1,
+            ERR_INTERNAL = 2,
+            ERR_FLOW_CONTROL = 3,
+            ERR_STREAM_CLOSED = 5,
+            ERR_FRAME_SIZE = 6,
+            ERR_REFUSED_STREAM = 7,
+            ERR_CANCEL = 8,
+            ERR_COMPRESSION = 9
+        };
+
+        struct FrameHeader
+        {
+            uint32_t length;
+            uint8_t type;
+            uint8_t flags;
+            uint32_t stream;
+        };
+
+        inline uint32_t readU32(const char *p)
+        {
+            const uint8_t *u = (const uint8_t *)p;
+            return (uint32_t)u[0] << 24 | (uint32_t)u[1] << 16 | (uint32_t)u[2] << 8 | u[3];
+        }
+
+        inline void appendU32(std::string *out, uint32_t v)
+        {
+            char b[4] = {(char)(v >> 24), (char)(v >> 16), (char)(v >> 8), (char)v};
+            out->append(b, 4);
+        }
+
+        inline FrameHeader parseFrameHeader(const char *p)
+        {
+            const uint8_t *u = (const uint8_t *)p;
+            FrameHeader h;
+            h.length = (uint32_t)u[0] << 16 | (uint32_t)u[1] << 8 | u[2];
+            h.type = u[3];
+            h.flags = u[4];
+            h.stream = readU32(p + 5) & 0x7fffffff;
+            return h;
+        }
+
+        inline void appendFrame(std::string *out, uint8_t type, uint8_t flags, uint32_t stream, const char *data, size_t len)
+        {
+            char h[frame_header_len] = {(char)(len >> 16), (char)(len >> 8), (char)len, (char)type, (char)flags,
+                                        (char)(stream >> 24 & 0x7f), (char)(stream >> 16), (char)(stream >> 8), (char)stream};
+            out->append(h, sizeof(h));
+            out->append(data, len);
+        }
+
+        // 头部块超过对端的帧长度上限时拆分为 HEADERS + CONTINUATION
+        inline void appendHeaders(std::string *out, uint32_t stream, const std::string &block, bool end_stream, size_t max_frame)
+        {
+            size_t pos = 0;
+            do
+            {
+                size_t n = std::min(max_frame, block.size() - pos);
+                bool last = pos + n == block.size();
+                uint8_t type = pos == 0 ? HEADERS : CONTINUATION;
+                uint8_t flags = (last ? FLAG_END_HEADERS : 0) | (pos == 0 && end_stream ? FLAG_END_STREAM : 0);
+                appendFrame(out, type, flags, stream, block.data() + pos, n);
+                pos += n;
+            } while (pos < block.size());
+        }
+
+        inline void appendSettings(std::string *out, const std::vector<std::pair<uint16_t, uint32_t>> &settings)
+        {
+            std::string payload;
+            for (auto &[id, val] : settings)
+            {
+                payload += (char)(id >> 8);
+                payload += (char)id;
+                appendU32(&payload, val);
+            }
+            appendFrame(out, SETTINGS, 0, 0, payload.data(), payload.size());
+        }
+
+        inline void appendWindowUpdate(std::string *out, uint32_t stream, uint32_t increment)
+        {
+            std::string payload;
+            appendU32(&payload, increment & 0x7fffffff);
+            appendFrame(out, WINDOW_UPDATE, 0, stream, payload.data(), payload.size());
+        }
+
+        inline void appendRstStream(std::string *out, uint32_t stream, uint32_t error)
+        {
+            std::string payload;
+            appendU32(&payload, error);
+            appendFrame(out, RST_STREAM, 0, stream, payload.data(), payload.size());
+        }
+
+        inline void appendGoaway(std::string *out, uint32_t last_stream, uint32_t error)
+        {
+            std::string payload;
+            appendU32(&payload, last_stream & 0x7fffffff);
+            appendU32(&payload, error);
+            appendFrame(out, GOAWAY, 0, 0, payload.data(), payload.size());
+        }
+    }
+
+    // HPACK (RFC 7541) 动态表：新条目在前，按条目大小(名称+值+32)淘汰最旧的条目
+    class HpackTable
+    {
+    public:
+        HpackTable(size_t max_size) : _max_size(max_size) {}
+        void setMaxSize(size_t size);
+        size_t maxSize() const { return _max_size; }
+        void insert(const std::string &name, const std::string &value);
+        const std::pair<std::string, std::string> *get(uint64_t index) const; // 下标从1开始，静态表之后是动态表
+        uint64_t find(const std::string &name, const std::string &value, uint64_t *name_index) const; // 完全匹配的下标，0表示没有
+
+    private:
+        void evict();
+
+    private:
+        static const std::vector<std::pair<std::string, std::string>> &staticTable();
+        std::deque<std::pair<std::string, std::string>> _entries;
+        size_t _size = 0;
+        size_t _max_size;
+    };
+
+    // HPACK 解码：一个连接一个解码器，按头部块到达顺序解码
+    class HpackDecoder
+    {
+    public:
+        HpackDecoder(size_t max_size = 4096) : _table(max_size), _limit(max_size) {}
+        bool decode(const char *data, size_t len, HeaderList *headers); // 出错(压缩错误)返回false，连接必须关闭
+
+    private:
+        static bool readInt(const uint8_t *&p, const uint8_t *end, int prefix, uint64_t *v);
+        static bool readString(const uint8_t *&p, const uint8_t *end, std::string *str);
+        static bool huffmanDecode(const uint8_t *p, size_t len, std::string *str);
+
+    private:
+        HpackTable _table;
+        size_t _limit; // 本端 SETTINGS_HEADER_TABLE_SIZE，对端的表长度更新不能超过它
+    };
+
+    // HPACK 编码：常见的字段值写入动态表，之后的响应只需一个字节；随请求变化的字段不入表；字符串不做Huffman编码
+    class HpackEncoder
+    {
+    public:
+        HpackEncoder() : _table(4096) {}
+        void setMaxSize(size_t size); // 对端的 SETTINGS_HEADER_TABLE_SIZE
+        void encode(const HeaderList &headers, std::string *out);
+
+    private:
+        static void writeInt(std::string *out, uint8_t bits, int prefix, uint64_t v);
+        static void writeString(std::string *out, const std::string &str);
+        static bool indexable(const std::string &name);
+
+    private:
+        HpackTable _table;
+        bool _size_update = false; // 下一个头部块开头需要告知对端动态表长度
+    };
+}
+
+const std::vector<std::pair<std::string, std::string>> &Cloud::HpackTable::staticTable()
+{
+    static const std::vector<std::pair<std::string, std::string>> table = {
+        {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+        {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+        {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+        {":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+        {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+        {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+        {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+        {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+        {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+        {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+        {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+        {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+        {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+        {"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+        {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+        {"www-authenticate", ""},    };
+    return table;
+}
+
+void Cloud::HpackTable::setMaxSize(size_t size)
+{
+    _max_size = size;
+    evict();
+}
+
+void Cloud::HpackTable::evict()
+{
+    while (_size > _max_size && !_entries.empty())
+    {
+        _size -= _entries.back().first.size() + _entries.back().second.size() + 32;
+        _entries.pop_back();
+    }
+}
+
+void Cloud::HpackTable::insert(const std::string &name, const std::string &value)
+{
+    // 比整个表还大的条目使表清空，本身也不入表
+    _entries.emplace_front(name, value);
+    _size += name.size() + value.size() + 32;
+    evict();
+}
+
+const std::pair<std::string, std::string> *Cloud::HpackTable::get(uint64_t index) const
+{
+    auto &st = staticTable();
+    if (index == 0)
+        return nullptr;
+    if (index <= st.size())
+        return &st[index - 1];
+    index -= st.size() + 1;
+    return index < _entries.size() ? &_entries[index] : nullptr;
+}
+
+uint64_t Cloud::HpackTable::find(const std::string &name, const std::string &value, uint64_t *name_index) const
+{
+    auto &st = staticTable();
+    *name_index = 0;
+    for (size_t i = 0; i < st.size(); i++)
+    {
+        if (st[i].first != name)
+            continue;
+        if (*name_index == 0)
+            *name_index = i + 1;
+        if (st[i].second == value)
+            return i + 1;
+    }
+    for (size_t i = 0; i < _entries.size(); i++)
+    {
+        if (_entries[i].first != name)
+            continue;
+        if (*name_index == 0)
+            *name_index = st.size() + i + 1;
+        if (_entries[i].second == value)
+            return st.size() + i + 1;
+    }
+    return 0;
+}
+
+bool Cloud::HpackDecoder::decode(const char *data, size_t len, HeaderList *headers)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    const uint8_t *end = p + len;
+    while (p < end)
+    {
+        uint8_t b = *p;
+        uint64_t index;
+        if (b & 0x80)
+        {
+            // 索引字段
+            if (!readInt(p, end, 7, &index))
+                return false;
+            auto entry = _table.get(index);
+            if (entry == nullptr)
+                return false;
+            headers->push_back(*entry);
+        }
+        else if ((b & 0xe0) == 0x20)
+        {
+            // 动态表长度更新
+            if (!readInt(p, end, 5, &index) || index > _limit)
+                return false;
+            _table.setMaxSize(index);
+        }
+        else
+        {
+            // 字面量字段：0x40 加入动态表；0x00 不加入；0x10 永不加入
+            bool incremental = b & 0x40;
+            std::pair<std::string, std::string> field;
+            if (!readInt(p, end, incremental ? 6 : 4, &index))
+                return false;
+            if (index > 0)
+            {
+                auto entry = _table.get(index);
+                if (entry == nullptr)
+                    return false;
+                field.first = entry->first;
+            }
+            else if (!readString(p, end, &field.first))
+            {
+                return false;
+            }
+            if (!readString(p, end, &field.second))
+                return false;
+            if (incremental)
+                _table.insert(field.first, field.second);
+            headers->push_back(std::move(field));
+        }
+    }
+    return true;
+}
+
+bool Cloud::HpackDecoder::readInt(const uint8_t *&p, const uint8_t *end, int prefix, uint64_t *v)
+{
+    if (p >= end)
+        return false;
+    uint64_t max = (1u << prefix) - 1;
+    uint64_t x = *p++ & max;
+    if (x < max)
+    {
+        *v = x;
+        return true;
+    }
+    for (int shift = 0; p < end && shift <= 56; shift += 7)
+    {
+        uint8_t b = *p++;
+        x += (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+        {
+            *v = x;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Cloud::HpackDecoder::readString(const uint8_t *&p, const uint8_t *end, std::string *str)
+{
+    if (p >= end)
+        return false;
+    bool huffman = *p & 0x80;
+    uint64_t len;
+    if (!readInt(p, end, 7, &len) || len > (uint64_t)(end - p))
+        return false;
+    bool ok = true;
+    if (huffman)
+        ok = huffmanDecode(p, len, str);
+    else
+        str->assign((const char *)p, len);
+    p += len;
+    return ok;
+}
+
+bool Cloud::HpackDecoder::huffmanDecode(const uint8_t *p, size_t len, std::string *str)
+{
+    // 规范Huffman码：同一长度的码字连续，按长度记录首个码字与对应的符号表位置
+    struct Code
+    {
+        uint32_t code;
+        uint8_t bits;
+    };
+    static const Code codes[256] = {
+        {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28}, {0xfffffe4, 28}, {0xfffffe5, 28},
+        {0xfffffe6, 28}, {0xfffffe7, 28}, {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+        {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28}, {0xfffffed, 28}, {0xfffffee, 28},
+        {0xfffffef, 28}, {0xffffff0, 28}, {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+        {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28}, {0xffffff8, 28}, {0xffffff9, 28},
+        {0xffffffa, 28}, {0xffffffb, 28}, {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+        {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11}, {0x3fa, 10}, {0x3fb, 10},
+        {0xf9, 8}, {0x7fb, 11}, {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+        {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6}, {0x1a, 6}, {0x1b, 6},
+        {0x1c, 6}, {0x1d, 6}, {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+        {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10}, {0x1ffa, 13}, {0x21, 6},
+        {0x5d, 7}, {0x5e, 7}, {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+        {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7}, {0x67, 7}, {0x68, 7},
+        {0x69, 7}, {0x6a, 7}, {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+        {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7}, {0xfc, 8}, {0x73, 7},
+        {0xfd, 8}, {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+        {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5},
+        {0x25, 6}, {0x26, 6}, {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+        {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5}, {0x2b, 6}, {0x76, 7},
+        {0x2c, 6}, {0x8, 5}, {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+        {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15}, {0x7fc, 11}, {0x3ffd, 14},
+        {0x1ffd, 13}, {0xffffffc, 28}, {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+        {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23}, {0x3fffd6, 22}, {0x7fffda, 23},
+        {0x7fffdb, 23}, {0x7fffdc, 23}, {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+        {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23}, {0xffffee, 24}, {0x7fffe1, 23},
+        {0x7fffe2, 23}, {0x7fffe3, 23}, {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+        {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24}, {0x3fffda, 22}, {0x1fffdd, 21},
+        {0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+        {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24}, {0x1fffdf, 21}, {0x3fffdf, 22},
+        {0x7fffeb, 23}, {0x7fffec, 23}, {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+        {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23}, {0xfffea, 20}, {0x3fffe2, 22},
+        {0x3fffe3, 22}, {0x3fffe4, 22}, {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+        {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19}, {0x3fffe7, 22}, {0x7ffff2, 23},
+        {0x3fffe8, 22}, {0x1ffffec, 25}, {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+        {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25}, {0x7fff2, 19}, {0x1fffe3, 21},
+        {0x3ffffe6, 26}, {0x7ffffe0, 27}, {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+        {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26}, {0xffffffd, 28}, {0x7ffffe3, 27},
+        {0x7ffffe4, 27}, {0x7ffffe5, 27}, {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+        {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23}, {0x3fffea, 22}, {0x3fffeb, 22},
+        {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+        {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26}, {0x7ffffe7, 27}, {0x7ffffe8, 27},
+        {0x7ffffe9, 27}, {0x7ffffea, 27}, {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+        {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},    };
+    struct Tables
+    {
+        uint32_t first[31] = {0}; // 各长度首个码字
+        uint32_t count[31] = {0};
+        uint32_t offset[31] = {0}; // 各长度在symbols中的起始位置
+        std::vector<uint16_t> symbols;
+        Tables()
+        {
+            std::vector<std::pair<uint64_t, uint16_t>> sorted; // (长度<<32 | 码字, 符号)
+            for (uint16_t s = 0; s < 256; s++)
+                sorted.emplace_back((uint64_t)codes[s].bits << 32 | codes[s].code, s);
+            sorted.emplace_back((uint64_t)30 << 32 | 0x3fffffff, 256); // EOS
+            std::sort(sorted.begin(), sorted.end());
+            for (size_t i = 0; i < sorted.size(); i++)
+            {
+                uint32_t bits = sorted[i].first >> 32;
+                if (count[bits]++ == 0)
+                {
+                    first[bits] = (uint32_t)sorted[i].first;
+                    offset[bits] = i;
+                }
+                symbols.push_back(sorted[i].second);
+            }
+        }
+    };
+    static const Tables tables;
+
+    str->clear();
+    uint32_t code = 0;
+    int bits = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        for (int b = 7; b >= 0; b--)
+        {
+            code = code << 1 | ((p[i] >> b) & 1);
+            bits++;
+            if (bits > 30)
+                return false;
+            if (tables.count[bits] && code >= tables.first[bits] && code - tables.first[bits] < tables.count[bits])
+            {
+                uint16_t sym = tables.symbols[tables.offset[bits] + code - tables.first[bits]];
+                if (sym == 256) // 不允许出现EOS
+                    return false;
+                *str += (char)sym;
+                code = 0;
+                bits = 0;
+            }
+        }
+    }
+    // 结尾的填充必须是不超过7位的EOS前缀(全1)
+    return bits <= 7 && code == (1u << bits) - 1;
+}
+
+void Cloud::HpackEncoder::setMaxSize(size_t size)
+{
+    size = std::min<size_t>(size, 4096);
+    if (size != _table.maxSize())
+    {
+        _table.setMaxSize(size);
+        _size_update = true;
+    }
+}
+
+bool Cloud::HpackEncoder::indexable(const std::string &name)
+{
+    static const char *varying[] = {":path", "content-length", "content-range", "content-disposition", "etag",
+                                    "last-modified", "date", "authorization", "cookie", "set-cookie"};
+    for (auto v : varying)
+    {
+        if (name == v)
+            return false;
+    }
+    return true;
+}
+
+void Cloud::HpackEncoder::encode(const HeaderList &headers, std::string *out)
+{
+    if (_size_update)
+    {
+        writeInt(out, 0x20, 5, _table.maxSize());
+        _size_update = false;
+    }
+    for (auto &[name, value] : headers)
+    {
+        uint64_t name_index;
+        uint64_t index = _table.find(name, value, &name_index);
+        if (index > 0)
+        {
+            writeInt(out, 0x80, 7, index);
+            continue;
+        }
+        bool incremental = indexable(name);
+        writeInt(out, incremental ? 0x40 : 0x00, incremental ? 6 : 4, name_index);
+        if (name_index == 0)
+            writeString(out, name);
+        writeString(out, value);
+        if (incremental)
+            _table.insert(name, value);
+    }
+}
+
+void Cloud::HpackEncoder::writeInt(std::string *out, uint8_t bits, int prefix, uint64_t v)
+{
+    uint64_t max = (1u << prefix) - 1;
+    if (v < max)
+    {
+        *out += (char)(bits | v);
+        return;
+    }
+    *out += (char)(bits | max);
+    v -= max;
+    while (v >= 128)
+    {
+        *out += (char)(0x80 | (v & 0x7f));
+        v >>= 7;
+    }
+    *out += (char)v;
+}
+
+void Cloud::HpackEncoder::writeString(std::string *out, const std::string &str)
+{
+    writeInt(out, 0x00, 7, str.size());
+    out->append(str);
+}
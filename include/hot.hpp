@@ -1,9 +1,12 @@
 #pragma once
 #include <iostream>
+#include <unordered_set>
 #include "util.hpp"
 #include "config.hpp"
 #include "data.hpp"
-#include "threadpool.hh"
+#include "pack.hpp"
+#include "scheduler.hpp"
+#include "prefetch.hpp"
 
 extern Cloud::BackupInfoManager *_biManager;
 extern ckflogs::Logger::Ptr _logger;
@@ -11,7 +14,9 @@ extern ckflogs::Logger::Ptr _logger;
 namespace Cloud
 {
     // 获取备份文件夹目录，遍历其中所有备份文件，对每一个备份文件进行热点判断
-    // 热点判断：当前时间 与 文件最近一次修改时间的差值，是否小于热点时间，是则为热点文件
+    // 热点判断：当前时间 与 备份信息中最近一次上传或解压时间的差值，是否小于热点时间，是则为热点文件
+    // (不看磁盘上的时间：内容相同的文件共享inode，磁盘时间属于最早的那个文件)
+    // 预取解压、尚未被下载的文件也视为热点文件
     // 若备份文件是非热点文件，对其进行压缩，删除原文件，修改备份数据pack_flag
 
     class HotManager // 热点管理器
@@ -21,13 +26,52 @@ namespace Cloud
         bool run(); // 运行热点管理器
 
     private:
-        bool isHot(const std::string &realPath);           // 热点判断
+        void restoreQueue();                               // 重新提交上次进程退出时未完成的压缩任务
+        void schedule(Cloud::BackupInfo bi);               // 提交一个压缩任务
+        bool isHot(const BackupInfo &bi);                  // 热点判断
         bool NotHotHandler(Cloud::BackupInfo backupInfo); // 非热点文件的处理函数
     };
 }
 
 Cloud::HotManager::HotManager()
 {
+    restoreQueue();
+}
+
+void Cloud::HotManager::restoreQueue()
+{
+    // 1.持久化的任务队列(唯一的记录：备份信息中的压缩中标记不落盘，队列记录丢失的文件由下一轮扫描重新发现)
+    std::vector<std::pair<std::string, size_t>> jobs;
+    CompressScheduler::getInstance().loadQueue(&jobs);
+
+    // 2.去重后，对仍未压缩的文件重新提交，不必等待下一轮全目录扫描
+    std::unordered_set<std::string> seen;
+    size_t restored = 0;
+    for (auto &[url, fsize] : jobs)
+    {
+        if (!seen.insert(url).second)
+            continue;
+
+        BackupInfo bi;
+        if (!_biManager->getOneByURL(url, &bi) || bi.pack_flag || !Util::FileUtil(bi.real_path).isExists())
+            continue;
+
+        schedule(bi);
+        restored++;
+    }
+    _logger->_debug("热点管理模块-恢复压缩任务 %d 个", restored);
+}
+
+void Cloud::HotManager::schedule(Cloud::BackupInfo bi)
+{
+    // 异步处理：将非热点文件处理工作（包括压缩、删除）交给压缩调度器，由其限速后派发到线程池
+    // 压缩中标记只改内存，不为每个文件重写备份信息；任务由压缩调度器的队列日志记录
+    bi.is_packing = true;
+    if (_biManager->setPacking(bi.url, true))
+    {
+        auto func = std::bind(&Cloud::HotManager::NotHotHandler, this, bi);
+        CompressScheduler::getInstance().submit(bi.url, bi.fsize, func);
+    }
 }
 
 // 运行热点管理模块
@@ -52,6 +96,13 @@ bool Cloud::HotManager::run()
         // 3.对每一个备份文件进行热点判断
         for (const std::string &backup : backups)
         {
+            // 临时文件（上传/解压未完成）不是备份文件，不用处理
+            Util::FileUtil bfu(backup);
+            if (!bfu.isRegularFile() || bfu.isTempFile())
+            {
+                continue;
+            }
+
             // 获取备份信息
             BackupInfo bi;
             if (_biManager->getOneByRealPath(backup, &bi) == false)
@@ -66,20 +117,14 @@ bool Cloud::HotManager::run()
 
             // 文件不存在 or 正在进行压缩 or 是热点文件 ，不用处理
 
-            if (!Util::FileUtil(backup).isExists() || bi.is_packing || isHot(backup))
+            // 副本中已是压缩包：文件刚被解压，备份信息尚未更新，不用处理
+            if (!Util::FileUtil(backup).isExists() || bi.pack_flag || bi.is_packing || isHot(bi))
             {
                 continue;
             }
 
             // 进入非热点文件的处理
-
-            // 异步处理：将非热点文件处理工作（包括压缩、删除）交给线程池
-            bi.is_packing = true;
-            if (_biManager->update(bi.url, bi))
-            {
-                auto func = std::bind(&Cloud::HotManager::NotHotHandler, this, std::placeholders::_1);
-                auto ret = ckf::ThreadPool::getInstance().submit(ckf::ThreadPool::LV1, func, bi);
-            }
+            schedule(bi);
         }
         usleep(1000);
     }
@@ -91,37 +136,27 @@ bool Cloud::HotManager::NotHotHandler(Cloud::BackupInfo bi)
     _logger->_debug("非热点文件 %s, 开始处理", bi.real_path.c_str());
     time_t begin = time(nullptr);
 
-    Util::FileUtil fu(bi.real_path);
-
-    // 1.压缩，并放入压缩包文件夹
-    if (!fu.compress(bi.pack_path))
-        return false;
-
-    // 2.修改备份信息
-    bi.pack_flag = true;
-
-    // 3.删除原备份文件
-    if (!fu.remove())
+    // 压缩、更新备份信息、删除原文件，由Packer保证崩溃安全
+    if (!Packer::pack(bi.url, [this](const BackupInfo &cur)
+                      { return !isHot(cur); }))
+    {
+        _logger->_warn("非热点文件 %s, 处理失败", bi.real_path.c_str());
         return false;
-
-    // 4.压缩工作结束
-    bi.is_packing = false;
-
-    // 5.更新备份信息
-    _biManager->update(bi.url, bi);
+    }
 
     time_t end = time(nullptr);
     _logger->_debug("非热点文件 %s, 处理成功 - 用时: %d", bi.pack_path.c_str(), end - begin);
     return true;
 }
 
-bool Cloud::HotManager::isHot(const std::string &realPath) // 判断path是否为热点文件
+bool Cloud::HotManager::isHot(const BackupInfo &bi) // 判断文件是否为热点文件
 {
     // 1.获取热点时间
     time_t hot_time = Config::getInstance()->getHotTime();
-    // 2.获取文件的最近访问时间
-    Util::FileUtil fu(realPath);
-    time_t mtime = fu.lastModTime();
+    if (Prefetcher::getInstance().isPinned(bi.url))
+        return true;
+    // 2.获取文件最近一次上传或解压的时间
+    time_t mtime = std::max(bi.mtime, bi.atime);
 
     // 3.获取当前时间
     time_t cur_time = std::time(nullptr);
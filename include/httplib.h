@@ -106,6 +106,10 @@
 #define CPPHTTPLIB_TCP_NODELAY false
 #endif
 
+#ifndef CPPHTTPLIB_COALESCE_BODY_MAX
+#define CPPHTTPLIB_COALESCE_BODY_MAX 16384
+#endif
+
 #ifndef CPPHTTPLIB_IPV6_V6ONLY
 #define CPPHTTPLIB_IPV6_V6ONLY false
 #endif
@@ -206,6 +210,7 @@ using socket_t = SOCKET;
 #include <netinet/in.h>
 #ifdef __linux__
 #include <resolv.h>
+#include <sys/sendfile.h>
 #endif
 #include <netinet/tcp.h>
 #ifdef CPPHTTPLIB_USE_POLL
@@ -529,6 +534,9 @@ public:
   DataSink &operator=(DataSink &&) = delete;
 
   std::function<bool(const char *data, size_t data_len)> write;
+  // Sends [offset, offset + length) of an open file. Only set by providers
+  // with a known content length; uses sendfile(2) on plain sockets.
+  std::function<bool(int fd, size_t offset, size_t length)> write_file;
   std::function<bool()> is_writable;
   std::function<void()> done;
   std::function<void(const Headers &trailer)> done_with_trailer;
@@ -728,6 +736,7 @@ public:
   virtual void get_remote_ip_and_port(std::string &ip, int &port) const = 0;
   virtual void get_local_ip_and_port(std::string &ip, int &port) const = 0;
   virtual socket_t socket() const = 0;
+  virtual ssize_t write_file(int fd, size_t offset, size_t size);
 
   ssize_t write(const char *ptr);
   ssize_t write(const std::string &s);
@@ -742,6 +751,10 @@ public:
   virtual void shutdown() = 0;
 
   virtual void on_idle() {}
+
+  // Called before a connection rejected by enqueue() is closed, so that the
+  // queue can still send a response (e.g. 503) on it.
+  virtual void on_rejected(socket_t /*sock*/) {}
 };
 
 class ThreadPool final : public TaskQueue {
@@ -972,6 +985,7 @@ public:
 
   Server &set_address_family(int family);
   Server &set_tcp_nodelay(bool on);
+  Server &set_tcp_cork(bool on);
   Server &set_ipv6_v6only(bool on);
   Server &set_socket_options(SocketOptions socket_options);
 
@@ -1115,6 +1129,7 @@ private:
 
   int address_family_ = AF_UNSPEC;
   bool tcp_nodelay_ = CPPHTTPLIB_TCP_NODELAY;
+  bool tcp_cork_ = false;
   bool ipv6_v6only_ = CPPHTTPLIB_IPV6_V6ONLY;
   SocketOptions socket_options_ = default_socket_options;
 
@@ -2340,6 +2355,7 @@ public:
   socket_t socket() const override;
 
   const std::string &get_buffer() const;
+  void clear(); // Keeps the capacity so the stream can be reused
 
 private:
   std::string buffer;
@@ -3210,6 +3226,7 @@ public:
   void get_remote_ip_and_port(std::string &ip, int &port) const override;
   void get_local_ip_and_port(std::string &ip, int &port) const override;
   socket_t socket() const override;
+  ssize_t write_file(int fd, size_t offset, size_t size) override;
 
 private:
   socket_t sock_;
@@ -3813,6 +3830,31 @@ inline bool can_compress_content_type(const std::string &content_type) {
   }
 }
 
+// Whether an Accept-Encoding value lists the coding with a non-zero q-value
+inline bool accepts_encoding(const std::string &s, const std::string &coding) {
+  auto found = false;
+  split(s.data(), s.data() + s.size(), ',', [&](const char *b, const char *e) {
+    std::string item(b, e);
+    auto semi = item.find(';');
+    auto name = trim_copy(item.substr(0, semi));
+    if (found || name.size() != coding.size() ||
+        !std::equal(name.begin(), name.end(), coding.begin(),
+                    [](char a, char b) { return ::tolower(a) == ::tolower(b); })) {
+      return;
+    }
+    auto q = 1.0;
+    if (semi != std::string::npos) {
+      auto param = trim_copy(item.substr(semi + 1));
+      if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') &&
+          param[1] == '=') {
+        q = std::atof(param.c_str() + 2);
+      }
+    }
+    found = q > 0;
+  });
+  return found;
+}
+
 inline EncodingType encoding_type(const Request &req, const Response &res) {
   auto ret =
       detail::can_compress_content_type(res.get_header_value("Content-Type"));
@@ -3822,15 +3864,11 @@ inline EncodingType encoding_type(const Request &req, const Response &res) {
   (void)(s);
 
 #ifdef CPPHTTPLIB_BROTLI_SUPPORT
-  // TODO: 'Accept-Encoding' has br, not br;q=0
-  ret = s.find("br") != std::string::npos;
-  if (ret) { return EncodingType::Brotli; }
+  if (accepts_encoding(s, "br")) { return EncodingType::Brotli; }
 #endif
 
 #ifdef CPPHTTPLIB_ZLIB_SUPPORT
-  // TODO: 'Accept-Encoding' has gzip, not gzip;q=0
-  ret = s.find("gzip") != std::string::npos;
-  if (ret) { return EncodingType::Gzip; }
+  if (accepts_encoding(s, "gzip")) { return EncodingType::Gzip; }
 #endif
 
   return EncodingType::None;
@@ -4380,6 +4418,16 @@ inline ssize_t write_headers(Stream &strm, const Headers &headers) {
   return write_len;
 }
 
+inline bool write_file_data(Stream &strm, int fd, size_t offset, size_t l) {
+  while (l > 0) {
+    auto length = strm.write_file(fd, offset, l);
+    if (length <= 0) { return false; }
+    offset += static_cast<size_t>(length);
+    l -= static_cast<size_t>(length);
+  }
+  return true;
+}
+
 inline bool write_data(Stream &strm, const char *d, size_t l) {
   size_t offset = 0;
   while (offset < l) {
@@ -4409,6 +4457,17 @@ inline bool write_content(Stream &strm, const ContentProvider &content_provider,
     return ok;
   };
 
+  data_sink.write_file = [&](int fd, size_t file_offset, size_t l) -> bool {
+    if (ok) {
+      if (write_file_data(strm, fd, file_offset, l)) {
+        offset += l;
+      } else {
+        ok = false;
+      }
+    }
+    return ok;
+  };
+
   data_sink.is_writable = [&]() -> bool { return strm.is_writable(); };
 
   while (offset < end_offset && !is_shutting_down()) {
@@ -5066,7 +5125,7 @@ serialize_multipart_formdata(const MultipartFormDataItems &items,
 }
 
 inline bool range_error(Request &req, Response &res) {
-  if (!req.ranges.empty() && 200 <= res.status && res.status < 300) {
+  if (!req.ranges.empty() && res.status == StatusCode::PartialContent_206) {
     ssize_t contant_len = static_cast<ssize_t>(
         res.content_length_ ? res.content_length_ : res.body.size());
 
@@ -5798,6 +5857,22 @@ inline ssize_t Stream::write(const std::string &s) {
   return write(s.data(), s.size());
 }
 
+// Generic fallback: copy through a user-space buffer
+inline ssize_t Stream::write_file(int fd, size_t offset, size_t size) {
+#ifndef _WIN32
+  char buf[64 * 1024];
+  auto n = ::pread(fd, buf, (std::min)(size, sizeof(buf)),
+                   static_cast<off_t>(offset));
+  if (n <= 0) { return -1; }
+  return write(buf, static_cast<size_t>(n));
+#else
+  (void)fd;
+  (void)offset;
+  (void)size;
+  return -1;
+#endif
+}
+
 namespace detail {
 
 // Socket stream implementation
@@ -5890,6 +5965,20 @@ inline void SocketStream::get_local_ip_and_port(std::string &ip,
 
 inline socket_t SocketStream::socket() const { return sock_; }
 
+inline ssize_t SocketStream::write_file(int fd, size_t offset, size_t size) {
+#ifdef __linux__
+  if (!is_writable()) { return -1; }
+  auto off = static_cast<off_t>(offset);
+  auto n = ::sendfile(sock_, fd, &off, size);
+  if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+    return Stream::write_file(fd, offset, size);
+  }
+  return n;
+#else
+  return Stream::write_file(fd, offset, size);
+#endif
+}
+
 // Buffer stream implementation
 inline bool BufferStream::is_readable() const { return true; }
 
@@ -5920,6 +6009,11 @@ inline socket_t BufferStream::socket() const { return 0; }
 
 inline const std::string &BufferStream::get_buffer() const { return buffer; }
 
+inline void BufferStream::clear() {
+  buffer.clear();
+  position = 0;
+}
+
 inline PathParamsMatcher::PathParamsMatcher(const std::string &pattern) {
   static constexpr char marker[] = "/:";
 
@@ -6192,6 +6286,11 @@ inline Server &Server::set_tcp_nodelay(bool on) {
   return *this;
 }
 
+inline Server &Server::set_tcp_cork(bool on) {
+  tcp_cork_ = on;
+  return *this;
+}
+
 inline Server &Server::set_ipv6_v6only(bool on) {
   ipv6_v6only_ = on;
   return *this;
@@ -6365,8 +6464,9 @@ inline bool Server::write_response_core(Stream &strm, bool close_connection,
   if (need_apply_ranges) { apply_ranges(req, res, content_type, boundary); }
 
   // Prepare additional headers
-  if (close_connection || req.get_header_value("Connection") == "close") {
-    res.set_header("Connection", "close");
+  if (close_connection || req.get_header_value("Connection") == "close" ||
+      res.get_header_value("Connection") == "close") {
+    if (!res.has_header("Connection")) { res.set_header("Connection", "close"); }
   } else {
     std::string s = "timeout=";
     s += std::to_string(keep_alive_timeout_sec_);
@@ -6391,11 +6491,28 @@ inline bool Server::write_response_core(Stream &strm, bool close_connection,
 
   if (post_routing_handler_) { post_routing_handler_(req, res); }
 
-  // Response line and headers
+#ifdef TCP_CORK
+  // Hold partial segments until the whole response is queued
+  auto cork = tcp_cork_ && strm.socket() != INVALID_SOCKET;
+  if (cork) {
+    int on = 1;
+    setsockopt(strm.socket(), IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+  }
+#endif
+
+  // Response line and headers. The buffer is reused by every response
+  // served on this thread; small bodies are sent together with the headers.
+  auto body_sent = false;
   {
-    detail::BufferStream bstrm;
+    thread_local detail::BufferStream bstrm;
+    bstrm.clear();
     if (!detail::write_response_line(bstrm, res.status)) { return false; }
     if (!header_writer_(bstrm, res.headers)) { return false; }
+    if (req.method != "HEAD" && !res.body.empty() &&
+        res.body.size() <= CPPHTTPLIB_COALESCE_BODY_MAX) {
+      bstrm.write(res.body.data(), res.body.size());
+      body_sent = true;
+    }
 
     // Flush buffer
     auto &data = bstrm.get_buffer();
@@ -6404,7 +6521,7 @@ inline bool Server::write_response_core(Stream &strm, bool close_connection,
 
   // Body
   auto ret = true;
-  if (req.method != "HEAD") {
+  if (req.method != "HEAD" && !body_sent) {
     if (!res.body.empty()) {
       if (!detail::write_data(strm, res.body.data(), res.body.size())) {
         ret = false;
@@ -6418,6 +6535,13 @@ inline bool Server::write_response_core(Stream &strm, bool close_connection,
     }
   }
 
+#ifdef TCP_CORK
+  if (cork) {
+    int off = 0;
+    setsockopt(strm.socket(), IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+  }
+#endif
+
   // Log
   if (logger_) { logger_(req, res); }
 
@@ -6433,7 +6557,8 @@ Server::write_content_with_provider(Stream &strm, const Request &req,
   };
 
   if (res.content_length_ > 0) {
-    if (req.ranges.empty()) {
+    // Ranges only apply to 206 responses, same as apply_ranges()
+    if (req.ranges.empty() || res.status != StatusCode::PartialContent_206) {
       return detail::write_content(strm, res.content_provider_, 0,
                                    res.content_length_, is_shutting_down);
     } else if (req.ranges.size() == 1) {
@@ -6752,6 +6877,7 @@ inline bool Server::listen_internal() {
 
       if (!task_queue->enqueue(
               [this, sock]() { process_and_close_socket(sock); })) {
+        task_queue->on_rejected(sock);
         detail::shutdown_socket(sock);
         detail::close_socket(sock);
       }
@@ -6871,7 +6997,10 @@ inline void Server::apply_ranges(const Request &req, Response &res,
                    "multipart/byteranges; boundary=" + boundary);
   }
 
-  auto type = detail::encoding_type(req, res);
+  // Content that is already encoded (e.g. precompressed) is sent as is
+  auto type = res.has_header("Content-Encoding")
+                  ? detail::EncodingType::None
+                  : detail::encoding_type(req, res);
 
   if (res.body.empty()) {
     if (res.content_length_ > 0) {
@@ -7105,6 +7234,13 @@ Server::process_request(Stream &strm, const std::string &remote_addr,
     }
   }
 #endif
+  // A handler may ask to close the connection, e.g. after rejecting a request
+  // whose body was not read.
+  if (res.get_header_value("Connection") == "close") {
+    close_connection = true;
+    connection_closed = true;
+  }
+
   if (routed) {
     if (res.status == -1) {
       res.status = req.ranges.empty() ? StatusCode::OK_200
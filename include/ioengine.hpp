@@ -0,0 +1,355 @@
+#pragma once
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "log/ckflog.hpp"
+
+namespace Util
+{
+    // 文件I/O引擎：读写请求先提交、后等待，提交与等待之间调用方可以继续做别的事(接收网络数据、计算哈希)
+    // uring: io_uring，一次系统调用提交一批请求，由一个收割线程等待完成，少量线程即可让大量磁盘请求同时在途
+    // blocking: pread/pwrite，提交时同步完成；内核不支持io_uring时自动退化为该实现
+    class IOEngine
+    {
+    public:
+        struct Op
+        {
+            int fd = -1;
+            bool write = false;
+            char *buf = nullptr;
+            size_t len = 0;
+            off_t offset = 0;
+            ssize_t result = 0; // 完成的字节数，失败为 -errno
+            bool done = false;
+        };
+
+        virtual ~IOEngine() = default;
+        virtual const char *name() const = 0;
+        virtual void submit(Op *const *ops, size_t n) = 0; // 提交一批请求，Op 在完成前必须保持有效
+        virtual void wait(Op *op) = 0;                     // 等待一个请求完成
+        bool finish(Op *op); // 等待完成并补齐短读写；读到文件尾不算失败，写必须写满
+
+        bool readFull(int fd, char *buf, size_t len, off_t offset, size_t *got); // 读取[offset, offset+len)，遇文件尾提前结束
+        bool writeFull(int fd, const char *buf, size_t len, off_t offset);
+
+        static IOEngine &getInstance();
+        static void select(const std::string &name); // 启动时选择引擎："uring" 或 "blocking"
+
+    protected:
+        static constexpr size_t split_size = 256 * 1024; // 大块读写拆成若干并发的子请求
+        static bool complete(Op *op);                // 以阻塞方式完成请求的剩余部分(短读写、io_uring不支持的操作)
+
+    private:
+        static IOEngine *_instance;
+    };
+
+    class BlockingEngine : public IOEngine
+    {
+    public:
+        const char *name() const override { return "blocking"; }
+        void submit(Op *const *ops, size_t n) override;
+        void wait(Op *) override {}
+    };
+
+    // 不依赖 liburing，直接使用 io_uring_setup / io_uring_enter 系统调用与共享内存环
+    class UringEngine : public IOEngine
+    {
+    public:
+        static UringEngine *create(unsigned entries); // 内核不支持时返回nullptr
+        const char *name() const override { return "uring"; }
+        void submit(Op *const *ops, size_t n) override;
+        void wait(Op *op) override;
+
+    private:
+        UringEngine() = default;
+        bool init(unsigned entries);
+        void reapLoop(); // 收割线程：阻塞等待完成事件，唤醒等待者
+
+    private:
+        int _ring_fd = -1;
+        unsigned _entries = 0;
+        unsigned *_sq_head = nullptr, *_sq_tail = nullptr, *_sq_mask = nullptr, *_sq_array = nullptr;
+        unsigned *_cq_head = nullptr, *_cq_tail = nullptr, *_cq_mask = nullptr;
+        io_uring_sqe *_sqes = nullptr;
+        io_uring_cqe *_cqes = nullptr;
+        size_t _inflight = 0; // 不超过提交队列长度，完成队列(两倍长)不会溢出
+        std::mutex _mutex;
+        std::condition_variable _cond;
+    };
+}
+
+Util::IOEngine *Util::IOEngine::_instance = nullptr;
+
+Util::IOEngine &Util::IOEngine::getInstance()
+{
+    static std::once_flag flag;
+    std::call_once(flag, []
+                   {
+        if (_instance == nullptr)
+            select("uring"); });
+    return *_instance;
+}
+
+void Util::IOEngine::select(const std::string &name)
+{
+    static BlockingEngine blocking;
+    static UringEngine *uring = nullptr;
+    if (name == "uring")
+    {
+        if (uring == nullptr)
+            uring = UringEngine::create(256);
+        if (uring == nullptr)
+            DF_WARN("io_uring 不可用，使用阻塞I/O");
+        _instance = uring ? (IOEngine *)uring : &blocking;
+    }
+    else
+    {
+        _instance = &blocking;
+    }
+}
+
+bool Util::IOEngine::complete(Op *op)
+{
+    size_t done = op->result > 0 ? op->result : 0;
+    while (done < op->len)
+    {
+        ssize_t n = op->write ? ::pwrite(op->fd, op->buf + done, op->len - done, op->offset + done)
+                              : ::pread(op->fd, op->buf + done, op->len - done, op->offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+        {
+            op->result = -errno;
+            return false;
+        }
+        if (n == 0) // 读到文件尾
+            break;
+        done += n;
+    }
+    op->result = done;
+    return true;
+}
+
+bool Util::IOEngine::finish(Op *op)
+{
+    wait(op);
+    if (op->result >= 0 && (size_t)op->result == op->len)
+        return true;
+    if (!complete(op))
+        return false;
+    return !op->write || (size_t)op->result == op->len;
+}
+
+bool Util::IOEngine::readFull(int fd, char *buf, size_t len, off_t offset, size_t *got)
+{
+    // 拆成子请求一次提交，在途并发读取
+    std::vector<Op> ops((len + split_size - 1) / split_size);
+    std::vector<Op *> ptrs;
+    for (size_t i = 0; i < ops.size(); i++)
+    {
+        ops[i].fd = fd;
+        ops[i].buf = buf + i * split_size;
+        ops[i].len = std::min(split_size, len - i * split_size);
+        ops[i].offset = offset + i * split_size;
+        ptrs.push_back(&ops[i]);
+    }
+    submit(ptrs.data(), ptrs.size());
+
+    bool ok = true;
+    *got = 0;
+    bool eof = false;
+    for (auto &op : ops)
+    {
+        if (!finish(&op))
+            ok = false;
+        if (!eof)
+            *got += op.result > 0 ? op.result : 0;
+        eof = eof || (size_t)op.result < op.len;
+    }
+    return ok;
+}
+
+bool Util::IOEngine::writeFull(int fd, const char *buf, size_t len, off_t offset)
+{
+    std::vector<Op> ops((len + split_size - 1) / split_size);
+    std::vector<Op *> ptrs;
+    for (size_t i = 0; i < ops.size(); i++)
+    {
+        ops[i].fd = fd;
+        ops[i].write = true;
+        ops[i].buf = const_cast<char *>(buf) + i * split_size;
+        ops[i].len = std::min(split_size, len - i * split_size);
+        ops[i].offset = offset + i * split_size;
+        ptrs.push_back(&ops[i]);
+    }
+    submit(ptrs.data(), ptrs.size());
+
+    bool ok = true;
+    for (auto &op : ops)
+    {
+        if (!finish(&op))
+            ok = false;
+    }
+    return ok;
+}
+
+void Util::BlockingEngine::submit(Op *const *ops, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        ops[i]->result = 0;
+        complete(ops[i]);
+        ops[i]->done = true;
+    }
+}
+
+Util::UringEngine *Util::UringEngine::create(unsigned entries)
+{
+    UringEngine *engine = new UringEngine;
+    if (!engine->init(entries))
+    {
+        delete engine;
+        return nullptr;
+    }
+    std::thread(&UringEngine::reapLoop, engine).detach();
+    return engine;
+}
+
+bool Util::UringEngine::init(unsigned entries)
+{
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    _ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (_ring_fd < 0)
+        return false;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        ::close(_ring_fd);
+        return false;
+    }
+    _entries = p.sq_entries;
+
+    // 提交队列与完成队列共用一次映射
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    size_t ring_size = std::max(sq_size, cq_size);
+    void *ring = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQ_RING);
+    void *sqes = mmap(nullptr, p.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      _ring_fd, IORING_OFF_SQES);
+    if (ring == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        ::close(_ring_fd);
+        return false;
+    }
+    char *base = (char *)ring;
+    _sq_head = (unsigned *)(base + p.sq_off.head);
+    _sq_tail = (unsigned *)(base + p.sq_off.tail);
+    _sq_mask = (unsigned *)(base + p.sq_off.ring_mask);
+    _sq_array = (unsigned *)(base + p.sq_off.array);
+    _cq_head = (unsigned *)(base + p.cq_off.head);
+    _cq_tail = (unsigned *)(base + p.cq_off.tail);
+    _cq_mask = (unsigned *)(base + p.cq_off.ring_mask);
+    _cqes = (io_uring_cqe *)(base + p.cq_off.cqes);
+    _sqes = (io_uring_sqe *)sqes;
+    return true;
+}
+
+void Util::UringEngine::submit(Op *const *ops, size_t n)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    for (size_t i = 0; i < n;)
+    {
+        // 在途请求已满：先提交已填好的，等收割线程腾出位置
+        _cond.wait(lck, [this]
+                   { return _inflight < _entries; });
+        size_t batch = 0;
+        unsigned tail = *_sq_tail;
+        for (; i < n && _inflight < _entries; i++, batch++, _inflight++)
+        {
+            Op *op = ops[i];
+            op->done = false;
+            op->result = 0;
+            unsigned index = tail & *_sq_mask;
+            io_uring_sqe *sqe = &_sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = op->write ? IORING_OP_WRITE : IORING_OP_READ;
+            sqe->fd = op->fd;
+            sqe->addr = (uint64_t)op->buf;
+            sqe->len = op->len;
+            sqe->off = op->offset;
+            sqe->user_data = (uint64_t)op;
+            _sq_array[index] = index;
+            tail++;
+        }
+        __atomic_store_n(_sq_tail, tail, __ATOMIC_RELEASE);
+
+        // 一次系统调用提交整批
+        while (batch > 0)
+        {
+            int ret = syscall(__NR_io_uring_enter, _ring_fd, batch, 0, 0, nullptr, 0);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret < 0)
+            {
+                // 未被内核取走的请求从提交队列中撤回(只有持锁的本函数提交，内核不会再读到它们)，
+                // 连同尚未放入队列的请求一起以失败完成，避免等待者永远阻塞
+                int err = errno;
+                DF_WARN("io_uring_enter failed: %s", strerror(err));
+                __atomic_store_n(_sq_tail, tail - batch, __ATOMIC_RELEASE);
+                _inflight -= batch;
+                for (size_t j = i - batch; j < n; j++)
+                {
+                    ops[j]->result = -err;
+                    ops[j]->done = true;
+                }
+                _cond.notify_all();
+                return;
+            }
+            batch -= ret;
+        }
+    }
+}
+
+void Util::UringEngine::wait(Op *op)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    _cond.wait(lck, [op]
+               { return op->done; });
+}
+
+void Util::UringEngine::reapLoop()
+{
+    while (true)
+    {
+        int ret = syscall(__NR_io_uring_enter, _ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (ret < 0 && errno != EINTR)
+        {
+            DF_WARN("io_uring_enter failed: %s", strerror(errno));
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        std::unique_lock<std::mutex> lck(_mutex);
+        unsigned head = *_cq_head;
+        unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail)
+            continue;
+        for (; head != tail; head++)
+        {
+            io_uring_cqe *cqe = &_cqes[head & *_cq_mask];
+            Op *op = (Op *)cqe->user_data;
+            op->result = cqe->res;
+            op->done = true;
+            _inflight--;
+        }
+        __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+        _cond.notify_all();
+    }
+}
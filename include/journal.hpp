@@ -0,0 +1,242 @@
+#pragma once
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include "util.hpp"
+#include "config.hpp"
+#include "log/ckflog.hpp"
+
+namespace Cloud
+{
+    // 状态转换日志：同时改动磁盘文件与备份信息的操作(压缩、解压、上传提交、删除)
+    // 修改磁盘前追加一条 BEGIN 记录并fsync落盘，完成后追加一条 COMMIT 记录(不必落盘：丢失只会让恢复多检查一个url)
+    // 启动时只有 BEGIN 没有 COMMIT 的url才可能与备份信息不一致，恢复时只检查这些url
+    // 运行中日志超过 checkpoint_size 时改写为只含未完成记录的新日志，不会无限增长
+    class PackJournal
+    {
+    public:
+        enum Op
+        {
+            PACK,   // 热点文件 -> 压缩包
+            UNPACK, // 压缩包 -> 热点文件
+            UPLOAD, // 上传提交(覆盖、去重、分块存储)
+            REMOVE  // 删除文件
+        };
+        struct Entry
+        {
+            Op op;
+            std::string url;
+        };
+
+    public:
+        static PackJournal &getInstance();
+        bool begin(Op op, const std::string &url);                // 记录状态转换开始，返回false时不能修改磁盘
+        bool begin(Op op, const std::vector<std::string> &urls);  // 一批url共用一次落盘
+        bool commit(Op op, const std::string &url);               // 记录状态转换完成
+        bool commit(Op op, const std::vector<std::string> &urls);
+        bool pending(std::vector<Entry> *array);                  // 获取上次进程未完成的状态转换
+        bool reset();                                             // 恢复完成后清空日志
+        static std::string opName(Op op);
+
+    private:
+        PackJournal();
+        ~PackJournal();
+        PackJournal(const PackJournal &other) = delete;
+        PackJournal &operator=(const PackJournal &other) = delete;
+
+        bool append(const std::string &lines, bool sync);
+        bool checkpoint(); // 只保留未完成的记录，原子替换日志文件
+
+    private:
+        static const size_t checkpoint_size = 1 << 20;
+
+        std::string _path;                             // 日志文件路径
+        int _fd;                                       // 日志文件描述符(追加写)
+        size_t _size = 0;                              // 日志文件当前大小
+        std::unordered_map<std::string, size_t> _open; // 本进程未完成的记录("操作 url") -> 个数
+        std::mutex _mutex;                             // 保护日志追加写
+    };
+}
+
+Cloud::PackJournal &Cloud::PackJournal::getInstance()
+{
+    static PackJournal inst;
+    return inst;
+}
+
+Cloud::PackJournal::PackJournal()
+    : _path(Config::getInstance()->getJournalFile())
+{
+    _fd = ::open(_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (_fd < 0)
+    {
+        DF_ERROR("%s: Journal open fail", _path.c_str());
+        return;
+    }
+    _size = Util::FileUtil(_path).fileSize();
+}
+
+Cloud::PackJournal::~PackJournal()
+{
+    if (_fd >= 0)
+        ::close(_fd);
+}
+
+std::string Cloud::PackJournal::opName(Op op)
+{
+    switch (op)
+    {
+    case PACK:
+        return "PACK";
+    case UNPACK:
+        return "UNPACK";
+    case UPLOAD:
+        return "UPLOAD";
+    default:
+        return "REMOVE";
+    }
+}
+
+bool Cloud::PackJournal::begin(Op op, const std::string &url)
+{
+    return begin(op, std::vector<std::string>{url});
+}
+
+bool Cloud::PackJournal::begin(Op op, const std::vector<std::string> &urls)
+{
+    std::string lines;
+    for (auto &url : urls)
+        lines += "BEGIN " + opName(op) + " " + url + "\n";
+    std::unique_lock<std::mutex> lck(_mutex);
+    if (!append(lines, true))
+        return false;
+    for (auto &url : urls)
+        _open[opName(op) + " " + url]++;
+    return true;
+}
+
+bool Cloud::PackJournal::commit(Op op, const std::string &url)
+{
+    return commit(op, std::vector<std::string>{url});
+}
+
+bool Cloud::PackJournal::commit(Op op, const std::vector<std::string> &urls)
+{
+    std::string lines;
+    for (auto &url : urls)
+        lines += "COMMIT " + opName(op) + " " + url + "\n";
+    std::unique_lock<std::mutex> lck(_mutex);
+    for (auto &url : urls)
+    {
+        auto it = _open.find(opName(op) + " " + url);
+        if (it != _open.end() && --it->second == 0)
+            _open.erase(it);
+    }
+    if (!append(lines, false))
+        return false;
+    return _size < checkpoint_size || checkpoint();
+}
+
+bool Cloud::PackJournal::append(const std::string &lines, bool sync)
+{
+    if (_fd < 0)
+        return false;
+
+    // O_APPEND下单次write是原子追加
+    if (::write(_fd, lines.c_str(), lines.size()) != (ssize_t)lines.size())
+    {
+        DF_ERROR("%s: Journal write failed", _path.c_str());
+        return false;
+    }
+    _size += lines.size();
+    return !sync || ::fdatasync(_fd) == 0;
+}
+
+bool Cloud::PackJournal::checkpoint()
+{
+    // 已完成的记录不再需要：新日志只含本进程仍在进行的转换，写完整后替换旧日志
+    std::string lines;
+    for (auto &[entry, count] : _open)
+    {
+        for (size_t i = 0; i < count; i++)
+            lines += "BEGIN " + entry + "\n";
+    }
+    if (!Util::FileUtil(_path).setContentAtomic(lines))
+    {
+        DF_ERROR("%s: Journal checkpoint failed", _path.c_str());
+        return false;
+    }
+    int fd = ::open(_path.c_str(), O_WRONLY | O_APPEND, 0644);
+    if (fd < 0)
+    {
+        DF_ERROR("%s: Journal open fail", _path.c_str());
+        return false;
+    }
+    ::close(_fd);
+    _fd = fd;
+    _size = lines.size();
+    return true;
+}
+
+bool Cloud::PackJournal::pending(std::vector<Entry> *array)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    Util::FileUtil fu(_path);
+    if (!fu.isExists())
+        return true;
+
+    std::string content;
+    if (!fu.getContent(content))
+        return false;
+
+    // 按顺序回放日志：BEGIN 入列，COMMIT 出列，剩下的就是未完成的转换
+    std::list<Entry> open;
+    std::istringstream iss(content);
+    std::string line;
+    while (std::getline(iss, line))
+    {
+        size_t p1 = line.find(' ');
+        size_t p2 = line.find(' ', p1 + 1);
+        if (p1 == std::string::npos || p2 == std::string::npos)
+            continue; // 崩溃时写了一半的记录
+
+        std::string kind = line.substr(0, p1);
+        Entry e;
+        std::string op = line.substr(p1 + 1, p2 - p1 - 1);
+        e.op = op == "PACK" ? PACK : op == "UNPACK" ? UNPACK : op == "UPLOAD" ? UPLOAD : REMOVE;
+        e.url = line.substr(p2 + 1);
+
+        if (kind == "BEGIN")
+        {
+            open.push_back(e);
+        }
+        else if (kind == "COMMIT")
+        {
+            for (auto it = open.begin(); it != open.end(); ++it)
+            {
+                if (it->op == e.op && it->url == e.url)
+                {
+                    open.erase(it);
+                    break;
+                }
+            }
+        }
+    }
+
+    array->assign(open.begin(), open.end());
+    return true;
+}
+
+bool Cloud::PackJournal::reset()
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    if (_fd < 0)
+        return false;
+    _open.clear();
+    _size = 0;
+    return ::ftruncate(_fd, 0) == 0 && ::fsync(_fd) == 0;
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include <iostream>
+#include <mutex>
+#include <functional>
+#include <algorithm>
+#include "util.hpp"
+#include "data.hpp"
+#include "journal.hpp"
+#include "blob.hpp"
+#include "log/ckflog.hpp"
+
+extern Cloud::BackupInfoManager *_biManager;
+extern ckflogs::Logger::Ptr _logger;
+
+namespace Cloud
+{
+    // 热点文件 <-> 压缩包 的状态转换
+    // 每次转换的步骤：记录日志BEGIN -> 原子地写出目标文件 -> 更新备份信息 -> 删除源文件 -> 记录日志COMMIT
+    // 任意一步崩溃，目标文件要么不存在要么完整，启动时由 BackupInfoManager::recover 根据磁盘状态修正日志中未完成的url
+    class Packer
+    {
+    public:
+        static bool pack(const std::string &url, const std::function<bool(const BackupInfo &)> &cold = nullptr); // 热点文件 -> 压缩包，cold在锁内确认仍非热点
+        static bool unpack(const std::string &url, BackupInfo *bi); // 压缩包 -> 热点文件
+        static std::mutex &mutexOf(const std::string &url);         // 同一url的状态转换互斥
+        static std::vector<std::unique_lock<std::mutex>> lockAll(const std::vector<std::string> &urls); // 按固定顺序锁住一批url
+
+    private:
+        static const size_t lock_num = 64; // 分段锁个数
+    };
+}
+
+std::mutex &Cloud::Packer::mutexOf(const std::string &url)
+{
+    static std::mutex locks[lock_num];
+    return locks[std::hash<std::string>()(url) % lock_num];
+}
+
+std::vector<std::unique_lock<std::mutex>> Cloud::Packer::lockAll(const std::vector<std::string> &urls)
+{
+    // 去重后按锁地址排序加锁，多个批量操作之间不会死锁
+    std::vector<std::mutex *> mutexes;
+    for (auto &url : urls)
+        mutexes.push_back(&mutexOf(url));
+    std::sort(mutexes.begin(), mutexes.end());
+    mutexes.erase(std::unique(mutexes.begin(), mutexes.end()), mutexes.end());
+
+    std::vector<std::unique_lock<std::mutex>> locks;
+    for (auto m : mutexes)
+        locks.emplace_back(*m);
+    return locks;
+}
+
+bool Cloud::Packer::pack(const std::string &url, const std::function<bool(const BackupInfo &)> &cold)
+{
+    std::unique_lock<std::mutex> lck(mutexOf(url));
+
+    // 加锁后重新读取备份信息，期间可能已被其他线程转换
+    BackupInfo bi;
+    if (!_biManager->getOneByURL(url, &bi))
+        return false;
+    if (bi.pack_flag)
+        return true;
+    // 排队期间文件可能已被下载解压或重新上传，又成为热点文件
+    if (cold && !cold(bi))
+    {
+        _biManager->setPacking(url, false);
+        return true;
+    }
+
+    PackJournal &journal = PackJournal::getInstance();
+    if (!journal.begin(PackJournal::PACK, url))
+    {
+        _biManager->setPacking(url, false);
+        return false;
+    }
+
+    // 1.压缩，并原子地放入压缩包文件夹（内容相同的文件已有压缩包时直接链接，不再重复压缩）
+    Util::FileUtil fu(bi.real_path);
+    if (!BlobStore::linkPack(bi) && !fu.compress(bi.pack_path, Config::getInstance()->getPackCodec()))
+    {
+        _biManager->setPacking(url, false);
+        journal.commit(PackJournal::PACK, url);
+        return false;
+    }
+
+    // 2.压缩包已完整落盘，更新备份信息
+    bi.pack_flag = true;
+    bi.is_packing = false;
+    _biManager->update(url, bi);
+
+    // 3.删除原备份文件
+    if (!fu.remove())
+        _logger->_warn("%s: 删除原文件失败", bi.real_path.c_str());
+
+    journal.commit(PackJournal::PACK, url);
+    return true;
+}
+
+bool Cloud::Packer::unpack(const std::string &url, BackupInfo *bi)
+{
+    std::unique_lock<std::mutex> lck(mutexOf(url));
+
+    if (!_biManager->getOneByURL(url, bi))
+        return false;
+    if (!bi->pack_flag)
+        return true;
+
+    PackJournal &journal = PackJournal::getInstance();
+    if (!journal.begin(PackJournal::UNPACK, url))
+        return false;
+
+    // 1.解压，并原子地放回备份文件夹（内容相同的文件已是热点文件时直接链接）
+    Util::FileUtil fu(bi->pack_path);
+    if (!BlobStore::linkReal(*bi) && !fu.uncompress(bi->real_path))
+    {
+        journal.commit(PackJournal::UNPACK, url);
+        return false;
+    }
+
+    // 2.更新备份信息：记录访问时间，解压后的文件在热点时间内不再被压缩
+    bi->pack_flag = false;
+    bi->atime = time(nullptr);
+    _biManager->update(url, *bi);
+
+    // 3.删除压缩包
+    if (!fu.remove())
+        _logger->_warn("%s: 删除压缩包失败", bi->pack_path.c_str());
+
+    journal.commit(PackJournal::UNPACK, url);
+    return true;
+}
@@ -0,0 +1,174 @@
+#pragma once
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <mutex>
+#include "util.hpp"
+#include "config.hpp"
+#include "data.hpp"
+#include "pack.hpp"
+#include "threadpool.hh"
+#include "log/ckflog.hpp"
+
+extern Cloud::BackupInfoManager *_biManager;
+extern ckflogs::Logger::Ptr _logger;
+
+namespace Cloud
+{
+    // 冷文件预取器
+    // 同一批文件：同一目录下、修改时间(上传时间)相差在 prefetch_window 秒内的文件
+    // 当一个客户端连续下载了同一批中的两个文件，认为它在批量恢复这一批文件，
+    // 按上传顺序把它接下来可能下载的 prefetch_depth 个压缩文件提前交给线程池解压
+    // 预取解压的文件在被下载或超过 prefetch_window 之前不会被热点管理器重新压缩
+    class Prefetcher
+    {
+    public:
+        static Prefetcher &getInstance();
+        void onDownload(const std::string &client, const BackupInfo &bi); // 记录一次下载，必要时触发预取
+        bool isPinned(const std::string &url);                            // 是否为预取解压、尚未被下载的文件
+
+    private:
+        Prefetcher();
+        Prefetcher(const Prefetcher &other) = delete;
+        Prefetcher &operator=(const Prefetcher &other) = delete;
+
+        bool sameBatch(const BackupInfo &a, const BackupInfo &b); // 是否为同一批文件
+        static std::string dirOf(const std::string &url);        // url中的目录部分
+        void prefetch(const BackupInfo &cur, bool forward);      // 预取cur之后(或之前)的同批压缩文件
+        void rehydrate(const std::string &url);                  // 线程池中执行的解压任务
+
+    private:
+        struct History
+        {
+            BackupInfo last; // 该客户端上次下载的文件
+            time_t when;     // 上次下载的时间
+        };
+
+        std::unordered_map<std::string, History> _history; // 客户端 -> 下载历史，超过 prefetch_window 的记录定期清理
+        time_t _last_sweep = 0;                            // 上次清理过期记录的时间
+        std::unordered_set<std::string> _inflight;         // 正在预取的url，避免重复提交
+        std::unordered_map<std::string, time_t> _pinned;   // 预取解压、尚未被下载的url -> 保护截止时间
+        std::mutex _mutex;
+        size_t _depth;
+        time_t _window;
+    };
+}
+
+Cloud::Prefetcher &Cloud::Prefetcher::getInstance()
+{
+    static Prefetcher inst;
+    return inst;
+}
+
+Cloud::Prefetcher::Prefetcher()
+    : _depth(Config::getInstance()->getPrefetchDepth()),
+      _window(Config::getInstance()->getPrefetchWindow())
+{
+}
+
+std::string Cloud::Prefetcher::dirOf(const std::string &url)
+{
+    size_t x = url.find_last_of('/');
+    return x == std::string::npos ? "" : url.substr(0, x);
+}
+
+bool Cloud::Prefetcher::sameBatch(const BackupInfo &a, const BackupInfo &b)
+{
+    time_t diff = a.mtime > b.mtime ? a.mtime - b.mtime : b.mtime - a.mtime;
+    return dirOf(a.url) == dirOf(b.url) && diff <= _window;
+}
+
+void Cloud::Prefetcher::onDownload(const std::string &client, const BackupInfo &bi)
+{
+    if (_depth == 0)
+        return;
+
+    bool trigger = false;
+    bool forward = true;
+    {
+        std::unique_lock<std::mutex> lck(_mutex);
+        time_t now = time(nullptr);
+        auto it = _history.find(client);
+        if (it != _history.end() && it->second.last.url != bi.url &&
+            now - it->second.when <= _window && sameBatch(it->second.last, bi))
+        {
+            trigger = true;
+            forward = it->second.last.mtime <= bi.mtime; // 按上传顺序正向或反向下载
+        }
+        _history[client] = History{bi, now};
+        _pinned.erase(bi.url); // 已被下载，此后按普通热点文件处理
+
+        // 超过窗口的记录不会再触发预取：每个窗口清理一次，历史表只保留最近活跃的客户端
+        if (now - _last_sweep > _window)
+        {
+            for (auto h = _history.begin(); h != _history.end();)
+                h = now - h->second.when > _window ? _history.erase(h) : std::next(h);
+            for (auto p = _pinned.begin(); p != _pinned.end();)
+                p = now > p->second ? _pinned.erase(p) : std::next(p);
+            _last_sweep = now;
+        }
+    }
+
+    if (trigger)
+        prefetch(bi, forward);
+}
+
+void Cloud::Prefetcher::prefetch(const BackupInfo &cur, bool forward)
+{
+    // 1.找出同一批中按上传顺序位于当前文件之后(或之前)的压缩文件，按上传顺序排列
+    //   只复制候选文件：大批量的小文件多为热点文件，逐个下载时不必每次复制整张表
+    auto before = [](const BackupInfo &a, const BackupInfo &b)
+    { return a.mtime != b.mtime ? a.mtime < b.mtime : a.url < b.url; };
+    std::vector<BackupInfo> batch;
+    _biManager->getIf([&](const BackupInfo &bi)
+                      { return bi.pack_flag && !bi.is_packing && (forward ? before(cur, bi) : before(bi, cur)) &&
+                               sameBatch(bi, cur); },
+                      &batch);
+    std::sort(batch.begin(), batch.end(), before);
+    if (!forward)
+        std::reverse(batch.begin(), batch.end());
+
+    // 2.从当前文件往后取 _depth 个压缩文件，交给线程池提前解压
+    size_t submitted = 0;
+    for (auto pos = batch.begin(); pos != batch.end() && submitted < _depth; ++pos)
+    {
+        {
+            std::unique_lock<std::mutex> lck(_mutex);
+            if (!_inflight.insert(pos->url).second)
+                continue;
+        }
+        auto func = std::bind(&Cloud::Prefetcher::rehydrate, this, pos->url);
+        ckf::ThreadPool::getInstance().submit(ckf::ThreadPool::LV2, func);
+        submitted++;
+    }
+}
+
+void Cloud::Prefetcher::rehydrate(const std::string &url)
+{
+    BackupInfo bi;
+    bool ok = Packer::unpack(url, &bi);
+    if (ok)
+        _logger->_debug("预取文件: %s 解压成功", bi.real_path.c_str());
+    else
+        _logger->_warn("预取文件: %s 解压失败", url.c_str());
+
+    std::unique_lock<std::mutex> lck(_mutex);
+    _inflight.erase(url);
+    if (ok)
+        _pinned[url] = time(nullptr) + _window;
+}
+
+bool Cloud::Prefetcher::isPinned(const std::string &url)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    auto it = _pinned.find(url);
+    if (it == _pinned.end())
+        return false;
+    if (time(nullptr) > it->second)
+    {
+        _pinned.erase(it);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,317 @@
+#pragma once
+#include <iostream>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <unordered_map>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "util.hpp"
+#include "config.hpp"
+#include "threadpool.hh"
+#include "log/ckflog.hpp"
+
+extern ckflogs::Logger::Ptr _logger;
+
+namespace Cloud
+{
+    // 后台压缩调度器
+    // 热点管理器不再直接把压缩任务丢给线程池，而是交给调度器排队，调度器每次只派发一个任务，并且：
+    // 1.前台请求速率超过 compress_busy_qps 时暂停派发
+    // 2.派发前按文件大小从磁盘带宽令牌桶中取令牌
+    // 3.任务结束后按实际消耗的CPU时间休眠，使压缩占用的CPU不超过 compress_cpu_budget，前台越忙休眠越久
+    // 任务队列的变化以追加记录的方式写入 queue_file(QUEUE/RUN/DONE，不fsync)，日志超过阈值时按当前队列改写；
+    // 进程重启后由热点管理器读回并重新提交。记录丢失只会让文件等到热点管理器下一轮扫描时才重新排队
+    class CompressScheduler
+    {
+    public:
+        using Job = std::function<bool()>;
+
+    public:
+        static CompressScheduler &getInstance();
+        void submit(const std::string &url, size_t fsize, Job job); // 提交一个压缩任务
+        static void onRequest();                                    // 记录一次前台请求
+        bool loadQueue(std::vector<std::pair<std::string, size_t>> *jobs); // 读取上次进程退出时未完成的任务
+        double currentQps();                                        // 当前前台请求速率
+
+    private:
+        CompressScheduler();
+        ~CompressScheduler();
+        CompressScheduler(const CompressScheduler &other) = delete;
+        CompressScheduler &operator=(const CompressScheduler &other) = delete;
+
+        void dispatchLoop();    // 派发线程执行函数
+        void waitForIdle();     // 等待前台负载降下来
+        void sampleLoad();      // 采样前台请求速率
+        double loadFactor();    // 前台负载对休眠时间的放大系数
+        void record(const std::string &line); // 追加一条队列变化记录（调用时需持有_mutex）
+        bool compact();                       // 按当前队列改写日志（调用时需持有_mutex）
+
+    private:
+        struct Task
+        {
+            std::string url;
+            size_t fsize;
+            Job job;
+        };
+
+        std::deque<Task> _queue;       // 待压缩任务
+        Task _running;                 // 正在执行的任务，url为空表示没有
+        std::string _queue_path;       // 任务队列日志文件
+        int _queue_fd = -1;            // 日志文件描述符(追加写)
+        size_t _log_size = 0;          // 日志当前大小
+        size_t _log_live = 0;          // 上次改写后的大小，日志增长到其数倍时再改写
+        std::mutex _mutex;             // 保护任务队列
+        std::condition_variable _cond; // 条件变量
+        std::atomic<bool> _isRunning;  // 调度器“工作中”标识
+        std::thread _dispatcher;       // 派发线程
+
+        Util::TokenBucket _disk_bucket; // 磁盘带宽令牌桶
+        double _cpu_budget;             // CPU预算
+        double _busy_qps;               // 繁忙阈值
+
+        static std::atomic<size_t> _req_count;            // 上次采样以来的前台请求数
+        double _qps;                                      // 前台请求速率(指数平滑)
+        std::chrono::steady_clock::time_point _last_sample; // 上次采样时间
+    };
+}
+
+std::atomic<size_t> Cloud::CompressScheduler::_req_count(0);
+
+Cloud::CompressScheduler &Cloud::CompressScheduler::getInstance()
+{
+    static CompressScheduler inst;
+    return inst;
+}
+
+Cloud::CompressScheduler::CompressScheduler()
+    : _queue_path(Config::getInstance()->getQueueFile()),
+      _isRunning(true),
+      _disk_bucket(Config::getInstance()->getCompressDiskBW(), Config::getInstance()->getCompressDiskBW()),
+      _cpu_budget(Config::getInstance()->getCompressCpuBudget()),
+      _busy_qps(Config::getInstance()->getCompressBusyQps()),
+      _qps(0),
+      _last_sample(std::chrono::steady_clock::now())
+{
+    if (_cpu_budget <= 0 || _cpu_budget > 1)
+        _cpu_budget = 1;
+    _queue_fd = ::open(_queue_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (_queue_fd < 0)
+        _logger->_error("压缩任务队列打开失败 %s", _queue_path.c_str());
+    _log_size = Util::FileUtil(_queue_path).fileSize();
+    _dispatcher = std::thread(&CompressScheduler::dispatchLoop, this);
+}
+
+Cloud::CompressScheduler::~CompressScheduler()
+{
+    _isRunning = false;
+    _cond.notify_all();
+    if (_dispatcher.joinable())
+        _dispatcher.join();
+    if (_queue_fd >= 0)
+        ::close(_queue_fd);
+}
+
+void Cloud::CompressScheduler::submit(const std::string &url, size_t fsize, Job job)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    _queue.push_back(Task{url, fsize, std::move(job)});
+    record("QUEUE " + std::to_string(fsize) + " " + url);
+    _cond.notify_one();
+}
+
+void Cloud::CompressScheduler::record(const std::string &line)
+{
+    if (_queue_fd < 0)
+        return;
+    std::string str = line + "\n";
+    if (::write(_queue_fd, str.data(), str.size()) != (ssize_t)str.size())
+    {
+        _logger->_error("压缩任务队列写入失败");
+        return;
+    }
+    _log_size += str.size();
+
+    // 已完成任务的记录越积越多：增长到上次改写后的数倍时按当前队列改写，摊还下来每条记录只写常数次
+    if (_log_size >= std::max<size_t>(1 << 20, _log_live * 4))
+        compact();
+}
+
+bool Cloud::CompressScheduler::compact()
+{
+    // 正在执行的任务记为RUN，其余按顺序记为QUEUE
+    std::string str;
+    if (!_running.url.empty())
+        str += "QUEUE " + std::to_string(_running.fsize) + " " + _running.url + "\nRUN " + _running.url + "\n";
+    for (auto &task : _queue)
+        str += "QUEUE " + std::to_string(task.fsize) + " " + task.url + "\n";
+
+    if (!Util::FileUtil(_queue_path).setContentAtomic(str))
+    {
+        _logger->_error("压缩任务队列改写失败");
+        return false;
+    }
+    int fd = ::open(_queue_path.c_str(), O_WRONLY | O_APPEND, 0644);
+    if (fd < 0)
+    {
+        _logger->_error("压缩任务队列打开失败 %s", _queue_path.c_str());
+        return false;
+    }
+    if (_queue_fd >= 0)
+        ::close(_queue_fd);
+    _queue_fd = fd;
+    _log_size = _log_live = str.size();
+    return true;
+}
+
+bool Cloud::CompressScheduler::loadQueue(std::vector<std::pair<std::string, size_t>> *jobs)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    Util::FileUtil fu(_queue_path);
+    std::string content;
+    if (fu.isExists() && !fu.getContent(content))
+    {
+        _logger->_error("压缩任务队列读取失败");
+        return false;
+    }
+
+    // 按顺序回放：QUEUE 入列(同一url只保留最早的位置)，DONE 出列，只有 RUN 没有 DONE 的任务在上次退出时中断
+    // 中断的任务：压缩包是原子写入的，崩溃时未完成的临时文件已在备份信息恢复时清理，直接重新压缩
+    std::vector<std::pair<std::string, size_t>> order;
+    std::unordered_map<std::string, bool> pending; // url -> 是否已开始执行
+    std::istringstream iss(content);
+    std::string line;
+    while (std::getline(iss, line))
+    {
+        size_t p1 = line.find(' ');
+        if (p1 == std::string::npos)
+            continue; // 崩溃时写了一半的记录
+        std::string kind = line.substr(0, p1);
+        if (kind == "QUEUE")
+        {
+            size_t p2 = line.find(' ', p1 + 1);
+            size_t fsize = 0;
+            if (p2 == std::string::npos ||
+                std::from_chars(line.data() + p1 + 1, line.data() + p2, fsize).ptr != line.data() + p2)
+                continue;
+            std::string url = line.substr(p2 + 1);
+            if (pending.emplace(url, false).second)
+                order.emplace_back(url, fsize);
+        }
+        else if (kind == "RUN")
+        {
+            auto it = pending.find(line.substr(p1 + 1));
+            if (it != pending.end())
+                it->second = true;
+        }
+        else if (kind == "DONE")
+        {
+            pending.erase(line.substr(p1 + 1));
+        }
+    }
+    for (auto &job : order)
+    {
+        auto it = pending.find(job.first);
+        if (it == pending.end())
+            continue;
+        if (it->second)
+            _logger->_warn("压缩任务 %s 在上次退出时中断，重新压缩", job.first.c_str());
+        jobs->push_back(job);
+    }
+
+    // 读回的任务将重新提交，日志从空开始
+    return compact();
+}
+
+void Cloud::CompressScheduler::onRequest()
+{
+    _req_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Cloud::CompressScheduler::sampleLoad()
+{
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - _last_sample).count();
+    if (elapsed < 0.1)
+        return;
+    _last_sample = now;
+
+    double inst = _req_count.exchange(0) / elapsed;
+    _qps = 0.7 * _qps + 0.3 * inst;
+}
+
+double Cloud::CompressScheduler::currentQps()
+{
+    return _qps;
+}
+
+double Cloud::CompressScheduler::loadFactor()
+{
+    if (_busy_qps <= 0)
+        return 1;
+    return 1 + _qps / _busy_qps;
+}
+
+void Cloud::CompressScheduler::waitForIdle()
+{
+    sampleLoad();
+    while (_isRunning && _busy_qps > 0 && _qps >= _busy_qps)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        sampleLoad();
+    }
+}
+
+void Cloud::CompressScheduler::dispatchLoop()
+{
+    while (_isRunning)
+    {
+        // 1.取出一个任务
+        Task task;
+        {
+            std::unique_lock<std::mutex> lck(_mutex);
+            while (_isRunning && _queue.empty())
+            {
+                _cond.wait(lck);
+            }
+            if (!_isRunning)
+                break;
+            task = std::move(_queue.front());
+            _queue.pop_front();
+            _running = task;
+            record("RUN " + task.url);
+        }
+
+        // 2.前台繁忙时等待，再按文件大小获取磁盘带宽
+        waitForIdle();
+        _disk_bucket.acquire(task.fsize);
+
+        // 3.交给线程池执行，并统计任务实际消耗的CPU时间
+        Job job = task.job;
+        auto ret = ckf::ThreadPool::getInstance().submit(ckf::ThreadPool::LV3, [job]()
+                                                         {
+            struct timespec begin, end;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin);
+            job();
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+            return (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9; });
+        double cpu = ret.get();
+        {
+            std::unique_lock<std::mutex> lck(_mutex);
+            _running = Task();
+            record("DONE " + task.url);
+        }
+
+        // 4.按CPU预算休眠：压缩用了cpu秒，则休眠 cpu*(1-budget)/budget 秒，前台越忙休眠越久
+        sampleLoad();
+        double idle = cpu * (1 - _cpu_budget) / _cpu_budget * loadFactor();
+        _logger->_debug("压缩任务 %s 完成, CPU用时 %.3fs, 休眠 %.3fs, 前台qps %.1f",
+                        task.url.c_str(), cpu, idle, _qps);
+        if (idle > 0)
+            std::this_thread::sleep_for(std::chrono::duration<double>(idle));
+    }
+}
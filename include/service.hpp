@@ -3,11 +3,61 @@
 #include "httplib.h"
 #include "config.hpp"
 #include "data.hpp"
+#include "pack.hpp"
+#include "scheduler.hpp"
+#include "prefetch.hpp"
+#include "session.hpp"
+#include "chunkstore.hpp"
+#include "delta.hpp"
+#include "threadpool.hh"
+#include "workerpool.hpp"
+#include "eventserver.hpp"
+#include "assets.hpp"
+#include "shaper.hpp"
+#include "archive.hpp"
 #include "log/ckflog.hpp"
 
 extern Cloud::BackupInfoManager *_biManager;
 extern ckflogs::Logger::Ptr _logger;
 
+namespace Cloud
+{
+    struct LoginRequest // 登录请求体
+    {
+        std::string username;
+        std::string password;
+    };
+
+    struct ListItem // 文件列表中的一项
+    {
+        std::string downloadUrl;
+        std::string fileName;
+        std::string lastModified;
+        std::string fileSize;
+    };
+}
+
+namespace Util
+{
+    template <>
+    struct JsonFields<Cloud::LoginRequest>
+    {
+        static constexpr bool as_array = false;
+        static constexpr auto fields = std::make_tuple(jsonField("username", &Cloud::LoginRequest::username),
+                                                       jsonField("password", &Cloud::LoginRequest::password));
+    };
+
+    template <>
+    struct JsonFields<Cloud::ListItem>
+    {
+        static constexpr bool as_array = false;
+        static constexpr auto fields = std::make_tuple(jsonField("downloadUrl", &Cloud::ListItem::downloadUrl),
+                                                       jsonField("fileName", &Cloud::ListItem::fileName),
+                                                       jsonField("lastModified", &Cloud::ListItem::lastModified),
+                                                       jsonField("fileSize", &Cloud::ListItem::fileSize));
+    };
+}
+
 namespace Cloud
 {
     class Service
@@ -19,13 +69,74 @@ namespace Cloud
     private:
         static void index(const httplib::Request &req, httplib::Response &resp);      // 起始界面
         static void login(const httplib::Request &req, httplib::Response &resp);      // 用户登录
-        static void upload(const httplib::Request &req, httplib::Response &resp);     // 文件上传
+        static void upload(const httplib::Request &req, httplib::Response &resp,
+                           const httplib::ContentReader &content_reader);             // 文件上传(流式写盘)
+        static void uploadBatch(const httplib::Request &req, httplib::Response &resp,
+                                const httplib::ContentReader &content_reader);        // 多文件批量上传
         static void download(const httplib::Request &req, httplib::Response &resp);   // 文件下载
+        static void archive(const httplib::Request &req, httplib::Response &resp);    // 多个文件打包为tar下载
         static void listShow(const httplib::Request &req, httplib::Response &resp);   // 文件列表展示
         static void uploadShow(const httplib::Request &req, httplib::Response &resp); // 上传页面展示
         static void updateList(const httplib::Request &req, httplib::Response &resp); // 前端更新文件列表
+        static void sendAsset(const std::string &name, const httplib::Request &req, httplib::Response &resp); // 从缓存发送前端页面
+
+        // 分块上传会话：创建会话 -> 并发PUT各分块 -> 查询已接收区间(断点续传) -> 提交
+        static void sessionCreate(const httplib::Request &req, httplib::Response &resp);
+        static void sessionPut(const httplib::Request &req, httplib::Response &resp,
+                               const httplib::ContentReader &content_reader);
+        static void sessionQuery(const httplib::Request &req, httplib::Response &resp);
+        static void sessionCommit(const httplib::Request &req, httplib::Response &resp);
+        static void sessionAbort(const httplib::Request &req, httplib::Response &resp);
+        static Json::Value sessionToJson(const UploadSession::Ptr &session);
 
-        static std::string getETag(const std::string &url);
+        // 增量上传(rsync式)：获取已存储版本的块签名 -> 只上传变化部分 -> 服务端由旧版本与增量重建新版本
+        static void signature(const httplib::Request &req, httplib::Response &resp);
+        static void deltaUpload(const httplib::Request &req, httplib::Response &resp,
+                                const httplib::ContentReader &content_reader);
+
+        // 已存储版本的只读句柄：热点文件持有打开的描述符，分块存储的文件按分块读取
+        struct StoredFile
+        {
+            std::shared_ptr<Util::FileReader> file;
+            std::shared_ptr<ChunkReader> chunks;
+            size_t size = 0;
+            bool read(size_t offset, size_t len, std::string *out)
+            {
+                return file ? file->pread(offset, len, out) : chunks->read(offset, len, out);
+            }
+        };
+        static bool openStored(const std::string &url, BackupInfo *bi, StoredFile *stored); // 压缩包会先解压
+        // 以内容提供者发送文件，返回是否压缩传输；每段数据发送前经flow限速
+        static bool setStoredContent(const httplib::Request &req, const StoredFile &stored, const std::string &path,
+                                     const TrafficShaper::FlowPtr &flow, httplib::Response &resp);
+        static bool sendPacked(const httplib::Request &req, const BackupInfo &bi, const TrafficShaper::FlowPtr &flow,
+                               httplib::Response &resp); // 直接发送与内容编码相同的压缩包
+        static TrafficShaper::FlowPtr uploadFlow(const httplib::Request &req); // 上传限速，已由事件循环限速时为空
+
+        static std::string getETag(const BackupInfo &bi);                                   // 由备份信息生成ETag，不再查表
+        static bool etagMatch(const std::string &header, const std::string &etag, bool strong); // 条件请求头是否命中ETag
+        static std::string uploadTempPath(const std::string &real_path);                  // 上传中的临时文件路径
+        static std::string uploadName(const std::string &name);                           // 上传文件名去掉路径，不合法(保留名称)返回空
+        static bool parseSize(const std::string &str, size_t *val);                        // 解析非负整数参数，格式错误或溢出返回false
+        struct UploadedFile
+        {
+            std::string tmp_path; // 已落盘的临时文件
+            std::string filename; // 目标文件名
+            std::string hash;     // 上传过程中计算的内容哈希，为空则提交时计算
+        };
+        // 上传完成：将一批临时文件原子地替换为正式文件(内容已存在则去重)，并在一次持久化中登记备份信息
+        static bool commitUploads(const std::vector<UploadedFile> &files);
+        static void removeFile(const httplib::Request &req, httplib::Response &resp); // 文件删除
+
+        // 准入控制：大文件传输与元数据请求分走两个通道，传输通道限并发、限排队，超出返回503
+        static bool isBulk(const httplib::Request &req); // 是否为大文件传输请求
+        static Lane &metaLane();
+        static Lane &bulkLane();
+        static void metrics(const httplib::Request &req, httplib::Response &resp); // 线程池与通道的排队指标
+
+        static const std::vector<Route> &routes(); // 路由表，两种服务端模型共用
+        void runThreaded();                        // httplib 每连接一线程
+        void runEvent();                           // epoll 事件驱动
 
     private:
         int _svr_port;        // 端口号
@@ -39,17 +150,91 @@ Cloud::Service::Service()
     Config *conf = Config::getInstance();
     _svr_port = conf->getSvrPort();
     _svr_ip = conf->getSvrIP();
+    AssetCache::getInstance(); // 启动时加载前端页面
+}
+
+const std::vector<Cloud::Route> &Cloud::Service::routes()
+{
+    static const std::vector<Route> table = {
+        {"GET", "/", index, nullptr},                           // 起始界面
+        {"POST", "/login", login, nullptr},                     // 用户登录
+        {"POST", "/upload", nullptr, upload},                   // 文件上传
+        {"POST", "/upload-batch", nullptr, uploadBatch},        // 多文件批量上传
+        {"GET", "/uploadShow", uploadShow, nullptr},            // 文件上传展示页面
+        {"GET", "/download/.*", download, nullptr},             // 文件下载
+        {"DELETE", "/download/.*", removeFile, nullptr},        // 文件删除
+        {"GET", "/archive", archive, nullptr},                  // 批量归档下载
+        {"GET", "/file-list", updateList, nullptr},             // 文件列表展示
+        {"GET", "/list", listShow, nullptr},                    // 前端页面更新文件列表
+        {"GET", "/metrics", metrics, nullptr},                  // 排队指标
+
+        // 分块上传(断点续传)
+        {"POST", "/upload-session", sessionCreate, nullptr},
+        {"PUT", R"(/upload-session/([0-9a-f]+))", nullptr, sessionPut},
+        {"GET", R"(/upload-session/([0-9a-f]+))", sessionQuery, nullptr},
+        {"POST", R"(/upload-session/([0-9a-f]+)/commit)", sessionCommit, nullptr},
+        {"DELETE", R"(/upload-session/([0-9a-f]+))", sessionAbort, nullptr},
+
+        // 增量上传
+        {"GET", R"(/signature/(.+))", signature, nullptr},
+        {"POST", R"(/delta/(.+))", nullptr, deltaUpload},
+    };
+    return table;
 }
 
 void Cloud::Service::run()
 {
-    _svr.Get("/", index);                // 起始界面
-    _svr.Post("/login", login);          // 用户登录
-    _svr.Post("/upload", upload);        // 文件上传
-    _svr.Get("/uploadShow", uploadShow); // 文件上传展示页面
-    _svr.Get("/download/.*", download);  // 文件下载
-    _svr.Get("/file-list", updateList); // 文件列表展示
-    _svr.Get("/list", listShow);        // 前端页面更新文件列表
+    if (Config::getInstance()->getServerMode() == "epoll")
+        runEvent();
+    else
+        runThreaded();
+}
+
+void Cloud::Service::runThreaded()
+{
+    // 连接线程池：线程数与排队上限可配置，排队已满的连接直接回复503
+    Config *conf = Config::getInstance();
+    _svr.new_task_queue = [conf]
+    { return new WorkerPool(conf->getHttpThreads(), conf->getHttpQueue(), conf->getRetryAfter()); };
+
+    // 统计前台请求速率，供后台压缩调度器自适应限速；按请求类型进入对应通道，传输通道排队已满则拒绝
+    _svr.set_pre_routing_handler([](const httplib::Request &req, httplib::Response &resp)
+                                 {
+        CompressScheduler::onRequest();
+        Lane &lane = isBulk(req) ? bulkLane() : metaLane();
+        if (!lane.acquire())
+        {
+            // 请求体尚未读取，回复后关闭连接
+            resp.status = 503;
+            resp.set_header("Retry-After", std::to_string(Config::getInstance()->getRetryAfter()));
+            resp.set_header("Connection", "close");
+            resp.set_content("server busy", "text/plain");
+            return httplib::Server::HandlerResponse::Handled;
+        }
+        return httplib::Server::HandlerResponse::Unhandled; });
+    // 响应发送完毕即归还通道名额(下载的数据在处理函数返回之后才发送)
+    _svr.set_logger([](const httplib::Request &req, const httplib::Response &resp)
+                    { Lane::releaseHeld(); });
+
+    // 连接层：同步客户端在一个连接上连续发送大量小请求
+    _svr.set_keep_alive_max_count(conf->getKeepAliveMax() > 0 ? conf->getKeepAliveMax() : SIZE_MAX);
+    _svr.set_keep_alive_timeout(conf->getKeepAliveTimeout());
+    _svr.set_read_timeout(conf->getReadTimeout());
+    _svr.set_write_timeout(conf->getWriteTimeout());
+    _svr.set_tcp_nodelay(conf->getTcpNodelay());
+    _svr.set_tcp_cork(conf->getTcpCork());
+
+    for (auto &r : routes())
+    {
+        if (r.method == "GET")
+            _svr.Get(r.pattern, r.handler);
+        else if (r.method == "DELETE")
+            _svr.Delete(r.pattern, r.handler);
+        else if (r.method == "POST")
+            r.reader ? _svr.Post(r.pattern, r.reader) : _svr.Post(r.pattern, r.handler);
+        else if (r.method == "PUT")
+            r.reader ? _svr.Put(r.pattern, r.reader) : _svr.Put(r.pattern, r.handler);
+    }
 
     if (!_svr.listen("0.0.0.0", _svr_port))
     {
@@ -58,22 +243,57 @@ void Cloud::Service::run()
     }
 }
 
+void Cloud::Service::runEvent()
+{
+    // 连接由事件循环承载，处理函数的并发数即工作线程数，不再需要请求通道
+    Config *conf = Config::getInstance();
+    ConnOptions opts;
+    opts.keep_alive_max = conf->getKeepAliveMax();
+    opts.keep_alive_timeout = conf->getKeepAliveTimeout();
+    opts.read_timeout = conf->getReadTimeout();
+    opts.write_timeout = conf->getWriteTimeout();
+    opts.tcp_nodelay = conf->getTcpNodelay();
+    opts.tcp_cork = conf->getTcpCork();
+    opts.h2c = conf->getH2c();
+    opts.h2_max_streams = conf->getH2MaxStreams();
+    EventServer server(routes(), conf->getEventLoops(), conf->getEventWorkers(), opts);
+    server.setRequestHook([](const httplib::Request &req)
+                          { CompressScheduler::onRequest(); });
+    // 上传限速：请求体由事件循环接收，每段先取得许可，被限速时停止读取该连接
+    if (TrafficShaper::getInstance().active())
+    {
+        server.setBodyGate([](const httplib::Request &req) -> EventServer::BodyGate
+                           {
+            auto flow = TrafficShaper::getInstance().open(req.remote_addr, req.path, TrafficShaper::UPLOAD);
+            return [flow](size_t want) -> size_t
+            {
+                size_t n = TrafficShaper::getInstance().chunkSize(want);
+                return flow->acquire(n) ? n : 0;
+            }; });
+    }
+    if (!server.listen("0.0.0.0", _svr_port))
+    {
+        _logger->_fatal("服务器监听失败 %s", strerror(errno));
+        exit(-2);
+    }
+}
+
 void Cloud::Service::index(const httplib::Request &req, httplib::Response &resp)
 {
-    resp.set_file_content("../www/index.html");
-    resp.set_header("Content-Type", "text/html");
-    resp.status = 200;
+    sendAsset("index.html", req, resp);
 }
 
 void Cloud::Service::login(const httplib::Request &req, httplib::Response &resp)
 {
     // 获取用户名和密码
-    Json::Value root;
-    if(!Util::JsonUtil::unserialize(req.body, &root)){
+    LoginRequest login;
+    if (!Util::FastJson::unserialize(req.body, &login))
+    {
+        resp.status = 400;
         return;
     }
-    std::string username = root["username"].asCString();
-    std::string password = root["password"].asCString();
+    const std::string &username = login.username;
+    const std::string &password = login.password;
 
     // 查看用户数据库，查看[用户名-密码]是否合法
     if (Util::checkUser(username, password))
@@ -81,10 +301,13 @@ void Cloud::Service::login(const httplib::Request &req, httplib::Response &resp)
         //生成重定向路径
         // std::string listUrl = "http://" + _svr_ip + ":" + _svr_port + "/list";
 
-        Json::Value response;
-        response["redirect"] = "http://123.249.9.114:9900/list";
+        Util::JsonWriter writer;
+        writer.beginObject();
+        writer.key("redirect");
+        writer.value("http://123.249.9.114:9900/list");
+        writer.endObject();
         resp.status = 200;
-        resp.set_content(response.toStyledString(), "application/json");
+        resp.set_content(writer.buffer(), "application/json");
     }
     else
     {
@@ -94,133 +317,603 @@ void Cloud::Service::login(const httplib::Request &req, httplib::Response &resp)
     }
 }
 
-void Cloud::Service::upload(const httplib::Request &req, httplib::Response &resp)
+void Cloud::Service::upload(const httplib::Request &req, httplib::Response &resp,
+                            const httplib::ContentReader &content_reader)
 {
-    // 处理请求
-    // 1.获取上传的文件内容  (一次只传一个文件)
-    if (!req.has_file("file"))
+    // 请求体不经httplib缓存，边接收边写入backup_dir中的临时文件，单个上传的内存占用只有一个接收缓冲区
+    std::string filename;       // 上传的文件名
+    std::string tmp_path;       // 临时文件
+    Util::FileWriter writer;
+    Util::Hasher hasher;        // 边接收边计算内容哈希，用于去重
+    bool in_file = false;       // 当前接收的数据是否属于上传文件
+    bool ok = true;
+    size_t peak_chunk = 0;      // 单次回调收到的最大数据块，即该上传的峰值缓冲
+    auto flow = uploadFlow(req);
+
+    auto receiver = [&](const char *data, size_t len)
+    {
+        peak_chunk = std::max(peak_chunk, len);
+        if (flow)
+            flow->acquire(len); // 限速：阻塞期间不再读取套接字，由TCP流量控制使客户端减速
+        if (in_file && ok)
+        {
+            hasher.update(data, len);
+            ok = writer.write(data, len);
+        }
+        return ok;
+    };
+
+    bool received = false; // 请求体完整接收(客户端中途断开或multipart格式错误时为false)
+    if (req.is_multipart_form_data())
+    {
+        // 1.multipart: 只接收名为file的部分  (一次只传一个文件)
+        received = content_reader(
+            [&](const httplib::MultipartFormData &file)
+            {
+                in_file = (file.name == "file" && !uploadName(file.filename).empty() && tmp_path.empty());
+                if (!in_file)
+                    return true;
+                filename = uploadName(file.filename);
+                tmp_path = uploadTempPath(Config::getInstance()->getBackupDir() + filename);
+                ok = writer.open(tmp_path);
+                return ok;
+            },
+            receiver);
+    }
+    else
+    {
+        // 2.非multipart: 请求体即文件内容，文件名由参数filename给出
+        filename = uploadName(req.get_param_value("filename"));
+        if (!filename.empty())
+        {
+            tmp_path = uploadTempPath(Config::getInstance()->getBackupDir() + filename);
+            ok = in_file = writer.open(tmp_path);
+        }
+        received = content_reader(receiver);
+    }
+
+    if (tmp_path.empty())
     {
         resp.status = 400;
         resp.set_content("File not exists", "text/plain");
         return;
     }
-    auto mfd = req.get_file_value("file"); // 获取一个文件内容
-
-    // 2.添加新文件
-    std::string real_path = Config::getInstance()->getBackupDir() + mfd.filename;
-    Util::FileUtil fu(real_path);
-    fu.setContent(mfd.content);
+    if (!received && ok)
+    {
+        // 请求体不完整：临时文件中只有部分数据，不能提交
+        writer.close();
+        Util::FileUtil(tmp_path).remove();
+        resp.status = 400;
+        resp.set_content("Incomplete request body", "text/plain");
+        return;
+    }
 
-    // 3.添加备份信息
-    BackupInfo newbi(real_path);
-    _biManager->update(newbi.url, newbi);
+    // 3.数据落盘，原子地替换为正式文件，并添加备份信息
+    ok = ok && writer.sync();
+    writer.close();
+    if (!ok || !commitUploads({{tmp_path, filename, hasher.hexdigest()}}))
+    {
+        Util::FileUtil(tmp_path).remove();
+        resp.status = 500;
+        resp.set_content("Upload failed", "text/plain");
+        return;
+    }
 
     // 返回响应
     resp.status = 200;
     resp.set_content("Upload successful", "text/plain");
 
-    _logger->_debug("用户上传文件已存入: %s", real_path.c_str());
+    _logger->_debug("用户上传文件已存入: %s%s, 大小 %lu, 峰值缓冲 %lu 字节",
+                    Config::getInstance()->getBackupDir().c_str(), filename.c_str(),
+                    writer.written(), peak_chunk);
 }
 
-void Cloud::Service::download(const httplib::Request &req, httplib::Response &resp)
+std::string Cloud::Service::uploadTempPath(const std::string &real_path)
 {
-    // 1.ETag缓存判断机制
-    if (req.has_header("If-None-Match"))
+    // 同名文件可能被并发上传，临时文件名带有序号，互不覆盖
+    return Util::FileUtil::tempPath(real_path);
+}
+
+bool Cloud::Service::parseSize(const std::string &str, size_t *val)
+{
+    const char *end = str.data() + str.size();
+    auto res = std::from_chars(str.data(), end, *val);
+    return !str.empty() && res.ec == std::errc() && res.ptr == end;
+}
+
+std::string Cloud::Service::uploadName(const std::string &name)
+{
+    // 去掉路径，防止写到备份目录之外；临时文件的保留名称会被启动恢复当作未完成的上传清理掉，不允许上传
+    std::string filename = Util::FileUtil(name).fileName();
+    if (filename == "." || filename == ".." || Util::FileUtil::isReservedName(filename))
+        return "";
+    return filename;
+}
+
+void Cloud::Service::uploadBatch(const httplib::Request &req, httplib::Response &resp,
+                                 const httplib::ContentReader &content_reader)
+{
+    if (!req.is_multipart_form_data())
     {
-        std::string old_etag = req.get_header_value("If-None-Match");
-        if (old_etag == getETag(req.path))
-        {
-            resp.status = 304;
-            resp.reason = "Not Modified";
+        resp.status = 400;
+        resp.set_content("Multipart form data required", "text/plain");
+        return;
+    }
+
+    // 1.各文件依次从连接中流式写入各自的临时文件；
+    //   一个文件接收完后，其落盘(fsync)交给本次上传专属的落盘线程，连接线程继续接收下一个文件
+    std::vector<UploadedFile> files;
+    Util::SyncQueue syncs;
+    std::shared_ptr<Util::FileWriter> writer;
+    std::unique_ptr<Util::Hasher> hasher;
+    bool ok = true;
+    bool bad_name = false; // 文件名不合法
+    auto flow = uploadFlow(req);
+
+    auto finishFile = [&]()
+    {
+        if (!writer)
             return;
+        files.back().hash = hasher->hexdigest();
+        syncs.push(writer);
+        writer.reset();
+    };
+
+    bool received = content_reader(
+        [&](const httplib::MultipartFormData &file)
+        {
+            finishFile();
+            if (file.filename.empty()) // 普通表单字段
+                return true;
+            std::string filename = uploadName(file.filename);
+            if (filename.empty())
+            {
+                bad_name = true;
+                return false;
+            }
+            std::string tmp_path = uploadTempPath(Config::getInstance()->getBackupDir() + filename);
+            writer = std::make_shared<Util::FileWriter>();
+            hasher.reset(new Util::Hasher);
+            files.push_back(UploadedFile{tmp_path, filename, ""});
+            ok = writer->open(tmp_path);
+            return ok;
+        },
+        [&](const char *data, size_t len)
+        {
+            if (flow)
+                flow->acquire(len);
+            if (writer && ok)
+            {
+                hasher->update(data, len);
+                ok = writer->write(data, len);
+            }
+            return ok;
+        });
+    // 请求体不完整(客户端中途断开、multipart格式错误)时最后一个文件是截断的，整批都不能提交
+    bool incomplete = !received && ok && !bad_name;
+    finishFile();
+    ok = syncs.wait() && ok;
+
+    // 2.所有文件都已落盘，一次性提交
+    if (files.empty() || bad_name || incomplete || !ok || !commitUploads(files))
+    {
+        for (auto &f : files)
+            Util::FileUtil(f.tmp_path).remove();
+        resp.status = (files.empty() || bad_name || incomplete) ? 400 : 500;
+        resp.set_content(bad_name     ? "Invalid filename"
+                         : incomplete ? "Incomplete request body"
+                         : files.empty() ? "File not exists"
+                                         : "Upload failed",
+                         "text/plain");
+        return;
+    }
+
+    Json::Value root(Json::arrayValue);
+    for (auto &f : files)
+        root.append(Config::getInstance()->getUrlPrefix() + f.filename);
+    std::string str;
+    Util::JsonUtil::serialize(root, &str);
+    resp.status = 200;
+    resp.set_content(str, "application/json");
+
+    _logger->_debug("用户批量上传文件 %d 个", files.size());
+}
+
+bool Cloud::Service::commitUploads(const std::vector<UploadedFile> &files)
+{
+    Config *conf = Config::getInstance();
+    std::vector<std::string> urls;
+    for (auto &f : files)
+        urls.push_back(conf->getUrlPrefix() + f.filename);
+
+    // 1.加锁前计算哈希、存入分块：读取与压缩大文件耗时长，只涉及各自的临时文件，不需要与压缩/解压互斥
+    //   内容已有原文件或压缩包的会在提交时去重，不必分块
+    std::vector<std::string> hashes(files.size());
+    std::vector<std::vector<ChunkRef>> prestored(files.size());
+    std::vector<bool> chunked(files.size(), false);
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        hashes[i] = files[i].hash;
+        if (hashes[i].empty())
+            Util::FileUtil(files[i].tmp_path).digest(&hashes[i]);
+
+        std::vector<BackupInfo> refs;
+        if (!hashes[i].empty())
+            _biManager->getByHash(hashes[i], &refs);
+        bool dedup = std::any_of(refs.begin(), refs.end(), [](const BackupInfo &ref)
+                                 { return Util::FileUtil(ref.real_path).isExists() || Util::FileUtil(ref.pack_path).isExists(); });
+        if (!dedup && ChunkStore::getInstance().enabled(Util::FileUtil(files[i].tmp_path).fileSize()))
+        {
+            if (!ChunkStore::getInstance().storeFile(files[i].tmp_path, &prestored[i]))
+            {
+                for (size_t j = 0; j < i; j++)
+                    ChunkStore::getInstance().release(prestored[j]);
+                return false;
+            }
+            chunked[i] = true;
+        }
+    }
+
+    // 2.与压缩/解压互斥，避免覆盖上传时旧文件的状态转换删掉新文件；锁内只做链接、改名与登记
+    auto locks = Packer::lockAll(urls);
+    PackJournal &journal = PackJournal::getInstance();
+    if (!journal.begin(PackJournal::UPLOAD, urls))
+    {
+        for (auto &chunks : prestored)
+            ChunkStore::getInstance().release(chunks);
+        return false;
+    }
+
+    // 整批要么全部提交，要么全部不变：覆盖或删除任何目标路径之前，先把原有文件硬链接到临时名称保存，
+    // 中途失败时按保存的内容逐个恢复；全部登记成功后才删除保存的旧版本
+    // (提交过程中崩溃时，保存的临时文件由启动恢复清理，已替换的文件以磁盘为准修正备份信息)
+    std::vector<std::pair<std::string, std::string>> saved; // 目标路径 -> 保存的旧版本(原本不存在则为空)
+    std::unordered_set<std::string> touched;
+    std::vector<std::vector<ChunkRef>> stored;   // 本次存入的分块，回滚时释放
+    std::vector<std::vector<ChunkRef>> unused;   // 预先存入但最终去重的分块，提交后释放
+    std::vector<std::string> consumed;           // 内容已转存的临时文件(去重、分块存储)，提交成功后删除
+    std::vector<BackupInfo> infos;
+    std::vector<std::vector<ChunkRef>> released; // 被覆盖的旧版本所引用的分块
+
+    auto save = [&](const std::string &path)
+    {
+        if (!touched.insert(path).second)
+            return true;
+        std::string backup;
+        if (Util::FileUtil(path).isExists())
+        {
+            backup = Util::FileUtil::tempPath(path);
+            if (!Util::FileUtil(path).link(backup))
+                return false;
+        }
+        saved.emplace_back(path, backup);
+        return true;
+    };
+    auto rollback = [&]()
+    {
+        for (auto it = saved.rbegin(); it != saved.rend(); ++it)
+        {
+            if (it->second.empty())
+                Util::FileUtil(it->first).remove();
+            else
+                Util::FileUtil(it->second).rename(it->first);
+        }
+        for (auto &chunks : stored)
+            ChunkStore::getInstance().release(chunks);
+        for (size_t i = 0; i < files.size(); i++)
+            ChunkStore::getInstance().release(prestored[i]);
+        journal.commit(PackJournal::UPLOAD, urls);
+        _logger->_warn("上传提交失败，已恢复 %d 个文件的原状态", files.size());
+        return false;
+    };
+
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        std::string real_path = conf->getBackupDir() + files[i].filename;
+        std::string pack_path = conf->getPackDir() + files[i].filename + conf->getArcSuffix();
+        BackupInfo old;
+        bool existed = _biManager->getOneByURL(urls[i], &old);
+        if (!save(real_path) || !save(pack_path) ||
+            (existed && (!save(old.real_path) || !save(old.pack_path))))
+            return rollback();
+
+        const std::string &hash = hashes[i];
+
+        // 内容已存在：链接已有数据，丢弃本次上传的临时文件
+        BackupInfo bi;
+        if (BlobStore::dedupUpload(hash, real_path, &bi))
+        {
+            consumed.push_back(files[i].tmp_path);
+            if (chunked[i])
+                unused.push_back(prestored[i]);
+            if (existed && old.pack_flag && !bi.pack_flag) // 旧版本的压缩包已过期
+                Util::FileUtil(old.pack_path).remove();
+            infos.push_back(bi);
+            if (existed)
+                released.push_back(old.chunks);
+            continue;
         }
+
+        // 大文件按内容分块存储：只保存新出现的分块，与旧版本相同的部分不再占用空间
+        size_t fsize = Util::FileUtil(files[i].tmp_path).fileSize();
+        if (ChunkStore::getInstance().enabled(fsize))
+        {
+            // 加锁前预计去重的内容在此期间已被删除时才在锁内分块
+            if (chunked[i])
+                bi.chunks = prestored[i];
+            else if (!ChunkStore::getInstance().storeFile(files[i].tmp_path, &bi.chunks))
+                return rollback();
+            else
+                stored.push_back(bi.chunks);
+            consumed.push_back(files[i].tmp_path);
+            if (existed) // 旧版本的原文件、压缩包已过期
+            {
+                Util::FileUtil(old.real_path).remove();
+                Util::FileUtil(old.pack_path).remove();
+            }
+
+            bi.pack_flag = false;
+            bi.is_packing = false;
+            bi.fsize = fsize;
+            bi.atime = bi.mtime = time(nullptr);
+            bi.real_path = real_path;
+            bi.pack_path = pack_path;
+            bi.url = urls[i];
+            bi.content_hash = hash;
+            infos.push_back(bi);
+            if (existed)
+                released.push_back(old.chunks);
+            continue;
+        }
+
+        if (!Util::FileUtil(files[i].tmp_path).rename(real_path))
+            return rollback();
+        if (existed && old.pack_flag) // 旧版本的压缩包已过期
+            Util::FileUtil(old.pack_path).remove();
+
+        infos.emplace_back(real_path);
+        infos.back().content_hash = hash;
+        if (existed)
+            released.push_back(old.chunks);
+    }
+    if (!_biManager->updateBatch(infos))
+        return rollback();
+
+    // 新版本已登记：删除保存的旧版本与已转存的临时文件，释放旧版本引用的分块
+    for (auto &[path, backup] : saved)
+    {
+        if (!backup.empty())
+            Util::FileUtil(backup).remove();
     }
+    for (auto &tmp : consumed)
+        Util::FileUtil(tmp).remove();
+    for (auto &chunks : released)
+        ChunkStore::getInstance().release(chunks);
+    for (auto &chunks : unused)
+        ChunkStore::getInstance().release(chunks);
+    journal.commit(PackJournal::UPLOAD, urls);
+    return true;
+}
 
-    // 2.以URL查找文件
+void Cloud::Service::removeFile(const httplib::Request &req, httplib::Response &resp)
+{
+    std::unique_lock<std::mutex> lck(Packer::mutexOf(req.path));
     BackupInfo bi;
     if (!_biManager->getOneByURL(req.path, &bi))
     {
-        // 文件不存在
         resp.status = 404;
         resp.set_content("File not found", "text/plain");
         return;
     }
 
-    // 3.判断文件是否为热点文件，若不是，需要先解压
-    // 若文件正在压缩中，需要等待其压缩结束，再解压
-
-    if (bi.pack_flag == true)
+    PackJournal &journal = PackJournal::getInstance();
+    if (!journal.begin(PackJournal::REMOVE, bi.url))
     {
-        // 非热点文件 -> 热点文件
-        Util::FileUtil fu(bi.pack_path);
-        fu.uncompress(bi.real_path);
-        bi.pack_flag = false;
-        fu.remove();
-        _biManager->update(bi.url, bi);
+        resp.status = 500;
+        resp.set_content("Remove failed", "text/plain");
+        return;
+    }
+    // 只删除该文件自己的链接，内容相同的其他文件不受影响
+    Util::FileUtil(bi.real_path).remove();
+    Util::FileUtil(bi.pack_path).remove();
+    _biManager->remove(bi.url);
+    ChunkStore::getInstance().release(bi.chunks);
+    journal.commit(PackJournal::REMOVE, bi.url);
+
+    resp.status = 204;
+    _logger->_debug("文件已删除: %s, 内容剩余引用 %d", bi.url.c_str(),
+                    bi.content_hash.empty() ? 0 : BlobStore::refcount(bi.content_hash));
+}
 
-        _logger->_debug("热点文件: %s 处理成功", bi.real_path.c_str());
+void Cloud::Service::download(const httplib::Request &req, httplib::Response &resp)
+{
+    // 1.以URL查找文件
+    BackupInfo bi;
+    if (!_biManager->getOneByURL(req.path, &bi))
+    {
+        // 文件不存在
+        resp.status = 404;
+        resp.set_content("File not found", "text/plain");
+        return;
     }
 
-    // 判断是否为断点续传(断点下载)请求
-    if (req.has_header("If-Range"))
+    // 2.ETag缓存判断机制：ETag直接由备份信息得到，命中时不需要解压或打开文件
+    if (req.has_header("If-None-Match") && etagMatch(req.get_header_value("If-None-Match"), getETag(bi), false))
     {
-        // 判断客户端的etag是否与当前etag相等
-        // 若不相等，表示服务端对文件进行了修改，客户端不能进行断点续传，需要重新下载
-        std::string old_etag = req.get_header_value("If-Range");
-        if (old_etag == getETag(req.path))
-        {
-            Util::FileUtil fu(bi.real_path);
-            fu.getContent(resp.body); // cpp-httplib库内置处理断点续传
+        resp.set_header("ETag", getETag(bi));
+        resp.status = 304;
+        resp.reason = "Not Modified";
+        return;
+    }
 
-            resp.set_header("ETag", getETag(req.path));
-            resp.set_header("Accept-Ranges", "bytes");
-            resp.status = 206;
-            resp.reason = "Partial Content";
-            return;
-        }
+    // 根据该客户端的下载规律，提前解压它接下来可能下载的冷文件
+    Prefetcher::getInstance().onDownload(req.remote_addr, bi);
+
+    // 限速：该下载在响应发送完毕(内容提供者释放)时离开调度
+    auto flow = TrafficShaper::getInstance().open(req.remote_addr, req.path, TrafficShaper::DOWNLOAD);
+
+    // 冷文件的压缩算法恰好是客户端支持的内容编码(br/zstd)：直接发送压缩数据，既不解压也不重新压缩
+    if (sendPacked(req, bi, flow, resp))
+        return;
+
+    // 3.打开文件：压缩包先解压为热点文件(若正在压缩中，等待其压缩结束再解压)，分块存储的文件按分块读取
+    StoredFile stored;
+    if (!openStored(req.path, &bi, &stored))
+    {
+        resp.status = 500;
+        resp.set_content("File uncompress failed", "text/plain");
+        return;
     }
 
-    // 4.获取文件内容，填充响应
-    resp.set_file_content(bi.real_path);
+    // 4.以内容提供者发送文件内容：Range与多区间(multipart/byteranges)请求由cpp-httplib按区间调用内容提供者，
+    //   只读取请求的部分，断点续传最后1MB与文件大小无关
+    bool encoded = setStoredContent(req, stored, bi.real_path, flow, resp);
     // 设置 Content-Disposition 以便下载文件而不是直接在浏览器显示
     std::string filename = Util::FileUtil(bi.real_path).fileName();
     resp.set_header("Content-Disposition", "attachment; filename=" + filename);
     // 设置ETag
-    resp.set_header("ETag", getETag(req.path));
+    // 压缩传输的字节与原文件不同，只能使用弱ETag
+    std::string etag = getETag(bi);
+    resp.set_header("ETag", encoded && etag[0] == '"' ? "W/" + etag : etag);
+    resp.set_header("Vary", "Accept-Encoding");
     // 设置接受断点续传
     resp.set_header("Accept-Ranges", "bytes");
-    // 设置状态码和状态描述
+
+    // 断点续传请求的If-Range与当前ETag不一致(或只有弱ETag，无法保证字节相同)，说明服务端文件可能已被修改，忽略Range返回完整文件；
+    // 其余情况不设置状态码，由cpp-httplib根据是否有Range返回200或206(区间越界返回416)
+    if (req.has_header("If-Range") && !etagMatch(req.get_header_value("If-Range"), etag, true))
+        resp.status = 200;
+}
+
+void Cloud::Service::archive(const httplib::Request &req, httplib::Response &resp)
+{
+    // 1.选择文件：?url=...(可重复)指定文件；否则按 ?prefix=... 文件名前缀选择，没有前缀为全部文件
+    std::vector<std::string> urls;
+    if (req.has_param("url"))
+    {
+        for (size_t i = 0; i < req.get_param_value_count("url"); i++)
+            urls.push_back(req.get_param_value("url", i));
+    }
+    else
+    {
+        std::vector<BackupInfo> all;
+        _biManager->getAll(&all);
+        std::string prefix = req.get_param_value("prefix");
+        for (auto &bi : all)
+        {
+            if (Util::FileUtil(bi.real_path).fileName().compare(0, prefix.size(), prefix) == 0)
+                urls.push_back(bi.url);
+        }
+        std::sort(urls.begin(), urls.end()); // 同一批文件每次归档的顺序相同
+    }
+    if (urls.empty())
+    {
+        resp.status = 404;
+        resp.set_content("No files selected", "text/plain");
+        return;
+    }
+
+    // 2.以分块传输边生成边发送，整个归档是一次连续传输；每段数据发送前经限速
+    std::string name = Util::FileUtil(req.get_param_value("name")).fileName();
+    if (name.empty())
+        name = "backup.tar";
+    auto stream = std::make_shared<ArchiveStream>(urls);
+    auto buf = std::make_shared<std::string>(); // 已生成、等待限速放行的数据
+    auto flow = TrafficShaper::getInstance().open(req.remote_addr, req.path, TrafficShaper::DOWNLOAD);
+    resp.set_chunked_content_provider(
+        "application/x-tar",
+        [stream, buf, flow](size_t offset, httplib::DataSink &sink)
+        {
+            if (buf->empty())
+            {
+                if (!stream->read(buf.get()))
+                    return false;
+                if (buf->empty())
+                {
+                    sink.done();
+                    return true;
+                }
+            }
+            if (!flow->acquire(buf->size()))
+                return true;
+            bool ok = sink.write(buf->data(), buf->size());
+            buf->clear();
+            return ok;
+        },
+        [stream, urls](bool success)
+        {
+            _logger->_debug("归档下载%s: %lu 个文件中写入 %lu 个", success ? "完成" : "中断",
+                            urls.size(), stream->entries());
+        });
+    resp.set_header("Content-Disposition", "attachment; filename=" + name);
     resp.status = 200;
-    resp.reason = "OK";
 }
 
 void Cloud::Service::listShow(const httplib::Request &req, httplib::Response &resp)
 {
-    resp.set_file_content("../www/list.html");
-    resp.set_header("Content-Type", "text/html");
-    resp.status = 200;
+    sendAsset("list.html", req, resp);
 }
 
 void Cloud::Service::uploadShow(const httplib::Request &req, httplib::Response &resp)
 {
-    resp.set_file_content("../www/upload.html");
-    resp.set_header("Content-Type", "text/html");
+    sendAsset("upload.html", req, resp);
+}
+
+void Cloud::Service::sendAsset(const std::string &name, const httplib::Request &req, httplib::Response &resp)
+{
+    auto asset = AssetCache::getInstance().get(name);
+    if (asset == nullptr)
+    {
+        resp.status = 404;
+        return;
+    }
+
+    // 选择客户端接受的最小版本；Range请求只发送原始内容
+    const std::string *body = &asset->raw;
+    std::string coding;
+    std::string accept = req.get_header_value("Accept-Encoding");
+    if (!req.has_header("Range"))
+    {
+        if (!asset->br.empty() && httplib::detail::accepts_encoding(accept, "br"))
+        {
+            body = &asset->br;
+            coding = "br";
+        }
+        else if (!asset->gzip.empty() && httplib::detail::accepts_encoding(accept, "gzip"))
+        {
+            body = &asset->gzip;
+            coding = "gzip";
+        }
+    }
+
+    // 每个编码版本有各自的强ETag
+    std::string etag = "\"" + asset->hash + (coding.empty() ? "" : "-" + coding) + "\"";
+    resp.set_header("ETag", etag);
+    resp.set_header("Cache-Control", "public, max-age=" + std::to_string(Config::getInstance()->getWwwMaxAge()));
+    resp.set_header("Vary", "Accept-Encoding");
+    if (req.has_header("If-None-Match") && etagMatch(req.get_header_value("If-None-Match"), etag, false))
+    {
+        resp.status = 304;
+        return;
+    }
+    if (!coding.empty())
+        resp.set_header("Content-Encoding", coding);
+    resp.set_content(*body, asset->content_type);
     resp.status = 200;
 }
 
 void Cloud::Service::updateList(const httplib::Request &req, httplib::Response &resp)
 {
-    // 1.获取可下载的文件列表(热点 or 非热点都可下载)
-    std::vector<Cloud::BackupInfo> list;
-    _biManager->getAll(&list);
-
-    Json::Value root;
+    // 文件列表逐批写入分块响应：每次从数据管理器取一批，编码后立即发送
+    // 不构造完整的文件数组与 Json::Value 树，文件再多内存占用也不变，且第一批数据立即开始发送
+    static const size_t batch = 256;
 
     auto time_tToDateString = [](time_t time)
     {
-        struct tm *timeinfo = std::localtime(&time);
+        struct tm timeinfo;
+        localtime_r(&time, &timeinfo);
         char buffer[80];
-        std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", timeinfo);
+        std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &timeinfo);
         return std::string(buffer);
     };
 
@@ -241,30 +934,660 @@ void Cloud::Service::updateList(const httplib::Request &req, httplib::Response &
             return std::to_string(sz / G) + "GB";
     };
 
-    for (auto &info : list)
+    struct ListState
+    {
+        std::string cursor; // 上一批最后一个文件的url
+        bool started = false;
+        bool more = true;
+        Util::JsonWriter writer;
+        std::vector<BackupInfo> list;
+    };
+    auto state = std::make_shared<ListState>();
+
+    resp.set_chunked_content_provider(
+        "application/json",
+        [state, time_tToDateString, size_tToString](size_t offset, httplib::DataSink &sink)
+        {
+            Util::JsonWriter &writer = state->writer;
+            if (!state->started)
+            {
+                state->started = true;
+                writer.beginArray();
+            }
+            else if (!state->more) // 上一批已是最后一批
+            {
+                sink.done();
+                return true;
+            }
+
+            state->list.clear();
+            state->more = _biManager->scan(&state->cursor, batch, &state->list);
+            const std::string &prefix = Config::getInstance()->getUrlPrefix();
+            ListItem item;
+            for (auto &info : state->list)
+            {
+                item.downloadUrl = info.url;
+                item.fileName = info.url.substr(prefix.size());
+                item.lastModified = time_tToDateString(info.mtime);
+                item.fileSize = size_tToString(info.fsize);
+                Util::FastJson::write(writer, item);
+            }
+            if (!state->more)
+                writer.endArray();
+
+            bool ok = writer.size() == 0 || sink.write(writer.buffer().data(), writer.size());
+            writer.clear();
+            return ok;
+        });
+}
+
+void Cloud::Service::sessionCreate(const httplib::Request &req, httplib::Response &resp)
+{
+    // 请求体: {"filename": "a.iso", "size": 4294967296}
+    Json::Value root;
+    if (!Util::JsonUtil::unserialize(req.body, &root) || !root["filename"].isString() || !root["size"].isIntegral())
+    {
+        resp.status = 400;
+        resp.set_content("Invalid session request", "text/plain");
+        return;
+    }
+    std::string filename = uploadName(root["filename"].asString());
+    if (filename.empty())
+    {
+        resp.status = 400;
+        resp.set_content("Invalid filename", "text/plain");
+        return;
+    }
+    auto session = UploadSessionManager::getInstance().create(filename, root["size"].asUInt64());
+    if (!session)
+    {
+        resp.status = 500;
+        resp.set_content("Create session failed", "text/plain");
+        return;
+    }
+
+    std::string str;
+    Util::JsonUtil::serialize(sessionToJson(session), &str);
+    resp.status = 201;
+    resp.set_content(str, "application/json");
+    _logger->_debug("分块上传会话 %s 创建: %s, 大小 %lu", session->id().c_str(), filename.c_str(), session->size());
+}
+
+void Cloud::Service::sessionPut(const httplib::Request &req, httplib::Response &resp,
+                                const httplib::ContentReader &content_reader)
+{
+    auto session = UploadSessionManager::getInstance().get(req.matches[1]);
+    if (!session)
+    {
+        resp.status = 404;
+        resp.set_content("Session not found", "text/plain");
+        return;
+    }
+
+    // 分块位置：?offset=N 或 ?index=I&chunk_size=S，必须给出其一且落在文件范围内
+    size_t offset = 0;
+    bool valid = false;
+    if (req.has_param("offset"))
+    {
+        valid = parseSize(req.get_param_value("offset"), &offset);
+    }
+    else if (req.has_param("index") && req.has_param("chunk_size"))
+    {
+        size_t index = 0, chunk_size = 0;
+        valid = parseSize(req.get_param_value("index"), &index) &&
+                parseSize(req.get_param_value("chunk_size"), &chunk_size) &&
+                chunk_size > 0 && index <= session->size() / chunk_size; // 乘积不超过文件大小，不会溢出
+        offset = valid ? index * chunk_size : 0;
+    }
+    // 请求体长度已知时提前检查，不必接收完才发现越界
+    if (valid && req.has_header("Content-Length"))
+        valid = offset <= session->size() && req.get_header_value_u64("Content-Length") <= session->size() - offset;
+    if (!valid || offset > session->size())
+    {
+        resp.status = 400;
+        resp.set_content("Invalid chunk position", "text/plain");
+        return;
+    }
+
+    // 提交或放弃开始后不再接受分块
+    UploadSession::Writing writing(*session);
+    if (!writing)
+    {
+        resp.status = 409;
+        resp.set_content("Session is closing", "text/plain");
+        return;
+    }
+
+    // 边接收边写到稀疏文件的对应偏移处
+    size_t len = 0;
+    bool ok = true;
+    auto flow = uploadFlow(req);
+    content_reader([&](const char *data, size_t n)
+                   {
+        if (flow)
+            flow->acquire(n);
+        ok = ok && session->write(data, n, offset + len);
+        len += n;
+        return ok; });
+
+    if (!ok || !session->received(offset, len))
+    {
+        resp.status = 400;
+        resp.set_content("Write chunk failed", "text/plain");
+        return;
+    }
+
+    std::string str;
+    Util::JsonUtil::serialize(sessionToJson(session), &str);
+    resp.status = 200;
+    resp.set_content(str, "application/json");
+}
+
+void Cloud::Service::sessionQuery(const httplib::Request &req, httplib::Response &resp)
+{
+    auto session = UploadSessionManager::getInstance().get(req.matches[1]);
+    if (!session)
+    {
+        resp.status = 404;
+        resp.set_content("Session not found", "text/plain");
+        return;
+    }
+
+    std::string str;
+    Util::JsonUtil::serialize(sessionToJson(session), &str);
+    resp.status = 200;
+    resp.set_content(str, "application/json");
+}
+
+void Cloud::Service::sessionCommit(const httplib::Request &req, httplib::Response &resp)
+{
+    auto session = UploadSessionManager::getInstance().get(req.matches[1]);
+    if (!session)
+    {
+        resp.status = 404;
+        resp.set_content("Session not found", "text/plain");
+        return;
+    }
+    // 关闭会话：拒绝新的分块并等在途分块写完，之后数据文件不再变化
+    if (!session->close(true))
+    {
+        resp.status = 409;
+        resp.set_content("Session is closing", "text/plain");
+        return;
+    }
+    if (!session->complete())
+    {
+        session->reopen();
+        resp.status = 409;
+        resp.set_content("Upload incomplete", "text/plain");
+        return;
+    }
+
+    // 数据文件已全部落盘，直接rename到备份目录并登记备份信息
+    if (!commitUploads({{session->dataPath(), session->filename(), ""}}))
+    {
+        session->reopen();
+        resp.status = 500;
+        resp.set_content("Commit failed", "text/plain");
+        return;
+    }
+    UploadSessionManager::getInstance().finish(session->id());
+
+    resp.status = 200;
+    resp.set_content("Upload successful", "text/plain");
+    _logger->_debug("分块上传会话 %s 提交: %s", session->id().c_str(), session->filename().c_str());
+}
+
+void Cloud::Service::sessionAbort(const httplib::Request &req, httplib::Response &resp)
+{
+    int ret = UploadSessionManager::getInstance().abort(req.matches[1]);
+    if (ret == -2)
+    {
+        resp.status = 409;
+        resp.set_content("Session is committing", "text/plain");
+        return;
+    }
+    resp.status = 204;
+}
+
+Json::Value Cloud::Service::sessionToJson(const UploadSession::Ptr &session)
+{
+    Json::Value root;
+    root["id"] = session->id();
+    root["filename"] = session->filename();
+    root["size"] = (Json::UInt64)session->size();
+    root["received"] = Json::Value(Json::arrayValue);
+    for (auto &[start, end] : session->ranges())
+    {
+        Json::Value range;
+        range.append((Json::UInt64)start);
+        range.append((Json::UInt64)end);
+        root["received"].append(range);
+    }
+    return root;
+}
+
+bool Cloud::Service::openStored(const std::string &url, BackupInfo *bi, StoredFile *stored)
+{
+    for (int retry = 0; retry < 2; retry++)
+    {
+        {
+            std::unique_lock<std::mutex> lck(Packer::mutexOf(url));
+            if (!_biManager->getOneByURL(url, bi))
+                return false;
+
+            // 1.分块存储：按分块读取
+            if (!bi->chunks.empty())
+            {
+                stored->chunks = std::make_shared<ChunkReader>(bi->chunks);
+                stored->size = stored->chunks->size();
+                return true;
+            }
+
+            // 2.热点文件：打开后即使文件被压缩或覆盖，已打开的描述符仍指向这个版本
+            if (!bi->pack_flag)
+            {
+                stored->file = std::make_shared<Util::FileReader>();
+                if (!stored->file->open(bi->real_path))
+                    return false;
+                stored->size = stored->file->size();
+                return true;
+            }
+        }
+
+        // 3.压缩包：先解压为热点文件
+        if (!Packer::unpack(url, bi))
+            return false;
+    }
+    return false;
+}
+
+bool Cloud::Service::setStoredContent(const httplib::Request &req, const StoredFile &stored, const std::string &path,
+                                      const TrafficShaper::FlowPtr &flow, httplib::Response &resp)
+{
+    // 限速的传输(acquire 返回false)本次不写出数据，事件循环稍后重新调用内容提供者
+    // 与 set_file_content 相同，按扩展名确定Content-Type
+    std::string content_type = httplib::detail::find_content_type(path, {}, "application/octet-stream");
+
+    // 文本类文件且客户端支持gzip/br：以分块传输发送，由cpp-httplib边读边压缩(压缩后长度未知，不支持Range)
+    resp.set_header("Content-Type", content_type);
+    bool encode = !req.has_header("Range") && httplib::detail::encoding_type(req, resp) != httplib::detail::EncodingType::None;
+    resp.headers.erase("Content-Type"); // 由set_*content_provider重新设置
+    if (encode)
+    {
+        StoredFile file = stored;
+        auto buf = std::make_shared<std::string>();
+        resp.set_chunked_content_provider(
+            content_type,
+            [file, buf, flow](size_t offset, httplib::DataSink &sink) mutable
+            {
+                size_t length = TrafficShaper::getInstance().chunkSize(64 << 10);
+                if (!flow->acquire(std::min<size_t>(file.size - offset, length)))
+                    return true;
+                if (!file.read(offset, length, buf.get()))
+                    return false;
+                if (!buf->empty() && !sink.write(buf->data(), buf->size()))
+                    return false;
+                if (offset + buf->size() >= file.size)
+                    sink.done();
+                return true;
+            });
+        return true;
+    }
+
+    // 热点文件：sendfile 从页缓存直接发送到socket，不经过用户态缓冲
+    if (stored.file)
+    {
+        auto file = stored.file;
+        resp.set_content_provider(
+            stored.size, content_type,
+            [file, flow](size_t offset, size_t length, httplib::DataSink &sink)
+            {
+                length = TrafficShaper::getInstance().chunkSize(std::min<size_t>(length, 4 << 20));
+                if (!flow->acquire(length))
+                    return true;
+                return sink.write_file(file->fd(), offset, length);
+            });
+        return false;
+    }
+
+    // 分块存储：边解压分块边发送，每次最多发送一个平均分块长度的数据(限速时不超过调度粒度)
+    auto chunks = stored.chunks;
+    auto buf = std::make_shared<std::string>();
+    resp.set_content_provider(
+        stored.size, content_type,
+        [chunks, buf, flow](size_t offset, size_t length, httplib::DataSink &sink)
+        {
+            length = TrafficShaper::getInstance().chunkSize(std::min(length, Config::getInstance()->getChunkAvgSize()));
+            if (!flow->acquire(length))
+                return true;
+            if (!chunks->read(offset, length, buf.get()))
+                return false;
+            return sink.write(buf->data(), buf->size());
+        });
+    return false;
+}
+
+bool Cloud::Service::sendPacked(const httplib::Request &req, const BackupInfo &bi, const TrafficShaper::FlowPtr &flow,
+                               httplib::Response &resp)
+{
+    // 压缩数据不能按原文件的偏移截取，Range请求仍走解压路径
+    if (!bi.pack_flag || req.has_header("Range"))
+        return false;
+
+    auto file = std::make_shared<Util::FileReader>();
+    unsigned codec;
+    size_t offset, zlen;
+    {
+        // 加锁确认仍是冷文件，打开后压缩包被解压删除也不影响已打开的描述符
+        std::unique_lock<std::mutex> lck(Packer::mutexOf(bi.url));
+        BackupInfo cur;
+        if (!_biManager->getOneByURL(bi.url, &cur) || !cur.pack_flag)
+            return false;
+        if (!Util::FileUtil(cur.pack_path).packInfo(&codec, &offset, &zlen))
+            return false;
+
+        std::string coding;
+        if (codec == bundle::BROTLI9 || codec == bundle::BROTLI11)
+            coding = "br";
+        else if (codec == bundle::ZSTD || codec == bundle::ZSTDF)
+            coding = "zstd";
+        if (coding.empty() || !httplib::detail::accepts_encoding(req.get_header_value("Accept-Encoding"), coding))
+            return false;
+        if (!file->open(cur.pack_path))
+            return false;
+        resp.set_header("Content-Encoding", coding);
+    }
+
+    std::string content_type = httplib::detail::find_content_type(bi.real_path, {}, "application/octet-stream");
+    resp.set_content_provider(
+        zlen, content_type,
+        [file, offset, flow](size_t pos, size_t length, httplib::DataSink &sink)
+        {
+            length = TrafficShaper::getInstance().chunkSize(std::min<size_t>(length, 4 << 20));
+            if (!flow->acquire(length))
+                return true;
+            return sink.write_file(file->fd(), offset + pos, length);
+        });
+
+    std::string etag = getETag(bi);
+    resp.set_header("ETag", etag[0] == '"' ? "W/" + etag : etag);
+    resp.set_header("Vary", "Accept-Encoding");
+    resp.set_header("Content-Disposition", "attachment; filename=" + Util::FileUtil(bi.real_path).fileName());
+    resp.status = 200;
+    _logger->_debug("%s 直接发送压缩包(%s)", bi.url.c_str(), resp.get_header_value("Content-Encoding").c_str());
+    return true;
+}
+
+Cloud::TrafficShaper::FlowPtr Cloud::Service::uploadFlow(const httplib::Request &req)
+{
+    // 事件驱动模型在处理函数执行前就已接收完请求体，限速在事件循环接收时进行(见 runEvent)，这里不再重复
+    if (Config::getInstance()->getServerMode() == "epoll")
+        return nullptr;
+    return TrafficShaper::getInstance().open(req.remote_addr, req.path, TrafficShaper::UPLOAD);
+}
+
+void Cloud::Service::signature(const httplib::Request &req, httplib::Response &resp)
+{
+    std::string filename = Util::FileUtil(req.matches[1]).fileName();
+    std::string url = Config::getInstance()->getUrlPrefix() + filename;
+    size_t block_size = Config::getInstance()->getDeltaBlockSize();
+    if ((req.has_param("block_size") && !parseSize(req.get_param_value("block_size"), &block_size)) ||
+        block_size < 64 || block_size > (16 << 20))
+    {
+        resp.status = 400;
+        resp.set_content("Invalid block size", "text/plain");
+        return;
+    }
+
+    BackupInfo bi;
+    StoredFile stored;
+    if (!openStored(url, &bi, &stored))
+    {
+        resp.status = 404;
+        resp.set_content("File not found", "text/plain");
+        return;
+    }
+    size_t size = stored.size;
+
+    // 每次读取一批块，逐块计算 弱校验和 + 强校验和，同时计算整个文件的哈希(供增量上传时校验旧版本)
+    Json::Value root;
+    Json::Value &blocks = root["blocks"] = Json::Value(Json::arrayValue);
+    Util::Hasher hasher;
+    std::string buf;
+    size_t batch = std::max<size_t>(1, (1 << 20) / block_size) * block_size;
+    for (size_t offset = 0; offset < size; offset += batch)
     {
-        Json::Value item;
-        Config *conf = Config::getInstance();
-        item["downloadUrl"] = info.url;
-        item["fileName"] = info.url.substr(conf->getUrlPrefix().size());
-        item["lastModified"] = time_tToDateString(info.mtime);
-        item["fileSize"] = size_tToString(info.fsize);
-        root.append(item);
+        if (!stored.read(offset, batch, &buf))
+        {
+            resp.status = 500;
+            resp.set_content("Read file failed", "text/plain");
+            return;
+        }
+        hasher.update(buf.data(), buf.size());
+        for (size_t i = 0; i < buf.size(); i += block_size)
+        {
+            size_t n = std::min(block_size, buf.size() - i);
+            Json::Value block;
+            block.append(Util::Delta::weakSum(buf.data() + i, n));
+            block.append(Util::Delta::strongSum(buf.data() + i, n));
+            blocks.append(block);
+        }
     }
+    root["filename"] = filename;
+    root["size"] = (Json::UInt64)size;
+    root["block_size"] = (Json::UInt64)block_size;
+    root["content_hash"] = hasher.hexdigest();
 
-    std::string jsonStr;
-    Util::JsonUtil::serialize(root, &jsonStr);
-    resp.set_content(jsonStr, "application/json");
+    std::string str;
+    Util::JsonUtil::serialize(root, &str);
+    resp.status = 200;
+    resp.set_content(str, "application/json");
 }
 
-std::string Cloud::Service::getETag(const std::string &url)
+void Cloud::Service::deltaUpload(const httplib::Request &req, httplib::Response &resp,
+                                 const httplib::ContentReader &content_reader)
 {
-    Cloud::BackupInfo bi;
-    _biManager->getOneByURL(url, &bi);
+    // 参数: block_size 签名的块大小; base 签名返回的content_hash; hash 新版本的SHA-256(可选，用于校验重建结果)
+    std::string filename = uploadName(req.matches[1]);
+    if (filename.empty())
+    {
+        resp.status = 400;
+        resp.set_content("Invalid filename", "text/plain");
+        return;
+    }
+    std::string url = Config::getInstance()->getUrlPrefix() + filename;
+    size_t block_size = 0;
+    if (!parseSize(req.get_param_value("block_size"), &block_size) || block_size < 64 || block_size > (16 << 20))
+    {
+        resp.status = 400;
+        resp.set_content("Invalid block size", "text/plain");
+        return;
+    }
 
-    // 文件名-文件大小-最近修改时间
+    BackupInfo bi;
+    StoredFile stored;
+    if (!openStored(url, &bi, &stored))
+    {
+        resp.status = 404;
+        resp.set_content("File not found", "text/plain");
+        return;
+    }
+    size_t size = stored.size;
+
+    // 1.签名之后旧版本已被修改，增量不再适用
+    if (req.has_param("base"))
+    {
+        std::string base_hash = bi.content_hash;
+        if (base_hash.empty()) // 早期上传的文件没有记录内容哈希
+        {
+            Util::Hasher hasher;
+            std::string buf;
+            for (size_t offset = 0; offset < size; offset += (1 << 20))
+            {
+                if (!stored.read(offset, 1 << 20, &buf))
+                    break;
+                hasher.update(buf.data(), buf.size());
+            }
+            base_hash = hasher.hexdigest();
+        }
+        if (base_hash != req.get_param_value("base"))
+        {
+            resp.status = 409;
+            resp.set_content("Base version changed", "text/plain");
+            return;
+        }
+    }
+
+    // 2.边接收增量边重建，新版本写入临时文件
+    std::string tmp_path = uploadTempPath(Config::getInstance()->getBackupDir() + filename);
+    Util::FileWriter writer;
+    Util::Hasher hasher;
+    if (!writer.open(tmp_path))
+    {
+        resp.status = 500;
+        resp.set_content("Upload failed", "text/plain");
+        return;
+    }
+    Util::DeltaApplier applier(block_size, (size + block_size - 1) / block_size,
+                               [&stored](size_t offset, size_t len, std::string *out)
+                               { return stored.read(offset, len, out); },
+                               [&](const char *data, size_t len)
+                               {
+                                   hasher.update(data, len);
+                                   return writer.write(data, len);
+                               });
+    size_t received = 0;
+    auto flow = uploadFlow(req);
+    // 请求体不完整时，截断处恰好在指令边界上也能通过finish，不能提交
+    bool complete = content_reader([&](const char *data, size_t len)
+                                   {
+        if (flow)
+            flow->acquire(len);
+        received += len;
+        return applier.feed(data, len); });
+
+    bool ok = complete && applier.finish() && writer.sync();
+    writer.close();
+    std::string hash = hasher.hexdigest();
+    if (ok && req.has_param("hash") && req.get_param_value("hash") != hash)
+        ok = false;
+    if (!ok)
+    {
+        Util::FileUtil(tmp_path).remove();
+        resp.status = 400;
+        std::string reason = !applier.error().empty() ? applier.error()
+                             : !complete          ? std::string("incomplete request body")
+                                                  : std::string("verification failed");
+        resp.set_content("Apply delta failed: " + reason, "text/plain");
+        return;
+    }
+
+    // 3.与普通上传相同：原子替换并更新备份信息
+    if (!commitUploads({{tmp_path, filename, hash}}))
+    {
+        Util::FileUtil(tmp_path).remove();
+        resp.status = 500;
+        resp.set_content("Upload failed", "text/plain");
+        return;
+    }
+
+    Json::Value root;
+    root["url"] = url;
+    root["size"] = (Json::UInt64)writer.written();
+    root["received"] = (Json::UInt64)received;
+    root["content_hash"] = hash;
+    std::string str;
+    Util::JsonUtil::serialize(root, &str);
+    resp.status = 200;
+    resp.set_content(str, "application/json");
+
+    _logger->_debug("增量上传 %s: 新版本 %lu 字节，实际接收 %lu 字节", url.c_str(), writer.written(), received);
+}
+
+std::string Cloud::Service::getETag(const BackupInfo &bi)
+{
+    // 强ETag：上传时边接收边计算的内容哈希，内容相同则ETag相同，与修改时间的精度无关
+    if (!bi.content_hash.empty())
+        return '"' + bi.content_hash + '"';
+
+    // 早期上传的文件没有内容哈希：弱ETag 文件名-文件大小-最近修改时间
     std::string fileName = Util::FileUtil(bi.real_path).fileName();
     std::string fileSize = std::to_string(bi.fsize);
     std::string lastMTime = std::to_string(bi.mtime);
-    return fileName + '-' + fileSize + '-' + lastMTime;
+    return "W/\"" + fileName + '-' + fileSize + '-' + lastMTime + '"';
+}
+
+bool Cloud::Service::etagMatch(const std::string &header, const std::string &etag, bool strong)
+{
+    // header: "*" 或以逗号分隔的ETag列表；强比较(If-Range)时弱ETag不匹配，弱比较(If-None-Match)时忽略W/前缀
+    auto opaque = [](std::string tag)
+    {
+        return tag.compare(0, 2, "W/") == 0 ? tag.substr(2) : tag;
+    };
+    bool weak = etag.compare(0, 2, "W/") == 0;
+    if (strong && weak)
+        return false;
+
+    std::istringstream iss(header);
+    std::string tag;
+    while (std::getline(iss, tag, ','))
+    {
+        size_t begin = tag.find_first_not_of(" \t");
+        size_t end = tag.find_last_not_of(" \t");
+        if (begin == std::string::npos)
+            continue;
+        tag = tag.substr(begin, end - begin + 1);
+        if (tag == "*" && !strong)
+            return true;
+        if (strong ? tag == etag : opaque(tag) == opaque(etag))
+            return true;
+    }
+    return false;
+}
+
+bool Cloud::Service::isBulk(const httplib::Request &req)
+{
+    size_t min_size = Config::getInstance()->getBulkMinSize();
+    if (req.method == "POST" || req.method == "PUT")
+    {
+        // 分块编码的请求体长度未知，按传输处理
+        if (req.get_header_value("Transfer-Encoding") == "chunked")
+            return true;
+        return req.get_header_value_u64("Content-Length") >= min_size;
+    }
+    if (req.method == "GET" && req.path == "/archive")
+        return true;
+    const std::string &prefix = Config::getInstance()->getUrlPrefix();
+    if (req.method == "GET" && req.path.compare(0, prefix.size(), prefix) == 0)
+    {
+        size_t fsize = 0;
+        return _biManager->getSizeByURL(req.path, &fsize) && fsize >= min_size;
+    }
+    return false;
+}
+
+Cloud::Lane &Cloud::Service::metaLane()
+{
+    static Lane lane("meta", 0, 0);
+    return lane;
+}
+
+Cloud::Lane &Cloud::Service::bulkLane()
+{
+    static Lane lane("bulk", Config::getInstance()->getBulkSlots(), Config::getInstance()->getBulkQueue());
+    return lane;
+}
+
+void Cloud::Service::metrics(const httplib::Request &req, httplib::Response &resp)
+{
+    Json::Value root;
+    WorkerPool::toJson(&root["pool"]);
+    metaLane().toJson(&root["lanes"]["meta"]);
+    bulkLane().toJson(&root["lanes"]["bulk"]);
+    TrafficShaper::getInstance().toJson(&root["shaper"]);
+    std::string body;
+    Util::JsonUtil::serialize(root, &body);
+    resp.set_content(body, "application/json");
+    resp.status = 200;
 }
@@ -0,0 +1,373 @@
+#pragma once
+#include <iostream>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include "util.hpp"
+#include "config.hpp"
+#include "log/ckflog.hpp"
+
+extern ckflogs::Logger::Ptr _logger;
+
+namespace Cloud
+{
+    // 分块上传会话
+    // 创建会话时在session_dir中建立一个与目标文件等大的稀疏文件，每个分块直接写到自己的偏移处，
+    // 同一会话的多个分块可以并发上传；已落盘的区间记录在 <id>.json 中，服务端重启后会话仍可继续
+    // 分块写入前需 beginWrite 登记；提交、放弃、过期先 close，之后的写入被拒绝，并等在途写入结束。
+    // 数据文件描述符在最后一个引用释放时才关闭，close 之后仍在使用会话的请求不会写到复用的描述符上
+    class UploadSession
+    {
+    public:
+        using Ptr = std::shared_ptr<UploadSession>;
+        using Ranges = std::map<size_t, size_t>; // 已接收区间 [start, end)
+
+        // 分块写入期间持有，析构时结束写入
+        class Writing
+        {
+        public:
+            Writing(UploadSession &session) : _session(session), _ok(session.beginWrite()) {}
+            ~Writing()
+            {
+                if (_ok)
+                    _session.endWrite();
+            }
+            Writing(const Writing &other) = delete;
+            Writing &operator=(const Writing &other) = delete;
+            explicit operator bool() const { return _ok; }
+
+        private:
+            UploadSession &_session;
+            bool _ok;
+        };
+
+    public:
+        UploadSession(const std::string &id, const std::string &filename, size_t size);
+        ~UploadSession();
+        bool open();                                                    // 打开(不存在则创建)数据文件
+        bool write(const char *data, size_t len, size_t offset);        // 写入一段数据（未落盘）
+        bool received(size_t offset, size_t len);                       // 数据落盘后记录已接收区间
+        bool complete();                                                // 是否已全部接收
+        Ranges ranges();                                                // 已接收区间
+        bool persist();                                                 // 持久化会话状态
+        static Ptr load(const std::string &meta_path);                  // 从持久化文件恢复会话
+        void remove();                                                  // 删除会话文件
+        bool beginWrite();                                              // 登记一次分块写入，会话已关闭返回false
+        void endWrite();
+        bool close(bool wait);                                          // 关闭会话；wait为false时有在途写入则失败
+        void reopen();                                                  // 提交失败，重新接受写入
+
+        std::string id() const { return _id; }
+        std::string filename() const { return _filename; }
+        size_t size() const { return _size; }
+        std::string dataPath() const { return _data_path; }
+        time_t lastActive();
+
+    private:
+        std::string _id;
+        std::string _filename;  // 目标文件名
+        size_t _size;           // 目标文件大小
+        std::string _data_path; // 稀疏数据文件
+        std::string _meta_path; // 会话状态文件
+        Ranges _ranges;         // 已落盘的区间
+        time_t _last_active;    // 最近一次活动时间
+        int _fd = -1;           // 数据文件，各分块并发pwrite
+        size_t _writers = 0;    // 在途的分块写入
+        bool _closed = false;   // 已开始提交/放弃，不再接受写入
+        std::mutex _mutex;      // 保护_ranges、状态文件与写入登记
+        std::condition_variable _idle;
+    };
+
+    class UploadSessionManager
+    {
+    public:
+        static UploadSessionManager &getInstance();
+        UploadSession::Ptr create(const std::string &filename, size_t size); // 新建会话
+        UploadSession::Ptr get(const std::string &id);                      // 查找会话
+        void finish(const std::string &id);                                 // 提交成功，会话结束
+        int abort(const std::string &id);                                   // 放弃会话：0成功，-1不存在，-2正在提交
+
+    private:
+        UploadSessionManager();
+        UploadSessionManager(const UploadSessionManager &other) = delete;
+        UploadSessionManager &operator=(const UploadSessionManager &other) = delete;
+
+        void expire();                  // 清理过期会话（调用时需持有_mutex）
+        static std::string generateId();
+
+    private:
+        std::unordered_map<std::string, UploadSession::Ptr> _sessions;
+        std::mutex _mutex;
+    };
+}
+
+Cloud::UploadSession::UploadSession(const std::string &id, const std::string &filename, size_t size)
+    : _id(id), _filename(filename), _size(size), _last_active(time(nullptr))
+{
+    std::string dir = Config::getInstance()->getSessionDir();
+    _data_path = dir + id + ".data";
+    _meta_path = dir + id + ".json";
+}
+
+Cloud::UploadSession::~UploadSession()
+{
+    if (_fd >= 0)
+        ::close(_fd);
+}
+
+bool Cloud::UploadSession::open()
+{
+    bool exists = Util::FileUtil(_data_path).isExists();
+    _fd = ::open(_data_path.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (_fd < 0)
+    {
+        _logger->_warn("分块上传会话 %s 打开数据文件失败", _id.c_str());
+        return false;
+    }
+    return exists || ::ftruncate(_fd, _size) == 0;
+}
+
+bool Cloud::UploadSession::write(const char *data, size_t len, size_t offset)
+{
+    if (offset > _size || len > _size - offset) // 不写成 offset + len > _size，避免溢出
+        return false;
+    return Util::IOEngine::getInstance().writeFull(_fd, data, len, offset);
+}
+
+bool Cloud::UploadSession::received(size_t offset, size_t len)
+{
+    // 先让数据落盘，再记录区间，保证记录的区间一定是完整的
+    if (::fdatasync(_fd) != 0)
+        return false;
+
+    std::unique_lock<std::mutex> lck(_mutex);
+    size_t start = offset, end = offset + len;
+
+    // 与相邻或重叠的区间合并
+    auto it = _ranges.upper_bound(start);
+    if (it != _ranges.begin())
+    {
+        auto prev = std::prev(it);
+        if (prev->second >= start)
+        {
+            start = prev->first;
+            end = std::max(end, prev->second);
+            it = _ranges.erase(prev);
+        }
+    }
+    while (it != _ranges.end() && it->first <= end)
+    {
+        end = std::max(end, it->second);
+        it = _ranges.erase(it);
+    }
+    _ranges[start] = end;
+    _last_active = time(nullptr);
+    return persist();
+}
+
+time_t Cloud::UploadSession::lastActive()
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    return _last_active;
+}
+
+bool Cloud::UploadSession::complete()
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    if (_size == 0)
+        return true;
+    return _ranges.size() == 1 && _ranges.begin()->first == 0 && _ranges.begin()->second == _size;
+}
+
+Cloud::UploadSession::Ranges Cloud::UploadSession::ranges()
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    return _ranges;
+}
+
+bool Cloud::UploadSession::persist()
+{
+    Json::Value root;
+    root["id"] = _id;
+    root["filename"] = _filename;
+    root["size"] = (Json::UInt64)_size;
+    root["last_active"] = (Json::Int64)_last_active;
+    for (auto &[start, end] : _ranges)
+    {
+        Json::Value range;
+        range.append((Json::UInt64)start);
+        range.append((Json::UInt64)end);
+        root["received"].append(range);
+    }
+
+    std::string str;
+    if (!Util::JsonUtil::serialize(root, &str))
+        return false;
+    return Util::FileUtil(_meta_path).setContentAtomic(str);
+}
+
+Cloud::UploadSession::Ptr Cloud::UploadSession::load(const std::string &meta_path)
+{
+    std::string content;
+    Json::Value root;
+    if (!Util::FileUtil(meta_path).getContent(content) || !Util::JsonUtil::unserialize(content, &root))
+        return nullptr;
+
+    auto session = std::make_shared<UploadSession>(root["id"].asString(), root["filename"].asString(),
+                                                   root["size"].asUInt64());
+    session->_last_active = (time_t)root["last_active"].asInt64();
+    for (auto &range : root["received"])
+        session->_ranges[range[0].asUInt64()] = range[1].asUInt64();
+    if (!session->open())
+        return nullptr;
+    return session;
+}
+
+void Cloud::UploadSession::remove()
+{
+    // 描述符留到析构时关闭，仍持有会话的请求只会写到已删除的文件
+    Util::FileUtil(_data_path).remove();
+    Util::FileUtil(_meta_path).remove();
+}
+
+bool Cloud::UploadSession::beginWrite()
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    if (_closed)
+        return false;
+    _writers++;
+    _last_active = time(nullptr);
+    return true;
+}
+
+void Cloud::UploadSession::endWrite()
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    if (--_writers == 0)
+        _idle.notify_all();
+}
+
+bool Cloud::UploadSession::close(bool wait)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    if (_closed || (!wait && _writers > 0))
+        return false;
+    _closed = true; // 先拒绝新的写入，再等在途写入结束
+    _idle.wait(lck, [this]
+               { return _writers == 0; });
+    return true;
+}
+
+void Cloud::UploadSession::reopen()
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    _closed = false;
+}
+
+Cloud::UploadSessionManager &Cloud::UploadSessionManager::getInstance()
+{
+    static UploadSessionManager inst;
+    return inst;
+}
+
+Cloud::UploadSessionManager::UploadSessionManager()
+{
+    // 恢复服务端重启前未完成的会话
+    Util::FileUtil dir(Config::getInstance()->getSessionDir());
+    dir.createDirectory();
+
+    std::vector<std::string> files;
+    dir.scanDirectory(files);
+    for (auto &file : files)
+    {
+        if (Util::fs::path(file).extension() != ".json")
+            continue;
+        auto session = UploadSession::load(file);
+        if (session)
+            _sessions[session->id()] = session;
+    }
+    _logger->_debug("分块上传模块-恢复会话 %d 个", _sessions.size());
+}
+
+std::string Cloud::UploadSessionManager::generateId()
+{
+    static std::random_device rd;
+    static std::mt19937_64 rng(rd());
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)rng());
+    return buf;
+}
+
+void Cloud::UploadSessionManager::expire()
+{
+    time_t now = time(nullptr);
+    time_t ttl = Config::getInstance()->getSessionTTL();
+    for (auto it = _sessions.begin(); it != _sessions.end();)
+    {
+        // 有分块正在写入的会话不算过期
+        if (now - it->second->lastActive() > ttl && it->second->close(false))
+        {
+            _logger->_debug("分块上传会话 %s 已过期", it->first.c_str());
+            it->second->remove();
+            it = _sessions.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+Cloud::UploadSession::Ptr Cloud::UploadSessionManager::create(const std::string &filename, size_t size)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    expire();
+
+    std::string id = generateId();
+    auto session = std::make_shared<UploadSession>(id, filename, size);
+    if (!session->open() || !session->persist())
+    {
+        session->remove();
+        return nullptr;
+    }
+    _sessions[id] = session;
+    return session;
+}
+
+Cloud::UploadSession::Ptr Cloud::UploadSessionManager::get(const std::string &id)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    auto it = _sessions.find(id);
+    if (it == _sessions.end())
+        return nullptr;
+    return it->second;
+}
+
+void Cloud::UploadSessionManager::finish(const std::string &id)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    auto it = _sessions.find(id);
+    if (it == _sessions.end())
+        return;
+    it->second->remove();
+    _sessions.erase(it);
+}
+
+int Cloud::UploadSessionManager::abort(const std::string &id)
+{
+    auto session = get(id);
+    if (!session)
+        return -1;
+    // 等在途写入结束时不持有管理器的锁；已被提交关闭的会话不能放弃
+    if (!session->close(true))
+        return -2;
+    std::unique_lock<std::mutex> lck(_mutex);
+    auto it = _sessions.find(id);
+    if (it != _sessions.end() && it->second == session)
+        _sessions.erase(it);
+    session->remove();
+    return 0;
+}
@@ -0,0 +1,302 @@
+#pragma once
+#include <iostream>
+#include <memory>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <unordered_map>
+#include <chrono>
+#include "util.hpp"
+#include "config.hpp"
+#include "eventserver.hpp"
+#include "log/ckflog.hpp"
+
+extern ckflogs::Logger::Ptr _logger;
+
+namespace Cloud
+{
+    // 带宽整形：传输每发送(或接收)一段数据前调用 Flow::acquire 获取许可
+    //   1.客户端令牌桶：同一客户端(IP)无论开多少个连接，同一方向合计不超过 shape_client_rate
+    //   2.方向调度器：下载/上传各自的总速率(shape_download_rate / shape_upload_rate)按差额轮询(DRR)分给活动的传输，
+    //     每轮每个传输获得 shape_quantum 字节配额，配额够发当前数据段即放行；数据段小的传输(小文件、交互请求)第一轮就能放行，
+    //     大传输之间平分带宽，只有一个传输时它独占全部带宽
+    //   3.路由令牌桶：请求路径以 shape_route_rates 中的前缀开头时，该前缀下同一方向的所有传输合计不超过其速率
+    // 速率为0的部分不生效。事件循环线程中不阻塞：未获许可时返回false，由调用方稍后重试
+    class TrafficShaper
+    {
+    public:
+        enum Direction
+        {
+            DOWNLOAD = 0,
+            UPLOAD = 1
+        };
+
+        class Flow
+        {
+        public:
+            ~Flow();
+            bool acquire(size_t n); // 获取传输n字节的许可
+
+        private:
+            friend class TrafficShaper;
+            Direction _dir;
+            std::shared_ptr<Util::TokenBucket> _client; // 为空表示不限客户端速率
+            bool _client_paid = false;                  // 非阻塞重试时，客户端令牌已扣除
+            std::shared_ptr<Util::TokenBucket> _route;  // 为空表示不限路由速率
+            bool _route_paid = false;
+            size_t _pending = 0;                        // 等待调度的数据段长度
+            size_t _deficit = 0;                        // DRR差额计数
+            bool _queued = false;
+            bool _granted = false;
+        };
+        using FlowPtr = std::shared_ptr<Flow>;
+
+        static TrafficShaper &getInstance();
+        FlowPtr open(const std::string &client, const std::string &path, Direction dir); // 开始一个传输，传输结束时释放
+        bool active() const;                                                             // 是否配置了任何限速
+        size_t chunkSize(size_t want) const;                                             // 限速时单个数据段的长度，保证调度粒度
+        void toJson(Json::Value *val);
+
+    private:
+        TrafficShaper();
+        TrafficShaper(const TrafficShaper &other) = delete;
+        TrafficShaper &operator=(const TrafficShaper &other) = delete;
+
+        struct Scheduler
+        {
+            double rate = 0;   // 字节/秒，0表示不调度
+            double tokens = 0; // 可为负(透支)，保证超过桶容量的数据段也能放行
+            std::chrono::steady_clock::time_point last;
+            std::deque<Flow *> ring; // 等待放行的传输，按轮询顺序
+            std::mutex mutex;
+            std::condition_variable cond;
+            std::unordered_map<std::string, std::weak_ptr<Util::TokenBucket>> clients; // 客户端令牌桶
+            std::unordered_map<std::string, std::shared_ptr<Util::TokenBucket>> routes; // 路由令牌桶，按前缀
+            size_t flows = 0;
+            uint64_t bytes = 0;
+            uint64_t throttled = 0; // 未能立即放行的次数
+        };
+
+        bool schedule(Scheduler &s); // 按DRR放行等待中的传输(已加锁)，返回是否有放行
+        void leave(Flow *flow);
+        static bool pay(const std::shared_ptr<Util::TokenBucket> &bucket, bool *paid, size_t n, bool nonblocking);
+
+    private:
+        double _client_rate;
+        size_t _quantum;
+        std::map<std::string, size_t> _route_rates;
+        Scheduler _sched[2];
+    };
+}
+
+Cloud::TrafficShaper &Cloud::TrafficShaper::getInstance()
+{
+    static TrafficShaper inst;
+    return inst;
+}
+
+Cloud::TrafficShaper::TrafficShaper()
+{
+    Config *conf = Config::getInstance();
+    _client_rate = conf->getShapeClientRate();
+    _quantum = conf->getShapeQuantum();
+    _route_rates = conf->getShapeRouteRates();
+    _sched[DOWNLOAD].rate = conf->getShapeDownloadRate();
+    _sched[UPLOAD].rate = conf->getShapeUploadRate();
+    for (auto &s : _sched)
+        s.last = std::chrono::steady_clock::now();
+}
+
+bool Cloud::TrafficShaper::active() const
+{
+    return _client_rate > 0 || _sched[DOWNLOAD].rate > 0 || _sched[UPLOAD].rate > 0 || !_route_rates.empty();
+}
+
+size_t Cloud::TrafficShaper::chunkSize(size_t want) const
+{
+    if (!active())
+        return want;
+    return std::min(want, _quantum * 4);
+}
+
+Cloud::TrafficShaper::FlowPtr Cloud::TrafficShaper::open(const std::string &client, const std::string &path, Direction dir)
+{
+    auto flow = std::make_shared<Flow>();
+    flow->_dir = dir;
+    Scheduler &s = _sched[dir];
+    std::unique_lock<std::mutex> lck(s.mutex);
+    s.flows++;
+    if (_client_rate > 0)
+    {
+        auto &weak = s.clients[client];
+        flow->_client = weak.lock();
+        if (!flow->_client)
+        {
+            // 桶容量至少容纳一个数据段，非阻塞的 tryAcquire 才可能成功
+            flow->_client = std::make_shared<Util::TokenBucket>(_client_rate, std::max<double>(_client_rate, _quantum * 4));
+            weak = flow->_client;
+        }
+        // 清理已没有传输的客户端
+        if (s.clients.size() > 1024)
+        {
+            for (auto it = s.clients.begin(); it != s.clients.end();)
+                it = it->second.expired() ? s.clients.erase(it) : std::next(it);
+        }
+    }
+
+    // 最长的匹配前缀生效
+    const std::string *prefix = nullptr;
+    for (auto &[p, rate] : _route_rates)
+    {
+        if (path.compare(0, p.size(), p) == 0 && (!prefix || p.size() > prefix->size()))
+            prefix = &p;
+    }
+    if (prefix)
+    {
+        auto &bucket = s.routes[*prefix];
+        if (!bucket)
+        {
+            double rate = _route_rates[*prefix];
+            bucket = std::make_shared<Util::TokenBucket>(rate, std::max<double>(rate, _quantum * 4));
+        }
+        flow->_route = bucket;
+    }
+    return flow;
+}
+
+bool Cloud::TrafficShaper::Flow::acquire(size_t n)
+{
+    TrafficShaper &shaper = TrafficShaper::getInstance();
+    bool nonblocking = EventServer::inLoop();
+
+    // 1.路由与客户端令牌桶
+    if (!pay(_route, &_route_paid, n, nonblocking) || !pay(_client, &_client_paid, n, nonblocking))
+    {
+        std::unique_lock<std::mutex> lck(shaper._sched[_dir].mutex);
+        shaper._sched[_dir].throttled++;
+        return false;
+    }
+
+    // 2.方向调度器
+    Scheduler &s = shaper._sched[_dir];
+    std::unique_lock<std::mutex> lck(s.mutex);
+    if (s.rate > 0)
+    {
+        if (!_queued && !_granted)
+        {
+            _pending = n;
+            _queued = true;
+            s.ring.push_back(this);
+        }
+        shaper.schedule(s);
+        if (!_granted)
+        {
+            s.throttled++;
+            if (nonblocking)
+                return false;
+            while (!_granted)
+            {
+                // 令牌透支时等到还清，否则等其他传输放行后再轮到自己
+                double wait = s.tokens < 0 ? -s.tokens / s.rate : 0.001;
+                s.cond.wait_for(lck, std::chrono::duration<double>(std::min(wait, 0.1)));
+                shaper.schedule(s);
+            }
+        }
+        _granted = false;
+    }
+    _client_paid = _route_paid = false;
+    s.bytes += n;
+    return true;
+}
+
+bool Cloud::TrafficShaper::pay(const std::shared_ptr<Util::TokenBucket> &bucket, bool *paid, size_t n, bool nonblocking)
+{
+    if (!bucket || *paid)
+        return true;
+    if (nonblocking && !bucket->tryAcquire(n))
+        return false;
+    if (!nonblocking)
+        bucket->acquire(n);
+    *paid = true;
+    return true;
+}
+
+bool Cloud::TrafficShaper::schedule(Scheduler &s)
+{
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - s.last).count();
+    s.last = now;
+    // 空闲时最多积攒一个数据段的令牌，避免突发
+    s.tokens = std::min<double>(_quantum * 4, s.tokens + elapsed * s.rate);
+
+    bool any = false;
+    while (!s.ring.empty() && s.tokens > 0)
+    {
+        Flow *flow = s.ring.front();
+        if (flow->_deficit < flow->_pending)
+        {
+            // 新的一轮：增加配额，仍不够发送当前数据段则排到队尾
+            flow->_deficit += _quantum;
+            if (flow->_deficit < flow->_pending)
+            {
+                s.ring.pop_front();
+                s.ring.push_back(flow);
+                continue;
+            }
+        }
+        s.ring.pop_front();
+        s.tokens -= flow->_pending;
+        flow->_deficit -= flow->_pending;
+        flow->_queued = false;
+        flow->_granted = true;
+        any = true;
+    }
+    if (any)
+        s.cond.notify_all();
+    return any;
+}
+
+void Cloud::TrafficShaper::leave(Flow *flow)
+{
+    Scheduler &s = _sched[flow->_dir];
+    std::unique_lock<std::mutex> lck(s.mutex);
+    s.flows--;
+    if (flow->_queued)
+    {
+        for (auto it = s.ring.begin(); it != s.ring.end(); ++it)
+        {
+            if (*it == flow)
+            {
+                s.ring.erase(it);
+                break;
+            }
+        }
+    }
+}
+
+Cloud::TrafficShaper::Flow::~Flow()
+{
+    TrafficShaper::getInstance().leave(this);
+}
+
+void Cloud::TrafficShaper::toJson(Json::Value *val)
+{
+    const char *names[] = {"download", "upload"};
+    (*val)["client_rate"] = _client_rate;
+    (*val)["quantum"] = (Json::UInt64)_quantum;
+    for (auto &[prefix, rate] : _route_rates)
+        (*val)["routes"][prefix] = (Json::UInt64)rate;
+    for (int i = 0; i < 2; i++)
+    {
+        Scheduler &s = _sched[i];
+        std::unique_lock<std::mutex> lck(s.mutex);
+        Json::Value &v = (*val)[names[i]];
+        v["rate"] = s.rate;
+        v["flows"] = (Json::UInt64)s.flows;
+        v["waiting"] = (Json::UInt64)s.ring.size();
+        v["clients"] = (Json::UInt64)s.clients.size();
+        v["bytes"] = (Json::UInt64)s.bytes;
+        v["throttled"] = (Json::UInt64)s.throttled;
+    }
+}
@@ -4,14 +4,28 @@
 #include <memory>
 #include <sstream>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <charconv>
+#include <thread>
+#include <atomic>
 #include <experimental/filesystem>
 #include <pthread.h>
 
+#include <openssl/evp.h>
+
 #include "jsoncpp/json/json.h"
 #include "bundle.h"
+#include "ioengine.hpp"
 #include "log/ckflog.hpp"
 
+#define TMP_PREFIX ".~tmp." // 临时文件名前缀，写完并落盘后再rename为正式文件；用户上传的文件名不允许使用该前缀
+
 namespace Util
 {
     namespace fs = std::experimental::filesystem;
@@ -29,19 +43,150 @@ namespace Util
         bool getContent(std::string &content);                        // 获取文件内容
         bool getPosLen(std::string &content, size_t pos, size_t len); // 获取文件的部分内容
         bool setContent(const std::string &content);                  // 设置文件内容
+        bool setContentAtomic(const std::string &content);            // 原子地设置文件内容(临时文件+fsync+rename)
 
-        bool compress(const std::string &packname);   // 压缩
+        bool compress(const std::string &packname, unsigned codec = bundle::LZIP); // 压缩(brotli为单一数据流，其他算法为分块压缩包)
         bool uncompress(const std::string &filename); // 解压
+        bool packInfo(unsigned *codec, size_t *offset, size_t *zlen, size_t *len = nullptr); // 读取单一数据流压缩包的包头：压缩算法、压缩数据的偏移与长度、原始长度(分块压缩包返回false)
 
         bool isExists();                                     // 判断文件是否存在
         bool createDirectory();                              // 创建目录
         bool scanDirectory(std::vector<std::string> &array); // 扫描目录中所有文件名称
         bool remove();
+        bool rename(const std::string &newPath);             // 原子重命名，并将目录项落盘
+        bool isTempFile();                                   // 是否为未完成的临时文件
+        static bool isReservedName(const std::string &name); // 文件名是否属于临时文件的保留名称
+        static std::string tempPath(const std::string &path); // path同目录下唯一的临时文件路径
+        bool isRegularFile();                                // 是否为普通文件
+        bool link(const std::string &newPath);               // 原子地创建指向同一份数据的硬链接
+        bool digest(std::string *hex);                       // 分块读取文件，计算内容的SHA-256
 
     private:
         std::string _path;       // 文件路径
         struct stat *_stat;      // 文件属性
         void upDateFileStatus(); // 更新文件属性
+        static bool syncDirectory(const std::string &path); // 将path所在目录的目录项落盘
+    };
+
+    // 流式文件写入：数据分块写入磁盘，内存占用与文件大小无关
+    // 顺序写经过两块缓冲区：一块写满后异步提交给I/O引擎，调用方继续填另一块，接收数据与写盘重叠进行
+    class FileWriter
+    {
+    public:
+        FileWriter();
+        ~FileWriter();
+        FileWriter(const FileWriter &other) = delete;
+        FileWriter &operator=(const FileWriter &other) = delete;
+        bool open(const std::string &path, bool truncate = true); // 打开(不存在则创建)文件
+        bool write(const char *data, size_t len);                 // 追加写
+        bool pwrite(const char *data, size_t len, off_t offset);  // 在指定偏移处写
+        bool flush();                                             // 等待缓冲的数据全部写入
+        bool sync();                                              // 数据落盘
+        bool truncate(size_t size);                               // 设置文件大小(扩大时为稀疏文件)
+        void close();
+        size_t written() const; // 已写入的字节数
+
+    private:
+        bool submitBuffer(); // 提交当前缓冲区，切换到另一块
+        bool waitPending();  // 等待在途的写请求
+
+    private:
+        static const size_t buffer_size = 512 * 1024;
+        int _fd;
+        std::string _path;
+        size_t _written;
+        off_t _offset;              // 顺序写的下一个偏移
+        std::vector<char> _bufs[2]; // 第一次顺序写时分配
+        int _cur;
+        size_t _fill;
+        IOEngine::Op _op; // 在途的写请求
+        bool _pending;
+    };
+
+    // 落盘队列：写完的文件交给专属线程依次fsync并关闭，调用方继续写下一个文件
+    // 每个队列一个线程，不占用压缩/预取共用的线程池，落盘不会排在长任务之后
+    class SyncQueue
+    {
+    public:
+        SyncQueue();
+        ~SyncQueue();
+        SyncQueue(const SyncQueue &other) = delete;
+        SyncQueue &operator=(const SyncQueue &other) = delete;
+        void push(const std::shared_ptr<FileWriter> &writer);
+        bool wait(); // 等待已提交的文件全部落盘，返回是否都成功
+
+    private:
+        void threadLoop();
+
+    private:
+        std::deque<std::shared_ptr<FileWriter>> _queue;
+        size_t _busy = 0; // 已取出、正在落盘的个数
+        bool _ok = true;
+        bool _stop = false;
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        std::thread _thread;
+    };
+
+    // 按偏移读取文件：打开后即使文件被rename覆盖或删除，描述符仍指向打开时的版本
+    class FileReader
+    {
+    public:
+        FileReader();
+        ~FileReader();
+        FileReader(const FileReader &other) = delete;
+        FileReader &operator=(const FileReader &other) = delete;
+        bool open(const std::string &path);
+        bool pread(size_t offset, size_t len, std::string *out); // 读取[offset, offset+len)，越界部分截断
+        void close();
+        int fd() const { return _fd; }
+        size_t size() const { return _size; }
+
+    private:
+        int _fd;
+        std::string _path;
+        size_t _size;
+    };
+
+    // 分块压缩包：除brotli外的压缩算法都不能流式解压，压缩包按 block_size 分块独立压缩(每块一个bundle数据包)，
+    // 解压、归档时逐块进行，内存占用与文件大小无关
+    // 格式：magic(8) 原始长度(8) 压缩算法(4)，之后每块：压缩后长度(4) bundle数据包；整数均为小端
+    class PackReader
+    {
+    public:
+        static constexpr size_t block_size = 4 << 20;
+        static constexpr char magic[] = "CKFPACK1";
+        static constexpr size_t header_size = 20;
+
+        bool open(const std::shared_ptr<FileReader> &file); // 读取包头，不是分块压缩包返回false
+        bool next(std::string *out);                         // 解压下一块，已读完时out为空
+        size_t size() const { return _size; }                // 原始长度
+        unsigned codec() const { return _codec; }
+
+        static void putInt(uint64_t val, size_t bytes, std::string *out);
+        static uint64_t getInt(const char *data, size_t bytes);
+
+    private:
+        std::shared_ptr<FileReader> _file;
+        size_t _pos = 0;  // 下一块在压缩包中的偏移
+        size_t _size = 0;
+        size_t _done = 0; // 已解压的原始长度
+        unsigned _codec = 0;
+    };
+
+    // SHA-256 流式计算：数据分块到达时逐块累加
+    class Hasher
+    {
+    public:
+        Hasher();
+        ~Hasher();
+        Hasher(const Hasher &other) = delete;
+        Hasher &operator=(const Hasher &other) = delete;
+        void update(const char *data, size_t len);
+        std::string hexdigest(); // 结束计算，返回十六进制摘要
+
+    private:
+        EVP_MD_CTX *_ctx;
     };
 
     // Json工具类
@@ -52,6 +197,38 @@ namespace Util
         static bool unserialize(const std::string &str, Json::Value *root);
     };
 
+    // 流式JSON写入：直接把JSON文本追加到缓冲区，不构造 Json::Value 树
+    // 调用方定期取走缓冲区内容(如写入分块响应)，内存占用与数据总量无关
+    class JsonWriter
+    {
+    public:
+        void beginArray() { open('['); }
+        void endArray() { close(']'); }
+        void beginObject() { open('{'); }
+        void endObject() { close('}'); }
+        void key(const std::string &k);
+        void value(const std::string &v);
+        void value(const char *v) { value(std::string(v)); }
+        void value(uint64_t v);
+        void value(int64_t v);
+        void value(bool v);
+
+        std::string &buffer() { return _buf; }
+        size_t size() const { return _buf.size(); }
+        void clear() { _buf.clear(); } // 只清空内容，保留层级状态
+
+    private:
+        void open(char c);
+        void close(char c);
+        void separate(); // 同一层级的元素之间加逗号
+        void escape(const std::string &str);
+
+    private:
+        std::string _buf;
+        std::vector<bool> _first; // 每一层级是否还没有元素
+        bool _after_key = false;
+    };
+
     class RDLockGuard
     {
     public:
@@ -62,7 +239,7 @@ namespace Util
         }
         ~RDLockGuard()
         {
-            pthread_rwlock_destroy(_rdlock);
+            pthread_rwlock_unlock(_rdlock);
         }
 
     private:
@@ -75,17 +252,39 @@ namespace Util
         WRLockGuard(pthread_rwlock_t *wrlock)
             : _wrlock(wrlock)
         {
-            pthread_rwlock_rdlock(_wrlock);
+            pthread_rwlock_wrlock(_wrlock);
         }
         ~WRLockGuard()
         {
-            pthread_rwlock_destroy(_wrlock);
+            pthread_rwlock_unlock(_wrlock);
         }
 
     private:
         pthread_rwlock_t *_wrlock;
     };
 
+    // 令牌桶：按rate(字节/秒)匀速产生令牌，最多积攒burst个
+    // acquire允许透支：一次取走超过桶内剩余的令牌时，调用者睡眠到令牌还清为止；
+    // tryAcquire只在桶满时允许一次取走超过桶容量的令牌
+    class TokenBucket
+    {
+    public:
+        TokenBucket(double rate, double burst);
+        void acquire(size_t n);    // 获取n个令牌（阻塞）
+        bool tryAcquire(size_t n); // 尝试获取n个令牌（非阻塞）
+        void setRate(double rate); // rate为0表示不限速
+
+    private:
+        void refill();
+
+    private:
+        double _rate;   // 令牌产生速率
+        double _burst;  // 桶容量
+        double _tokens; // 当前令牌数（可为负，表示透支）
+        std::chrono::steady_clock::time_point _last;
+        std::mutex _mutex;
+    };
+
     bool checkUser(const std::string& username, const std::string& password) {
         return true;
     }
@@ -144,91 +343,149 @@ bool Util::FileUtil::getContent(std::string &content)
 
 bool Util::FileUtil::getPosLen(std::string &content, size_t pos, size_t len)
 {
-    std::ifstream ifs(_path, std::ios::binary);
-    if (!ifs.is_open())
-    {
-        DF_WARN("%s: File open fail", _path.c_str());
+    FileReader reader;
+    if (!reader.open(_path))
         return false;
-    }
 
-    size_t fileSz = this->fileSize();
-    if (pos + len > fileSz)
+    if (pos + len > reader.size())
     {
         DF_WARN("%s: The read length is too long", _path.c_str());
-        ifs.close();
         return false;
     }
-
-    content.resize(len);
-    ifs.seekg(pos, ifs.beg);
-    ifs.read(&content[0], len);
-    if (!ifs.good())
+    if (!reader.pread(pos, len, &content) || content.size() != len)
     {
         DF_WARN("%s: Read file failed", _path.c_str());
-        ifs.close();
         return false;
     }
-
-    ifs.close();
     return true;
 }
 
 bool Util::FileUtil::setContent(const std::string &content)
 {
     // content -> 文件
-    std::ofstream ofs;
-    ofs.open(_path, std::ios::binary);
-    if (!ofs.is_open())
+    int fd = ::open(_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
     {
         DF_WARN("%s: File open fail", _path.c_str());
         return false;
     }
-
-    ofs.write(content.c_str(), content.size());
-    if (!ofs.good())
-    {
+    bool ok = IOEngine::getInstance().writeFull(fd, content.data(), content.size(), 0);
+    if (!ok)
         DF_WARN("%s: Write file failed", _path.c_str());
-        ofs.close();
-        return false;
-    }
-    ofs.close();
-    return true;
+    ::close(fd);
+    return ok;
 }
 
-bool Util::FileUtil::compress(const std::string &packname)
+bool Util::FileUtil::setContentAtomic(const std::string &content)
 {
-    // 压缩当前文件的内容
-    std::string cont;
-    if (!getContent(cont))
+    // 1.写入临时文件
+    std::string tmp = tempPath(_path);
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
     {
-        DF_WARN("%s: Get file content failed", _path.c_str());
+        DF_WARN("%s: File open fail", tmp.c_str());
         return false;
     }
-    std::string packed = bundle::pack(bundle::LZIP, cont);
 
-    // 打开压缩包文件
-    std::ofstream ofs(packname, std::ios::binary);
-    if (!ofs.is_open())
+    if (!IOEngine::getInstance().writeFull(fd, content.data(), content.size(), 0))
     {
-        DF_WARN("%s: File open fail", _path.c_str());
+        DF_WARN("%s: Write file failed", tmp.c_str());
+        ::close(fd);
+        ::unlink(tmp.c_str());
         return false;
     }
 
-    // 写入压缩包文件
-    ofs.write(packed.c_str(), packed.size());
-    if (!ofs.good())
+    // 2.数据落盘后再rename，保证_path要么是旧内容，要么是完整的新内容
+    if (::fsync(fd) < 0)
     {
-        DF_WARN("%s: Write file failed", _path.c_str());
-        ofs.close();
+        DF_WARN("%s: fsync failed", tmp.c_str());
+        ::close(fd);
+        ::unlink(tmp.c_str());
         return false;
     }
-    ofs.close();
+    ::close(fd);
+
+    return FileUtil(tmp).rename(_path);
+}
+
+bool Util::FileUtil::compress(const std::string &packname, unsigned codec)
+{
+    // brotli压缩包保持单一数据流：可以流式解压，也可以按 Content-Encoding 直接发送
+    if (codec == bundle::BROTLI9 || codec == bundle::BROTLI11)
+    {
+        std::string cont;
+        if (!getContent(cont))
+        {
+            DF_WARN("%s: Get file content failed", _path.c_str());
+            return false;
+        }
+        std::string packed = bundle::pack(codec, cont);
+
+        // 写入压缩包文件：先写临时文件再rename，崩溃时不会留下截断的压缩包
+        if (!FileUtil(packname).setContentAtomic(packed))
+        {
+            DF_WARN("%s: Write pack file failed", packname.c_str());
+            return false;
+        }
+        return true;
+    }
 
+    // 其他算法：逐块读取、压缩、写入临时文件，落盘后rename
+    FileReader in;
+    if (!in.open(_path))
+    {
+        DF_WARN("%s: Get file content failed", _path.c_str());
+        return false;
+    }
+    std::string tmp = tempPath(packname);
+    FileWriter out;
+    std::string header(PackReader::magic, 8), block;
+    PackReader::putInt(in.size(), 8, &header);
+    PackReader::putInt(codec, 4, &header);
+    bool ok = out.open(tmp) && out.write(header.data(), header.size());
+    for (size_t off = 0; ok && off < in.size(); off += PackReader::block_size)
+    {
+        ok = in.pread(off, PackReader::block_size, &block);
+        std::string packed = bundle::pack(codec, block), len;
+        PackReader::putInt(packed.size(), 4, &len);
+        ok = ok && out.write(len.data(), len.size()) && out.write(packed.data(), packed.size());
+    }
+    ok = ok && out.sync();
+    out.close();
+    if (!ok || !FileUtil(tmp).rename(packname))
+    {
+        DF_WARN("%s: Write pack file failed", packname.c_str());
+        ::unlink(tmp.c_str());
+        return false;
+    }
     return true;
 }
 
 bool Util::FileUtil::uncompress(const std::string &filename)
 {
+    auto file = std::make_shared<FileReader>();
+    PackReader pack;
+    if (file->open(_path) && pack.open(file))
+    {
+        // 分块压缩包：逐块解压写入临时文件，落盘后rename
+        std::string tmp = tempPath(filename);
+        FileWriter out;
+        std::string block;
+        bool ok = out.open(tmp);
+        while (ok && (ok = pack.next(&block)) && !block.empty())
+            ok = out.write(block.data(), block.size());
+        ok = ok && out.written() == pack.size() && out.sync();
+        out.close();
+        if (!ok || !FileUtil(tmp).rename(filename))
+        {
+            DF_WARN("%s: Write file failed", filename.c_str());
+            ::unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // 单一数据流的压缩包(brotli，以及分块格式之前写出的压缩包)
     std::string cont;
     if (!getContent(cont))
     {
@@ -237,22 +494,29 @@ bool Util::FileUtil::uncompress(const std::string &filename)
     }
     std::string unpacked = bundle::unpack(cont);
 
-    std::ofstream ofs(filename, std::ios::binary);
-    if (!ofs.is_open())
+    if (!FileUtil(filename).setContentAtomic(unpacked))
     {
-        DF_WARN("%s: File open fail", _path.c_str());
+        DF_WARN("%s: Write file failed", filename.c_str());
         return false;
     }
 
-    ofs.write(unpacked.c_str(), unpacked.size());
-    if (!ofs.good())
-    {
-        DF_WARN("%s: Write file failed", _path.c_str());
-        ofs.close();
-        return false;
-    }
-    ofs.close();
+    return true;
+}
 
+bool Util::FileUtil::packInfo(unsigned *codec, size_t *offset, size_t *zlen, size_t *len)
+{
+    // 只读取包头，不读取压缩数据
+    char header[bundle::MAX_HEADER_SIZE];
+    std::ifstream ifs(_path, std::ios::binary);
+    ifs.read(header, sizeof(header));
+    size_t n = ifs.gcount();
+    if (!bundle::is_packed(header, n))
+        return false;
+    *codec = bundle::type_of(header, n);
+    *offset = (const char *)bundle::zptr(header, n) - header;
+    *zlen = bundle::zlen(header, n);
+    if (len)
+        *len = bundle::len(header, n);
     return true;
 }
 
@@ -281,6 +545,433 @@ bool Util::FileUtil::remove()
     return fs::remove(_path);
 }
 
+bool Util::FileUtil::rename(const std::string &newPath)
+{
+    if (::rename(_path.c_str(), newPath.c_str()) < 0)
+    {
+        DF_WARN("%s -> %s: rename failed", _path.c_str(), newPath.c_str());
+        return false;
+    }
+    _path = newPath;
+    // rename本身是原子的，但目录项需要落盘才能在断电后保留
+    return syncDirectory(newPath);
+}
+
+bool Util::FileUtil::isTempFile()
+{
+    return isReservedName(fileName());
+}
+
+bool Util::FileUtil::isReservedName(const std::string &name)
+{
+    return name.compare(0, sizeof(TMP_PREFIX) - 1, TMP_PREFIX) == 0;
+}
+
+std::string Util::FileUtil::tempPath(const std::string &path)
+{
+    // 与目标同目录(同一文件系统，rename是原子的)；进程号加序号保证并发写同一目标时互不覆盖
+    static std::atomic<size_t> seq(0);
+    size_t x = path.find_last_of('/');
+    std::string dir = (x == std::string::npos) ? "" : path.substr(0, x + 1);
+    std::string name = (x == std::string::npos) ? path : path.substr(x + 1);
+    return dir + TMP_PREFIX + name + "." + std::to_string(getpid()) + "." + std::to_string(seq++);
+}
+
+bool Util::FileUtil::isRegularFile()
+{
+    return fs::is_regular_file(_path);
+}
+
+bool Util::FileUtil::link(const std::string &newPath)
+{
+    // 先链接到临时名称再rename覆盖，目标路径上不会出现中间状态
+    std::string tmp = tempPath(newPath);
+    if (::link(_path.c_str(), tmp.c_str()) < 0)
+    {
+        DF_WARN("%s -> %s: link failed", _path.c_str(), newPath.c_str());
+        return false;
+    }
+    if (!FileUtil(tmp).rename(newPath))
+    {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Util::FileUtil::digest(std::string *hex)
+{
+    FileReader reader;
+    if (!reader.open(_path))
+        return false;
+
+    // 双缓冲预读：计算当前块哈希的同时，下一块的读取已在途
+    IOEngine &engine = IOEngine::getInstance();
+    const size_t block = 1 << 20;
+    std::vector<char> bufs[2] = {std::vector<char>(block), std::vector<char>(block)};
+    IOEngine::Op ops[2];
+    auto issue = [&](int i, size_t offset)
+    {
+        ops[i] = IOEngine::Op();
+        ops[i].fd = reader.fd();
+        ops[i].buf = bufs[i].data();
+        ops[i].len = std::min(block, reader.size() - offset);
+        ops[i].offset = offset;
+        IOEngine::Op *op = &ops[i];
+        engine.submit(&op, 1);
+    };
+
+    Hasher hasher;
+    bool ok = true;
+    size_t offset = 0;
+    int cur = 0;
+    if (reader.size() > 0)
+        issue(cur, 0);
+    while (offset < reader.size())
+    {
+        size_t next = offset + ops[cur].len;
+        if (next < reader.size())
+            issue(cur ^ 1, next);
+        if (!engine.finish(&ops[cur]) || (size_t)ops[cur].result < ops[cur].len)
+            ok = false;
+        if (ok)
+            hasher.update(ops[cur].buf, ops[cur].len);
+        offset = next;
+        cur ^= 1;
+    }
+    if (!ok)
+    {
+        DF_WARN("%s: Read file failed", _path.c_str());
+        return false;
+    }
+    *hex = hasher.hexdigest();
+    return true;
+}
+
+bool Util::FileUtil::syncDirectory(const std::string &path)
+{
+    std::string dir = fs::path(path).parent_path().string();
+    if (dir.empty())
+        dir = ".";
+
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+    {
+        DF_WARN("%s: Directory open fail", dir.c_str());
+        return false;
+    }
+    bool ok = (::fsync(fd) == 0);
+    ::close(fd);
+    return ok;
+}
+
+
+Util::FileWriter::FileWriter()
+    : _fd(-1), _written(0), _offset(0), _cur(0), _fill(0), _pending(false)
+{
+}
+
+Util::FileWriter::~FileWriter()
+{
+    close();
+}
+
+bool Util::FileWriter::open(const std::string &path, bool truncate)
+{
+    close();
+    _path = path;
+    _written = 0;
+    _offset = 0;
+    _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+    if (_fd < 0)
+    {
+        DF_WARN("%s: File open fail", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Util::FileWriter::write(const char *data, size_t len)
+{
+    if (_bufs[0].empty())
+    {
+        _bufs[0].resize(buffer_size);
+        _bufs[1].resize(buffer_size);
+    }
+    while (len > 0)
+    {
+        size_t n = std::min(len, buffer_size - _fill);
+        memcpy(_bufs[_cur].data() + _fill, data, n);
+        _fill += n;
+        data += n;
+        len -= n;
+        _written += n;
+        if (_fill == buffer_size && !submitBuffer())
+            return false;
+    }
+    return true;
+}
+
+bool Util::FileWriter::submitBuffer()
+{
+    if (!waitPending())
+        return false;
+    _op = IOEngine::Op();
+    _op.fd = _fd;
+    _op.write = true;
+    _op.buf = _bufs[_cur].data();
+    _op.len = _fill;
+    _op.offset = _offset;
+    IOEngine::Op *op = &_op;
+    IOEngine::getInstance().submit(&op, 1);
+    _pending = true;
+    _offset += _fill;
+    _fill = 0;
+    _cur ^= 1;
+    return true;
+}
+
+bool Util::FileWriter::waitPending()
+{
+    if (!_pending)
+        return true;
+    _pending = false;
+    if (!IOEngine::getInstance().finish(&_op))
+    {
+        DF_WARN("%s: Write file failed", _path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Util::FileWriter::flush()
+{
+    if (_fill > 0 && !submitBuffer())
+        return false;
+    return waitPending();
+}
+
+bool Util::FileWriter::pwrite(const char *data, size_t len, off_t offset)
+{
+    if (!flush())
+        return false;
+    if (!IOEngine::getInstance().writeFull(_fd, data, len, offset))
+    {
+        DF_WARN("%s: Write file failed", _path.c_str());
+        return false;
+    }
+    _written += len;
+    return true;
+}
+
+bool Util::FileWriter::sync()
+{
+    return _fd >= 0 && flush() && ::fsync(_fd) == 0;
+}
+
+bool Util::FileWriter::truncate(size_t size)
+{
+    return _fd >= 0 && flush() && ::ftruncate(_fd, size) == 0;
+}
+
+void Util::FileWriter::close()
+{
+    if (_fd >= 0)
+    {
+        flush();
+        ::close(_fd);
+        _fd = -1;
+    }
+    _fill = 0;
+    _cur = 0;
+}
+
+size_t Util::FileWriter::written() const
+{
+    return _written;
+}
+
+Util::SyncQueue::SyncQueue()
+    : _thread(&SyncQueue::threadLoop, this)
+{
+}
+
+Util::SyncQueue::~SyncQueue()
+{
+    {
+        std::unique_lock<std::mutex> lck(_mutex);
+        _stop = true;
+    }
+    _cond.notify_all();
+    _thread.join();
+}
+
+void Util::SyncQueue::push(const std::shared_ptr<FileWriter> &writer)
+{
+    {
+        std::unique_lock<std::mutex> lck(_mutex);
+        _queue.push_back(writer);
+    }
+    _cond.notify_all();
+}
+
+bool Util::SyncQueue::wait()
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    _cond.wait(lck, [this]
+               { return _queue.empty() && _busy == 0; });
+    return _ok;
+}
+
+void Util::SyncQueue::threadLoop()
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    while (true)
+    {
+        // 退出前也要处理完队列中的文件，保证描述符都被关闭
+        _cond.wait(lck, [this]
+                   { return _stop || !_queue.empty(); });
+        if (_queue.empty())
+            break;
+        auto writer = _queue.front();
+        _queue.pop_front();
+        _busy++;
+        lck.unlock();
+        bool synced = writer->sync();
+        writer->close();
+        lck.lock();
+        _busy--;
+        _ok = _ok && synced;
+        _cond.notify_all();
+    }
+}
+
+Util::FileReader::FileReader()
+    : _fd(-1), _size(0)
+{
+}
+
+Util::FileReader::~FileReader()
+{
+    close();
+}
+
+bool Util::FileReader::open(const std::string &path)
+{
+    close();
+    _path = path;
+    _fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (_fd < 0 || fstat(_fd, &st) < 0)
+    {
+        DF_WARN("%s: File open fail", path.c_str());
+        close();
+        return false;
+    }
+    _size = st.st_size;
+    return true;
+}
+
+bool Util::FileReader::pread(size_t offset, size_t len, std::string *out)
+{
+    len = offset < _size ? std::min(len, _size - offset) : 0;
+    out->resize(len);
+    size_t got = 0;
+    if (!IOEngine::getInstance().readFull(_fd, &(*out)[0], len, offset, &got) || got < len)
+    {
+        DF_WARN("%s: Read file failed", _path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void Util::FileReader::close()
+{
+    if (_fd >= 0)
+    {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+bool Util::PackReader::open(const std::shared_ptr<FileReader> &file)
+{
+    std::string header;
+    if (!file->pread(0, header_size, &header) || header.size() != header_size || header.compare(0, 8, magic) != 0)
+        return false;
+    _file = file;
+    _size = getInt(header.data() + 8, 8);
+    _codec = getInt(header.data() + 16, 4);
+    _pos = header_size;
+    _done = 0;
+    return true;
+}
+
+bool Util::PackReader::next(std::string *out)
+{
+    out->clear();
+    if (_done == _size)
+        return true;
+    std::string len, packed;
+    if (!_file->pread(_pos, 4, &len) || len.size() != 4)
+        return false;
+    size_t zlen = getInt(len.data(), 4);
+    if (!_file->pread(_pos + 4, zlen, &packed) || packed.size() != zlen)
+        return false;
+    *out = bundle::unpack(packed);
+    // 每块解压后必须恰好是一块(最后一块为剩余部分)，否则压缩包已损坏
+    if (out->size() != std::min(block_size, _size - _done))
+        return false;
+    _pos += 4 + zlen;
+    _done += out->size();
+    return true;
+}
+
+void Util::PackReader::putInt(uint64_t val, size_t bytes, std::string *out)
+{
+    for (size_t i = 0; i < bytes; i++)
+        out->push_back((char)(val >> (8 * i)));
+}
+
+uint64_t Util::PackReader::getInt(const char *data, size_t bytes)
+{
+    uint64_t val = 0;
+    for (size_t i = 0; i < bytes; i++)
+        val |= (uint64_t)(unsigned char)data[i] << (8 * i);
+    return val;
+}
+
+Util::Hasher::Hasher()
+    : _ctx(EVP_MD_CTX_new())
+{
+    EVP_DigestInit_ex(_ctx, EVP_sha256(), nullptr);
+}
+
+Util::Hasher::~Hasher()
+{
+    EVP_MD_CTX_free(_ctx);
+}
+
+void Util::Hasher::update(const char *data, size_t len)
+{
+    EVP_DigestUpdate(_ctx, data, len);
+}
+
+std::string Util::Hasher::hexdigest()
+{
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    EVP_DigestFinal_ex(_ctx, md, &len);
+
+    static const char *digits = "0123456789abcdef";
+    std::string hex;
+    for (unsigned int i = 0; i < len; i++)
+    {
+        hex += digits[md[i] >> 4];
+        hex += digits[md[i] & 0xf];
+    }
+    return hex;
+}
 
 bool Util::JsonUtil::serialize(const Json::Value &root, std::string *str)
 {
@@ -297,6 +988,109 @@ bool Util::JsonUtil::serialize(const Json::Value &root, std::string *str)
     return true;
 }
 
+void Util::JsonWriter::separate()
+{
+    if (_after_key)
+    {
+        _after_key = false;
+        return;
+    }
+    if (!_first.empty())
+    {
+        if (!_first.back())
+            _buf += ',';
+        _first.back() = false;
+    }
+}
+
+void Util::JsonWriter::open(char c)
+{
+    separate();
+    _buf += c;
+    _first.push_back(true);
+}
+
+void Util::JsonWriter::close(char c)
+{
+    _buf += c;
+    _first.pop_back();
+}
+
+void Util::JsonWriter::key(const std::string &k)
+{
+    separate();
+    escape(k);
+    _buf += ':';
+    _after_key = true;
+}
+
+void Util::JsonWriter::value(const std::string &v)
+{
+    separate();
+    escape(v);
+}
+
+void Util::JsonWriter::value(uint64_t v)
+{
+    separate();
+    char tmp[24];
+    auto res = std::to_chars(tmp, tmp + sizeof(tmp), v);
+    _buf.append(tmp, res.ptr - tmp);
+}
+
+void Util::JsonWriter::value(int64_t v)
+{
+    separate();
+    char tmp[24];
+    auto res = std::to_chars(tmp, tmp + sizeof(tmp), v);
+    _buf.append(tmp, res.ptr - tmp);
+}
+
+void Util::JsonWriter::value(bool v)
+{
+    separate();
+    _buf += v ? "true" : "false";
+}
+
+void Util::JsonWriter::escape(const std::string &str)
+{
+    static const char hex[] = "0123456789abcdef";
+    _buf += '"';
+    for (unsigned char c : str)
+    {
+        switch (c)
+        {
+        case '"':
+            _buf += "\\\"";
+            break;
+        case '\\':
+            _buf += "\\\\";
+            break;
+        case '\n':
+            _buf += "\\n";
+            break;
+        case '\r':
+            _buf += "\\r";
+            break;
+        case '\t':
+            _buf += "\\t";
+            break;
+        default:
+            if (c < 0x20)
+            {
+                _buf += "\\u00";
+                _buf += hex[c >> 4];
+                _buf += hex[c & 0xf];
+            }
+            else
+            {
+                _buf += c; // UTF-8 原样输出
+            }
+        }
+    }
+    _buf += '"';
+}
+
 bool Util::JsonUtil::unserialize(const std::string &str, Json::Value *root)
 {
     Json::CharReaderBuilder crb;
@@ -309,4 +1103,53 @@ bool Util::JsonUtil::unserialize(const std::string &str, Json::Value *root)
         return false;
 
     return true;
+}
+
+Util::TokenBucket::TokenBucket(double rate, double burst)
+    : _rate(rate), _burst(burst), _tokens(burst), _last(std::chrono::steady_clock::now())
+{
+}
+
+void Util::TokenBucket::refill()
+{
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - _last).count();
+    _last = now;
+    _tokens = std::min(_burst, _tokens + elapsed * _rate);
+}
+
+void Util::TokenBucket::acquire(size_t n)
+{
+    double wait = 0;
+    {
+        std::unique_lock<std::mutex> lck(_mutex);
+        if (_rate <= 0)
+            return;
+        refill();
+        _tokens -= n;
+        if (_tokens < 0)
+            wait = -_tokens / _rate;
+    }
+    if (wait > 0)
+        std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+}
+
+bool Util::TokenBucket::tryAcquire(size_t n)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    if (_rate <= 0)
+        return true;
+    refill();
+    // 超过桶容量的请求永远等不到足够的令牌：桶满时放行并透支，之后的请求等到还清为止
+    if (_tokens < std::min<double>(n, _burst))
+        return false;
+    _tokens -= n;
+    return true;
+}
+
+void Util::TokenBucket::setRate(double rate)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    refill();
+    _rate = rate;
 }
\ No newline at end of file
@@ -0,0 +1,263 @@
+#pragma once
+#include <iostream>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <sys/socket.h>
+#include "httplib.h"
+#include "util.hpp"
+#include "log/ckflog.hpp"
+
+extern ckflogs::Logger::Ptr _logger;
+
+namespace Cloud
+{
+    // 排队时间统计(毫秒)
+    struct WaitStats
+    {
+        uint64_t count = 0;
+        double total_ms = 0;
+        double max_ms = 0;
+
+        void add(double ms)
+        {
+            count++;
+            total_ms += ms;
+            max_ms = std::max(max_ms, ms);
+        }
+        void toJson(Json::Value *val) const
+        {
+            (*val)["wait_count"] = (Json::UInt64)count;
+            (*val)["wait_avg_ms"] = count ? total_ms / count : 0;
+            (*val)["wait_max_ms"] = max_ms;
+        }
+    };
+
+    // 请求通道：限制同一类请求的并发数，超出的请求排队等待，排队数达到上限则拒绝
+    // 名额绑定在获取它的工作线程上，响应发送完毕(或连接结束)时由 releaseHeld 归还
+    class Lane
+    {
+    public:
+        Lane(const std::string &name, size_t slots, size_t queue); // slots为0表示不限并发
+        bool acquire();            // 获取名额(可能阻塞)，排队已满返回false
+        static void releaseHeld(); // 归还当前线程持有的名额
+        void toJson(Json::Value *val);
+
+    private:
+        void release();
+
+    private:
+        std::string _name;
+        size_t _slots;
+        size_t _queue;
+        size_t _active = 0;  // 正在处理的请求数
+        size_t _waiting = 0; // 排队等待的请求数
+        uint64_t _admitted = 0;
+        uint64_t _rejected = 0;
+        WaitStats _wait;
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        static thread_local Lane *_held; // 当前线程持有名额的通道
+    };
+
+    // HTTP连接工作线程池，替换 httplib 默认的无界 ThreadPool
+    // 等待线程的连接数有上限，超过时直接在连接上回复503并关闭，而不是无限堆积
+    // 一个连接(含keep-alive的后续请求)处理结束后，归还该线程可能仍持有的通道名额
+    class WorkerPool : public httplib::TaskQueue
+    {
+    public:
+        WorkerPool(size_t threads, size_t queue, time_t retry_after);
+        bool enqueue(std::function<void()> fn) override;
+        void shutdown() override;
+        void on_rejected(socket_t sock) override;
+        static void toJson(Json::Value *val); // 运行指标(进程内只有一个连接线程池)
+
+    private:
+        void threadLoop();
+
+    private:
+        using Clock = std::chrono::steady_clock;
+        struct Task
+        {
+            std::function<void()> fn;
+            Clock::time_point enqueued;
+        };
+
+        size_t _queue_max;
+        time_t _retry_after;
+        std::deque<Task> _tasks;
+        std::vector<std::thread> _threads;
+        bool _shutdown = false;
+        std::mutex _mutex;
+        std::condition_variable _cond;
+
+        // 指标
+        static std::mutex _stats_mutex;
+        static size_t _stats_threads;
+        static size_t _stats_busy;
+        static size_t _stats_queued;
+        static uint64_t _stats_rejected;
+        static WaitStats _stats_wait;
+    };
+}
+
+thread_local Cloud::Lane *Cloud::Lane::_held = nullptr;
+std::mutex Cloud::WorkerPool::_stats_mutex;
+size_t Cloud::WorkerPool::_stats_threads = 0;
+size_t Cloud::WorkerPool::_stats_busy = 0;
+size_t Cloud::WorkerPool::_stats_queued = 0;
+uint64_t Cloud::WorkerPool::_stats_rejected = 0;
+Cloud::WaitStats Cloud::WorkerPool::_stats_wait;
+
+Cloud::Lane::Lane(const std::string &name, size_t slots, size_t queue)
+    : _name(name), _slots(slots), _queue(queue)
+{
+}
+
+bool Cloud::Lane::acquire()
+{
+    releaseHeld();
+    auto begin = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lck(_mutex);
+    if (_slots > 0 && _active >= _slots)
+    {
+        if (_waiting >= _queue)
+        {
+            _rejected++;
+            _logger->_warn("通道 %s 排队已满，拒绝请求", _name.c_str());
+            return false;
+        }
+        _waiting++;
+        _cond.wait(lck, [this]
+                   { return _active < _slots; });
+        _waiting--;
+    }
+    _active++;
+    _admitted++;
+    _wait.add(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+    _held = this;
+    return true;
+}
+
+void Cloud::Lane::release()
+{
+    {
+        std::unique_lock<std::mutex> lck(_mutex);
+        _active--;
+    }
+    _cond.notify_one();
+}
+
+void Cloud::Lane::releaseHeld()
+{
+    if (_held == nullptr)
+        return;
+    _held->release();
+    _held = nullptr;
+}
+
+void Cloud::Lane::toJson(Json::Value *val)
+{
+    std::unique_lock<std::mutex> lck(_mutex);
+    (*val)["slots"] = (Json::UInt64)_slots;
+    (*val)["queue"] = (Json::UInt64)_queue;
+    (*val)["active"] = (Json::UInt64)_active;
+    (*val)["waiting"] = (Json::UInt64)_waiting;
+    (*val)["admitted"] = (Json::UInt64)_admitted;
+    (*val)["rejected"] = (Json::UInt64)_rejected;
+    _wait.toJson(val);
+}
+
+Cloud::WorkerPool::WorkerPool(size_t threads, size_t queue, time_t retry_after)
+    : _queue_max(queue), _retry_after(retry_after)
+{
+    {
+        std::unique_lock<std::mutex> lck(_stats_mutex);
+        _stats_threads = threads;
+    }
+    for (size_t i = 0; i < threads; i++)
+        _threads.emplace_back(&WorkerPool::threadLoop, this);
+}
+
+bool Cloud::WorkerPool::enqueue(std::function<void()> fn)
+{
+    {
+        std::unique_lock<std::mutex> lck(_mutex);
+        if (_tasks.size() >= _queue_max)
+            return false;
+        _tasks.push_back({std::move(fn), Clock::now()});
+        std::unique_lock<std::mutex> stats_lck(_stats_mutex);
+        _stats_queued++;
+    }
+    _cond.notify_one();
+    return true;
+}
+
+void Cloud::WorkerPool::on_rejected(socket_t sock)
+{
+    {
+        std::unique_lock<std::mutex> lck(_stats_mutex);
+        _stats_rejected++;
+    }
+    // 不读取请求，尽力写出503后由 httplib 关闭连接
+    std::string resp = "HTTP/1.1 503 Service Unavailable\r\n"
+                       "Retry-After: " + std::to_string(_retry_after) + "\r\n"
+                       "Content-Length: 0\r\n"
+                       "Connection: close\r\n\r\n";
+    send(sock, resp.data(), resp.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+void Cloud::WorkerPool::shutdown()
+{
+    {
+        std::unique_lock<std::mutex> lck(_mutex);
+        _shutdown = true;
+    }
+    _cond.notify_all();
+    for (auto &thr : _threads)
+        thr.join();
+    _threads.clear();
+}
+
+void Cloud::WorkerPool::threadLoop()
+{
+    while (true)
+    {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lck(_mutex);
+            _cond.wait(lck, [this]
+                       { return _shutdown || !_tasks.empty(); });
+            if (_tasks.empty()) // 停止且队列已清空
+                break;
+            task = std::move(_tasks.front());
+            _tasks.pop_front();
+        }
+        {
+            std::unique_lock<std::mutex> lck(_stats_mutex);
+            _stats_queued--;
+            _stats_busy++;
+            _stats_wait.add(std::chrono::duration<double, std::milli>(Clock::now() - task.enqueued).count());
+        }
+
+        task.fn();
+        Lane::releaseHeld();
+
+        std::unique_lock<std::mutex> lck(_stats_mutex);
+        _stats_busy--;
+    }
+}
+
+void Cloud::WorkerPool::toJson(Json::Value *val)
+{
+    std::unique_lock<std::mutex> lck(_stats_mutex);
+    (*val)["threads"] = (Json::UInt64)_stats_threads;
+    (*val)["busy"] = (Json::UInt64)_stats_busy;
+    (*val)["queued"] = (Json::UInt64)_stats_queued;
+    (*val)["rejected"] = (Json::UInt64)_stats_rejected;
+    _stats_wait.toJson(val);
+}
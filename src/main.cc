@@ -33,6 +33,7 @@ void loggerBuild()
 int main()
 {
     loggerBuild();
+    Util::IOEngine::select(Cloud::Config::getInstance()->getIOEngine()); // 文件I/O引擎
 
     _biManager = new Cloud::BackupInfoManager;
 